@@ -1,5 +1,14 @@
 #include "AutoConnect.h"
 
+#include <algorithm>
+#include <memory>
+#include <utility>
+#include <esp_system.h>
+#include <esp_netif.h>
+#include <Preferences.h>
+#include <climits>
+#include <time.h>
+
 #ifndef TIME_BETWEEN_MODAL_SCANS
   // Default to 30s
   #define TIME_BETWEEN_MODAL_SCANS          120000UL
@@ -17,13 +26,14 @@
   #define AUTOCONNECT_NO_INVALIDATE true
 #endif
 
+// Last good BSSID / channel / lease. RTC memory survives deep sleep, NVS copy survives power loss
+RTC_DATA_ATTR static WiFi_ReconnectCache rtcReconnectCache;
+
 ESPAsync_WiFiManager::ESPAsync_WiFiManager(AsyncWebServer * webserver, DNSServer *dnsserver, const char *iHostname)
 {
   server    = webserver;
   dnsServer = dnsserver;
   
-  wifiSSIDs     = NULL;
-  
   // KH
   wifiSSIDscan  = true;
   //wifiSSIDscan  = false;
@@ -37,6 +47,27 @@ ESPAsync_WiFiManager::ESPAsync_WiFiManager(AsyncWebServer * webserver, DNSServer
   _params = (ESPAsync_WMParameter**)malloc(_max_params * sizeof(ESPAsync_WMParameter*));
 #endif
 
+  _wifiEventGroup = xEventGroupCreate();
+  _portalEvents   = xEventGroupCreate();
+  
+  _storedConfigLock = xSemaphoreCreateMutex();
+  _infoLock         = xSemaphoreCreateMutex();
+  
+  memset(&_storedConfig, 0, sizeof(_storedConfig));
+  memset(&_storedConfigShared, 0, sizeof(_storedConfigShared));
+  
+  _etagSeed    = esp_random();
+  
+  // Per chip, so a fleet losing its AP at once doesn't retry in lockstep
+  uint64_t chipId = ESP.getEfuseMac();
+  
+  _jitterState = (uint32_t) chipId ^ (uint32_t) (chipId >> 32);
+  
+  if (_jitterState == 0)
+    _jitterState = 1;
+    
+  _wifiEventId = WiFi.onEvent(std::bind(&ESPAsync_WiFiManager::onWiFiEvent, this, std::placeholders::_1, std::placeholders::_2));
+
   //WiFi not yet started here, must call WiFi.mode(WIFI_STA) and modify function WiFiGenericClass::mode(wifi_mode_t m) !!!
 
   WiFi.mode(WIFI_STA);
@@ -65,6 +96,24 @@ ESPAsync_WiFiManager::ESPAsync_WiFiManager(AsyncWebServer * webserver, DNSServer
 
 ESPAsync_WiFiManager::~ESPAsync_WiFiManager()
 {
+  // Never delete the portal task mid-pass, it may hold the driver or NVS. Ask it to end, and wait
+  if (_portalTaskRunning)
+  {
+    xEventGroupSetBits(_portalEvents, PORTAL_EXIT_BIT | PORTAL_WAKE_BIT);
+    xEventGroupWaitBits(_portalEvents, PORTAL_DONE_BIT, pdFALSE, pdFALSE, portMAX_DELAY);
+    
+    // DONE is set from inside the task, let it return from that call before the group goes
+    while (_portalTaskRunning)
+      vTaskDelay(1);
+  }
+  
+  WiFi.removeEvent(_wifiEventId);
+    
+  vEventGroupDelete(_portalEvents);
+  vEventGroupDelete(_wifiEventGroup);
+  vSemaphoreDelete(_storedConfigLock);
+  vSemaphoreDelete(_infoLock);
+  
 #if USE_DYNAMIC_PARAMS
   if (_params != NULL)
   {
@@ -109,6 +158,18 @@ char* ESPAsync_WiFiManager::getRFC952_hostname(const char* iHostname)
 //////////////////////////////////////////
 
 void ESPAsync_WiFiManager::setupConfigPortal()
+{
+  startAccessPoint();
+  
+  delay(WIFI_PORTAL_AP_SETTLE_MS); // Without delay I've seen the IP address blank
+  
+  startPortalServer();
+}
+
+//////////////////////////////////////////
+
+// First half of the portal setup : DNS server and soft AP
+void ESPAsync_WiFiManager::startAccessPoint()
 {
   stopConfigPortal = false; //Signal not to close config portal
 
@@ -146,7 +207,8 @@ void ESPAsync_WiFiManager::setupConfigPortal()
     }
   }
   
-  _configPortalStart = millis();
+  _configPortalStart  = WiFiTimerWheel::now();
+  _portalTimeoutArmed = ~0UL;
 
   log_i("\nConfiguring AP SSID = %s", _apName);
 
@@ -184,9 +246,13 @@ void ESPAsync_WiFiManager::setupConfigPortal()
     WiFi.softAP(_apName);
   }
   //////
-  
-  delay(500); // Without delay I've seen the IP address blank
-  
+}
+
+//////////////////////////////////////////
+
+// Second half of the portal setup, once the AP got its IP
+void ESPAsync_WiFiManager::startPortalServer()
+{
   log_i("AP IP address = %s", WiFi.softAPIP().toString().c_str());
 
   /* Setup web pages: root, wifi config pages, SO captive portal detectors and not found. */
@@ -199,10 +265,17 @@ void ESPAsync_WiFiManager::setupConfigPortal()
   server->on("/r",        std::bind(&ESPAsync_WiFiManager::handleReset,       this, std::placeholders::_1)).setFilter(ON_AP_FILTER);
   server->on("/state",    std::bind(&ESPAsync_WiFiManager::handleState,       this, std::placeholders::_1)).setFilter(ON_AP_FILTER);
   server->on("/scan",     std::bind(&ESPAsync_WiFiManager::handleScan,        this, std::placeholders::_1)).setFilter(ON_AP_FILTER);
+  server->on("/stats",    std::bind(&ESPAsync_WiFiManager::handleStats,       this, std::placeholders::_1)).setFilter(ON_AP_FILTER);
+  server->on("/link",     std::bind(&ESPAsync_WiFiManager::handleLink,        this, std::placeholders::_1)).setFilter(ON_AP_FILTER);
   //Microsoft captive portal. Maybe not needed. Might be handled by notFound handler.
   server->on("/fwlink",   std::bind(&ESPAsync_WiFiManager::handleRoot,        this, std::placeholders::_1)).setFilter(ON_AP_FILTER);  
   server->onNotFound (std::bind(&ESPAsync_WiFiManager::handleNotFound,        this, std::placeholders::_1));
 
+  // First pages up before a request can come in, the loop keeps them current from here
+  loadStoredConfig();
+  setInfo();
+  publishStats();
+
   server->begin(); // Web server start in case of AP mode
   
   log_i("HTTP server started");
@@ -229,32 +302,58 @@ bool ESPAsync_WiFiManager::autoConnect()
 
 bool ESPAsync_WiFiManager::autoConnect(char const *apName, char const *apPassword)
 {
+  loadSTAStaticIPConfig();
+  
+#if AUTOCONNECT_FAST_RECONNECT
+  unsigned long bootStartedAt = millis();
+  
+  // Pinned BSSID, known channel and cached lease first, the full scan / DHCP path only if that fails
+  if (fastReconnect())
+  {
+    log_i("Fast reconnect : connected after %lu ms", millis() - bootStartedAt);
+    
+    return true;
+  }
+  
+  preloadReconnectCache();
+#endif
+
+  unsigned long startedAt = millis();
+  int           connectResult;
+  
+  if (_credentials.count() > 0)
+  {
+    log_i("\nAutoConnect using %i stored credentials", _credentials.count());
+    // One scan, then the best matching stored network first
+    connectResult = reconnectWifi();
+  }
+  else
+  {
+    // Find out where the saved network is with a targeted scan, and hand the channel to the driver
+    // so it doesn't sweep all channels again before associating
+    if (storedSSID()[0] != 0)
+      scanKnownNetworks();
+      
 #if AUTOCONNECT_NO_INVALIDATE
-  log_i("\nAutoConnect using previously saved SSID/PW, but keep previous settings");
-  // Connect to previously saved SSID/PW, but keep previous settings
-  connectWifi();
+    log_i("\nAutoConnect using previously saved SSID/PW, but keep previous settings");
+    // Connect to previously saved SSID/PW, but keep previous settings
+    connectResult = connectWifi("", "", _storedChannel);
 #else
-  log_i("\nAutoConnect using previously saved SSID/PW, but invalidate previous settings");
-  // Connect to previously saved SSID/PW, but invalidate previous settings
-  connectWifi(WiFi_SSID(), WiFi_Pass());  
+    log_i("\nAutoConnect using previously saved SSID/PW, but invalidate previous settings");
+    // Connect to previously saved SSID/PW, but invalidate previous settings
+    connectResult = connectWifi(storedSSID(), storedPass(), _storedChannel);  
 #endif
+  }
  
-  unsigned long startedAt = millis();
-
-  while (millis() - startedAt < 10000)
+  // Both waited on the connect events already, a failure means the plan or the attempt is over
+  if (connectResult == WL_CONNECTED)
   {
-    //delay(100);
-    delay(200);
-
-    if (WiFi.status() == WL_CONNECTED)
-    {
-      float waited = (millis() - startedAt);
-       
-      log_i("Connected after waiting (s) : %f", waited / 1000);
-      log_i("Local ip = %s", WiFi.localIP().toString().c_str());
-      
-      return true;
-    }
+    float waited = (millis() - startedAt);
+     
+    log_i("Connected after (s) : %f", waited / 1000);
+    log_i("Local ip = %s", WiFi.localIP().toString().c_str());
+    
+    return true;
   }
 
   // no connection to wifi possible - start AP for configuration
@@ -265,17 +364,17 @@ bool ESPAsync_WiFiManager::autoConnect(char const *apName, char const *apPasswor
 ///////////////////////////////////////////////////////////////////
 // get networks separated by semicolon listed by name quality and encryption separated by comma
 
-String ESPAsync_WiFiManager::networkListAsString()
+String ESPAsync_WiFiManager::networkListAsString(const WiFi_ScanSnapshot* snapshot)
 {
   String pager;
   
   //display networks in page
-  for (int i = 0; i < wifiSSIDCount; i++) 
+  for (int i = 0; i < snapshot->count; i++) 
   {
-    if (wifiSSIDs[i].duplicate == true) 
+    if (snapshot->records[i].duplicate == true) 
       continue; // skip dups
       
-    int quality = getRSSIasQuality(wifiSSIDs[i].RSSI);
+    int quality = snapshot->records[i].quality;
 
     if (_minimumQuality == -1 || _minimumQuality < quality) 
     {
@@ -283,12 +382,12 @@ String ESPAsync_WiFiManager::networkListAsString()
       String rssiQ;
       
       rssiQ += quality;
-      item += wifiSSIDs[i].SSID; 
+      item += snapshot->records[i].SSID; 
       item += ",";
       item += rssiQ;
       item += ",";
 
-      if (wifiSSIDs[i].encryptionType != WIFI_AUTH_OPEN)
+      if (snapshot->records[i].encryptionType != WIFI_AUTH_OPEN)
       {
         item += "1";
       } 
@@ -318,553 +417,2920 @@ String ESPAsync_WiFiManager::scanModal()
   shouldscan = true;
   scan();
   
-  String pager = networkListAsString();
+  // Modal by contract : wait for the asynchronous scan to complete before listing
+  while (_scanInFlight)
+  {
+    delay(10);
+    pollScan();
+  }
+  
+  const WiFi_ScanSnapshot* snapshot = _scanSnapshots.acquire();
+  
+  String pager = networkListAsString(snapshot);
+  
+  _scanSnapshots.release(snapshot);
   
   return pager;
 }
 
 //////////////////////////////////////////
 
+// Non-blocking. Starts an asynchronous scan if one is due, and collects the results of a finished one.
+// Results are signalled through isScanReady() and the scan done callback.
 void ESPAsync_WiFiManager::scan()
 {
-  if (!shouldscan) 
-    return;
-  
-  log_d("About to scan");
-  
-  if (wifiSSIDscan)
+  if (shouldscan && wifiSSIDscan && !_scanInFlight)
   {
-    delay(100);
+    log_d("About to scan");
+    startScan();
   }
+  
+  pollScan();
+}
 
-  if (wifiSSIDscan)
+//////////////////////////////////////////
+
+bool ESPAsync_WiFiManager::startScan()
+{
+  return startScan(NULL, 0);
+}
+
+//////////////////////////////////////////
+
+// Targeted scan : probe only the given channels, one async scan per channel, results merged as each one completes.
+// count == 0 is a full sweep.
+bool ESPAsync_WiFiManager::startScan(const uint8_t* channels, uint8_t count)
+{
+  if (_scanInFlight)
   {
-    log_d("Start scan");
-    wifi_ssid_count_t n = WiFi.scanNetworks();
-    log_d("Scan done");
+    log_d("Scan already running");
+    return false;
+  }
+  
+  if (count > WIFI_SCAN_MAX_CHANNELS)
+    count = WIFI_SCAN_MAX_CHANNELS;
     
-    if (n == WIFI_SCAN_FAILED) 
-    {
-      log_d("WIFI_SCAN_FAILED!");
-    }
-    else if (n == WIFI_SCAN_RUNNING) 
-    {
-      log_d("WIFI_SCAN_RUNNING!");
-    } 
-    else if (n < 0) 
-    {
-      log_d("Failed, unknown error code!");
-    } 
-    else if (n == 0) 
-    {
-      log_d("No network found");
-      // page += F("No networks found. Refresh to scan again.");
-    } 
-    else 
-    {
-      if (wifiSSIDscan)
-      {
-        /* WE SHOULD MOVE THIS IN PLACE ATOMICALLY */
-        if (wifiSSIDs) 
-          delete [] wifiSSIDs;
-          
-        wifiSSIDs     = new WiFiResult[n];
-        wifiSSIDCount = n;
-
-        if (n > 0)
-          shouldscan = false;
+  if (count > 0)
+    memcpy(_scanChannels, channels, count);
+  
+  _scanChannelCount = count;
+  _scanChannelIndex = 0;
+  _scanStartedAt    = millis();
 
-        for (wifi_ssid_count_t i = 0; i < n; i++)
-        {
-          wifiSSIDs[i].duplicate=false;
+  log_d("Start async scan, channels = %i", count);
+  
+  if (!startChannelScan())
+    return false;
 
-          WiFi.getNetworkInfo(i, wifiSSIDs[i].SSID, wifiSSIDs[i].encryptionType, wifiSSIDs[i].RSSI, wifiSSIDs[i].BSSID, wifiSSIDs[i].channel);
-        }
+  _scanInFlight = true;
+  _scanReady    = false;
+  
+  return true;
+}
 
-        // RSSI SORT
-        // old sort
-        for (int i = 0; i < n; i++) 
-        {
-          for (int j = i + 1; j < n; j++) 
-          {
-            if (wifiSSIDs[j].RSSI > wifiSSIDs[i].RSSI) 
-            {
-              std::swap(wifiSSIDs[i], wifiSSIDs[j]);
-            }
-          }
-        }
+//////////////////////////////////////////
 
-        // remove duplicates ( must be RSSI sorted )
-        if (_removeDuplicateAPs) 
-        {
-        String cssid;
-        
-        for (int i = 0; i < n; i++) 
-        {
-          if (wifiSSIDs[i].duplicate == true) 
-            continue;
-            
-          cssid = wifiSSIDs[i].SSID;
-          
-          for (int j = i + 1; j < n; j++) 
-          {
-            if (cssid == wifiSSIDs[j].SSID) 
-            {
-              log_d("DUP AP: %s", wifiSSIDs[j].SSID.c_str());
-              // set dup aps to NULL
-              wifiSSIDs[j].duplicate = true; 
-            }
-          }
-        }
-        }
-      }
-    }
+bool ESPAsync_WiFiManager::startChannelScan()
+{
+  int16_t res;
+  
+  // Returns WIFI_SCAN_RUNNING immediately, completion is polled with WiFi.scanComplete()
+  if (_scanChannelCount == 0)
+    res = WiFi.scanNetworks(true);
+  else
+    res = WiFi.scanNetworks(true, false, false, WIFI_SCAN_TARGETED_DWELL_MS, _scanChannels[_scanChannelIndex]);
+  
+  if (res == WIFI_SCAN_FAILED)
+  {
+    log_d("WIFI_SCAN_FAILED!");
+    return false;
   }
+  
+  return true;
 }
 
 //////////////////////////////////////////
 
-void ESPAsync_WiFiManager::startConfigPortalModeless(char const *apName, char const *apPassword, bool shouldConnectWiFi) 
+bool ESPAsync_WiFiManager::pollScan()
 {
-  _modeless     = true;
-  _apName       = apName;
-  _apPassword   = apPassword;
+  if (!_scanInFlight)
+  {
+    // Single flight : however many /scan?refresh=1 came in, they share this one scan
+    if (_scanRequested)
+    {
+      _scanRequested = false;
+      startScan();
+    }
+    
+    if (_scanPublishPending)
+      publishScanResults();
+    
+    return false;
+  }
 
-  WiFi.mode(WIFI_AP_STA);
+  wifi_ssid_count_t n = WiFi.scanComplete();
   
-  log_d("SET AP STA");
-
-  // try to connect
-  if (shouldConnectWiFi && connectWifi("", "") == WL_CONNECTED)   
+  if (n == WIFI_SCAN_RUNNING) 
+    return false;
+    
+  log_d("Scan done");
+  
+  if (n == WIFI_SCAN_FAILED) 
   {
-    log_d("IP Address: %s", WiFi.localIP());
-       
- 	  if ( _savecallback != NULL) 
-	  {
-	    //todo: check if any custom parameters actually exist, and check if they really changed maybe
-	    _savecallback();
-	  }
+    log_d("WIFI_SCAN_FAILED!");
   }
-
-  if ( _apcallback != NULL) 
+  else if (n < 0) 
   {
-    _apcallback(this);
+    log_d("Failed, unknown error code!");
+  } 
+  else 
+  {
+    if (n == 0) 
+      log_d("No network found");
+    
+    // Also run with n == 0, so entries no longer heard still age out
+    processScanResults(n);
   }
-
-  connect = false;
-  setupConfigPortal();
-  scannow = -1 ;
+  
+  WiFi.scanDelete();
+  
+  // Targeted scan : move on to the next channel, if any
+  if ( (_scanChannelCount > 0) && (++_scanChannelIndex < _scanChannelCount) && startChannelScan() )
+  {
+    return false;
+  }
+  
+  _scanInFlight = false;
+  _scanReady    = true;
+  _scanGeneration++;
+  
+  publishScanResults();
+  
+  if (_scandonecallback != NULL)
+  {
+    _scandonecallback(this);
+  }
+  
+  return true;
 }
 
 //////////////////////////////////////////
 
-void ESPAsync_WiFiManager::loop()
+// Copy the loop's scan table into a free snapshot and swap it in for the HTTP handlers. The table itself keeps
+// being merged in place by the loop only, readers never see it change under them
+void ESPAsync_WiFiManager::publishScanResults()
 {
-	safeLoop();
-	criticalLoop();
+  WiFi_ScanSnapshot* snapshot = _scanSnapshots.claim();
+  
+  if (snapshot == NULL)
+  {
+    // Every other slot still read by a client, try again on the next poll
+    log_d("Scan snapshots all held, publish deferred");
+    
+    _scanPublishPending = true;
+    
+    return;
+  }
+  
+  snapshot->generation  = _scanGeneration;
+  snapshot->count       = wifiSSIDCount;
+  
+  memcpy(snapshot->records, wifiSSIDs, wifiSSIDCount * sizeof(WiFiScanRecord));
+  
+  _scanSnapshots.publish(snapshot);
+  
+  _scanPublishPending = false;
 }
 
 //////////////////////////////////////////
 
-void ESPAsync_WiFiManager::setInfo() 
+// Index of the strongest AP with this SSID heard since the last scan started, -1 if none
+int ESPAsync_WiFiManager::findScanResult(const char* ssid)
 {
-  if (needInfo) 
+  size_t len = strnlen(ssid, WIFI_SSID_MAXLEN + 1);
+  
+  if ( (len == 0) || (len > WIFI_SSID_MAXLEN) )
+    return -1;
+    
+  uint32_t hash = WiFi_SSIDHash(ssid, len);
+
+  // Table is RSSI sorted, first match is the strongest. Strictly after the start : a scan takes far longer than
+  // a ms, but the previous one may have been merged in the very ms this one started
+  for (int i = 0; i < wifiSSIDCount; i++)
   {
-    pager       = infoAsString();
-    wifiStatus  = WiFi.status();
-    needInfo    = false;
+    if ( (wifiSSIDs[i].SSIDHash == hash) && (wifiSSIDs[i].SSIDLength == len) && (memcmp(wifiSSIDs[i].SSID, ssid, len) == 0) &&
+         ( (int32_t) (wifiSSIDs[i].lastSeen - _scanStartedAt) > 0 ) )
+    {
+      return i;
+    }
   }
+  
+  return -1;
 }
 
 //////////////////////////////////////////
 
-// Anything that accesses WiFi, ESP or EEPROM goes here
-
-void ESPAsync_WiFiManager::criticalLoop()
+// Blocking. Look for the stored credentials, probing first only the channels they were last seen on,
+// then falling back to a full sweep if none of them answered. Found channels are recorded per credential.
+bool ESPAsync_WiFiManager::scanKnownNetworks()
 {
-  log_d("criticalLoop: Enter");
+  const char* driverSSID  = storedSSID();
+  uint16_t  credentials   = _credentials.count();
   
-  if (_modeless)
+  uint8_t   channels[WIFI_SCAN_MAX_CHANNELS];
+  uint8_t   channelCount  = 0;
+  
+  if ( (driverSSID[0] == 0) && (credentials == 0) )
+    return false;
+
+  for (int i = -1; i < credentials; i++)
+  {
+    uint8_t channel = (i < 0) ? _storedChannel : _credentials.get(i)->channel;
+    
+    if ( (channel == 0) || (memchr(channels, channel, channelCount) != NULL) || (channelCount >= WIFI_SCAN_MAX_CHANNELS) )
+      continue;
+    
+    channels[channelCount++] = channel;
+  }
+    
+  if ( (_storedChannel == 0) && (driverSSID[0] != 0) && (WiFi.getMode() != WIFI_MODE_NULL) )
   {
-    if (scannow == -1 || millis() > scannow + TIME_BETWEEN_MODELESS_SCANS)
+    // Driver keeps the channel of the last WiFi.begin() with the stored config
+    wifi_config_t conf;
+    
+    if ( (esp_wifi_get_config(WIFI_IF_STA, &conf) == ESP_OK) && (conf.sta.channel != 0) && (channelCount < WIFI_SCAN_MAX_CHANNELS) &&
+         (memchr(channels, conf.sta.channel, channelCount) == NULL) )
     {
-      log_d("criticalLoop: modeless scan");
-      
-      scan();
-      scannow = millis();
+      channels[channelCount++] = conf.sta.channel;
     }
+  }
+  
+  bool anyFound = false;
+  
+  // First pass targeted, if we know any channel. Second pass full sweep.
+  for (int pass = (channelCount > 0) ? 0 : 1; (pass < 2) && !anyFound; pass++)
+  {
+    unsigned long startedAt = millis();
     
-    if (connect) 
+    if (_scanInFlight)
     {
-      connect = false;
+      // Let a pending scan finish first, we need our own channel set
+      while (!pollScan())
+        delay(10);
+    }
 
-      log_d("criticalLoop: Connecting to new AP");
+    if (!startScan(channels, (pass == 0) ? channelCount : 0))
+      break;
+    
+    while (!pollScan())
+      delay(10);
+      
+    // The config stored by the driver
+    int index = (driverSSID[0] != 0) ? findScanResult(driverSSID) : -1;
+    
+    if (index >= 0)
+    {
+      _storedChannel  = wifiSSIDs[index].channel;
+      anyFound        = true;
+      
+      log_i("Found %s on channel %i", driverSSID, _storedChannel);
+    }
+    
+    WiFi_ConnectCandidate found[WIFI_SCAN_MAX_RESULTS];
+    
+    uint16_t foundCount = matchKnownNetworks(found);
+    
+    for (uint16_t i = 0; i < foundCount; i++)
+    {
+      _credentials.setChannel(found[i].credential, found[i].channel);
+      
+      log_i("Found %s on channel %i", _credentials.get(found[i].credential)->SSID, found[i].channel);
+    }
+    
+    anyFound |= (foundCount > 0);
+    
+    log_i("%s scan for known networks took %lu ms", (pass == 0) ? "Targeted" : "Full", millis() - startedAt);
+  }
+  
+  // Keep the channels for the next boot, only written if one changed
+  _credentials.save();
+  
+  return anyFound;
+}
 
-      // using user-provided  _ssid, _pass in place of system-stored ssid and pass
-      if (connectWifi(_ssid, _pass) != WL_CONNECTED) 
-      {
-        log_d("criticalLoop: Failed to connect.");
-      } 
-      else 
-      {
-        //connected
-        // alanswx - should we have a config to decide if we should shut down AP?
-        // WiFi.mode(WIFI_STA);
-        //notify that configuration has changed and any optional parameters should be saved
-        if ( _savecallback != NULL) 
-        {
-          //todo: check if any custom parameters actually exist, and check if they really changed maybe
-          _savecallback();
-        }
+//////////////////////////////////////////
 
-        return;
-      }
+void ESPAsync_WiFiManager::processScanResults(wifi_ssid_count_t n)
+{
+  // Merge in place into the long-lived per-BSSID table, no rebuild. Loop only, published by publishScanResults()
+  uint32_t now = millis();
+  
+  shouldscan = false;
 
-      if (_shouldBreakAfterConfig) 
+  // Age out entries not seen within _scanResultMaxAge, compacting the table
+  wifi_ssid_count_t kept = 0;
+  
+  for (wifi_ssid_count_t i = 0; i < wifiSSIDCount; i++)
+  {
+    if ( (_scanResultMaxAge != 0) && (now - wifiSSIDs[i].lastSeen > _scanResultMaxAge) )
+    {
+      log_d("Aged out AP: %s", wifiSSIDs[i].SSID);
+      continue;
+    }
+    
+    if (kept != i)
+      wifiSSIDs[kept] = wifiSSIDs[i];
+      
+    kept++;
+  }
+  
+  wifiSSIDCount = kept;
+
+  // BSSID index, open addressing as for duplicates below. A recycled entry leaves its old slot behind, which no
+  // longer matches on BSSID but keeps the probe chains intact ; rebuilt when the stale slots fill it up
+  const int         slotCount = 2 * WIFI_SCAN_MAX_RESULTS;
+  int16_t           slots[slotCount];
+  int               slotsUsed = slotCount;
+  
+  // Eviction candidates, a max-heap of (age << 16 | index) built once per scan when the table first fills up.
+  // Keys don't change after that, entries seen in this scan meanwhile are skipped as they come out
+  uint64_t          evictable[WIFI_SCAN_MAX_RESULTS];
+  int               evictableCount = -1;
+
+  for (wifi_ssid_count_t i = 0; i < n; i++)
+  {
+    // Copy straight from the driver record, no String / BSSID pointer into driver memory
+    wifi_ap_record_t* ap = (wifi_ap_record_t*) WiFi.getScanInfoByIndex(i);
+    
+    if (ap == NULL)
+      continue;
+    
+    if (slotsUsed >= (slotCount * 3) / 4)
+    {
+      memset(slots, 0xFF, sizeof(slots));
+      slotsUsed = 0;
+      
+      for (wifi_ssid_count_t j = 0; j < wifiSSIDCount; j++)
       {
-        //flag set to exit after config after trying to connect
-        //notify that configuration has changed and any optional parameters should be saved
-        if ( _savecallback != NULL) 
+        int slot = WiFi_SSIDHash(reinterpret_cast<const char*>(wifiSSIDs[j].BSSID), sizeof(wifiSSIDs[j].BSSID)) % slotCount;
+        
+        while (slots[slot] >= 0)
+          slot = (slot + 1) % slotCount;
+          
+        slots[slot] = j;
+        slotsUsed++;
+      }
+    }
+    
+    WiFiScanRecord* record  = NULL;
+    int             slot    = WiFi_SSIDHash(reinterpret_cast<const char*>(ap->bssid), sizeof(ap->bssid)) % slotCount;
+    
+    while (slots[slot] >= 0)
+    {
+      if (memcmp(wifiSSIDs[slots[slot]].BSSID, ap->bssid, sizeof(ap->bssid)) == 0)
+      {
+        record = &wifiSSIDs[slots[slot]];
+        break;
+      }
+      
+      slot = (slot + 1) % slotCount;
+    }
+    
+    if (record != NULL)
+    {
+      // Known BSSID : exponentially weighted RSSI, so one weak sample doesn't reorder the list
+      record->RSSIx16 += ( (ap->rssi * 16) - record->RSSIx16 ) >> WIFI_SCAN_RSSI_EWMA_SHIFT;
+      
+      if (record->hits < UINT16_MAX)
+        record->hits++;
+    }
+    else
+    {
+      if (wifiSSIDCount < WIFI_SCAN_MAX_RESULTS)
+      {
+        record = &wifiSSIDs[wifiSSIDCount++];
+      }
+      else
+      {
+        // Table full : recycle the least recently seen entry, unless everything was seen in this scan
+        if (evictableCount < 0)
         {
-          //todo: check if any custom parameters actually exist, and check if they really changed maybe
-          _savecallback();
+          evictableCount = 0;
+          
+          for (wifi_ssid_count_t j = 0; j < wifiSSIDCount; j++)
+          {
+            if (wifiSSIDs[j].lastSeen != now)
+              evictable[evictableCount++] = ( (uint64_t) (now - wifiSSIDs[j].lastSeen) << 16 ) | (uint16_t) j;
+          }
+          
+          std::make_heap(evictable, evictable + evictableCount);
+        }
+        
+        while ( (evictableCount > 0) && (wifiSSIDs[evictable[0] & 0xFFFF].lastSeen == now) )
+          std::pop_heap(evictable, evictable + evictableCount--);
+        
+        if (evictableCount == 0)
+        {
+          log_d("Scan table full, dropping AP");
+          continue;
+        }
+        
+        record = &wifiSSIDs[evictable[0] & 0xFFFF];
+        std::pop_heap(evictable, evictable + evictableCount--);
+      }
+      
+      memcpy(record->BSSID, ap->bssid, sizeof(record->BSSID));
+      
+      record->RSSIx16 = ap->rssi * 16;
+      record->hits    = 1;
+      
+      slots[slot] = record - wifiSSIDs;
+      slotsUsed++;
+    }
+
+    record->SSIDLength = strnlen(reinterpret_cast<const char*>(ap->ssid), WIFI_SSID_MAXLEN);
+    memcpy(record->SSID, ap->ssid, record->SSIDLength);
+    record->SSID[record->SSIDLength] = 0;
+    
+    record->channel        = ap->primary;
+    record->encryptionType = ap->authmode;
+    record->isHidden       = (record->SSIDLength == 0);
+    record->SSIDHash       = WiFi_SSIDHash(record->SSID, record->SSIDLength);
+    record->lastSeen       = now;
+  }
+  
+  n = wifiSSIDCount;
+  
+  for (wifi_ssid_count_t i = 0; i < n; i++)
+  {
+    wifiSSIDs[i].RSSI       = wifiSSIDs[i].RSSIx16 / 16;
+    wifiSSIDs[i].quality    = getRSSIasQuality(wifiSSIDs[i].RSSI);
+    wifiSSIDs[i].duplicate  = false;
+  }
+
+  // RSSI SORT, strongest first. BSSID as tie-break so equal entries keep their order between scans
+  std::sort(wifiSSIDs, wifiSSIDs + n, [](const WiFiScanRecord& a, const WiFiScanRecord& b)
+  {
+    if (a.RSSIx16 != b.RSSIx16)
+      return a.RSSIx16 > b.RSSIx16;
+      
+    return memcmp(a.BSSID, b.BSSID, sizeof(a.BSSID)) < 0;
+  });
+
+  // remove duplicates ( must be RSSI sorted ), so the first seen of each SSID is the strongest
+  if (_removeDuplicateAPs) 
+  {
+    // Open addressing on the precomputed SSID hash, strings only compared on hash match
+    const int slotCount = 2 * WIFI_SCAN_MAX_RESULTS;
+    int16_t   slots[slotCount];
+    
+    memset(slots, 0xFF, sizeof(slots));
+    
+    for (int i = 0; i < n; i++) 
+    {
+      int slot = wifiSSIDs[i].SSIDHash % slotCount;
+      
+      while (slots[slot] >= 0)
+      {
+        const WiFiScanRecord& seen = wifiSSIDs[slots[slot]];
+        
+        if ( (seen.SSIDHash == wifiSSIDs[i].SSIDHash) && (seen.SSIDLength == wifiSSIDs[i].SSIDLength) && 
+             (memcmp(seen.SSID, wifiSSIDs[i].SSID, seen.SSIDLength) == 0) )
+        {
+          log_d("DUP AP: %s", wifiSSIDs[i].SSID);
+          wifiSSIDs[i].duplicate = true;
+          break;
         }
+        
+        slot = (slot + 1) % slotCount;
+      }
+      
+      if (!wifiSSIDs[i].duplicate)
+        slots[slot] = i;
+    }
+  }
+}
+
+//////////////////////////////////////////
+
+void ESPAsync_WiFiManager::startConfigPortalModeless(char const *apName, char const *apPassword, bool shouldConnectWiFi) 
+{
+  _modeless     = true;
+  _apName       = apName;
+  _apPassword   = apPassword;
+
+#if AUTOCONNECT_FAST_RECONNECT
+  preloadReconnectCache();
+#endif
+
+  WiFi.mode(WIFI_AP_STA);
+  
+  log_d("SET AP STA");
+
+  // try to connect
+  if (shouldConnectWiFi && connectWifi("", "") == WL_CONNECTED)   
+  {
+    log_d("IP Address: %s", WiFi.localIP());
+       
+ 	  if ( _savecallback != NULL) 
+	  {
+	    //todo: check if any custom parameters actually exist, and check if they really changed maybe
+	    _savecallback();
+	  }
+  }
+
+  if ( _apcallback != NULL) 
+  {
+    _apcallback(this);
+  }
+
+  connect = false;
+  setupConfigPortal();
+  
+  // First scan on the next pass
+  _timers.schedule(WM_TIMER_SCAN, WiFiTimerWheel::now());
+}
+
+//////////////////////////////////////////
+
+void ESPAsync_WiFiManager::loop()
+{
+	safeLoop();
+	criticalLoop();
+}
+
+//////////////////////////////////////////
+
+// Loop only, from processCommands(). Built outside the lock, the handlers only ever wait for the swap
+void ESPAsync_WiFiManager::setInfo() 
+{
+  // Clear first, an event arriving while rebuilding invalidates again
+  if (needInfo.exchange(false)) 
+  {
+    uint32_t generation = _stateGeneration.load();
+    
+    wifiStatus  = WiFi.status();
+    
+    String info     = infoAsString();
+    String state    = stateAsString();
+    String staticIP = staticIPAsString();
+    
+    xSemaphoreTake(_infoLock, portMAX_DELAY);
+    
+    _statePageGeneration  = generation;
+    pager                 = std::move(info);
+    _statePage            = std::move(state);
+    _staticIPPage         = std::move(staticIP);
+    
+    xSemaphoreGive(_infoLock);
+  }
+}
+
+//////////////////////////////////////////
+
+// HTTP handler side : a copy of a page last published by setInfo() / publishStats()
+String ESPAsync_WiFiManager::sharedPage(const String& page, uint32_t* generation)
+{
+  xSemaphoreTake(_infoLock, portMAX_DELAY);
+  
+  String copy = page;
+  
+  if (generation)
+    *generation = _statePageGeneration;
+  
+  xSemaphoreGive(_infoLock);
+  
+  return copy;
+}
+
+//////////////////////////////////////////
+
+String ESPAsync_WiFiManager::infoAsString()
+{
+  WiFi_StoredConfig stored;
+  
+  sharedStoredConfig(stored);
+  
+  String page = "";
+  page += "Info";
+
+  if (connect)
+    page += "connected. ";
+  
+  if (connect)
+  {
+    page += "Trying to connect: ";
+    page += wifiStatus;
+    page += " ";
+  }
+
+  page += "WiFi Information ";
+  reportStatus(page);
+  
+  page += "Device Data ";  
+  page += "Chip ID ";
+  page += String((uint32_t)ESP.getEfuseMac(), HEX);		//ESP.getChipId();
+
+  page += "Flash Chip ID ";
+  // TODO
+  page += "TODO ";
+
+  page += "IDE Flash Size ";
+  page += ESP.getFlashChipSize();
+  page += " bytes ";
+  page += "Real Flash Size ";
+
+  // TODO
+  page += "TODO";
+
+  page += " bytes ";
+  page += "Access Point IP ";
+  page += WiFi.softAPIP().toString();
+  page += " Access Point MAC ";
+  page += WiFi.softAPmacAddress();
+
+  page += " SSID ";
+  page += stored.SSID;
+
+  page += " Station IP ";
+  page += WiFi.localIP().toString();
+  
+  page += " Station MAC ";
+  page += WiFi.macAddress();
+
+  page += F("<p/>More information about ESPAsync_WiFiManager at");
+  page += F("<p/><a href=\"https://github.com/khoih-prog/ESPAsync_WiFiManager\">https://github.com/khoih-prog/ESPAsync_WiFiManager</a>");
+ 
+  return page;
+}
+
+//////////////////////////////////////////
+
+String ESPAsync_WiFiManager::stateAsString()
+{
+  WiFi_StoredConfig stored;
+  
+  sharedStoredConfig(stored);
+  
+  String page = F("{\"Soft_AP_IP\":\"");
+  page += WiFi.softAPIP().toString();
+  page += F("\",\"Soft_AP_MAC\":\"");
+  page += WiFi.softAPmacAddress();
+  page += F("\",\"Station_IP\":\"");
+  page += WiFi.localIP().toString();
+  page += F("\",\"Station_MAC\":\"");
+  page += WiFi.macAddress();
+  page += F("\",");
+
+  if (stored.password[0] != 0)
+  {
+    page += F("\"Password\":true,");
+  }
+  else
+  {
+    page += F("\"Password\":false,");
+  }
+
+  page += F("\"SSID\":\"");
+  page += stored.SSID;
+  page += F("\"}");
+  
+  return page;
+}
+
+//////////////////////////////////////////
+
+// Any WiFi / IP event can change what /i and /state report
+void ESPAsync_WiFiManager::onWiFiEvent(WiFiEvent_t event, WiFiEventInfo_t info)
+{
+  switch (event)
+  {
+    case ARDUINO_EVENT_WIFI_STA_GOT_IP:
+      xEventGroupClearBits(_wifiEventGroup, WIFI_FAIL_BIT);
+      xEventGroupSetBits(_wifiEventGroup, WIFI_CONNECTED_BIT);
+      
+      if (_linkDropped.exchange(false))
+        _roamStats.disconnectedTime += millis() - _linkDownSince.load();
+      
+      // DHCP took over from the cached lease
+      if (_leaseRenewing.exchange(false))
+        _leaseFromCache = false;
+      
+      _linkUp = true;
+      
+      // Portal task may wait on a /wifisave connect
+      wakeConfigPortal();
+      break;
+      
+    case ARDUINO_EVENT_WIFI_SCAN_DONE:
+      // Portal task sleeps while a scan runs
+      wakeConfigPortal();
+      break;
+      
+    case ARDUINO_EVENT_WIFI_STA_DISCONNECTED:
+      xEventGroupClearBits(_wifiEventGroup, WIFI_CONNECTED_BIT);
+      
+      // Only drops of an established link count, not failed attempts
+      if (_linkUp.exchange(false))
+      {
+        _linkDownSince  = millis();
+        _linkDropped    = true;
+        _roamStats.disconnects++;
+      }
+      
+      // Only a definite failure of the network we are joining ends the wait early. Ignore the disconnects
+      // of a previous association, e.g. the dummy one left by eraseDriverConfig()
+      if ( isDefiniteConnectFailure(info.wifi_sta_disconnected.reason) && 
+           (info.wifi_sta_disconnected.ssid_len == _connectingSSIDLength) &&
+           (WiFi_SSIDHash(reinterpret_cast<const char*>(info.wifi_sta_disconnected.ssid), info.wifi_sta_disconnected.ssid_len) == _connectingSSIDHash) )
+      {
+        _lastDisconnectReason = info.wifi_sta_disconnected.reason;
+        xEventGroupSetBits(_wifiEventGroup, WIFI_FAIL_BIT);
+        
+        wakeConfigPortal();
       }
+      break;
+      
+    default:
+      break;
+  }
+  
+  switch (event)
+  {
+    case ARDUINO_EVENT_WIFI_STA_START:
+    case ARDUINO_EVENT_WIFI_STA_CONNECTED:
+    case ARDUINO_EVENT_WIFI_STA_DISCONNECTED:
+    case ARDUINO_EVENT_WIFI_STA_GOT_IP:
+    case ARDUINO_EVENT_WIFI_STA_LOST_IP:
+    case ARDUINO_EVENT_WIFI_AP_START:
+      invalidateInfo();
+      break;
+      
+    default:
+      break;
+  }
+}
+
+//////////////////////////////////////////
+
+bool ESPAsync_WiFiManager::isDefiniteConnectFailure(uint8_t reason)
+{
+  switch (reason)
+  {
+    case WIFI_REASON_AUTH_FAIL:
+    case WIFI_REASON_NO_AP_FOUND:
+    case WIFI_REASON_4WAY_HANDSHAKE_TIMEOUT:
+    case WIFI_REASON_HANDSHAKE_TIMEOUT:
+      return true;
+      
+    default:
+      return false;
+  }
+}
+
+//////////////////////////////////////////
+
+void ESPAsync_WiFiManager::invalidateInfo()
+{
+  _stateGeneration++;
+  needInfo = true;
+}
+
+//////////////////////////////////////////
+
+
+// Anything that accesses WiFi, ESP or EEPROM goes here
+
+void ESPAsync_WiFiManager::criticalLoop()
+{
+  log_d("criticalLoop: Enter");
+  
+  uint64_t now = pollTimers();
+  
+  processCommands();
+  sampleLink();
+  roamLoop();
+  
+  if (_modeless)
+  {
+    // Not while a reconnect / roam / save attempt is pending, the scan would abort it
+    if ( !_reconnectInFlight && !_roamInFlight && (_saveConnect == WM_SAVE_CONNECT_IDLE) && !_timers.pending(WM_TIMER_SCAN) )
+    {
+      log_d("criticalLoop: modeless scan");
+      
+      // Periodic refresh : shouldscan is cleared by every processed scan, nothing else sets it while modeless
+      shouldscan = true;
+      
+      scan();
+      _timers.schedule(WM_TIMER_SCAN, now + TIME_BETWEEN_MODELESS_SCANS);
+    }
+    else
+    {
+      pollScan();
+    }
+    
+    reconnectStep();
+    
+    if (connect) 
+    {
+      invalidateInfo();
+      
+      // Takes over any scheduled reconnect
+      _reconnectInFlight  = false;
+      _reconnectScheduled = false;
+
+      log_d("criticalLoop: Connecting to new AP");
+    }
+    
+    int connectResult;
+    
+    if (saveConnectStep(now, 0, connectResult))
+    {
+      if (connectResult != WL_CONNECTED) 
+      {
+        log_d("criticalLoop: Failed to connect.");
+      } 
+      else 
+      {
+        //connected
+        // alanswx - should we have a config to decide if we should shut down AP?
+        // WiFi.mode(WIFI_STA);
+        //notify that configuration has changed and any optional parameters should be saved
+        if ( _savecallback != NULL) 
+        {
+          //todo: check if any custom parameters actually exist, and check if they really changed maybe
+          _savecallback();
+        }
+
+        return;
+      }
+
+      if (_shouldBreakAfterConfig) 
+      {
+        //flag set to exit after config after trying to connect
+        //notify that configuration has changed and any optional parameters should be saved
+        if ( _savecallback != NULL) 
+        {
+          //todo: check if any custom parameters actually exist, and check if they really changed maybe
+          _savecallback();
+        }
+      }
+    }
+  }
+}
+
+//////////////////////////////////////////
+
+// Modeless reconnect, never blocks : after the link drops, wait a backoff delay, issue one WiFi.begin(),
+// and check the connect event bits on the next calls. Each failure doubles the delay up to the max,
+// success resets it. Tries the candidates of the last modeless scan in turn, best first
+void ESPAsync_WiFiManager::reconnectStep()
+{
+  // A roam is a reconnect of its own
+  if ( (_reconnectBackoffMin == 0) || _roamInFlight)
+    return;
+    
+  unsigned long now = millis();
+  
+  if (_reconnectInFlight)
+  {
+    unsigned long attemptLimit  = (_connectTimeout != 0) ? _connectTimeout : WIFI_CONNECT_DEFAULT_TIMEOUT;
+    EventBits_t   bits          = xEventGroupGetBits(_wifiEventGroup);
+    bool          connected     = (bits & WIFI_CONNECTED_BIT);
+    
+    if ( !connected && !(bits & WIFI_FAIL_BIT) && (now - _reconnectStartedAt < attemptLimit) )
+      return;
+    
+    _reconnectInFlight = false;
+    
+    // Kept in RAM while failing, written once the outage is over
+    if (_reconnectCredential >= 0)
+      _credentials.recordAttempt(_reconnectCredential, connected, now - _reconnectStartedAt);
+    
+    if (connected)
+    {
+      log_i("Reconnected after %i attempts", _reconnectAttempt + 1);
+      
+      _reconnectAttempt   = 0;
+      _reconnectScheduled = false;
+      
+      _credentials.save();
+      
+#if AUTOCONNECT_FAST_RECONNECT
+      saveReconnectCache();
+#endif
+      
+      return;
+    }
+    
+    if (_reconnectAttempt < 255)
+      _reconnectAttempt++;
+      
+    unsigned long backoff = reconnectBackoff();
+    
+    _timers.schedule(WM_TIMER_RECONNECT, WiFiTimerWheel::now() + backoff);
+    _reconnectScheduled = true;
+    
+    log_w("Reconnect attempt %i failed, next in %lu ms", _reconnectAttempt, backoff);
+    
+    return;
+  }
+  
+  if (WiFi.status() == WL_CONNECTED)
+  {
+    _reconnectAttempt   = 0;
+    _reconnectScheduled = false;
+    
+    return;
+  }
+  
+  // A save from the portal or a running scan go first
+  if (connect || (_saveConnect != WM_SAVE_CONNECT_IDLE) || _scanInFlight)
+    return;
+  
+  if (!_reconnectScheduled)
+  {
+    // Even the first attempt is delayed, that's what spreads the fleet out
+    unsigned long backoff = reconnectBackoff();
+    
+    _timers.schedule(WM_TIMER_RECONNECT, WiFiTimerWheel::now() + backoff);
+    _reconnectScheduled = true;
+    
+    log_w("Link down, reconnect in %lu ms", backoff);
+    
+    return;
+  }
+  
+  if (_timers.pending(WM_TIMER_RECONNECT))
+    return;
+    
+  WiFi_ConnectCandidate candidates[WIFI_SCAN_MAX_RESULTS];
+  
+  uint16_t count = (_credentials.count() > 0) ? planConnect(candidates) : 0;
+  
+  if (count > 0)
+  {
+    const WiFi_ConnectCandidate& candidate = candidates[_reconnectAttempt % count];
+    
+    _reconnectCredential = (candidate.credential != WIFI_DRIVER_CANDIDATE) ? candidate.credential : -1;
+    
+    beginCandidate(candidate);
+  }
+  else if (_credentials.count() > 0)
+  {
+    // None seen by the last scan, go round them blindly
+    _reconnectCredential = _reconnectAttempt % _credentials.count();
+    
+    beginConnect(getSSID(_reconnectCredential), getPW(_reconnectCredential), getChannel(_reconnectCredential));
+  }
+  else
+  {
+    // Driver config, or nothing at all : beginConnect() then flags the failure
+    _reconnectCredential = -1;
+    
+    beginConnect("", "", _storedChannel);
+  }
+  
+  _reconnectInFlight  = true;
+  _reconnectStartedAt = now;
+}
+
+//////////////////////////////////////////
+
+// Roaming monitor, never blocks : sample RSSI, and once it stayed below the threshold for the hysteresis
+// window, scan the channels the SSID is known on. Then move to a BSSID at least WIFI_ROAM_MIN_GAIN stronger
+void ESPAsync_WiFiManager::roamLoop()
+{
+  if (_roamThreshold == 0)
+    return;
+    
+  uint64_t now = pollTimers();
+  
+  if (_roamInFlight)
+  {
+    unsigned long attemptLimit  = (_connectTimeout != 0) ? _connectTimeout : WIFI_CONNECT_DEFAULT_TIMEOUT;
+    EventBits_t   bits          = xEventGroupGetBits(_wifiEventGroup);
+    
+    if ( !(bits & (WIFI_CONNECTED_BIT | WIFI_FAIL_BIT)) && (now - _roamStartedAt < attemptLimit) )
+      return;
+      
+    _roamInFlight = false;
+    
+    if (bits & WIFI_CONNECTED_BIT)
+    {
+      _roamStats.roams++;
+      
+      log_i("Roamed to %s in %lu ms", WiFi.BSSIDstr().c_str(), (unsigned long) (now - _roamStartedAt));
+      
+#if AUTOCONNECT_FAST_RECONNECT
+      saveReconnectCache();
+#endif
+
+      return;
+    }
+    
+    _roamStats.roamFailures++;
+    
+    log_w("Roam failed, back to any BSSID");
+    
+    // Unpinned, the driver picks whichever AP of the SSID answers. RAM only, the stored config was never pinned
+    esp_wifi_set_storage(WIFI_STORAGE_RAM);
+    prepareConnectWait(storedSSID());
+    WiFi.begin(storedSSID(), storedPass(), 0, NULL, true);
+    esp_wifi_set_storage(WIFI_STORAGE_FLASH);
+    
+    return;
+  }
+  
+  if (WiFi.status() != WL_CONNECTED)
+  {
+    _roamWeak         = false;
+    _roamScanPending  = false;
+    
+    return;
+  }
+  
+  if (_roamScanPending)
+  {
+    // Polled here too, in case nothing else runs the scan engine
+    if (_scanInFlight && !pollScan())
+      return;
+    
+    _roamScanPending = false;
+    
+    roamToBest();
+    
+    return;
+  }
+  
+  if (_timers.pending(WM_TIMER_ROAM_SAMPLE))
+    return;
+    
+  _timers.schedule(WM_TIMER_ROAM_SAMPLE, now + WIFI_ROAM_SAMPLE_INTERVAL);
+  
+  if (WiFi.RSSI() >= _roamThreshold)
+  {
+    _roamWeak = false;
+    return;
+  }
+  
+  if (!_roamWeak)
+  {
+    _roamWeak       = true;
+    _roamWeakSince  = now;
+    
+    return;
+  }
+  
+  if ( (now - _roamWeakSince < _roamHysteresis) || _scanInFlight || _timers.pending(WM_TIMER_ROAM_SCAN) )
+    return;
+  
+  startRoamScan();
+}
+
+//////////////////////////////////////////
+
+// Targeted : the current channel plus every channel the SSID was heard on. Full sweep if that's only the current one
+void ESPAsync_WiFiManager::startRoamScan()
+{
+  const char* ssid  = storedSSID();
+  size_t      len   = strlen(ssid);
+  uint32_t    hash  = WiFi_SSIDHash(ssid, len);
+  
+  uint8_t channels[WIFI_SCAN_MAX_CHANNELS];
+  uint8_t channelCount = 0;
+  
+  channels[channelCount++] = WiFi.channel();
+  
+  for (wifi_ssid_count_t i = 0; (i < wifiSSIDCount) && (channelCount < WIFI_SCAN_MAX_CHANNELS); i++)
+  {
+    const WiFiScanRecord& record = wifiSSIDs[i];
+    
+    if ( (record.SSIDHash == hash) && (record.SSIDLength == len) && (memcmp(record.SSID, ssid, len) == 0) &&
+         (memchr(channels, record.channel, channelCount) == NULL) )
+    {
+      channels[channelCount++] = record.channel;
+    }
+  }
+  
+  if (!startScan(channels, (channelCount > 1) ? channelCount : 0))
+    return;
+  
+  _roamScanPending  = true;
+  _timers.schedule(WM_TIMER_ROAM_SCAN, WiFiTimerWheel::now() + WIFI_ROAM_SCAN_INTERVAL);
+  _roamStats.roamScans++;
+  
+  log_i("RSSI %i below %i, roam scan on %i channels", WiFi.RSSI(), _roamThreshold, (channelCount > 1) ? channelCount : 0);
+}
+
+//////////////////////////////////////////
+
+void ESPAsync_WiFiManager::roamToBest()
+{
+  const char* ssid    = storedSSID();
+  size_t      len     = strlen(ssid);
+  uint32_t    hash    = WiFi_SSIDHash(ssid, len);
+  int8_t      current = WiFi.RSSI();
+  uint8_t*    bssid   = WiFi.BSSID();
+  
+  // Table is RSSI sorted, the first other BSSID of the SSID is the strongest
+  for (wifi_ssid_count_t i = 0; i < wifiSSIDCount; i++)
+  {
+    const WiFiScanRecord& record = wifiSSIDs[i];
+    
+    if ( (record.SSIDHash != hash) || (record.SSIDLength != len) || (memcmp(record.SSID, ssid, len) != 0) ||
+         ( (int32_t) (record.lastSeen - _scanStartedAt) <= 0 ) || ( bssid && (memcmp(record.BSSID, bssid, 6) == 0) ) )
+      continue;
+    
+    if (record.RSSI < current + WIFI_ROAM_MIN_GAIN)
+      break;
+    
+    log_i("Roaming from %i dBm to %02X:%02X:%02X:%02X:%02X:%02X, %i dBm, channel %i", current,
+          record.BSSID[0], record.BSSID[1], record.BSSID[2], record.BSSID[3], record.BSSID[4], record.BSSID[5],
+          record.RSSI, record.channel);
+    
+    _roamWeak       = false;
+    _roamInFlight   = true;
+    _roamStartedAt  = WiFiTimerWheel::now();
+    
+    // Pinned BSSID only kept in RAM, like fastReconnect()
+    esp_wifi_set_storage(WIFI_STORAGE_RAM);
+    prepareConnectWait(ssid);
+    WiFi.begin(ssid, storedPass(), record.channel, record.BSSID);
+    esp_wifi_set_storage(WIFI_STORAGE_FLASH);
+    
+    return;
+  }
+  
+  log_d("No stronger BSSID, staying");
+}
+
+//////////////////////////////////////////
+
+// One link sample per WIFI_LINK_SAMPLE_INTERVAL : a few driver reads, no allocation
+void ESPAsync_WiFiManager::sampleLink()
+{
+  if (_timers.pending(WM_TIMER_LINK_SAMPLE))
+    return;
+    
+  _timers.schedule(WM_TIMER_LINK_SAMPLE, WiFiTimerWheel::now() + WIFI_LINK_SAMPLE_INTERVAL);
+  
+  unsigned long now = millis();
+  
+  WiFi_LinkSample sample;
+  
+  sample.time         = now;
+  sample.connected    = (WiFi.status() == WL_CONNECTED);
+  sample.RSSI         = sample.connected ? WiFi.RSSI() : 0;
+  sample.channel      = sample.connected ? WiFi.channel() : 0;
+  sample.disconnects  = _roamStats.disconnects.load();
+  
+  _linkHistory.add(sample);
+}
+
+//////////////////////////////////////////
+
+// Exponential backoff with equal jitter : half the delay fixed, half random
+unsigned long ESPAsync_WiFiManager::reconnectBackoff()
+{
+  unsigned long backoff = _reconnectBackoffMin;
+  
+  for (uint8_t i = 0; (i < _reconnectAttempt) && (backoff < _reconnectBackoffMax); i++)
+    backoff *= 2;
+    
+  backoff = std::min(backoff, _reconnectBackoffMax);
+  
+  // xorshift32
+  _jitterState ^= _jitterState << 13;
+  _jitterState ^= _jitterState >> 17;
+  _jitterState ^= _jitterState << 5;
+  
+  return backoff / 2 + _jitterState % (backoff / 2 + 1);
+}
+
+//////////////////////////////////////////
+
+// Anything that doesn't access WiFi, ESP or EEPROM can go here
+
+void ESPAsync_WiFiManager::safeLoop()
+{
+  #ifndef USE_EADNS	
+  dnsServer->processNextRequest();
+  #endif
+}
+
+///////////////////////////////////////////////////////////
+
+bool  ESPAsync_WiFiManager::startConfigPortal()
+{
+  String ssid = "ESP_" + String((uint32_t)ESP.getEfuseMac());
+
+  ssid.toUpperCase();
+
+  return startConfigPortal(ssid.c_str(), NULL);
+}
+
+//////////////////////////////////////////
+
+bool  ESPAsync_WiFiManager::startConfigPortal(char const *apName, char const *apPassword)
+{
+  WiFi.mode(WIFI_AP_STA);
+
+  _apName = apName;
+  _apPassword = apPassword;
+
+  //notify we entered AP mode
+  if (_apcallback != NULL)
+  {
+    log_i("_apcallback");
+    
+    _apcallback(this);
+  }
+
+  connect = false;
+
+  setupConfigPortal();
+
+  _portalTimedOut = true;
+
+  log_i("startConfigPortal : Enter loop");
+  
+  // First scan on the first pass
+  _timers.schedule(WM_TIMER_SCAN, WiFiTimerWheel::now());
+  
+  if (_portalTask)
+  {
+    xEventGroupClearBits(_portalEvents, PORTAL_WAKE_BIT | PORTAL_DONE_BIT | PORTAL_CONNECTED_BIT | PORTAL_EXIT_BIT);
+    
+    _portalTaskRunning = true;
+    
+    if (xTaskCreatePinnedToCore(configPortalTask, "ConfigPortal", _portalTaskStack, this, _portalTaskPriority, 
+                                &_portalTaskHandle, _portalTaskCore) == pdPASS)
+    {
+      log_i("startConfigPortal : running in its own task");
+      
+      return false;
+    }
+    
+    log_e("Can't create config portal task, running modal");
+    
+    _portalTaskHandle   = NULL;
+    _portalTaskRunning  = false;
+  }
+
+  while (!configPortalExpired())
+  {
+    if (!configPortalStep())
+      break;
+    
+    yield();
+    
+#if ( defined(TIME_BETWEEN_CONFIG_PORTAL_LOOP) && (TIME_BETWEEN_CONFIG_PORTAL_LOOP > 0) )
+    #warning Using delay in startConfigPortal loop
+    delay(TIME_BETWEEN_CONFIG_PORTAL_LOOP);
+#endif    
+  }
+
+  return finishConfigPortal();
+}
+
+//////////////////////////////////////////
+
+// One pass of the config portal loop. Returns false once the portal should end
+bool ESPAsync_WiFiManager::configPortalStep()
+{
+  processCommands();
+  
+  if (dnsServer)
+    dnsServer->processNextRequest();    
+  
+  //
+  //  we should do a scan every so often here and
+  //  try to reconnect to AP while we are at it
+  //
+  // The scan's disconnect would abort a /wifisave connect, it waits for the result
+  if ( !_timers.pending(WM_TIMER_SCAN) && !connect && (_saveConnect == WM_SAVE_CONNECT_IDLE) )
+  {
+    log_d("About to modal scan");
+    
+    // since we are modal, we can scan every time
+    shouldscan = true;
+    
+    WiFi.disconnect(false);
+
+    scan();
+    
+    //if (_tryConnectDuringConfigPortal) 
+    //  WiFi.begin(); // try to reconnect to AP
+      
+    _timers.schedule(WM_TIMER_SCAN, WiFiTimerWheel::now() + TIME_BETWEEN_MODAL_SCANS);
+  }
+  else
+  {
+    // Keep serving DNS / HTTP while the scan runs, just collect it once done
+    pollScan();
+  }
+
+  if (connect)
+    _portalTimedOut = false;
+    
+  int connectResult;
+  
+  // Never waits : DNS and the portal timeout keep running through the settle delay and the attempt
+  if (saveConnectStep(WiFiTimerWheel::now(), WIFI_PORTAL_CONNECT_SETTLE_MS, connectResult))
+  {
+    if (connectResult != WL_CONNECTED)
+    {  
+      log_e("Failed to connect");
+  
+      WiFi.mode(WIFI_AP); // Dual mode becomes flaky if not connected to a WiFi network.
+    }
+    else
+    {
+      //notify that configuration has changed and any optional parameters should be saved
+      if (_savecallback != NULL)
+      {
+        //todo: check if any custom parameters actually exist, and check if they really changed maybe
+        _savecallback();
+      }
+      return false;
+    }
+    
+    if (_shouldBreakAfterConfig)
+    {
+      //flag set to exit after config after trying to connect
+      //notify that configuration has changed and any optional parameters should be saved
+      if (_savecallback != NULL)
+      {
+        //todo: check if any custom parameters actually exist, and check if they really changed maybe
+        _savecallback();
+      }
+      return false;
+    }
+  }
+
+  if (stopConfigPortal)
+  {
+    log_e("Stop ConfigPortal");
+   
+    stopConfigPortal = false;
+    return false;
+  }
+  
+  return true;
+}
+
+//////////////////////////////////////////
+
+// Leave the portal, back to station. Returns true if connected
+bool ESPAsync_WiFiManager::finishConfigPortal()
+{
+  WiFi.mode(WIFI_STA);
+  if (_portalTimedOut)
+  {
+    setHostname();
+
+    // New v1.0.8 to fix static IP when CP not entered or timed-out
+    setWifiStaticIP();
+    
+    prepareConnectWait(storedSSID());
+    WiFi.begin();
+    int connRes = waitForConnectResult();
+
+    log_e("Timed out connection result: %s", getStatus(connRes));
+  }
+
+  server->reset();
+  dnsServer->stop();
+
+  return  WiFi.status() == WL_CONNECTED;
+}
+
+//////////////////////////////////////////
+
+// How long the portal task may sleep : until the next deadline on the timer wheel, or the next DNS poll
+unsigned long ESPAsync_WiFiManager::configPortalSleep()
+{
+  uint64_t      now   = WiFiTimerWheel::now();
+  uint64_t      next  = _timers.nextDeadline();
+  unsigned long sleep = ULONG_MAX;
+  
+  if (next != WIFI_TIMER_NEVER)
+    sleep = (next > now) ? (unsigned long) std::min(next - now, (uint64_t) (ULONG_MAX - 1)) : 0;
+  
+  if (_scanInFlight || _scanRequested)
+    sleep = std::min(sleep, (unsigned long) WIFI_PORTAL_SCAN_POLL_MS);
+    
+#ifndef USE_EADNS
+  sleep = std::min(sleep, (unsigned long) WIFI_PORTAL_DNS_POLL_MS);
+#endif
+
+  return sleep;
+}
+
+//////////////////////////////////////////
+
+// Portal timeout on the timer wheel. HOLD / CLOSE / SAVE commands clear / restore _configPortalTimeout, re-armed here when it changed
+bool ESPAsync_WiFiManager::configPortalExpired()
+{
+  if (_configPortalTimeout != _portalTimeoutArmed)
+  {
+    _portalTimeoutArmed = _configPortalTimeout;
+    
+    if (_configPortalTimeout == 0)
+    {
+      _timers.cancel(WM_TIMER_PORTAL);
+    }
+    else
+    {
+      _timers.schedule(WM_TIMER_PORTAL, _configPortalStart + _configPortalTimeout);
+      
+      // The next page opened holds it again
+      _portalHeld = false;
+    }
+  }
+  
+  pollTimers();
+  
+  return _timers.expired(WM_TIMER_PORTAL);
+}
+
+//////////////////////////////////////////
+
+uint64_t ESPAsync_WiFiManager::pollTimers()
+{
+  uint64_t now = WiFiTimerWheel::now();
+  
+  _timers.poll(now);
+  
+  return now;
+}
+
+//////////////////////////////////////////
+
+void ESPAsync_WiFiManager::runConfigPortalTask()
+{
+  while (!configPortalExpired())
+  {
+    // The manager is going away : no reconnect wait in finishConfigPortal() either
+    if (xEventGroupGetBits(_portalEvents) & PORTAL_EXIT_BIT)
+    {
+      _portalTimedOut = false;
+      break;
+    }
+    
+    if (!configPortalStep())
+      break;
+    
+    // Woken early by /wifisave, /close, /scan?refresh=1 or a scan done event. The synchronous DNSServer has no
+    // packet event : without USE_EADNS the sleep is capped at WIFI_PORTAL_DNS_POLL_MS, so an idle portal still
+    // wakes that often to poll it, not only when a DNS query comes in
+    unsigned long sleep = configPortalSleep();
+    
+    xEventGroupWaitBits(_portalEvents, PORTAL_WAKE_BIT, pdTRUE, pdFALSE, (sleep == ULONG_MAX) ? portMAX_DELAY : pdMS_TO_TICKS(sleep));
+  }
+  
+  bool connected = finishConfigPortal();
+  
+  xEventGroupSetBits(_portalEvents, PORTAL_DONE_BIT | (connected ? PORTAL_CONNECTED_BIT : 0));
+  
+  log_i("Config portal task done, %s", connected ? "connected" : "not connected");
+}
+
+//////////////////////////////////////////
+
+void ESPAsync_WiFiManager::configPortalTask(void* param)
+{
+  ESPAsync_WiFiManager* manager = static_cast<ESPAsync_WiFiManager*>(param);
+  
+  manager->runConfigPortalTask();
+  
+  // Last access : the destructor may free the manager right after
+  manager->_portalTaskRunning = false;
+  
+  vTaskDelete(NULL);
+}
+
+//////////////////////////////////////////
+
+bool ESPAsync_WiFiManager::waitConfigPortal(unsigned long timeout)
+{
+  EventBits_t bits = xEventGroupWaitBits(_portalEvents, PORTAL_DONE_BIT, pdFALSE, pdFALSE, 
+                                         (timeout == portMAX_DELAY) ? portMAX_DELAY : pdMS_TO_TICKS(timeout));
+  
+  return (bits & PORTAL_CONNECTED_BIT);
+}
+
+//////////////////////////////////////////
+
+void ESPAsync_WiFiManager::setConfigPortalTask(bool enable, int core, uint32_t stackSize, UBaseType_t priority)
+{
+  _portalTask         = enable;
+  _portalTaskCore     = core;
+  _portalTaskStack    = stackSize;
+  _portalTaskPriority = priority;
+}
+
+//////////////////////////////////////////
+
+// Cooperative lifecycle. Each state has an enter handler, run once on the transition, and a run handler
+// returning the next state. None of them waits : scans are async, and connects are checked on the event bits
+const ESPAsync_WiFiManager::WiFi_StateEntry ESPAsync_WiFiManager::_stateTable[WM_STATE_COUNT] =
+{
+  { "idle",       &ESPAsync_WiFiManager::enterIdle,       &ESPAsync_WiFiManager::runIdle        },
+  { "scanning",   &ESPAsync_WiFiManager::enterScanning,   &ESPAsync_WiFiManager::runScanning    },
+  { "connecting", &ESPAsync_WiFiManager::enterConnecting, &ESPAsync_WiFiManager::runConnecting  },
+  { "portal",     &ESPAsync_WiFiManager::enterPortal,     &ESPAsync_WiFiManager::runPortal      },
+  { "connected",  &ESPAsync_WiFiManager::enterConnected,  &ESPAsync_WiFiManager::runConnected   },
+  { "backoff",    &ESPAsync_WiFiManager::enterBackoff,    &ESPAsync_WiFiManager::runBackoff     },
+};
+
+//////////////////////////////////////////
+
+void ESPAsync_WiFiManager::begin(char const *apName, char const *apPassword)
+{
+  _apName           = apName;
+  _apPassword       = apPassword;
+  _modeless         = false;
+  connect           = false;
+  stopConfigPortal  = false;
+  _portalOpened     = false;
+  _reconnectAttempt = 0;
+  _pendingState     = WM_STATE_COUNT;
+  
+  loadSTAStaticIPConfig();
+  
+#if AUTOCONNECT_FAST_RECONNECT
+  preloadReconnectCache();
+#endif
+  
+  WiFi.mode(WIFI_STA);
+  
+  if ( (_credentials.count() > 0) || (storedSSID()[0] != 0) )
+    enterState(WM_STATE_SCANNING);
+  else
+    enterState(WM_STATE_PORTAL);
+}
+
+//////////////////////////////////////////
+
+WiFi_State ESPAsync_WiFiManager::tick()
+{
+  unsigned long startedAt = micros();
+  
+  pollTimers();
+  processCommands();
+  sampleLink();
+  
+  if ( (_portalStep == WM_PORTAL_SERVING) && dnsServer)
+    dnsServer->processNextRequest();
+  
+  _tickOps = 0;
+  
+  // Found after a blocking call on the last tick
+  if (_pendingState != WM_STATE_COUNT)
+  {
+    WiFi_State next = _pendingState;
+    
+    _pendingState = WM_STATE_COUNT;
+    enterState(next);
+  }
+  
+  // Follow transitions while they happen at once (scan done -> connecting ...), within the budget.
+  // At most one blocking driver call : a handler that made one ends the tick
+  for (uint8_t step = 0; (step < WIFI_TICK_MAX_STEPS) && (_tickOps == 0); step++)
+  {
+    WiFi_State next = (this->*_stateTable[_state].run)(pollTimers());
+    
+    if (next == _state)
+      break;
+      
+    if (_tickOps > 0)
+    {
+      _pendingState = next;
+      break;
+    }
+      
+    enterState(next);
+    
+    if (micros() - startedAt >= WIFI_TICK_BUDGET_US)
+      break;
+  }
+  
+  if (_tickOps == 0)
+    flushPendingWrite();
+  
+  uint32_t took = micros() - startedAt;
+  
+  if (took > _maxTickTime)
+    _maxTickTime = took;
+  
+  return _state;
+}
+
+//////////////////////////////////////////
+
+const char* ESPAsync_WiFiManager::getStateName(WiFi_State state)
+{
+  return (state < WM_STATE_COUNT) ? _stateTable[state].name : "unknown";
+}
+
+//////////////////////////////////////////
+
+void ESPAsync_WiFiManager::enterState(WiFi_State state)
+{
+  log_i("State %s -> %s", getStateName(_state), getStateName(state));
+  
+  _state          = state;
+  _stateSince     = WiFiTimerWheel::now();
+  
+  _timers.cancel(WM_TIMER_STATE);
+  
+  (this->*_stateTable[state].enter)(_stateSince);
+}
+
+//////////////////////////////////////////
+
+void ESPAsync_WiFiManager::closePortal()
+{
+  if (!_portalUp)
+    return;
+    
+  log_i("Close config portal");
+  
+  server->reset();
+  
+  if (dnsServer)
+    dnsServer->stop();
+  
+  WiFi.mode(WIFI_STA);
+  _tickOps++;
+  
+  _portalUp   = false;
+  _portalStep = WM_PORTAL_DOWN;
+}
+
+//////////////////////////////////////////
+
+// One deferred flash write, credentials first. Returns true if it wrote
+bool ESPAsync_WiFiManager::flushPendingWrite()
+{
+  if (_pendingWrites & WM_WRITE_CREDENTIALS)
+  {
+    _pendingWrites &= ~WM_WRITE_CREDENTIALS;
+    _credentials.save();
+  }
+  else if (_pendingWrites & WM_WRITE_STA_IPCONFIG)
+  {
+    _pendingWrites &= ~WM_WRITE_STA_IPCONFIG;
+    saveSTAStaticIPConfig();
+  }
+  else if (_pendingWrites & WM_WRITE_RECONNECT_CACHE)
+  {
+    _pendingWrites &= ~WM_WRITE_RECONNECT_CACHE;
+    
+#if AUTOCONNECT_FAST_RECONNECT
+    saveReconnectCache();
+#endif
+  }
+  else
+  {
+    return false;
+  }
+  
+  _tickOps++;
+  
+  return true;
+}
+
+//////////////////////////////////////////
+
+// A plan ran out of candidates or time. The first time since begin() open the portal, later back off and retry
+WiFi_State ESPAsync_WiFiManager::connectFailed()
+{
+  if (_planFromPortal)
+  {
+    _planFromPortal = false;
+    
+    if (!_shouldBreakAfterConfig)
+      return WM_STATE_PORTAL;
+      
+    //flag set to exit after config after trying to connect
+    //notify that configuration has changed and any optional parameters should be saved
+    if (_savecallback != NULL)
+    {
+      //todo: check if any custom parameters actually exist, and check if they really changed maybe
+      _savecallback();
+    }
+    
+    closePortal();
+  }
+  
+  if (_portalUp)
+    return WM_STATE_PORTAL;
+  
+  if (_reconnectAttempt < 255)
+    _reconnectAttempt++;
+    
+  if (!_portalOpened)
+    return WM_STATE_PORTAL;
+    
+  return (_reconnectBackoffMin != 0) ? WM_STATE_BACKOFF : WM_STATE_IDLE;
+}
+
+//////////////////////////////////////////
+
+void ESPAsync_WiFiManager::enterIdle(uint64_t now)
+{
+  closePortal();
+}
+
+//////////////////////////////////////////
+
+WiFi_State ESPAsync_WiFiManager::runIdle(uint64_t now)
+{
+  return WM_STATE_IDLE;
+}
+
+//////////////////////////////////////////
+
+void ESPAsync_WiFiManager::enterScanning(uint64_t now)
+{
+  _timers.schedule(WM_TIMER_STATE, now + WIFI_SCAN_REFRESH_TIMEOUT_MS);
+  
+  // A scan already running (/scan?refresh=1) does as well
+  if (!_scanInFlight)
+    startScan();
+}
+
+//////////////////////////////////////////
+
+WiFi_State ESPAsync_WiFiManager::runScanning(uint64_t now)
+{
+  if ( _scanInFlight && !pollScan() && !_timers.expired(WM_TIMER_STATE) )
+    return WM_STATE_SCANNING;
+  
+  _planFromPortal = false;
+  _planCount      = (_credentials.count() > 0) ? planConnect(_plan) : 0;
+  
+  // Scan saw none of them (hidden SSID ?), blindly try them all in stored order
+  if ( (_planCount == 0) && (_credentials.count() > 0) )
+    _planCount = blindCandidates(_plan);
+  
+  return WM_STATE_CONNECTING;
+}
+
+//////////////////////////////////////////
+
+void ESPAsync_WiFiManager::enterConnecting(uint64_t now)
+{
+  _planIndex        = 0;
+  _attemptInFlight  = false;
+  
+  _timers.schedule(WM_TIMER_STATE, now + _connectPlanTimeout);
+}
+
+//////////////////////////////////////////
+
+WiFi_State ESPAsync_WiFiManager::runConnecting(uint64_t now)
+{
+  if (_attemptInFlight)
+  {
+    unsigned long attemptLimit  = (_connectTimeout != 0) ? _connectTimeout : WIFI_CONNECT_DEFAULT_TIMEOUT;
+    EventBits_t   bits          = xEventGroupGetBits(_wifiEventGroup);
+    bool          connected     = (bits & WIFI_CONNECTED_BIT);
+    
+    if ( !connected && !(bits & WIFI_FAIL_BIT) && (now - _attemptStartedAt < attemptLimit) && !_timers.expired(WM_TIMER_STATE) )
+    {
+      return WM_STATE_CONNECTING;
+    }
+      
+    _attemptInFlight = false;
+    
+    if (_planCount > 0)
+      _credentials.recordAttempt(_plan[_planIndex].credential, connected, now - _attemptStartedAt);
+    
+    if (connected)
+      return WM_STATE_CONNECTED;
+      
+    log_e("Connect attempt %i failed, reason %i", _planIndex, _lastDisconnectReason.load());
+    
+    _planIndex++;
+  }
+  
+  if ( (_planIndex >= std::max(_planCount, (uint16_t) 1)) || _timers.expired(WM_TIMER_STATE) )
+  {
+    // Connect history, one blob write for the whole plan
+    _pendingWrites |= WM_WRITE_CREDENTIALS;
+    
+    return connectFailed();
+  }
+  
+  // The mode switch beginConnect() would make first gets a tick of its own
+  if (WiFi.getMode() != WIFI_AP_STA)
+  {
+    WiFi.mode(WIFI_AP_STA);
+    _tickOps++;
+    
+    return WM_STATE_CONNECTING;
+  }
+  
+  int connectResult;
+  
+  if (_planCount > 0)
+  {
+    connectResult = beginCandidate(_plan[_planIndex]);
+  }
+  else
+  {
+    // Driver config, or nothing at all : beginConnect() then flags the failure
+    connectResult = beginConnect("", "", _storedChannel);
+  }
+  
+  // WiFi.begin() writes the driver config when it changed
+  _tickOps++;
+  
+  if (connectResult == WL_CONNECTED)
+    return WM_STATE_CONNECTED;
+  
+  _attemptInFlight  = true;
+  _attemptStartedAt = now;
+  
+  return WM_STATE_CONNECTING;
+}
+
+//////////////////////////////////////////
+
+void ESPAsync_WiFiManager::enterPortal(uint64_t now)
+{
+  // Back from a failed /wifisave connect : still up
+  if (!_portalUp)
+  {
+    if (_apcallback != NULL)
+    {
+      _apcallback(this);
+    }
+    
+    connect = false;
+    
+    // Mode, soft AP and server come up in runPortal()
+    _portalUp     = true;
+    _portalStep   = WM_PORTAL_MODE;
+    _portalOpened = true;
+  }
+}
+
+//////////////////////////////////////////
+
+WiFi_State ESPAsync_WiFiManager::runPortal(uint64_t now)
+{
+  // Bring-up, one blocking driver call per tick
+  if (_portalStep == WM_PORTAL_MODE)
+  {
+    WiFi.mode(WIFI_AP_STA);
+    _tickOps++;
+    
+    log_d("SET AP STA");
+    
+    _portalStep = WM_PORTAL_AP;
+    
+    return WM_STATE_PORTAL;
+  }
+  
+  if (_portalStep == WM_PORTAL_AP)
+  {
+    startAccessPoint();
+    _tickOps++;
+    
+    // The server starts once the AP settled, first scan then too
+    _timers.schedule(WM_TIMER_STATE, now + WIFI_PORTAL_AP_SETTLE_MS);
+    _timers.schedule(WM_TIMER_SCAN, now + WIFI_PORTAL_AP_SETTLE_MS);
+    
+    _portalStep = WM_PORTAL_SETTLE;
+    
+    return WM_STATE_PORTAL;
+  }
+  
+  if (_portalStep == WM_PORTAL_SETTLE)
+  {
+    if (!_timers.expired(WM_TIMER_STATE))
+      return WM_STATE_PORTAL;
+      
+    _timers.cancel(WM_TIMER_STATE);
+    
+    startPortalServer();
+    
+    _portalStep = WM_PORTAL_SERVING;
+  }
+  
+  if (connect)
+  {
+    connect = false;
+    invalidateInfo();
+    
+    log_d("Connecting to new AP");
+    
+    // Written on the next quiet ticks, the attempt only needs them in RAM
+    if (persistSavedConfig(true))
+      return WM_STATE_CONNECTED;
+    
+    // Portal stays up during the attempt, and if it fails
+    _plan[0].credential = 0;
+    _plan[0].channel    = getChannel(0);
+    _plan[0].RSSI       = 0;
+    _plan[0].score      = 0;
+    _planCount          = 1;
+    _planFromPortal     = true;
+    
+    return WM_STATE_CONNECTING;
+  }
+  
+  if (stopConfigPortal)
+  {
+    log_e("Stop ConfigPortal");
+    
+    stopConfigPortal = false;
+  }
+  else if (!configPortalExpired())
+  {
+    // Refresh the network list now and then, the portal STA isn't connecting meanwhile
+    if (!_timers.pending(WM_TIMER_SCAN))
+    {
+      shouldscan = true;
+      
+      scan();
+      _timers.schedule(WM_TIMER_SCAN, now + TIME_BETWEEN_MODELESS_SCANS);
+    }
+    else
+    {
+      pollScan();
+    }
+    
+    return WM_STATE_PORTAL;
+  }
+  
+  // Closed or timed out : keep trying the stored networks with backoff
+  closePortal();
+  
+  if ( (_credentials.count() == 0) && (storedSSID()[0] == 0) )
+    return WM_STATE_IDLE;
+    
+  return (_reconnectBackoffMin != 0) ? WM_STATE_BACKOFF : WM_STATE_SCANNING;
+}
+
+//////////////////////////////////////////
+
+void ESPAsync_WiFiManager::enterConnected(uint64_t now)
+{
+  log_i("Connected, local ip = %s", WiFi.localIP().toString().c_str());
+  
+  _reconnectAttempt = 0;
+  
+  _pendingWrites |= WM_WRITE_CREDENTIALS | WM_WRITE_RECONNECT_CACHE;
+  
+  if (_planFromPortal || _portalUp)
+  {
+    _planFromPortal = false;
+    
+    //notify that configuration has changed and any optional parameters should be saved
+    if (_savecallback != NULL)
+    {
+      //todo: check if any custom parameters actually exist, and check if they really changed maybe
+      _savecallback();
+    }
+    
+    closePortal();
+  }
+}
+
+//////////////////////////////////////////
+
+WiFi_State ESPAsync_WiFiManager::runConnected(uint64_t now)
+{
+  roamLoop();
+  
+  // A roam drops the link on purpose and reports on its own
+  if (_roamInFlight || (WiFi.status() == WL_CONNECTED) )
+    return WM_STATE_CONNECTED;
+    
+  log_w("Link down");
+  
+  return (_reconnectBackoffMin != 0) ? WM_STATE_BACKOFF : WM_STATE_SCANNING;
+}
+
+//////////////////////////////////////////
+
+void ESPAsync_WiFiManager::enterBackoff(uint64_t now)
+{
+  unsigned long backoff = reconnectBackoff();
+  
+  _timers.schedule(WM_TIMER_STATE, now + backoff);
+  
+  log_w("Next connect attempt in %lu ms", backoff);
+}
+
+//////////////////////////////////////////
+
+WiFi_State ESPAsync_WiFiManager::runBackoff(uint64_t now)
+{
+  // The driver may get the link back by itself
+  if (WiFi.status() == WL_CONNECTED)
+    return WM_STATE_CONNECTED;
+    
+  if (!_timers.expired(WM_TIMER_STATE))
+    return WM_STATE_BACKOFF;
+    
+  return WM_STATE_SCANNING;
+}
+
+//////////////////////////////////////////
+
+void ESPAsync_WiFiManager::setWifiStaticIP()
+{ 
+#if USE_CONFIGURABLE_DNS
+  if (_WiFi_STA_IPconfig._sta_static_ip)
+  {
+    LOGWARN(F("Custom STA IP/GW/Subnet"));
+   
+    //***** Added section for DNS config option *****
+    if (_WiFi_STA_IPconfig._sta_static_dns1 && _WiFi_STA_IPconfig._sta_static_dns2) 
+    { 
+      LOGWARN(F("DNS1 and DNS2 set"));
+ 
+      WiFi.config(_WiFi_STA_IPconfig._sta_static_ip, _WiFi_STA_IPconfig._sta_static_gw, _WiFi_STA_IPconfig._sta_static_sn, _WiFi_STA_IPconfig._sta_static_dns1, _WiFi_STA_IPconfig._sta_static_dns2);
+    }
+    else if (_WiFi_STA_IPconfig._sta_static_dns1) 
+    {
+      LOGWARN(F("Only DNS1 set"));
+     
+      WiFi.config(_WiFi_STA_IPconfig._sta_static_ip, _WiFi_STA_IPconfig._sta_static_gw, _WiFi_STA_IPconfig._sta_static_sn, _WiFi_STA_IPconfig._sta_static_dns1);
+    }
+    else 
+    {
+      LOGWARN(F("No DNS server set"));
+  
+      WiFi.config(_WiFi_STA_IPconfig._sta_static_ip, _WiFi_STA_IPconfig._sta_static_gw, _WiFi_STA_IPconfig._sta_static_sn);
+    }
+    //***** End added section for DNS config option *****
+
+    LOGINFO1(F("setWifiStaticIP IP ="), WiFi.localIP());
+  }
+  else
+  {
+    LOGWARN(F("Can't use Custom STA IP/GW/Subnet"));
+  }
+#else
+  // check if we've got static_ip settings, if we do, use those.
+  if (_WiFi_STA_IPconfig._sta_static_ip)
+  {
+    WiFi.config(_WiFi_STA_IPconfig._sta_static_ip, _WiFi_STA_IPconfig._sta_static_gw, _WiFi_STA_IPconfig._sta_static_sn);
+    
+    log_w("Custom STA IP/GW/Subnet : %s", WiFi.localIP());
+  }
+#endif
+}
+
+//////////////////////////////////////////
+
+// New from v1.1.1
+int ESPAsync_WiFiManager::reconnectWifi()
+{
+  if (_credentials.count() == 0)
+  {
+    // Nothing from the config portal, use the config stored by the driver
+    scanKnownNetworks();
+    
+    return connectWifi("", "", _storedChannel);
+  }
+  
+  // One scan, all candidates ranked, all attempts under a single deadline
+  unsigned long startedAt     = millis();
+  unsigned long attemptLimit  = (_connectTimeout != 0) ? _connectTimeout : WIFI_CONNECT_DEFAULT_TIMEOUT;
+  
+  bool inRange = scanKnownNetworks();
+  
+  WiFi_ConnectCandidate candidates[WIFI_SCAN_MAX_RESULTS];
+  
+  uint16_t count = planConnect(candidates);
+  
+  int connectResult = WL_NO_SSID_AVAIL;
+  
+  if (!inRange)
+  {
+    // Scan saw none of them (hidden SSID ?), blindly try them all in stored order
+    count = blindCandidates(candidates);
+  }
+  
+  for (uint16_t i = 0; i < count; i++)
+  {
+    unsigned long elapsed = millis() - startedAt;
+    
+    if (elapsed >= _connectPlanTimeout)
+    {
+      log_e("Connect deadline reached");
+      break;
+    }
+    
+    unsigned long attemptStartedAt = millis();
+    
+    // using user-provided ssid, pass in place of system-stored ssid and pass
+    connectResult = beginCandidate(candidates[i]);
+    
+    // Already connected : nothing learned
+    if (connectResult == WL_CONNECTED)
+      break;
+    
+    connectResult = waitForConnectEvent(std::min(attemptLimit, _connectPlanTimeout - elapsed));
+    
+    // The driver candidate has no history, recordAttempt() ignores it
+    _credentials.recordAttempt(candidates[i].credential, connectResult == WL_CONNECTED, millis() - attemptStartedAt);
+    
+    if (connectResult == WL_CONNECTED)
+    {
+      log_e("Connected after %lu ms", millis() - startedAt);
+      break;
     }
+    
+    log_e("Attempt %i failed", i);
   }
+  
+  // Connect history, one blob write for the whole plan
+  _credentials.save();
+  
+  return connectResult;
 }
 
 //////////////////////////////////////////
 
-// Anything that doesn't access WiFi, ESP or EEPROM can go here
-
-void ESPAsync_WiFiManager::safeLoop()
+// All stored credentials in stored order, on their last known channel. Returns the candidate count
+uint16_t ESPAsync_WiFiManager::blindCandidates(WiFi_ConnectCandidate* candidates)
 {
-  #ifndef USE_EADNS	
-  dnsServer->processNextRequest();
-  #endif
+  uint16_t count;
+  
+  for (count = 0; (count < _credentials.count()) && (count < WIFI_SCAN_MAX_RESULTS); count++)
+  {
+    candidates[count].credential  = count;
+    candidates[count].channel     = _credentials.get(count)->channel;
+    candidates[count].RSSI        = 0;
+    candidates[count].score       = 0;
+  }
+  
+  return count;
 }
 
-///////////////////////////////////////////////////////////
+//////////////////////////////////////////
 
-bool  ESPAsync_WiFiManager::startConfigPortal()
+// beginConnect() to a planned candidate, a stored credential or the config kept by the driver
+int ESPAsync_WiFiManager::beginCandidate(const WiFi_ConnectCandidate& candidate)
 {
-  String ssid = "ESP_" + String((uint32_t)ESP.getEfuseMac());
-
-  ssid.toUpperCase();
-
-  return startConfigPortal(ssid.c_str(), NULL);
+  if (candidate.credential == WIFI_DRIVER_CANDIDATE)
+  {
+    log_i("Trying driver config \"%s\", RSSI %i", storedSSID(), candidate.RSSI);
+    
+    return beginConnect("", "", candidate.channel);
+  }
+  
+  const WiFi_Credential* credential = _credentials.get(candidate.credential);
+  
+  log_i("Trying \"%s\", RSSI %i, score %i", credential->SSID, candidate.RSSI, candidate.score);
+  
+  return beginConnect(credential->SSID, credential->password, candidate.channel);
 }
 
 //////////////////////////////////////////
 
-bool  ESPAsync_WiFiManager::startConfigPortal(char const *apName, char const *apPassword)
+// Match the scan table against the stored credentials, best candidate first. Returns the candidate count
+uint16_t ESPAsync_WiFiManager::planConnect(WiFi_ConnectCandidate* candidates)
 {
-  WiFi.mode(WIFI_AP_STA);
+  uint16_t count = matchKnownNetworks(candidates);
+  
+#if AUTOCONNECT_FAST_RECONNECT
+  // RAM only, runs in tick() : the NVS copy was loaded by begin() / autoConnect() / startConfigPortalModeless()
+  WiFi_ReconnectCache lastGood;
+  bool                haveLastGood = peekReconnectCache(lastGood);
+#endif
 
-  _apName = apName;
-  _apPassword = apPassword;
+  for (uint16_t i = 0; i < count; i++)
+  {
+    WiFi_ConnectCandidate& candidate = candidates[i];
+    
+    candidate.score += historyScore(candidate.credential);
+    
+#if AUTOCONNECT_FAST_RECONNECT
+    const char* ssid = _credentials.get(candidate.credential)->SSID;
+    
+    // History : the network we were last connected to gets a head start
+    if (haveLastGood && (lastGood.SSIDHash == WiFi_SSIDHash(ssid, strlen(ssid))) )
+      candidate.score += WIFI_CONNECT_LAST_GOOD_BONUS;
+#endif
+  }
+  
+  std::sort(candidates, candidates + count, [](const WiFi_ConnectCandidate& a, const WiFi_ConnectCandidate& b)
+  {
+    return a.score > b.score;
+  });
+  
+  // The config kept by the driver, if the scan saw it and it isn't stored here too : tried last
+  const char* driverSSID  = storedSSID();
+  int         index       = (driverSSID[0] != 0) ? findScanResult(driverSSID) : -1;
+  
+  if ( (index >= 0) && (_credentials.find(driverSSID) < 0) && (count < WIFI_SCAN_MAX_RESULTS) )
+  {
+    WiFi_ConnectCandidate& candidate = candidates[count++];
+    
+    candidate.credential  = WIFI_DRIVER_CANDIDATE;
+    candidate.channel     = wifiSSIDs[index].channel;
+    candidate.RSSI        = wifiSSIDs[index].RSSI;
+    candidate.score       = wifiSSIDs[index].RSSI;
+  }
+  
+  return count;
+}
 
-  //notify we entered AP mode
-  if (_apcallback != NULL)
+//////////////////////////////////////////
+
+// Stored credentials seen by the last scan, strongest AP of each, scored by RSSI. One hashed lookup
+// per scan entry, so the cost follows the scan size, not the store size. Returns the match count
+uint16_t ESPAsync_WiFiManager::matchKnownNetworks(WiFi_ConnectCandidate* candidates)
+{
+  uint16_t  count = 0;
+  uint32_t  matched[(WIFI_CREDENTIALS_CAPACITY + 31) / 32] = { 0 };
+  
+  // Table is RSSI sorted, first match of a credential is its strongest AP
+  for (wifi_ssid_count_t i = 0; i < wifiSSIDCount; i++)
   {
-    log_i("_apcallback");
+    const WiFiScanRecord& record = wifiSSIDs[i];
     
-    _apcallback(this);
+    if ( (int32_t) (record.lastSeen - _scanStartedAt) <= 0 )
+      continue;
+    
+    int index = _credentials.find(record.SSID, record.SSIDLength, record.SSIDHash);
+    
+    if ( (index < 0) || (matched[index / 32] & (1UL << (index % 32))) )
+      continue;
+      
+    matched[index / 32] |= (1UL << (index % 32));
+    
+    WiFi_ConnectCandidate& candidate = candidates[count++];
+    
+    candidate.credential  = index;
+    candidate.channel     = record.channel;
+    candidate.RSSI        = record.RSSI;
+    candidate.score       = record.RSSI;
   }
+  
+  return count;
+}
 
-  connect = false;
+//////////////////////////////////////////
 
-  setupConfigPortal();
+// Score bonus, in dB, learned from the connect history of a credential
+int16_t ESPAsync_WiFiManager::historyScore(uint16_t index)
+{
+  const WiFi_CredentialStats& stats = _credentials.get(index)->stats;
+  
+  // Success ratio, smoothed so a single attempt doesn't decide
+  int16_t neutral = WIFI_CONNECT_HISTORY_WEIGHT / 2;
+  int16_t history = (WIFI_CONNECT_HISTORY_WEIGHT * (stats.successes + 1)) / (stats.attempts + 2);
+  
+  // Stale history fades back to neutral
+  uint32_t age    = _credentials.sequence() - stats.lastAttempt;
+  uint8_t  shift  = std::min<uint32_t>(age / WIFI_CONNECT_HISTORY_HALFLIFE, 15);
+  
+  history = neutral + ( (history - neutral) / (1 << shift) );
+  
+  // Slow to get an IP : slow DHCP or a flaky AP
+  history -= std::min(_credentials.medianTimeToIP(index) / WIFI_CONNECT_TTI_PENALTY_MS, WIFI_CONNECT_TTI_PENALTY_MAX);
+  
+  return history;
+}
 
-  bool TimedOut = true;
+//////////////////////////////////////////
 
-  log_i("startConfigPortal : Enter loop");
+int ESPAsync_WiFiManager::connectWifi(String ssid, String pass, uint8_t channel)
+{
+  int connRes = beginConnect(ssid, pass, channel);
   
-  scannow = -1 ;
+  //fix for auto connect racing issue. Move up from v1.1.0 to avoid eraseDriverConfig()
+  if (connRes == WL_CONNECTED)
+    return connRes;
+
+  connRes = waitForConnectResult();
+  log_w("Connection result: %s", getStatus(connRes));
 
-  while (_configPortalTimeout == 0 || millis() < _configPortalStart + _configPortalTimeout)
+  //not connected, WPS enabled, no pass - first attempt
+  if (_tryWPS && connRes != WL_CONNECTED && pass == "")
   {
-    if (dnsServer)
-      dnsServer->processNextRequest();    
+    startWPS();
+    //should be connected at the end of WPS
+    connRes = waitForConnectResult();
+  }
+
+  return connRes;
+}
+
+//////////////////////////////////////////
+
+// Non-blocking half of connectWifi() : issue WiFi.begin(), the result comes through the connect event bits.
+// Returns WL_CONNECTED if already connected, WL_NO_SSID_AVAIL if there is nothing to connect to, WL_IDLE_STATUS otherwise
+int ESPAsync_WiFiManager::beginConnect(String ssid, String pass, uint8_t channel)
+{
+  // Add option if didn't input/update SSID/PW => Use the previous saved Credentials.
+  // But update the Static/DHCP options if changed.
+  if ( (ssid != "") || ( (ssid == "") && (storedSSID()[0] != 0) ) )
+  {  
+    //fix for auto connect racing issue. Move up from v1.1.0 to avoid eraseDriverConfig()
+    if (WiFi.status() == WL_CONNECTED)
+    {
+      log_w("Already connected. Bailing out.");
+      return WL_CONNECTED;
+    }
+     
+    // Same config as the driver holds : WiFi.begin() won't write anything, keep it.
+    // Otherwise the new one simply overwrites it, no need for the erase + dummy write of eraseDriverConfig()
+    if ( (ssid != "") && ( (ssid != storedSSID()) || (pass != storedPass()) ) )
+    {
+      log_i("Previous settings replaced");
+      
+      invalidateInfo();
+      WiFi.disconnect();
+    }
+
+    WiFi.mode(WIFI_AP_STA); //It will start in station mode if it was previously in AP mode.
+
+    setHostname();
     
-    //
-    //  we should do a scan every so often here and
-    //  try to reconnect to AP while we are at it
-    //
-    if ( scannow == -1 || millis() > scannow + TIME_BETWEEN_MODAL_SCANS)
+    setWifiStaticIP();
+
+    if (ssid != "")
     {
-      log_d("About to modal scan");
+      // Start Wifi with new values.
+      log_w("Connect to new WiFi using new IP parameters");
       
-      // since we are modal, we can scan every time
-      shouldscan = true;
+      // channel 0 lets the driver sweep all channels
+      prepareConnectWait(ssid.c_str());
+      WiFi.begin(ssid.c_str(), pass.c_str(), channel);
       
-      WiFi.disconnect(false);
-
-      scan();
+      invalidateStoredConfig();
+    }
+    else if (channel != 0)
+    {
+      // Start Wifi with old values, on the channel the targeted scan found it
+      log_w("Connect to previous WiFi on channel %i using new IP parameters", channel);
       
-      //if (_tryConnectDuringConfigPortal) 
-      //  WiFi.begin(); // try to reconnect to AP
-        
-      scannow = millis() ;
+      prepareConnectWait(storedSSID());
+      WiFi.begin(storedSSID(), storedPass(), channel);
     }
-
-    if (connect)
+    else
     {
-      TimedOut = false;
-      delay(2000);
+      // Start Wifi with old values.
+      log_w("Connect to previous WiFi using new IP parameters");
+      
+      prepareConnectWait(storedSSID());
+      WiFi.begin();
+    }
+    
+    return WL_IDLE_STATUS;
+  }
+  
+  log_w("No saved credentials");
+  
+  // Nothing to wait for
+  prepareConnectWait("");
+  _lastDisconnectReason = WIFI_REASON_NO_AP_FOUND;
+  xEventGroupSetBits(_wifiEventGroup, WIFI_FAIL_BIT);
+  
+  return WL_NO_SSID_AVAIL;
+}
 
-      log_e("Connecting to new AP");
+//////////////////////////////////////////
 
-      // using user-provided  _ssid, _pass in place of system-stored ssid and pass
-      if (connectWifi(_ssid, _pass) != WL_CONNECTED)
-      {  
-        log_e("Failed to connect");
+// Connect after a /wifisave, never blocks : wait settle ms, persist what was submitted, issue WiFi.begin(),
+// and check the connect event bits on the next calls, like reconnectStep(). Re-submitting the config we are
+// already connected with writes nothing and doesn't drop the connection.
+// Returns true once the attempt ended, result is then WL_CONNECTED or why it failed
+bool ESPAsync_WiFiManager::saveConnectStep(uint64_t now, unsigned long settle, int& result)
+{
+  if (connect)
+  {
+    connect = false;
     
-        WiFi.mode(WIFI_AP); // Dual mode becomes flaky if not connected to a WiFi network.
-      }
-      else
-      {
-        //notify that configuration has changed and any optional parameters should be saved
-        if (_savecallback != NULL)
-        {
-          //todo: check if any custom parameters actually exist, and check if they really changed maybe
-          _savecallback();
-        }
-        break;
-      }
+    // A new save restarts it
+    _saveConnect = WM_SAVE_CONNECT_SETTLE;
+    
+    if (settle > 0)
+      _timers.schedule(WM_TIMER_SAVE_CONNECT, now + settle);
+    else
+      _timers.cancel(WM_TIMER_SAVE_CONNECT);
+  }
+  
+  if (_saveConnect == WM_SAVE_CONNECT_IDLE)
+    return false;
+  
+  if (_saveConnect == WM_SAVE_CONNECT_SETTLE)
+  {
+    if (_timers.pending(WM_TIMER_SAVE_CONNECT))
+      return false;
       
-      if (_shouldBreakAfterConfig)
-      {
-        //flag set to exit after config after trying to connect
-        //notify that configuration has changed and any optional parameters should be saved
-        if (_savecallback != NULL)
-        {
-          //todo: check if any custom parameters actually exist, and check if they really changed maybe
-          _savecallback();
-        }
-        break;
-      }
+    log_e("Connecting to new AP");
+    
+    // using user-provided ssid, pass in place of system-stored ssid and pass
+    result = persistSavedConfig() ? WL_CONNECTED : beginConnect(getSSID(0), getPW(0), getChannel(0));
+    
+    if (result == WL_IDLE_STATUS)
+    {
+      unsigned long attemptLimit = (_connectTimeout != 0) ? _connectTimeout : WIFI_CONNECT_DEFAULT_TIMEOUT;
+      
+      _saveConnect = WM_SAVE_CONNECT_WAIT;
+      _timers.schedule(WM_TIMER_SAVE_CONNECT, now + attemptLimit);
+      
+      return false;
     }
-
-    if (stopConfigPortal)
+  }
+  else
+  {
+    EventBits_t bits = xEventGroupGetBits(_wifiEventGroup);
+    
+    if (bits & WIFI_CONNECTED_BIT)
     {
-      log_e("Stop ConfigPortal");
-     
-      stopConfigPortal = false;
-      break;
+      log_w("Local ip = %s", WiFi.localIP().toString().c_str());
+      
+      result = WL_CONNECTED;
+      
+#if AUTOCONNECT_FAST_RECONNECT
+      saveReconnectCache();
+#endif
+    }
+    else if (bits & WIFI_FAIL_BIT)
+    {
+      result = (_lastDisconnectReason == WIFI_REASON_NO_AP_FOUND) ? WL_NO_SSID_AVAIL : WL_CONNECT_FAILED;
+    }
+    else if (_timers.expired(WM_TIMER_SAVE_CONNECT))
+    {
+      log_e("Connection timed out");
+      
+      result = WL_DISCONNECTED;
+    }
+    else
+    {
+      return false;
     }
     
-    yield();
+    //not connected, WPS enabled, no pass
+    if (_tryWPS && (result != WL_CONNECTED) && (getPW(0) == ""))
+      startWPS();
+  }
+  
+  log_w("Connection result: %s", getStatus(result));
+  
+  _saveConnect = WM_SAVE_CONNECT_IDLE;
+  _timers.cancel(WM_TIMER_SAVE_CONNECT);
+  
+  return true;
+}
+
+//////////////////////////////////////////
+
+// Write what /wifisave changed, or with deferred leave it to the next quiet tick(). Returns true if we are
+// already connected with it, nothing to do then
+bool ESPAsync_WiFiManager::persistSavedConfig(bool deferred)
+{
+  bool unchanged = _savedConfigUnchanged;
+  
+  _savedConfigUnchanged = false;
+  
+  if (deferred)
+  {
+    _pendingWrites |= WM_WRITE_CREDENTIALS | WM_WRITE_STA_IPCONFIG;
+  }
+  else
+  {
+    _credentials.save();
+    saveSTAStaticIPConfig();
+  }
+  
+  if ( unchanged && (WiFi.status() == WL_CONNECTED) && (WiFi.SSID() == getSSID(0)) )
+  {
+    log_i("Config unchanged, keep connection to %s", WiFi.SSID().c_str());
+    
+    return true;
+  }
+  
+  return false;
+}
+
+//////////////////////////////////////////
+
+static void WiFi_STA_IPConfigToRecord(const WiFi_STA_IPConfig& config, WiFi_STA_IPConfigRecord& record)
+{
+  record.ip   = (uint32_t) config._sta_static_ip;
+  record.gw   = (uint32_t) config._sta_static_gw;
+  record.sn   = (uint32_t) config._sta_static_sn;
+  record.dns1 = (uint32_t) config._sta_static_dns1;
+  record.dns2 = (uint32_t) config._sta_static_dns2;
+}
+
+//////////////////////////////////////////
+
+// Static IP saved from the portal, unless the sketch set one itself
+void ESPAsync_WiFiManager::loadSTAStaticIPConfig()
+{
+  if ( (uint32_t) _WiFi_STA_IPconfig._sta_static_ip != 0)
+    return;
+    
+  Preferences prefs;
+  
+  if (!prefs.begin(WIFI_PREFS_NAMESPACE, true))
+    return;
+    
+  WiFi_STA_IPConfigRecord record;
+  
+  if (prefs.getBytes(WIFI_STA_IPCONFIG_KEY, &record, sizeof(record)) == sizeof(record))
+  {
+    _WiFi_STA_IPconfig._sta_static_ip   = IPAddress(record.ip);
+    _WiFi_STA_IPconfig._sta_static_gw   = IPAddress(record.gw);
+    _WiFi_STA_IPconfig._sta_static_sn   = IPAddress(record.sn);
+    _WiFi_STA_IPconfig._sta_static_dns1 = IPAddress(record.dns1);
+    _WiFi_STA_IPconfig._sta_static_dns2 = IPAddress(record.dns2);
+    
+    log_i("Static IP %s loaded", _WiFi_STA_IPconfig._sta_static_ip.toString().c_str());
+    
+    // /wifi shows it
+    invalidateInfo();
+  }
+  
+  prefs.end();
+}
+
+//////////////////////////////////////////
+
+// Written only if /wifisave changed it, and only if it differs from what NVS holds
+bool ESPAsync_WiFiManager::saveSTAStaticIPConfig()
+{
+  if (!_staIPConfigChanged)
+    return true;
+    
+  Preferences prefs;
+  
+  if (!prefs.begin(WIFI_PREFS_NAMESPACE, false))
+  {
+    log_e("Can't open NVS for static IP");
+    return false;
+  }
+  
+  WiFi_STA_IPConfigRecord record, stored;
+  
+  WiFi_STA_IPConfigToRecord(_WiFi_STA_IPconfig, record);
+  
+  bool ok = true;
+  
+  if ( (prefs.getBytes(WIFI_STA_IPCONFIG_KEY, &stored, sizeof(stored)) != sizeof(stored)) || (memcmp(&record, &stored, sizeof(record)) != 0) )
+  {
+    ok = (prefs.putBytes(WIFI_STA_IPCONFIG_KEY, &record, sizeof(record)) == sizeof(record));
     
-#if ( defined(TIME_BETWEEN_CONFIG_PORTAL_LOOP) && (TIME_BETWEEN_CONFIG_PORTAL_LOOP > 0) )
-    #warning Using delay in startConfigPortal loop
-    delay(TIME_BETWEEN_CONFIG_PORTAL_LOOP);
-#endif    
+    log_i("Static IP saved");
   }
+  
+  prefs.end();
+  
+  if (ok)
+    _staIPConfigChanged = false;
+    
+  return ok;
+}
 
-  WiFi.mode(WIFI_STA);
-  if (TimedOut)
-  {
-    setHostname();
+//////////////////////////////////////////
 
-    // New v1.0.8 to fix static IP when CP not entered or timed-out
-    setWifiStaticIP();
+wl_status_t ESPAsync_WiFiManager::waitForConnectResult()
+{
+  if (_connectTimeout == 0)
+  {
+    return waitForConnectEvent(WIFI_CONNECT_DEFAULT_TIMEOUT);
+  }
+  else
+  {
+    log_e("Waiting WiFi connection with time out");
     
-    WiFi.begin();
-    int connRes = waitForConnectResult();
-
-    log_e("Timed out connection result: %s", getStatus(connRes));
+    return waitForConnectEvent(_connectTimeout);
   }
+}
 
-  server->reset();
-  dnsServer->stop();
+//////////////////////////////////////////
 
-  return  WiFi.status() == WL_CONNECTED;
+// Arm the connect event bits before a WiFi.begin(), so a stale result of a previous attempt isn't taken for this one
+void ESPAsync_WiFiManager::prepareConnectWait(const char* ssid)
+{
+  uint8_t len = strnlen(ssid, WIFI_SSID_MAXLEN);
+  
+  _connectingSSIDLength = len;
+  _connectingSSIDHash   = WiFi_SSIDHash(ssid, len);
+  _lastDisconnectReason = 0;
+  
+  xEventGroupClearBits(_wifiEventGroup, WIFI_CONNECTED_BIT | WIFI_FAIL_BIT);
 }
 
 //////////////////////////////////////////
 
-void ESPAsync_WiFiManager::setWifiStaticIP()
-{ 
-#if USE_CONFIGURABLE_DNS
-  if (_WiFi_STA_IPconfig._sta_static_ip)
-  {
-    LOGWARN(F("Custom STA IP/GW/Subnet"));
-   
-    //***** Added section for DNS config option *****
-    if (_WiFi_STA_IPconfig._sta_static_dns1 && _WiFi_STA_IPconfig._sta_static_dns2) 
-    { 
-      LOGWARN(F("DNS1 and DNS2 set"));
- 
-      WiFi.config(_WiFi_STA_IPconfig._sta_static_ip, _WiFi_STA_IPconfig._sta_static_gw, _WiFi_STA_IPconfig._sta_static_sn, _WiFi_STA_IPconfig._sta_static_dns1, _WiFi_STA_IPconfig._sta_static_dns2);
-    }
-    else if (_WiFi_STA_IPconfig._sta_static_dns1) 
-    {
-      LOGWARN(F("Only DNS1 set"));
-     
-      WiFi.config(_WiFi_STA_IPconfig._sta_static_ip, _WiFi_STA_IPconfig._sta_static_gw, _WiFi_STA_IPconfig._sta_static_sn, _WiFi_STA_IPconfig._sta_static_dns1);
-    }
-    else 
-    {
-      LOGWARN(F("No DNS server set"));
+// Block on the driver events instead of polling WiFi.status() : wakes on got-IP,
+// or on a disconnect with a reason that retrying won't fix (wrong password, SSID not found)
+wl_status_t ESPAsync_WiFiManager::waitForConnectEvent(unsigned long timeout)
+{
+  unsigned long startedAt = millis();
   
-      WiFi.config(_WiFi_STA_IPconfig._sta_static_ip, _WiFi_STA_IPconfig._sta_static_gw, _WiFi_STA_IPconfig._sta_static_sn);
-    }
-    //***** End added section for DNS config option *****
-
-    LOGINFO1(F("setWifiStaticIP IP ="), WiFi.localIP());
-  }
-  else
+  EventBits_t bits = xEventGroupWaitBits(_wifiEventGroup, WIFI_CONNECTED_BIT | WIFI_FAIL_BIT, pdFALSE, pdFALSE, pdMS_TO_TICKS(timeout));
+  
+  float waited = (millis() - startedAt);
+  
+  if (bits & WIFI_CONNECTED_BIT)
   {
-    LOGWARN(F("Can't use Custom STA IP/GW/Subnet"));
+    log_w("Connected after waiting (s): %f", waited / 1000);
+    log_w("Local ip = %s", WiFi.localIP().toString().c_str());
+    
+#if AUTOCONNECT_FAST_RECONNECT
+    saveReconnectCache();
+#endif
+    
+    return WL_CONNECTED;
   }
-#else
-  // check if we've got static_ip settings, if we do, use those.
-  if (_WiFi_STA_IPconfig._sta_static_ip)
+  
+  if (bits & WIFI_FAIL_BIT)
   {
-    WiFi.config(_WiFi_STA_IPconfig._sta_static_ip, _WiFi_STA_IPconfig._sta_static_gw, _WiFi_STA_IPconfig._sta_static_sn);
+    log_e("Connection failed after %f s, reason %i", waited / 1000, _lastDisconnectReason.load());
     
-    log_w("Custom STA IP/GW/Subnet : %s", WiFi.localIP());
+    return (_lastDisconnectReason == WIFI_REASON_NO_AP_FOUND) ? WL_NO_SSID_AVAIL : WL_CONNECT_FAILED;
   }
-#endif
+  
+  log_e("Connection timed out");
+  
+  return WiFi.status();
 }
 
 //////////////////////////////////////////
 
-// New from v1.1.1
-int ESPAsync_WiFiManager::reconnectWifi()
+#if AUTOCONNECT_FAST_RECONNECT
+
+uint32_t ESPAsync_WiFiManager::reconnectCacheChecksum(const WiFi_ReconnectCache& cache)
 {
-  int connectResult;
-  
-  // using user-provided  _ssid, _pass in place of system-stored ssid and pass
-  if ( ( connectResult = connectWifi(_ssid, _pass) ) != WL_CONNECTED)
-  {  
-    log_e("Failed to connect to \"%s\"", _ssid);
-    
-    if ( ( connectResult = connectWifi(_ssid1, _pass1) ) != WL_CONNECTED)
-    {  
-      log_e("Failed to connect to \"%s\"", _ssid1);
+  return WiFi_SSIDHash(reinterpret_cast<const char*>(&cache), offsetof(WiFi_ReconnectCache, checksum));
+}
 
-    }
-    else
-      log_e("Connected to \"%s\"", _ssid1);
+//////////////////////////////////////////
+
+// warm is set if the cache came from RTC memory : no power cycle since, the RTC clock kept counting
+bool ESPAsync_WiFiManager::loadReconnectCache(WiFi_ReconnectCache& cache, bool& warm)
+{
+  warm = (rtcReconnectCache.magic == WIFI_RECONNECT_CACHE_MAGIC) && (rtcReconnectCache.checksum == reconnectCacheChecksum(rtcReconnectCache));
+  
+  if (warm)
+  {
+    memcpy(&cache, &rtcReconnectCache, sizeof(cache));
+    return true;
   }
-  else
-      log_e("Connected to \"%s\"", _ssid);
   
-  return connectResult;
+  // Cold boot : RTC memory is gone, fall back to the NVS copy
+  Preferences prefs;
+  
+  if (!prefs.begin(WIFI_PREFS_NAMESPACE, true))
+    return false;
+  
+  bool valid = (prefs.getBytes(WIFI_RECONNECT_CACHE_KEY, &cache, sizeof(cache)) == sizeof(cache)) &&
+               (cache.magic == WIFI_RECONNECT_CACHE_MAGIC) && (cache.checksum == reconnectCacheChecksum(cache));
+  
+  prefs.end();
+  
+  if (valid)
+    memcpy(&rtcReconnectCache, &cache, sizeof(cache));
+  
+  return valid;
 }
 
 //////////////////////////////////////////
 
-int ESPAsync_WiFiManager::connectWifi(String ssid, String pass)
+// The copy in RTC memory only, no NVS access
+bool ESPAsync_WiFiManager::peekReconnectCache(WiFi_ReconnectCache& cache)
 {
-  // Add option if didn't input/update SSID/PW => Use the previous saved Credentials.
-  // But update the Static/DHCP options if changed.
-  if ( (ssid != "") || ( (ssid == "") && (WiFi_SSID() != "") ) )
-  {  
-    //fix for auto connect racing issue. Move up from v1.1.0 to avoid resetSettings()
-    if (WiFi.status() == WL_CONNECTED)
-    {
-      log_w("Already connected. Bailing out.");
-      return WL_CONNECTED;
-    }
-     
-    if (ssid != "")
-      resetSettings();
+  if ( (rtcReconnectCache.magic != WIFI_RECONNECT_CACHE_MAGIC) || (rtcReconnectCache.checksum != reconnectCacheChecksum(rtcReconnectCache)) )
+    return false;
+    
+  memcpy(&cache, &rtcReconnectCache, sizeof(cache));
+  
+  return true;
+}
 
-    WiFi.mode(WIFI_AP_STA); //It will start in station mode if it was previously in AP mode.
+//////////////////////////////////////////
 
-    setHostname();
+// Outside tick() : a cold boot's NVS copy into RTC memory, where planConnect() looks for it
+void ESPAsync_WiFiManager::preloadReconnectCache()
+{
+  WiFi_ReconnectCache cache;
+  bool                warm;
+  
+  loadReconnectCache(cache, warm);
+}
+
+//////////////////////////////////////////
+
+// A cached lease is only reused within WIFI_FAST_RECONNECT_LEASE_TTL of when DHCP handed it out. After a power
+// cycle that is only known if time() was synced both then and now
+bool ESPAsync_WiFiManager::isLeaseFresh(const WiFi_ReconnectCache& cache, bool warm)
+{
+  uint32_t now = time(NULL);
+  
+  if (!cache.hasLease)
+    return false;
     
-    setWifiStaticIP();
+  if ( !warm && ( (now < WIFI_TIME_VALID_EPOCH) || (cache.leaseTime < WIFI_TIME_VALID_EPOCH) ) )
+    return false;
+  
+  return (now >= cache.leaseTime) && (now - cache.leaseTime < WIFI_FAST_RECONNECT_LEASE_TTL);
+}
 
-    if (ssid != "")
-    {
-      // Start Wifi with new values.
-      log_w("Connect to new WiFi using new IP parameters");
-      
-      WiFi.begin(ssid.c_str(), pass.c_str());
-    }
-    else
-    {
-      // Start Wifi with old values.
-      log_w("Connect to previous WiFi using new IP parameters");
-      
-      WiFi.begin();
-    }
+//////////////////////////////////////////
+
+void ESPAsync_WiFiManager::saveReconnectCache()
+{
+  String ssid = WiFi.SSID();
+  
+  WiFi_ReconnectCache cache;
+  
+  memset(&cache, 0, sizeof(cache));
+  
+  uint8_t* bssid = WiFi.BSSID();
+  
+  if ( (bssid == NULL) || (ssid == "") )
+    return;
+  
+  cache.magic     = WIFI_RECONNECT_CACHE_MAGIC;
+  cache.SSIDHash  = WiFi_SSIDHash(ssid.c_str(), ssid.length());
+  cache.channel   = WiFi.channel();
+  memcpy(cache.BSSID, bssid, sizeof(cache.BSSID));
+  
+  // Only a DHCP lease is worth caching, a static IP is applied anyway
+  if (_leaseFromCache)
+  {
+    // Still the address restored from the cache, not a lease DHCP renewed : keep it as it was, time included,
+    // or it would never expire
+    cache.hasLease  = rtcReconnectCache.hasLease;
+    cache.ip        = rtcReconnectCache.ip;
+    cache.gw        = rtcReconnectCache.gw;
+    cache.sn        = rtcReconnectCache.sn;
+    cache.dns1      = rtcReconnectCache.dns1;
+    cache.dns2      = rtcReconnectCache.dns2;
+    cache.leaseTime = rtcReconnectCache.leaseTime;
   }
-  else if (WiFi_SSID() == "")
+  else if (!_WiFi_STA_IPconfig._sta_static_ip)
   {
-    log_w("No saved credentials");
+    cache.hasLease  = true;
+    cache.ip        = WiFi.localIP();
+    cache.gw        = WiFi.gatewayIP();
+    cache.sn        = WiFi.subnetMask();
+    cache.dns1      = WiFi.dnsIP(0);
+    cache.dns2      = WiFi.dnsIP(1);
+    cache.leaseTime = time(NULL);
+    
+    // Same lease again : keep its time until it is half way to the TTL, so every reconnect isn't a flash write
+    if ( rtcReconnectCache.hasLease && (rtcReconnectCache.magic == WIFI_RECONNECT_CACHE_MAGIC) &&
+         (rtcReconnectCache.ip == cache.ip) && (rtcReconnectCache.gw == cache.gw) && (rtcReconnectCache.sn == cache.sn) &&
+         (rtcReconnectCache.dns1 == cache.dns1) && (rtcReconnectCache.dns2 == cache.dns2) &&
+         (cache.leaseTime >= rtcReconnectCache.leaseTime) && (cache.leaseTime - rtcReconnectCache.leaseTime < WIFI_FAST_RECONNECT_LEASE_TTL / 2) )
+    {
+      cache.leaseTime = rtcReconnectCache.leaseTime;
+    }
   }
-
-  int connRes = waitForConnectResult();
-  log_w("Connection result: %s", getStatus(connRes));
-
-  //not connected, WPS enabled, no pass - first attempt
-  if (_tryWPS && connRes != WL_CONNECTED && pass == "")
+  
+  cache.checksum = reconnectCacheChecksum(cache);
+  
+  if (memcmp(&cache, &rtcReconnectCache, sizeof(cache)) == 0)
+    return;
+    
+  memcpy(&rtcReconnectCache, &cache, sizeof(cache));
+  
+  // Flash only written when the AP or lease actually changed
+  Preferences prefs;
+  
+  if (prefs.begin(WIFI_PREFS_NAMESPACE, false))
   {
-    startWPS();
-    //should be connected at the end of WPS
-    connRes = waitForConnectResult();
+    WiFi_ReconnectCache stored;
+    
+    if ( (prefs.getBytes(WIFI_RECONNECT_CACHE_KEY, &stored, sizeof(stored)) != sizeof(stored)) || 
+         (memcmp(&stored, &cache, sizeof(cache)) != 0) )
+    {
+      log_i("Saving fast reconnect cache, channel %i", cache.channel);
+      prefs.putBytes(WIFI_RECONNECT_CACHE_KEY, &cache, sizeof(cache));
+    }
+    
+    prefs.end();
   }
-
-  return connRes;
 }
 
 //////////////////////////////////////////
 
-wl_status_t ESPAsync_WiFiManager::waitForConnectResult()
+bool ESPAsync_WiFiManager::fastReconnect()
 {
-  if (_connectTimeout == 0)
+  const char* ssid = storedSSID();
+  
+  WiFi_ReconnectCache cache;
+  bool                warm;
+  
+  if ( (ssid[0] == 0) || !loadReconnectCache(cache, warm) || (cache.SSIDHash != WiFi_SSIDHash(ssid, strlen(ssid))) )
   {
-    unsigned long startedAt = millis();
-    
-    // In ESP8266, WiFi.waitForConnectResult() @return wl_status_t (0-255) or -1 on timeout !!!
-    // In ESP32, WiFi.waitForConnectResult() @return wl_status_t (0-255)
-    // So, using int for connRes to be safe
-    //int connRes = WiFi.waitForConnectResult();
-    WiFi.waitForConnectResult();
-    
-    float waited = (millis() - startedAt);
-
-    log_w("Connected after waiting (s): %f", waited / 1000);
-    log_w("Local ip = %s", WiFi.localIP().toString().c_str());
+    log_d("No fast reconnect cache");
+    return false;
+  }
+  
+  log_i("Fast reconnect to %s, channel %i", ssid, cache.channel);
+  
+  const char* pass = storedPass();
 
-    // Fix bug from v1.1.0+, connRes is sometimes not correct.
-    //return connRes;
-    return WiFi.status();
+  WiFi.mode(WIFI_STA);
+  
+  setHostname();
+  
+  // Skip DHCP with the cached lease while it is fresh, unless a static IP is configured
+  bool cachedLease = !_WiFi_STA_IPconfig._sta_static_ip && isLeaseFresh(cache, warm);
+  
+  if (_WiFi_STA_IPconfig._sta_static_ip)
+  {
+    setWifiStaticIP();
   }
-  else
+  else if (cachedLease)
   {
-    log_e("Waiting WiFi connection with time out");
-    unsigned long start = millis();
-    bool keepConnecting = true;
+    _leaseFromCache = true;
+    WiFi.config(IPAddress(cache.ip), IPAddress(cache.gw), IPAddress(cache.sn), IPAddress(cache.dns1), IPAddress(cache.dns2));
+  }
+  
+  // Pinned BSSID only kept in RAM, the stored config stays unpinned for the normal path
+  esp_wifi_set_storage(WIFI_STORAGE_RAM);
+  prepareConnectWait(ssid);
+  WiFi.begin(ssid, pass, cache.channel, cache.BSSID);
+  esp_wifi_set_storage(WIFI_STORAGE_FLASH);
+  
+  if (waitForConnectEvent(WIFI_FAST_RECONNECT_TIMEOUT) == WL_CONNECTED)
+  {
+    unpinDriverConfig();
     
-    wl_status_t status;
-
-    while (keepConnecting)
+    if (cachedLease)
     {
-      status = WiFi.status();
-      if (millis() > start + _connectTimeout)
-      {
-        keepConnecting = false;
-        log_e("Connection timed out");
-      }
-
-      if (status == WL_CONNECTED || status == WL_CONNECT_FAILED)    
-      {
-        keepConnecting = false;
-      }
-      delay(100);
+      // The lease went in as a static address, which stops the DHCP client : restart it so the lease gets renewed.
+      // lwIP keeps the address meanwhile, unlike WiFi.config(INADDR_NONE, ...) which clears it first
+      _leaseRenewing = true;
+      
+      if (esp_netif_dhcpc_start(esp_netif_get_handle_from_ifkey("WIFI_STA_DEF")) != ESP_OK)
+        log_w("DHCP client restart failed");
     }
     
-    return status;
+    return true;
+  }
+    
+  log_w("Fast reconnect failed, falling back");
+  
+  // Drop the pinned BSSID and cached lease, next attempt goes through scan and DHCP. The NVS copy too, or every
+  // cold boot would load it again and wait for the same AP first. Written back once connected
+  rtcReconnectCache.magic = 0;
+  _leaseFromCache         = false;
+  
+  Preferences prefs;
+  
+  if (prefs.begin(WIFI_PREFS_NAMESPACE, false))
+  {
+    if (prefs.isKey(WIFI_RECONNECT_CACHE_KEY))
+      prefs.remove(WIFI_RECONNECT_CACHE_KEY);
+      
+    prefs.end();
   }
+  
+  WiFi.disconnect(false);
+  WiFi.config(INADDR_NONE, INADDR_NONE, INADDR_NONE);
+  
+  esp_wifi_set_storage(WIFI_STORAGE_RAM);
+  WiFi.begin(ssid, pass, 0, NULL, false);
+  esp_wifi_set_storage(WIFI_STORAGE_FLASH);
+  
+  return false;
+}
+
+//////////////////////////////////////////
+
+// The pinned BSSID / channel of a fast reconnect would stick to the RAM config, and the driver's own
+// reconnects would only ever look for that one AP. RAM only, the stored config was never pinned
+void ESPAsync_WiFiManager::unpinDriverConfig()
+{
+  wifi_config_t conf;
+  
+  if (esp_wifi_get_config(WIFI_IF_STA, &conf) != ESP_OK)
+    return;
+    
+  conf.sta.bssid_set  = false;
+  conf.sta.channel    = 0;
+  memset(conf.sta.bssid, 0, sizeof(conf.sta.bssid));
+  
+  esp_wifi_set_storage(WIFI_STORAGE_RAM);
+  esp_wifi_set_config(WIFI_IF_STA, &conf);
+  esp_wifi_set_storage(WIFI_STORAGE_FLASH);
 }
 
+#endif
+
 //////////////////////////////////////////
 
 void ESPAsync_WiFiManager::startWPS()
@@ -877,6 +3343,8 @@ void ESPAsync_WiFiManager::startWPS()
   // TODO
   log_i("ESP32 WPS TODO");
 #endif
+
+  invalidateStoredConfig();
 }
 
 //////////////////////////////////////////
@@ -918,16 +3386,40 @@ String ESPAsync_WiFiManager::getConfigPortalPW()
 
 //////////////////////////////////////////
 
-void ESPAsync_WiFiManager::resetSettings()
+void ESPAsync_WiFiManager::resetSettings()
+{
+  log_i("Stored credentials erased");
+  
+  _credentials.clear();
+  _credentials.save();
+  
+  Preferences prefs;
+  
+  if (prefs.begin(WIFI_PREFS_NAMESPACE, false))
+  {
+    prefs.remove(WIFI_STA_IPCONFIG_KEY);
+    prefs.end();
+  }
+  
+  eraseDriverConfig();
+}
+
+//////////////////////////////////////////
+
+void ESPAsync_WiFiManager::eraseDriverConfig()
 {
   log_i("Previous settings invalidated");
   
+  invalidateInfo();
+  
   WiFi.disconnect(true, true);
   
   // Temporary fix for issue of not clearing WiFi SSID/PW from flash of ESP32
   // See https://github.com/khoih-prog/ESPAsync_WiFiManager/issues/25 and https://github.com/espressif/arduino-esp32/issues/400
   WiFi.begin("0","0");
   //////
+  
+  invalidateStoredConfig();
 
   delay(200);
   return;
@@ -935,6 +3427,34 @@ void ESPAsync_WiFiManager::resetSettings()
 
 //////////////////////////////////////////
 
+int ESPAsync_WiFiManager::addCredential(const char* ssid, const char* pass)
+{
+  int index = _credentials.add(ssid, pass);
+  
+  if (index >= 0)
+  {
+    _credentials.save();
+    invalidateInfo();
+  }
+  
+  return index;
+}
+
+//////////////////////////////////////////
+
+bool ESPAsync_WiFiManager::removeCredential(uint16_t index)
+{
+  if (!_credentials.remove(index))
+    return false;
+    
+  _credentials.save();
+  invalidateInfo();
+  
+  return true;
+}
+
+//////////////////////////////////////////
+
 void ESPAsync_WiFiManager::setTimeout(unsigned long seconds)
 {
   setConfigPortalTimeout(seconds);
@@ -954,6 +3474,30 @@ void ESPAsync_WiFiManager::setConnectTimeout(unsigned long seconds)
   _connectTimeout = seconds * 1000;
 }
 
+//////////////////////////////////////////
+
+void ESPAsync_WiFiManager::setConnectPlanTimeout(unsigned long seconds)
+{
+  _connectPlanTimeout = seconds * 1000;
+}
+
+//////////////////////////////////////////
+
+void ESPAsync_WiFiManager::setReconnectBackoff(unsigned long minSeconds, unsigned long maxSeconds)
+{
+  _reconnectBackoffMin = minSeconds * 1000;
+  _reconnectBackoffMax = std::max(minSeconds, maxSeconds) * 1000;
+}
+
+//////////////////////////////////////////
+
+void ESPAsync_WiFiManager::setRoaming(int8_t thresholdRSSI, unsigned long hysteresisSeconds)
+{
+  _roamThreshold  = thresholdRSSI;
+  _roamHysteresis = hysteresisSeconds * 1000;
+  _roamWeak       = false;
+}
+
 void ESPAsync_WiFiManager::setDebugOutput(bool debug)
 {
   _debug = debug;
@@ -1012,6 +3556,8 @@ void ESPAsync_WiFiManager::setSTAStaticIPConfig(IPAddress ip, IPAddress gw, IPAd
   _WiFi_STA_IPconfig._sta_static_ip = ip;
   _WiFi_STA_IPconfig._sta_static_gw = gw;
   _WiFi_STA_IPconfig._sta_static_sn = sn;
+  
+  invalidateInfo();
 }
 
 //////////////////////////////////////////
@@ -1021,6 +3567,8 @@ void ESPAsync_WiFiManager::setSTAStaticIPConfig(WiFi_STA_IPConfig WM_STA_IPconfi
   log_i("setSTAStaticIPConfig");
   
   memcpy((void *) &_WiFi_STA_IPconfig, &WM_STA_IPconfig, sizeof(_WiFi_STA_IPconfig));
+  
+  invalidateInfo();
 }
 
 //////////////////////////////////////////
@@ -1044,6 +3592,8 @@ void ESPAsync_WiFiManager::setSTAStaticIPConfig(IPAddress ip, IPAddress gw, IPAd
   _WiFi_STA_IPconfig._sta_static_sn = sn;
   _WiFi_STA_IPconfig._sta_static_dns1 = dns_address_1; //***** Added argument *****
   _WiFi_STA_IPconfig._sta_static_dns2 = dns_address_2; //***** Added argument *****
+  
+  invalidateInfo();
 }
 #endif
 
@@ -1052,6 +3602,10 @@ void ESPAsync_WiFiManager::setSTAStaticIPConfig(IPAddress ip, IPAddress gw, IPAd
 void ESPAsync_WiFiManager::setMinimumSignalQuality(int quality)
 {
   _minimumQuality = quality;
+  _scanGeneration++;
+  
+  // New ETag for /scan
+  publishScanResults();
 }
 
 //////////////////////////////////////////
@@ -1065,10 +3619,14 @@ void ESPAsync_WiFiManager::setBreakAfterConfig(bool shouldBreak)
 
 void ESPAsync_WiFiManager::reportStatus(String &page)
 {
-  if (WiFi_SSID() != "")
+  WiFi_StoredConfig stored;
+  
+  sharedStoredConfig(stored);
+  
+  if (stored.SSID[0] != 0)
   {
     page += "Configured to connect to AP ";
-    page += WiFi_SSID();
+    page += stored.SSID;
 
     if (WiFi.status() == WL_CONNECTED)
     {
@@ -1089,13 +3647,156 @@ void ESPAsync_WiFiManager::reportStatus(String &page)
 
 //////////////////////////////////////////
 
+// Producer side, HTTP handlers only. The portal task, if any, is woken to apply it
+bool ESPAsync_WiFiManager::postCommand(const WiFi_Command& command)
+{
+  if (!_commands.push(command))
+  {
+    log_w("Command queue full, command %i dropped", command.type);
+    
+    return false;
+  }
+  
+  wakeConfigPortal();
+  
+  return true;
+}
+
+//////////////////////////////////////////
+
+bool ESPAsync_WiFiManager::postCommand(uint8_t type)
+{
+  WiFi_Command command;
+  
+  memset(&command, 0, sizeof(command));
+  command.type = type;
+  
+  return postCommand(command);
+}
+
+//////////////////////////////////////////
+
+// Portal page opened : one WM_CMD_HOLD until the loop arms a portal timeout again, see configPortalExpired()
+void ESPAsync_WiFiManager::holdConfigPortal()
+{
+  if (!_portalHeld.exchange(true) && !postCommand(WM_CMD_HOLD))
+    _portalHeld = false;
+}
+
+//////////////////////////////////////////
+
+// Consumer side, run by every control loop : modal / task portal, criticalLoop() and tick()
+void ESPAsync_WiFiManager::processCommands()
+{
+  WiFi_Command command;
+  
+  // Refill the driver config copy after a change, here rather than in the handlers that read it
+  loadStoredConfig();
+  
+  while (_commands.pop(command))
+  {
+    log_d("Command %i", command.type);
+    
+    switch (command.type)
+    {
+      case WM_CMD_SAVE:
+        applySaveCommand(command);
+        break;
+        
+      case WM_CMD_CLOSE:
+        stopConfigPortal = true; //signal ready to shutdown config portal
+        
+        // Restore when Press Save WiFi
+        _configPortalTimeout = DEFAULT_PORTAL_TIMEOUT;
+        break;
+        
+      case WM_CMD_RESCAN:
+        // Single flight : however many /scan?refresh=1 came in, they share one scan
+        if (!_scanInFlight)
+          _scanRequested = true;
+        break;
+        
+      case WM_CMD_RESET:
+        _timers.schedule(WM_TIMER_RESTART, WiFiTimerWheel::now() + WIFI_RESET_RESTART_DELAY);
+        break;
+        
+      case WM_CMD_HOLD:
+        _configPortalTimeout = 0;
+        break;
+    }
+  }
+  
+  memset(&command, 0, sizeof(command));
+  
+  // What the handlers serve, after the commands so a save shows up in this pass
+  setInfo();
+  publishStats();
+  
+  if (_timers.expired(WM_TIMER_RESTART))
+  {
+    // Temporary fix for issue of not clearing WiFi SSID/PW from flash of ESP32
+    // See https://github.com/khoih-prog/ESP_WiFiManager/issues/25 and https://github.com/espressif/arduino-esp32/issues/400
+    resetSettings();
+    //WiFi.disconnect(true); // Wipe out WiFi credentials.
+    //////
+
+    ESP.restart();
+  }
+}
+
+//////////////////////////////////////////
+
+void ESPAsync_WiFiManager::applySaveCommand(const WiFi_Command& command)
+{
+  WiFi_STA_IPConfigRecord previous, current;
+  
+  WiFi_STA_IPConfigToRecord(_WiFi_STA_IPconfig, previous);
+  
+  // Most recently saved goes first, so SSID ends at index 0 and SSID1 at index 1
+  if (command.SSID1[0] != 0)
+    _credentials.add(command.SSID1, command.password1);
+    
+  _credentials.add(command.SSID, command.password);
+  
+  if (command.IPFields & WM_CMD_IP)
+    _WiFi_STA_IPconfig._sta_static_ip   = IPAddress(command.ip);
+    
+  if (command.IPFields & WM_CMD_GW)
+    _WiFi_STA_IPconfig._sta_static_gw   = IPAddress(command.gw);
+    
+  if (command.IPFields & WM_CMD_SN)
+    _WiFi_STA_IPconfig._sta_static_sn   = IPAddress(command.sn);
+    
+  if (command.IPFields & WM_CMD_DNS1)
+    _WiFi_STA_IPconfig._sta_static_dns1 = IPAddress(command.dns1);
+    
+  if (command.IPFields & WM_CMD_DNS2)
+    _WiFi_STA_IPconfig._sta_static_dns2 = IPAddress(command.dns2);
+
+  WiFi_STA_IPConfigToRecord(_WiFi_STA_IPconfig, current);
+  
+  bool ipChanged = (memcmp(&previous, &current, sizeof(current)) != 0);
+  
+  // Lets the loop skip the NVS writes and the reconnect for an identical re-submit
+  _staIPConfigChanged    |= ipChanged;
+  _savedConfigUnchanged   = !ipChanged && !_credentials.changed();
+  
+  connect = true; //signal ready to connect/reset
+  invalidateInfo();
+
+  // Restore when Press Save WiFi
+  _configPortalTimeout = DEFAULT_PORTAL_TIMEOUT;
+}
+
+//////////////////////////////////////////
+
 // Handle root or redirect to captive portal
 void ESPAsync_WiFiManager::handleRoot(AsyncWebServerRequest *request)
 {
   log_d("Handle root");
 
   // Disable _configPortalTimeout when someone accessing Portal to give some time to config
-  _configPortalTimeout = 0;
+  holdConfigPortal();
   
   //wifiSSIDscan  = true;
   //scan();
@@ -1106,21 +3807,25 @@ void ESPAsync_WiFiManager::handleRoot(AsyncWebServerRequest *request)
     return;
   }
   
+  WiFi_StoredConfig stored;
+  
+  sharedStoredConfig(stored);
+  
   String page = "";
   page += _apName;
 
-  if (WiFi_SSID() != "")
+  if (stored.SSID[0] != 0)
   {
     if (WiFi.status() == WL_CONNECTED)
     {
       page += " on ";
-      page += WiFi_SSID();
+      page += stored.SSID;
       page += " ";
     }
     else
     {
       page += " on ";
-      page += WiFi_SSID();
+      page += stored.SSID;
       page += " ";
     }
   }
@@ -1150,14 +3855,14 @@ void ESPAsync_WiFiManager::handleWifi(AsyncWebServerRequest *request)
   log_d("Handle WiFi");
 
   // Disable _configPortalTimeout when someone accessing Portal to give some time to config
-  _configPortalTimeout = 0;
+  holdConfigPortal();
    
   String page = "";
 
-  wifiSSIDscan = false;
-  log_d("handleWifi: Scan done");
+  // Last published scan, the loop may merge a new one meanwhile
+  const WiFi_ScanSnapshot* snapshot = _scanSnapshots.acquire();
 
-  if (wifiSSIDCount == 0) 
+  if (snapshot->count == 0) 
   {
     log_d("handleWifi: No network found");
     page += "No network found. Refresh to scan again.";
@@ -1165,45 +3870,15 @@ void ESPAsync_WiFiManager::handleWifi(AsyncWebServerRequest *request)
   else 
   {
     //display networks in page
-    String pager = networkListAsString();
+    String pager = networkListAsString(snapshot);
     
     page += pager;
   }
   
-  wifiSSIDscan = true;
-  
-  log_d("Static IP = %s", _WiFi_STA_IPconfig._sta_static_ip.toString());
-  
-  // KH, Comment out to permit changing from DHCP to static IP, or vice versa
-  // and add staticIP label in CP
+  _scanSnapshots.release(snapshot);
   
-  // To permit disable/enable StaticIP configuration in Config Portal from sketch. Valid only if DHCP is used.
-  // You'll loose the feature of dynamically changing from DHCP to static IP, or vice versa
-  // You have to explicitly specify false to disable the feature.
-
-#if !USE_STATIC_IP_CONFIG_IN_CP
-  if (_WiFi_STA_IPconfig._sta_static_ip)
-#endif  
-  {
-    page += "Static IP: ";
-    page += _WiFi_STA_IPconfig._sta_static_ip.toString();
-
-    page += "Gateway IP";
-    page += _WiFi_STA_IPconfig._sta_static_gw.toString();
-
-    page += "Subnet";
-    page += _WiFi_STA_IPconfig._sta_static_sn.toString();
-
-  #if USE_CONFIGURABLE_DNS
-    //***** Added for DNS address options *****
-    page += "DNS1 IP";
-    page += _WiFi_STA_IPconfig._sta_static_dns1.toString();
-
-    page += "DNS2 IP";
-    page += _WiFi_STA_IPconfig._sta_static_dns2.toString();
-    //***** End added for DNS address options *****
-  #endif
-  }
+  // Static IP fields as the loop last published them, _WiFi_STA_IPconfig is the loop's
+  page += sharedPage(_staticIPPage);
  
   AsyncWebServerResponse *response = request->beginResponse(200, "text/plain", page);
   
@@ -1234,68 +3909,104 @@ void ESPAsync_WiFiManager::handleWifiSave(AsyncWebServerRequest *request)
     return;
   }
   
-  _ssid = request->header("SSID").c_str();  
-  _pass = request->header("Pwd").c_str();
+  String ssid = request->header("SSID");
+  String pass = request->header("Pwd");
 
   // New from v1.1.0
-  _ssid1 = request->header("SSID1").c_str();
-  _pass1 = request->header("Pwd1").c_str();
+  String ssid1 = request->header("SSID1");
+  String pass1 = request->header("Pwd1");
+  
+  // Parsed here, applied by the control loop : this runs on the AsyncTCP task
+  WiFi_Command command;
+  
+  memset(&command, 0, sizeof(command));
+  
+  command.type = WM_CMD_SAVE;
+  
+  strncpy(command.SSID,       ssid.c_str(),   WIFI_SSID_MAXLEN);
+  strncpy(command.password,   pass.c_str(),   WIFI_PASS_MAXLEN);
+  strncpy(command.SSID1,      ssid1.c_str(),  WIFI_SSID_MAXLEN);
+  strncpy(command.password1,  pass1.c_str(),  WIFI_PASS_MAXLEN);
+  
+  IPAddress address;
 
-  if (request->hasArg("ip"))
+  if (request->hasArg("ip") && optionalIPFromString(&address, request->arg("ip").c_str()))
   {
-    String ip = request->arg("ip");
-    optionalIPFromString(&_WiFi_STA_IPconfig._sta_static_ip, ip.c_str());
+    command.ip        = (uint32_t) address;
+    command.IPFields |= WM_CMD_IP;
     
-    log_d("New Static IP = %s", _WiFi_STA_IPconfig._sta_static_ip.toString());
+    log_d("New Static IP = %s", address.toString().c_str());
   }
 
-  if (request->hasArg("gw"))
+  if (request->hasArg("gw") && optionalIPFromString(&address, request->arg("gw").c_str()))
   {
-    String gw = request->arg("gw");
-    optionalIPFromString(&_WiFi_STA_IPconfig._sta_static_gw, gw.c_str());
+    command.gw        = (uint32_t) address;
+    command.IPFields |= WM_CMD_GW;
     
-    log_d("New Static Gateway = %s", _WiFi_STA_IPconfig._sta_static_gw.toString());
+    log_d("New Static Gateway = %s", address.toString().c_str());
   }
 
-  if (request->hasArg("sn"))
+  if (request->hasArg("sn") && optionalIPFromString(&address, request->arg("sn").c_str()))
   {
-    String sn = request->arg("sn");
-    optionalIPFromString(&_WiFi_STA_IPconfig._sta_static_sn, sn.c_str());
+    command.sn        = (uint32_t) address;
+    command.IPFields |= WM_CMD_SN;
     
-    log_d("New Static Netmask = %s", _WiFi_STA_IPconfig._sta_static_sn.toString());
+    log_d("New Static Netmask = %s", address.toString().c_str());
   }
 
 #if USE_CONFIGURABLE_DNS
   //*****  Added for DNS Options *****
-  if (request->hasArg("dns1"))
+  if (request->hasArg("dns1") && optionalIPFromString(&address, request->arg("dns1").c_str()))
   {
-    String dns1 = request->arg("dns1");
-    optionalIPFromString(&_WiFi_STA_IPconfig._sta_static_dns1, dns1.c_str());
+    command.dns1      = (uint32_t) address;
+    command.IPFields |= WM_CMD_DNS1;
     
-    log_d("New Static DNS1 = %s", _WiFi_STA_IPconfig._sta_static_dns1.toString());
+    log_d("New Static DNS1 = %s", address.toString().c_str());
   }
 
-  if (request->hasArg("dns2"))
+  if (request->hasArg("dns2") && optionalIPFromString(&address, request->arg("dns2").c_str()))
   {
-    String dns2 = request->arg("dns2");
-    optionalIPFromString(&_WiFi_STA_IPconfig._sta_static_dns2, dns2.c_str());
+    command.dns2      = (uint32_t) address;
+    command.IPFields |= WM_CMD_DNS2;
     
-    log_d("New Static DNS2 = %s", _WiFi_STA_IPconfig._sta_static_dns2.toString());
+    log_d("New Static DNS2 = %s", address.toString().c_str());
   }
   //*****  End added for DNS Options *****
 #endif
 
+  bool posted = postCommand(command);
+  
+  memset(&command, 0, sizeof(command));
+  
+  if (!posted)
+  {
+    AsyncWebServerResponse *response = request->beginResponse(503, "text/plain", "Busy, try again");
+    response->addHeader("Cache-Control", "no-cache, no-store, must-revalidate");
+    
+#if USING_CORS_FEATURE
+    // New from v1.1.0, for configure CORS Header, default to WM_HTTP_CORS_ALLOW_ALL = "*"
+    response->addHeader("Access-Control-Allow-Origin", "*");
+#endif
+    
+    response->addHeader("Retry-After", "1");
+    response->addHeader("Pragma", "no-cache");
+    response->addHeader("Expires", "-1");
+    request->send(response);
+    
+    return;
+  }
+
   String page = "";
   page +=  "Credentials Saved: ";
   page += _apName;
   page += " ";
-  page += _ssid;
+  page += ssid;
   page += " ";
-  page += _pass;
+  page += pass;
   page += " ";
-  page += _ssid1;
+  page += ssid1;
   page += " ";
-  page += _pass1;
+  page += pass1;
 
   AsyncWebServerResponse *response = request->beginResponse(200, "text/plain", page);
   response->addHeader("Cache-Control", "no-cache, no-store, must-revalidate");
@@ -1310,11 +4021,6 @@ void ESPAsync_WiFiManager::handleWifiSave(AsyncWebServerRequest *request)
   request->send(response);
 
   log_d("Sent wifi save page");
-
-  connect = true; //signal ready to connect/reset
-
-  // Restore when Press Save WiFi
-  _configPortalTimeout = DEFAULT_PORTAL_TIMEOUT;
 }
 
 //////////////////////////////////////////
@@ -1324,10 +4030,14 @@ void ESPAsync_WiFiManager::handleServerClose(AsyncWebServerRequest *request)
 {
   log_d("Server Close");
    
+  WiFi_StoredConfig stored;
+  
+  sharedStoredConfig(stored);
+  
   String page = "";
   page += "Close Server";
   page += "My network is ";
-  page += WiFi_SSID();
+  page += stored.SSID;
   page += " IP address is ";
   page += WiFi.localIP().toString();
   page += "Portal closed...";
@@ -1346,77 +4056,216 @@ void ESPAsync_WiFiManager::handleServerClose(AsyncWebServerRequest *request)
   response->addHeader("Expires", "-1");
   request->send(response);
   
-  stopConfigPortal = true; //signal ready to shutdown config portal
+  //signal ready to shutdown config portal
+  postCommand(WM_CMD_CLOSE);
   
   log_d("Sent server close page");
+}
+
+//////////////////////////////////////////
+
+// Handle the info page
+void ESPAsync_WiFiManager::handleInfo(AsyncWebServerRequest *request)
+{
+  log_d("Info");
+
+  // Disable _configPortalTimeout when someone accessing Portal to give some time to config
+  holdConfigPortal();
+ 
+  // Pre-serialized by the loop, only rebuilt after a WiFi event / credential change invalidated it
+  AsyncWebServerResponse *response = request->beginResponse(200, "text/plain", sharedPage(pager));
+  response->addHeader("Cache-Control", "no-cache, no-store, must-revalidate");
+  
+#if USING_CORS_FEATURE
+  // New from v1.1.0, for configure CORS Header, default to WM_HTTP_CORS_ALLOW_ALL = "*"
+  response->addHeader("Access-Control-Allow-Origin", "*");
+#endif
+  
+  response->addHeader("Pragma", "no-cache");
+  response->addHeader("Expires", "-1");
+  request->send(response);
+
+  log_d("Info page sent");
+}
+
+//////////////////////////////////////////
+
+// Handle the state page
+void ESPAsync_WiFiManager::handleState(AsyncWebServerRequest *request)
+{
+  log_d("State-Json");
+  
+  char      etag[WIFI_ETAG_MAXLEN];
+  uint32_t  generation;
+  
+  // Pre-serialized by the loop, only rebuilt after a WiFi event / credential change invalidated it.
+  // Page and generation are copied together, so the ETag always names the payload sent
+  String page = sharedPage(_statePage, &generation);
+  
+  formatETag(etag, 'd', generation);
+  
+  if (sendNotModified(request, etag))
+    return;
+   
+  AsyncWebServerResponse *response = request->beginResponse(200, "application/json", page);
+  response->addHeader("Cache-Control", "no-cache");
+  response->addHeader("ETag", etag);
+  
+#if USING_CORS_FEATURE
+  // New from v1.1.0, for configure CORS Header, default to WM_HTTP_CORS_ALLOW_ALL = "*"
+  response->addHeader("Access-Control-Allow-Origin", "*");
+#endif
+  
+  response->addHeader("Pragma", "no-cache");
+  response->addHeader("Expires", "-1");
+  request->send(response);
+
+  log_d("Sent state page in json format");
+}
+
+//////////////////////////////////////////
+
+// Static IP part of /wifi. Loop only, published by setInfo()
+String ESPAsync_WiFiManager::staticIPAsString()
+{
+  String page = "";
+  
+  log_d("Static IP = %s", _WiFi_STA_IPconfig._sta_static_ip.toString());
+  
+  // KH, Comment out to permit changing from DHCP to static IP, or vice versa
+  // and add staticIP label in CP
+  
+  // To permit disable/enable StaticIP configuration in Config Portal from sketch. Valid only if DHCP is used.
+  // You'll loose the feature of dynamically changing from DHCP to static IP, or vice versa
+  // You have to explicitly specify false to disable the feature.
+
+#if !USE_STATIC_IP_CONFIG_IN_CP
+  if (_WiFi_STA_IPconfig._sta_static_ip)
+#endif  
+  {
+    page += "Static IP: ";
+    page += _WiFi_STA_IPconfig._sta_static_ip.toString();
+
+    page += "Gateway IP";
+    page += _WiFi_STA_IPconfig._sta_static_gw.toString();
+
+    page += "Subnet";
+    page += _WiFi_STA_IPconfig._sta_static_sn.toString();
+
+  #if USE_CONFIGURABLE_DNS
+    //***** Added for DNS address options *****
+    page += "DNS1 IP";
+    page += _WiFi_STA_IPconfig._sta_static_dns1.toString();
 
-  // Restore when Press Save WiFi
-  _configPortalTimeout = DEFAULT_PORTAL_TIMEOUT;
+    page += "DNS2 IP";
+    page += _WiFi_STA_IPconfig._sta_static_dns2.toString();
+    //***** End added for DNS address options *****
+  #endif
+  }
+  
+  return page;
 }
 
 //////////////////////////////////////////
 
-// Handle the info page
-void ESPAsync_WiFiManager::handleInfo(AsyncWebServerRequest *request)
+// Loop only : the credential store, timers and tick() state aren't the handlers' to read
+String ESPAsync_WiFiManager::statsAsString()
 {
-  log_d("Info");
-
-  // Disable _configPortalTimeout when someone accessing Portal to give some time to config
-  _configPortalTimeout = 0;
- 
-  String page = "";
-  page += "Info";
-
-  if (connect)
-    page += "connected. ";
+  WiFi_RoamStats roam = getRoamStats();
   
-  if (connect)
+  String page = F("{\"Sequence\":");
+  page += _credentials.sequence();
+  page += F(",\"Writes\":");
+  page += _credentials.writes();
+  page += F(",\"CommandsDropped\":");
+  page += _commands.dropped();
+  page += F(",\"Roaming\":{\"Roams\":");
+  page += roam.roams;
+  page += F(",\"RoamFailures\":");
+  page += roam.roamFailures;
+  page += F(",\"RoamScans\":");
+  page += roam.roamScans;
+  page += F(",\"Disconnects\":");
+  page += roam.disconnects;
+  page += F(",\"DisconnectedTime\":");
+  page += roam.disconnectedTime;
+  page += F("},\"Lifecycle\":{\"State\":\"");
+  page += getStateName(_state);
+  page += F("\",\"Since\":");
+  page += _stateSince;
+  page += F(",\"Deadline\":");
+  page += (getStateDeadline() != WIFI_TIMER_NEVER) ? getStateDeadline() : 0;
+  page += F(",\"Now\":");
+  page += WiFiTimerWheel::now();
+  page += F(",\"MaxTick\":");
+  page += _maxTickTime;
+  page += F("},\"Credentials\":[");
+  
+  for (uint16_t i = 0; i < _credentials.count(); i++)
   {
-    page += "Trying to connect: ";
-    page += wifiStatus;
-    page += " ";
+    const WiFi_Credential* credential = _credentials.get(i);
+    
+    if (i > 0)
+      page += ',';
+      
+    page += F("{\"SSID\":\"");
+    
+    for (const char* c = credential->SSID; *c; c++)
+    {
+      if ( (*c == '"') || (*c == '\\') )
+        page += '\\';
+        
+      if ((uint8_t) *c >= 0x20)
+        page += *c;
+    }
+    
+    page += F("\",\"Channel\":");
+    page += credential->channel;
+    page += F(",\"Attempts\":");
+    page += credential->stats.attempts;
+    page += F(",\"Successes\":");
+    page += credential->stats.successes;
+    page += F(",\"MedianTimeToIP\":");
+    page += _credentials.medianTimeToIP(i);
+    page += F(",\"LastAttempt\":");
+    page += credential->stats.lastAttempt;
+    page += F(",\"LastSuccess\":");
+    page += credential->stats.lastSuccess;
+    page += F(",\"Score\":");
+    page += historyScore(i);
+    page += '}';
   }
-
-  page +=pager;
   
-  page += "WiFi Information ";
-  reportStatus(page);
+  page += F("]}");
   
-  page += "Device Data ";  
-  page += "Chip ID ";
-  page += String((uint32_t)ESP.getEfuseMac(), HEX);		//ESP.getChipId();
-
-  page += "Flash Chip ID ";
-  // TODO
-  page += "TODO ";
-
-  page += "IDE Flash Size ";
-  page += ESP.getFlashChipSize();
-  page += " bytes ";
-  page += "Real Flash Size ";
+  return page;
+}
 
-  // TODO
-  page += "TODO";
+//////////////////////////////////////////
 
-  page += " bytes ";
-  page += "Access Point IP ";
-  page += WiFi.softAPIP().toString();
-  page += " Access Point MAC ";
-  page += WiFi.softAPmacAddress();
+// Loop only, from processCommands(). Periodic rather than on change, "Now" tells a client how old it is
+void ESPAsync_WiFiManager::publishStats()
+{
+  if (_timers.pending(WM_TIMER_STATS) && !_timers.expired(WM_TIMER_STATS))
+    return;
+    
+  _timers.schedule(WM_TIMER_STATS, WiFiTimerWheel::now() + WIFI_STATS_PUBLISH_MS);
+  
+  String page = statsAsString();
+  
+  xSemaphoreTake(_infoLock, portMAX_DELAY);
+  _statsPage = std::move(page);
+  xSemaphoreGive(_infoLock);
+}
 
-  page += " SSID ";
-  page += WiFi_SSID();
+//////////////////////////////////////////
 
-  page += " Station IP ";
-  page += WiFi.localIP().toString();
+// Connect history of the stored credentials, passwords left out
+void ESPAsync_WiFiManager::handleStats(AsyncWebServerRequest *request)
+{
+  log_d("Stats-Json");
   
-  page += " Station MAC ";
-  page += WiFi.macAddress();
-
-  page += F("<p/>More information about ESPAsync_WiFiManager at");
-  page += F("<p/><a href=\"https://github.com/khoih-prog/ESPAsync_WiFiManager\">https://github.com/khoih-prog/ESPAsync_WiFiManager</a>");
- 
-  AsyncWebServerResponse *response = request->beginResponse(200, "text/plain", page);
+  AsyncWebServerResponse *response = request->beginResponse(200, "application/json", sharedPage(_statsPage));
   response->addHeader("Cache-Control", "no-cache, no-store, must-revalidate");
   
 #if USING_CORS_FEATURE
@@ -1428,40 +4277,43 @@ void ESPAsync_WiFiManager::handleInfo(AsyncWebServerRequest *request)
   response->addHeader("Expires", "-1");
   request->send(response);
 
-  log_d("Info page sent");
+  log_d("Sent stats page in json format");
 }
 
 //////////////////////////////////////////
 
-// Handle the state page
-void ESPAsync_WiFiManager::handleState(AsyncWebServerRequest *request)
+// Link quality summary as JSON. ?raw=1 sends the samples themselves instead, as packed WiFi_LinkSample records, oldest first
+void ESPAsync_WiFiManager::handleLink(AsyncWebServerRequest *request)
 {
-  log_d("State-Json");
-   
-  String page = F("{\"Soft_AP_IP\":\"");
-  page += WiFi.softAPIP().toString();
-  page += F("\",\"Soft_AP_MAC\":\"");
-  page += WiFi.softAPmacAddress();
-  page += F("\",\"Station_IP\":\"");
-  page += WiFi.localIP().toString();
-  page += F("\",\"Station_MAC\":\"");
-  page += WiFi.macAddress();
-  page += F("\",");
-
-  if (WiFi.psk() != "")
+  log_d("Link");
+  
+  AsyncWebServerResponse *response;
+  
+  if (request->hasArg("raw") && (request->arg("raw") == "1"))
   {
-    page += F("\"Password\":true,");
+    // Copied straight from the ring under its lock, no buffer. A sample taken while sending may show up in place of the oldest
+    size_t len = _linkHistory.count() * sizeof(WiFi_LinkSample);
+    
+    response = request->beginResponse("application/octet-stream", len, [this](uint8_t *buffer, size_t maxLen, size_t index) -> size_t
+    {
+      return _linkHistory.copy(index, buffer, maxLen);
+    });
   }
   else
   {
-    page += F("\"Password\":false,");
+    char page[256];
+    
+    // One consistent set, sampleLink() may add to the ring on the loop meanwhile
+    WiFi_LinkSummary link = _linkHistory.summary();
+    
+    snprintf(page, sizeof(page), "{\"Interval\":%lu,\"Samples\":%u,\"Connected\":%u,\"Disconnects\":%u,"
+             "\"RSSI\":{\"Min\":%i,\"Max\":%i,\"Mean\":%i,\"P5\":%i,\"P95\":%i}}",
+             WIFI_LINK_SAMPLE_INTERVAL, link.samples, link.connected, _roamStats.disconnects.load(),
+             link.minRSSI, link.maxRSSI, link.meanRSSI, link.p5RSSI, link.p95RSSI);
+             
+    response = request->beginResponse(200, "application/json", page);
   }
-
-  page += F("\"SSID\":\"");
-  page += WiFi_SSID();
-  page += F("\"}");
-   
-  AsyncWebServerResponse *response = request->beginResponse(200, "application/json", page);
+  
   response->addHeader("Cache-Control", "no-cache, no-store, must-revalidate");
   
 #if USING_CORS_FEATURE
@@ -1473,7 +4325,41 @@ void ESPAsync_WiFiManager::handleState(AsyncWebServerRequest *request)
   response->addHeader("Expires", "-1");
   request->send(response);
 
-  log_d("Sent state page in json format");
+  log_d("Sent link page");
+}
+
+//////////////////////////////////////////
+
+// Serialize one AP as a JSON item, SSID escaped. Returns the length written.
+size_t ESPAsync_WiFiManager::serializeScanRecord(char* buf, size_t len, const WiFiScanRecord& record, bool first)
+{
+  size_t pos = 0;
+  
+  pos += snprintf(buf + pos, len - pos, "%s{\"SSID\":\"", first ? "" : ", ");
+  
+  for (uint8_t i = 0; (i < record.SSIDLength) && (pos + 7 < len); i++)
+  {
+    char c = record.SSID[i];
+    
+    if ( (c == '"') || (c == '\\') )
+    {
+      buf[pos++] = '\\';
+      buf[pos++] = c;
+    }
+    else if ( (uint8_t) c < 0x20 )
+    {
+      pos += snprintf(buf + pos, len - pos, "\\u%04x", (uint8_t) c);
+    }
+    else
+    {
+      buf[pos++] = c;
+    }
+  }
+  
+  pos += snprintf(buf + pos, len - pos, "\", \"Encryption\":%s, \"Quality\":\"%u\"}", 
+                  (record.encryptionType != WIFI_AUTH_OPEN) ? "true" : "false", record.quality);
+  
+  return (pos < len) ? pos : len - 1;
 }
 
 //////////////////////////////////////////
@@ -1484,58 +4370,139 @@ void ESPAsync_WiFiManager::handleScan(AsyncWebServerRequest *request)
   log_d("Scan");
 
   // Disable _configPortalTimeout when someone accessing Portal to give some time to config
-  _configPortalTimeout = 0;		//KH
+  holdConfigPortal();
 
   log_d("Scan-Json");
-
-  String page = F("{\"Access_Points\":[");
   
-  // KH, display networks in page using previously scan results
-  for (int i = 0; i < wifiSSIDCount; i++) 
+  char etag[WIFI_ETAG_MAXLEN];
+  
+  bool refresh = request->hasArg("refresh") && (request->arg("refresh") == "1");
+  
+  // The snapshot streamed, taken before the ETag so both are the same version. A refresh takes it once the scan is in
+  const WiFi_ScanSnapshot* snapshot = refresh ? NULL : _scanSnapshots.acquire();
+  
+  if (!refresh)
   {
-    if (wifiSSIDs[i].duplicate == true) 
-      continue; // skip dups
-      
-    if (i != 0)
-      page += F(", ");
-
-    log_d("Index = %i", i);
-    log_d("SSID = %s", wifiSSIDs[i].SSID);
-    log_d("RSSI = %i", wifiSSIDs[i].RSSI);
-      
-    int quality = getRSSIasQuality(wifiSSIDs[i].RSSI);
-
-    if (_minimumQuality == -1 || _minimumQuality < quality) 
+    // Scan generation bumps each time a scan is merged into the table
+    formatETag(etag, 's', snapshot->generation);
+    
+    if (sendNotModified(request, etag))
     {
-      String item = FPSTR(JSON_ITEM);
-      String rssiQ;
+      _scanSnapshots.release(snapshot);
+      return;
+    }
+  }
+  
+  // Stream the scan table record by record into the TCP send buffer. The only allocation is this
+  // fixed-size state, so heap use doesn't grow with the number of APs.
+  // The snapshot streamed is released with the state, also when the client goes away mid-body
+  std::shared_ptr<WiFiScanStreamState> state(new WiFiScanStreamState, [this](WiFiScanStreamState* stream)
+  {
+    _scanSnapshots.release(stream->snapshot);
+    delete stream;
+  });
+  
+  state->snapshot   = snapshot;
+  
+  state->phase      = SCAN_STREAM_HEADER;
+  state->index      = 0;
+  state->first      = true;
+  state->pendingLen = 0;
+  state->pendingPos = 0;
+  state->waiting    = refresh;
+  
+  if (refresh)
+  {
+    // Wait for the next scan to complete. Attach to the one in flight, or ask the loop for one :
+    // requests arriving before it starts all share the same flag, so only one driver scan happens.
+    state->waitGeneration = _scanSnapshots.generation();
+    state->waitStartedAt  = millis();
+    
+    postCommand(WM_CMD_RESCAN);
+    
+    log_d("Scan refresh requested");
+  }
+  
+  AsyncWebServerResponse *response = request->beginChunkedResponse("application/json", 
+                                      [this, state](uint8_t *buffer, size_t maxLen, size_t index) -> size_t
+  {
+    size_t written = 0;
+    
+    if (state->waiting)
+    {
+      // Hold the body until the scan completes, the server calls back on its next poll
+      if ( (_scanSnapshots.generation() == state->waitGeneration) && (millis() - state->waitStartedAt < WIFI_SCAN_REFRESH_TIMEOUT_MS) )
+        return RESPONSE_TRY_AGAIN;
+        
+      state->waiting = false;
+    }
+    
+    // One snapshot for the whole body, however many chunks it takes
+    if (state->snapshot == NULL)
+      state->snapshot = _scanSnapshots.acquire();
+    
+    const WiFi_ScanSnapshot* snapshot = state->snapshot;
+    
+    while (written < maxLen)
+    {
+      // Drain what is left of the previous item first
+      if (state->pendingPos < state->pendingLen)
+      {
+        size_t chunk = std::min(maxLen - written, (size_t) (state->pendingLen - state->pendingPos));
+        
+        memcpy(buffer + written, state->pending + state->pendingPos, chunk);
+        written           += chunk;
+        state->pendingPos += chunk;
+        
+        continue;
+      }
       
-      rssiQ += quality;
-      item.replace("{v}", wifiSSIDs[i].SSID);
-      item.replace("{r}", rssiQ);
-
-      if (wifiSSIDs[i].encryptionType != WIFI_AUTH_OPEN)
+      state->pendingPos = 0;
+      state->pendingLen = 0;
+      
+      if (state->phase == SCAN_STREAM_HEADER)
+      {
+        state->pendingLen = snprintf(state->pending, sizeof(state->pending), "{\"Access_Points\":[");
+        state->phase      = SCAN_STREAM_ITEMS;
+      }
+      else if (state->phase == SCAN_STREAM_ITEMS)
+      {
+        // KH, display networks in page using previously scan results
+        while ( (state->index < snapshot->count) && ( snapshot->records[state->index].duplicate || 
+                ( (_minimumQuality != -1) && (_minimumQuality >= snapshot->records[state->index].quality) ) ) )
+        {
+          state->index++; // skip dups and weak APs
+        }
+        
+        if (state->index >= snapshot->count)
+        {
+          state->phase = SCAN_STREAM_FOOTER;
+          continue;
+        }
+        
+        state->pendingLen = serializeScanRecord(state->pending, sizeof(state->pending), snapshot->records[state->index], state->first);
+        state->first      = false;
+        state->index++;
+      }
+      else if (state->phase == SCAN_STREAM_FOOTER)
       {
-      item.replace("{i}", "true");
+        state->pendingLen = snprintf(state->pending, sizeof(state->pending), "]}");
+        state->phase      = SCAN_STREAM_DONE;
       }
       else
       {
-        item.replace("{i}", "false");
+        break;
       }
-      
-      page += item;
-      delay(0);
-    } 
-    else 
-    {
-      log_d("Skipping due to quality");
     }
-  }
+    
+    return written;
+  });
   
-  page += F("]}");
- 
-  AsyncWebServerResponse *response = request->beginResponse(200, "application/json", page);
-  response->addHeader("Cache-Control", "no-cache, no-store, must-revalidate");
+  response->addHeader("Cache-Control", "no-cache");
+  
+  // Headers go out before the refreshed body exists, its version is unknown yet
+  if (!refresh)
+    response->addHeader("ETag", etag);
   
 #if USING_CORS_FEATURE
   // New from v1.1.0, for configure CORS Header, default to WM_HTTP_CORS_ALLOW_ALL = "*"
@@ -1551,6 +4518,38 @@ void ESPAsync_WiFiManager::handleScan(AsyncWebServerRequest *request)
 
 //////////////////////////////////////////
 
+// Boot nonce keeps ETags from one boot matching payloads of the next
+void ESPAsync_WiFiManager::formatETag(char* etag, char kind, uint32_t generation)
+{
+  snprintf(etag, WIFI_ETAG_MAXLEN, "\"%c%08x-%x\"", kind, _etagSeed, generation);
+}
+
+//////////////////////////////////////////
+
+// Conditional GET : answer 304 without building the body if the client already has this version
+bool ESPAsync_WiFiManager::sendNotModified(AsyncWebServerRequest *request, const char* etag)
+{
+  if (!request->hasHeader("If-None-Match") || (request->header("If-None-Match") != etag))
+    return false;
+    
+  log_d("Not modified : %s", etag);
+  
+  AsyncWebServerResponse *response = request->beginResponse(304);
+  response->addHeader("Cache-Control", "no-cache");
+  response->addHeader("ETag", etag);
+  
+#if USING_CORS_FEATURE
+  // New from v1.1.0, for configure CORS Header, default to WM_HTTP_CORS_ALLOW_ALL = "*"
+  response->addHeader("Access-Control-Allow-Origin", "*");
+#endif
+
+  request->send(response);
+  
+  return true;
+}
+
+//////////////////////////////////////////
+
 // Handle the reset page
 void ESPAsync_WiFiManager::handleReset(AsyncWebServerRequest *request)
 {
@@ -1573,16 +4572,9 @@ void ESPAsync_WiFiManager::handleReset(AsyncWebServerRequest *request)
   request->send(response);
   
   log_d("Sent reset page");
-  delay(5000);
   
-  // Temporary fix for issue of not clearing WiFi SSID/PW from flash of ESP32
-  // See https://github.com/khoih-prog/ESP_WiFiManager/issues/25 and https://github.com/espressif/arduino-esp32/issues/400
-  resetSettings();
-  //WiFi.disconnect(true); // Wipe out WiFi credentials.
-  //////
-
-  ESP.restart();
-  delay(2000);
+  // Erase and restart from the control loop, WIFI_RESET_RESTART_DELAY from now
+  postCommand(WM_CMD_RESET);
 }
 
 //////////////////////////////////////////
@@ -1659,6 +4651,14 @@ void ESPAsync_WiFiManager::setAPCallback(void(*func)(ESPAsync_WiFiManager* myWiF
 
 //////////////////////////////////////////
 
+// scan done callback, called from the loop once asynchronous scan results are available
+void ESPAsync_WiFiManager::setScanDoneCallback(void(*func)(ESPAsync_WiFiManager* myWiFiManager))
+{
+  _scandonecallback = func;
+}
+
+//////////////////////////////////////////
+
 // start up save config callback
 void ESPAsync_WiFiManager::setSaveConfigCallback(void(*func)())
 {
@@ -1678,6 +4678,10 @@ void ESPAsync_WiFiManager::setCustomHeadElement(const char* element) {
 void ESPAsync_WiFiManager::setRemoveDuplicateAPs(bool removeDuplicates)
 {
   _removeDuplicateAPs = removeDuplicates;
+  _scanGeneration++;
+  
+  // New ETag for /scan
+  publishScanResults();
 }
 
 //////////////////////////////////////////
@@ -1744,41 +4748,77 @@ String ESPAsync_WiFiManager::toStringIp(IPAddress ip)
 
 String ESPAsync_WiFiManager::getStoredWiFiSSID()
 {
-  if (WiFi.getMode() == WIFI_MODE_NULL)
-  {
-    return String();
-  }
+  return String(storedSSID());
+}
+
+//////////////////////////////////////////
+
+String ESPAsync_WiFiManager::getStoredWiFiPass()
+{
+  return String(storedPass());
+}
+#endif
 
-  wifi_ap_record_t info;
+//////////////////////////////////////////
 
-  if (!esp_wifi_sta_get_ap_info(&info))
+// One esp_wifi_get_config() per config change instead of one per read. Loop only : the HTTP handlers
+// read the copy published here, so they never refill it or call into the driver themselves
+void ESPAsync_WiFiManager::loadStoredConfig()
+{
+  if (_storedConfigValid)
+    return;
+  
+  memset(&_storedConfig, 0, sizeof(_storedConfig));
+  
+  wifi_config_t conf;
+    
+  // Driver not started, nothing to read yet. Not cached, so the first read after WiFi.mode() gets it
+  if ( (WiFi.getMode() != WIFI_MODE_NULL) && (esp_wifi_get_config(WIFI_IF_STA, &conf) == ESP_OK) )
   {
-    return String(reinterpret_cast<char*>(info.ssid));
+    // Driver fields aren't terminated when full
+    strncpy(_storedConfig.SSID, reinterpret_cast<char*>(conf.sta.ssid), WIFI_SSID_MAXLEN);
+    strncpy(_storedConfig.password, reinterpret_cast<char*>(conf.sta.password), WIFI_PASS_MAXLEN);
+    
+    _storedConfigValid = true;
   }
-  else
+  
+  // Only the loop writes the shared copy, reading it here needs no lock
+  if (memcmp(&_storedConfigShared, &_storedConfig, sizeof(_storedConfig)) != 0)
   {
-    wifi_config_t conf;
-    esp_wifi_get_config(WIFI_IF_STA, &conf);
-    return String(reinterpret_cast<char*>(conf.sta.ssid));
+    xSemaphoreTake(_storedConfigLock, portMAX_DELAY);
+    _storedConfigShared = _storedConfig;
+    xSemaphoreGive(_storedConfigLock);
+    
+    // /i and /state show it
+    invalidateInfo();
   }
+}
+
+//////////////////////////////////////////
 
-  return String();
+void ESPAsync_WiFiManager::sharedStoredConfig(WiFi_StoredConfig& config)
+{
+  xSemaphoreTake(_storedConfigLock, portMAX_DELAY);
+  config = _storedConfigShared;
+  xSemaphoreGive(_storedConfigLock);
 }
 
 //////////////////////////////////////////
 
-String ESPAsync_WiFiManager::getStoredWiFiPass()
+const char* ESPAsync_WiFiManager::storedSSID()
 {
-  if (WiFi.getMode() == WIFI_MODE_NULL)
-  {
-    return String();
-  }
+  loadStoredConfig();
+  
+  return _storedConfig.SSID;
+}
 
-  wifi_config_t conf;
-  esp_wifi_get_config(WIFI_IF_STA, &conf);
+//////////////////////////////////////////
+
+const char* ESPAsync_WiFiManager::storedPass()
+{
+  loadStoredConfig();
   
-  return String(reinterpret_cast<char*>(conf.sta.password));
+  return _storedConfig.password;
 }
-#endif
 
 //////////////////////////////////////////
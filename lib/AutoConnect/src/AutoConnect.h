@@ -2,6 +2,17 @@
 #include <ESPAsyncWebServer.h>
 #include <DNSServer.h>
 #include <esp_wifi.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/event_groups.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+#include <atomic>
+
+#include "WiFiCredentialStore.h"
+#include "WiFiLinkHistory.h"
+#include "WiFiTimerWheel.h"
+#include "WiFiCommandQueue.h"
+#include "WiFiScanSnapshot.h"
 #define ESP_getChipId()   ((uint32_t)ESP.getEfuseMac())
 typedef int16_t wifi_ssid_count_t;  
 
@@ -22,6 +33,261 @@ typedef struct
   IPAddress _sta_static_dns2;
 }  WiFi_STA_IPConfig;
 
+// Static IP set from the portal, persisted apart from the credentials so each is only written when it changes
+#define WIFI_STA_IPCONFIG_KEY         "staip"
+
+typedef struct
+{
+  uint32_t  ip;
+  uint32_t  gw;
+  uint32_t  sn;
+  uint32_t  dns1;
+  uint32_t  dns2;
+}  WiFi_STA_IPConfigRecord;
+
+// Remember last good BSSID / channel / DHCP lease to skip scan and DHCP on the next boot or wake
+#ifndef AUTOCONNECT_FAST_RECONNECT
+  #define AUTOCONNECT_FAST_RECONNECT    true
+#endif
+
+#ifndef WIFI_FAST_RECONNECT_TIMEOUT
+  #define WIFI_FAST_RECONNECT_TIMEOUT   3000UL
+#endif
+
+#ifndef WIFI_FAST_RECONNECT_LEASE_TTL
+  // Seconds a cached DHCP lease is reused after it was obtained. Keep it below the DHCP server's renewal time (T1)
+  #define WIFI_FAST_RECONNECT_LEASE_TTL 1800UL
+#endif
+
+// time() below this was never synced and only counts since boot, useless to age a lease stored before a power cycle
+#define WIFI_TIME_VALID_EPOCH         1577836800UL    // 2020-01-01
+
+#define WIFI_RECONNECT_CACHE_KEY      "reconnect"
+#define WIFI_RECONNECT_CACHE_MAGIC    0x57464332UL
+
+typedef struct
+{
+  uint32_t  magic;
+  uint32_t  SSIDHash;
+  uint8_t   BSSID[6];
+  uint8_t   channel;
+  bool      hasLease;
+  uint32_t  ip;
+  uint32_t  gw;
+  uint32_t  sn;
+  uint32_t  dns1;
+  uint32_t  dns2;
+  uint32_t  leaseTime;      // time() the lease was obtained
+  uint32_t  checksum;
+}  WiFi_ReconnectCache;
+
+#ifndef WIFI_CONNECT_PLAN_TIMEOUT
+  // Overall deadline for scan + all connect attempts in reconnectWifi()
+  #define WIFI_CONNECT_PLAN_TIMEOUT     30000UL
+#endif
+
+#ifndef WIFI_CONNECT_LAST_GOOD_BONUS
+  // Score bonus, in dB, of the network we were last connected to
+  #define WIFI_CONNECT_LAST_GOOD_BONUS  10
+#endif
+
+#ifndef WIFI_CONNECT_HISTORY_WEIGHT
+  // Score bonus, in dB, of a network that always connects. One without history gets half
+  #define WIFI_CONNECT_HISTORY_WEIGHT   20
+#endif
+
+#ifndef WIFI_CONNECT_HISTORY_HALFLIFE
+  // History fades back to neutral by half every that many attempts (on any network) since it was last tried
+  #define WIFI_CONNECT_HISTORY_HALFLIFE 8
+#endif
+
+#ifndef WIFI_CONNECT_TTI_PENALTY_MS
+  // 1 dB of score lost per that many ms of median time-to-IP, up to WIFI_CONNECT_TTI_PENALTY_MAX
+  #define WIFI_CONNECT_TTI_PENALTY_MS   500
+  #define WIFI_CONNECT_TTI_PENALTY_MAX  10
+#endif
+
+#ifndef WIFI_RECONNECT_BACKOFF_MIN
+  // Modeless reconnect : first delay after the link drops, doubled on every failed attempt up to the max
+  #define WIFI_RECONNECT_BACKOFF_MIN    1000UL
+#endif
+
+#ifndef WIFI_RECONNECT_BACKOFF_MAX
+  #define WIFI_RECONNECT_BACKOFF_MAX    300000UL
+#endif
+
+#ifndef WIFI_ROAM_SAMPLE_INTERVAL
+  // Roaming : RSSI sampled that often while connected
+  #define WIFI_ROAM_SAMPLE_INTERVAL     2000UL
+#endif
+
+#ifndef WIFI_ROAM_HYSTERESIS
+  // RSSI must stay below the threshold that long before a roam scan
+  #define WIFI_ROAM_HYSTERESIS          10000UL
+#endif
+
+#ifndef WIFI_ROAM_SCAN_INTERVAL
+  // At most one roam scan per interval, however long the link stays weak
+  #define WIFI_ROAM_SCAN_INTERVAL       60000UL
+#endif
+
+#ifndef WIFI_ROAM_MIN_GAIN
+  // dB a BSSID must beat the current one by to be worth the reassociation
+  #define WIFI_ROAM_MIN_GAIN            8
+#endif
+
+typedef struct
+{
+  uint32_t  roams;              // moves to a stronger BSSID of the same SSID
+  uint32_t  roamFailures;
+  uint32_t  roamScans;
+  uint32_t  disconnects;        // link drops, roams included
+  uint32_t  disconnectedTime;   // ms without IP after a drop, roams included
+}  WiFi_RoamStats;
+
+// Live counters behind WiFi_RoamStats. Disconnects are counted by the WiFi event task, read by the loop and handlers
+typedef struct
+{
+  std::atomic<uint32_t>  roams             { 0 };
+  std::atomic<uint32_t>  roamFailures      { 0 };
+  std::atomic<uint32_t>  roamScans         { 0 };
+  std::atomic<uint32_t>  disconnects       { 0 };
+  std::atomic<uint32_t>  disconnectedTime  { 0 };
+}  WiFi_RoamCounters;
+
+// Config portal task mode, see setConfigPortalTask()
+#ifndef WIFI_PORTAL_TASK_STACK
+  #define WIFI_PORTAL_TASK_STACK        8192
+#endif
+
+#ifndef WIFI_PORTAL_TASK_PRIORITY
+  #define WIFI_PORTAL_TASK_PRIORITY     1
+#endif
+
+#ifndef WIFI_PORTAL_TASK_CORE
+  #define WIFI_PORTAL_TASK_CORE         tskNO_AFFINITY
+#endif
+
+#ifndef WIFI_PORTAL_DNS_POLL_MS
+  // The synchronous DNSServer has no packet event, the task polls it that often. Not used with USE_EADNS
+  #define WIFI_PORTAL_DNS_POLL_MS       20
+#endif
+
+#ifndef WIFI_PORTAL_CONNECT_SETTLE_MS
+  // After /wifisave, so its response goes out before the radio switches. The portal keeps serving meanwhile
+  #define WIFI_PORTAL_CONNECT_SETTLE_MS 2000UL
+#endif
+
+#ifndef WIFI_STATS_PUBLISH_MS
+  // /stats is rebuilt by the loop this often, a request gets the last one
+  #define WIFI_STATS_PUBLISH_MS         1000UL
+#endif
+
+#ifndef WIFI_PORTAL_SCAN_POLL_MS
+  // Fallback while a scan runs, the scan done event normally wakes the task first
+  #define WIFI_PORTAL_SCAN_POLL_MS      500
+#endif
+
+// Portal event group bits. WAKE is internal, DONE / CONNECTED are set when the portal ends
+#define PORTAL_WAKE_BIT               BIT0
+#define PORTAL_DONE_BIT               BIT1
+#define PORTAL_CONNECTED_BIT          BIT2
+
+// Set by the destructor, the portal task ends at its next pass and sets DONE
+#define PORTAL_EXIT_BIT               BIT3
+
+// Deadlines of the manager, all on one WiFiTimerWheel
+typedef enum
+{
+  WM_TIMER_SCAN = 0,          // next periodic scan, modal / modeless / portal
+  WM_TIMER_PORTAL,            // config portal timeout
+  WM_TIMER_RECONNECT,         // modeless reconnect backoff
+  WM_TIMER_LINK_SAMPLE,
+  WM_TIMER_ROAM_SAMPLE,
+  WM_TIMER_ROAM_SCAN,         // earliest next roam scan
+  WM_TIMER_STATE,             // current tick() state gives up
+  WM_TIMER_RESTART,           // restart after /r, once the response is out
+  WM_TIMER_SAVE_CONNECT,      // /wifisave connect : settle delay, then the attempt gives up
+  WM_TIMER_STATS,             // next /stats payload rebuild
+  WM_TIMER_COUNT
+}  WiFi_TimerId;
+
+static_assert(WM_TIMER_COUNT <= WIFI_TIMERS_MAX, "WiFiTimerWheel too small");
+
+// Steps of the connect after a /wifisave
+typedef enum
+{
+  WM_SAVE_CONNECT_IDLE = 0,
+  WM_SAVE_CONNECT_SETTLE,     // WM_TIMER_SAVE_CONNECT runs the settle delay
+  WM_SAVE_CONNECT_WAIT        // WiFi.begin() issued, WM_TIMER_SAVE_CONNECT runs the attempt timeout
+}  WiFi_SaveConnect;
+
+#ifndef WIFI_RESET_RESTART_DELAY
+  // /r : settings erased and restart that long after the response was sent
+  #define WIFI_RESET_RESTART_DELAY      5000UL
+#endif
+
+// Lifecycle states of the cooperative API, see tick()
+typedef enum
+{
+  WM_STATE_IDLE = 0,          // before begin(), or nothing left to try
+  WM_STATE_SCANNING,          // async scan for the stored networks
+  WM_STATE_CONNECTING,        // one WiFi.begin() per candidate, result from the connect event bits
+  WM_STATE_PORTAL,            // config portal up, waiting for /wifisave, /close or the portal timeout
+  WM_STATE_CONNECTED,
+  WM_STATE_BACKOFF,           // link lost or all candidates failed, waiting for the next attempt
+  WM_STATE_COUNT
+}  WiFi_State;
+
+#ifndef WIFI_TICK_BUDGET_US
+  // tick() stops chaining state transitions once it ran that long
+  #define WIFI_TICK_BUDGET_US           2000UL
+#endif
+
+#ifndef WIFI_TICK_MAX_STEPS
+  // At most that many state handlers per tick()
+  #define WIFI_TICK_MAX_STEPS           4
+#endif
+
+#ifndef WIFI_PORTAL_AP_SETTLE_MS
+  // After softAP(), before its IP is valid and the portal server can start
+  #define WIFI_PORTAL_AP_SETTLE_MS      500UL
+#endif
+
+// Portal bring-up in WM_STATE_PORTAL, one blocking driver call per tick()
+typedef enum
+{
+  WM_PORTAL_DOWN = 0,
+  WM_PORTAL_MODE,             // next : WiFi.mode(WIFI_AP_STA)
+  WM_PORTAL_AP,               // next : softAP()
+  WM_PORTAL_SETTLE,           // WM_TIMER_STATE runs WIFI_PORTAL_AP_SETTLE_MS, then the server starts
+  WM_PORTAL_SERVING
+}  WiFi_PortalStep;
+
+// Flash writes tick() defers to a tick that made no other blocking call
+#define WM_WRITE_CREDENTIALS          BIT0
+#define WM_WRITE_STA_IPCONFIG         BIT1
+#define WM_WRITE_RECONNECT_CACHE      BIT2
+
+// A stored credential found in the scan, ranked by score
+typedef struct
+{
+  uint16_t  credential;
+  uint8_t   channel;
+  int8_t    RSSI;
+  int16_t   score;
+}  WiFi_ConnectCandidate;
+
+// Copy of the STA config kept by the driver
+typedef struct
+{
+  char      SSID[WIFI_SSID_MAXLEN + 1];
+  char      password[WIFI_PASS_MAXLEN + 1];
+}  WiFi_StoredConfig;
+
+// Candidate credential of the config kept by the driver, when its SSID is not among the stored credentials
+#define WIFI_DRIVER_CANDIDATE         0xFFFF
+
 typedef struct
 {
   IPAddress _ap_static_ip;
@@ -30,23 +296,52 @@ typedef struct
 
 }  WiFi_AP_IPConfig;
 
-class WiFiResult
-{
-  public:
-    bool duplicate;
-    String SSID;
-    uint8_t encryptionType;
-    int32_t RSSI;
-    uint8_t* BSSID;
-    int32_t channel;
-    bool isHidden;
-
-    WiFiResult()
-    {
-    }
-};
+#ifndef WIFI_SCAN_MAX_AGE
+  // Default to 5 min, BSSIDs not heard for that long are dropped from the scan table
+  #define WIFI_SCAN_MAX_AGE           300000UL
+#endif
 
-const char JSON_ITEM[] PROGMEM    = "{\"SSID\":\"{v}\", \"Encryption\":{i}, \"Quality\":\"{r}\"}";
+#ifndef WIFI_SCAN_RSSI_EWMA_SHIFT
+  // Weight of a new RSSI sample is 1 / (1 << WIFI_SCAN_RSSI_EWMA_SHIFT)
+  #define WIFI_SCAN_RSSI_EWMA_SHIFT   2
+#endif
+
+#ifndef WIFI_SCAN_TARGETED_DWELL_MS
+  // Active dwell per channel for targeted scans
+  #define WIFI_SCAN_TARGETED_DWELL_MS 120
+#endif
+
+#define WIFI_SCAN_MAX_CHANNELS        14
+
+
+
+// Worst case item : every SSID byte escaped as \u00XX, plus the fixed JSON around it
+#define WIFI_SCAN_JSON_ITEM_MAXLEN    ( (6 * WIFI_SSID_MAXLEN) + 64 )
+
+#define SCAN_STREAM_HEADER    0
+#define SCAN_STREAM_ITEMS     1
+#define SCAN_STREAM_FOOTER    2
+#define SCAN_STREAM_DONE      3
+
+#ifndef WIFI_SCAN_REFRESH_TIMEOUT_MS
+  // /scan?refresh=1 serves the current table if no scan completed within that time
+  #define WIFI_SCAN_REFRESH_TIMEOUT_MS  15000UL
+#endif
+
+// Cursor of a streamed /scan response, one per request
+typedef struct
+{
+  uint8_t   phase;
+  bool      first;
+  bool      waiting;
+  uint32_t  waitGeneration;
+  uint32_t  waitStartedAt;
+  const WiFi_ScanSnapshot*  snapshot;     // held from the first item to the end of the body
+  int       index;
+  uint16_t  pendingLen;
+  uint16_t  pendingPos;
+  char      pending[WIFI_SCAN_JSON_ITEM_MAXLEN];
+}  WiFiScanStreamState;
 
 #define WFM_LABEL_BEFORE 1
 #define WFM_LABEL_AFTER 2
@@ -111,13 +406,34 @@ class ESPAsync_WiFiManager
 
     ~ESPAsync_WiFiManager();
     
-    //Scan for WiFiNetworks in range and sort by signal strength
+    //Scan for WiFiNetworks in range and sort by signal strength. Non-blocking, results via isScanReady()
     void          scan();
     
+    // Asynchronous scan engine. startScan() returns immediately, pollScan() returns true once results are in
+    bool          startScan();
+    bool          startScan(const uint8_t* channels, uint8_t count);
+    bool          pollScan();
+    
+    // Blocking. Targeted scan on the channels stored credentials were last seen, full sweep if none found
+    bool          scanKnownNetworks();
+    
+    bool          isScanRunning()
+    {
+      return _scanInFlight;
+    }
+    
+    bool          isScanReady()
+    {
+      return _scanReady;
+    }
+    
     String        scanModal();
     void          loop();
     void          safeLoop();
     void          criticalLoop();
+    
+    // Roaming monitor, also run by criticalLoop(). Call from loop() when not using the manager loops
+    void          roamLoop();
     String        infoAsString();
 
     // Can use with STA staticIP now
@@ -125,10 +441,68 @@ class ESPAsync_WiFiManager
     bool          autoConnect(char const *apName, char const *apPassword = NULL);
     //////
 
+    // Cooperative lifecycle, instead of autoConnect() and loop() : begin() once, then tick() from loop().
+    // tick() never waits on the driver, it runs at most WIFI_TICK_MAX_STEPS state handlers within
+    // WIFI_TICK_BUDGET_US and returns the current state. Of the calls that do take time (mode switch, softAP,
+    // a WiFi.begin() writing the driver config, NVS writes) it makes at most one : a transition found after
+    // one is entered on the next tick(), and NVS writes wait for a tick() with nothing else to do
+    void          begin(char const *apName, char const *apPassword = NULL);
+    WiFi_State    tick();
+    
+    WiFi_State    getState()
+    {
+      return _state;
+    }
+    
+    const char*   getStateName(WiFi_State state);
+    
+    // Times below are ms on the WiFiTimerWheel::now() clock, 64-bit so they never wrap
+    uint64_t      getStateSince()
+    {
+      return _stateSince;
+    }
+    
+    // When the current state gives up (connect plan, portal timeout, backoff), WIFI_TIMER_NEVER if it doesn't
+    uint64_t      getStateDeadline()
+    {
+      return _timers.deadline( (_state == WM_STATE_PORTAL) ? WM_TIMER_PORTAL : WM_TIMER_STATE);
+    }
+    
+    // Earliest pending deadline of any periodic work, the loop may sleep until then
+    uint64_t      getNextDeadline()
+    {
+      return _timers.nextDeadline();
+    }
+    
+    // Longest tick() so far, in us
+    uint32_t      getMaxTickTime()
+    {
+      return _maxTickTime;
+    }
+
     // If you want to start the config portal
     bool          startConfigPortal();
     bool          startConfigPortal(char const *apName, char const *apPassword = NULL);
     void startConfigPortalModeless(char const *apName, char const *apPassword, bool shouldConnectWiFi = true);
+    
+    // Task mode : startConfigPortal() runs the portal in its own task and returns false at once.
+    // The task sleeps until an HTTP command, a scan result or a deadline. Don't run the manager loops meanwhile
+    void          setConfigPortalTask(bool enable, int core = WIFI_PORTAL_TASK_CORE, uint32_t stackSize = WIFI_PORTAL_TASK_STACK,
+                                      UBaseType_t priority = WIFI_PORTAL_TASK_PRIORITY);
+    
+    // PORTAL_DONE_BIT is set when the portal task ends, PORTAL_CONNECTED_BIT too if it connected
+    EventGroupHandle_t  getConfigPortalEvents()
+    {
+      return _portalEvents;
+    }
+    
+    bool          isConfigPortalRunning()
+    {
+      return _portalTaskRunning && !(xEventGroupGetBits(_portalEvents) & PORTAL_DONE_BIT);
+    }
+    
+    // Blocks until the portal task ends, or timeout (ms). Returns true if connected
+    bool          waitConfigPortal(unsigned long timeout = portMAX_DELAY);
 
 
     // get the AP name of the config portal, so it can be used in the callback
@@ -136,6 +510,7 @@ class ESPAsync_WiFiManager
     // get the AP password of the config portal, so it can be used in the callback
     String        getConfigPortalPW();
 
+    // Erase the stored credentials and the driver config
     void          resetSettings();
 
     //sets timeout before webserver loop ends and exits even if there has been no setup.
@@ -146,6 +521,38 @@ class ESPAsync_WiFiManager
 
     //sets timeout for which to attempt connecting, usefull if you get a lot of failed connects
     void          setConnectTimeout(unsigned long seconds);
+    
+    //sets the overall deadline for trying all stored networks, scan included
+    void          setConnectPlanTimeout(unsigned long seconds);
+    
+    //sets the modeless reconnect backoff, first delay and cap. minSeconds 0 disables reconnecting from criticalLoop()
+    void          setReconnectBackoff(unsigned long minSeconds, unsigned long maxSeconds);
+    
+    //roams to a stronger BSSID of the same SSID once RSSI stayed below thresholdRSSI (dBm) for hysteresisSeconds. 0 disables
+    void          setRoaming(int8_t thresholdRSSI, unsigned long hysteresisSeconds = WIFI_ROAM_HYSTERESIS / 1000);
+    
+    // Copy of the counters, each read atomically
+    WiFi_RoamStats  getRoamStats()
+    {
+      WiFi_RoamStats stats;
+      
+      stats.roams             = _roamStats.roams.load();
+      stats.roamFailures      = _roamStats.roamFailures.load();
+      stats.roamScans         = _roamStats.roamScans.load();
+      stats.disconnects       = _roamStats.disconnects.load();
+      stats.disconnectedTime  = _roamStats.disconnectedTime.load();
+      
+      return stats;
+    }
+    
+    // Periodic link samples taken by criticalLoop(), see WIFI_LINK_SAMPLE_INTERVAL
+    WiFiLinkHistory&  getLinkHistory()
+    {
+      return _linkHistory;
+    }
+    
+    //sets how long an AP not seen in scans stays in the scan results. 0 keeps them forever
+    void          setScanResultMaxAge(unsigned long seconds);
 
 
     void          setDebugOutput(bool debug);
@@ -181,6 +588,8 @@ class ESPAsync_WiFiManager
     void          setAPCallback(void(*func)(ESPAsync_WiFiManager*));
     //called when settings have been changed and connection was successful
     void          setSaveConfigCallback(void(*func)());
+    //called when an asynchronous scan has completed and results are available
+    void          setScanDoneCallback(void(*func)(ESPAsync_WiFiManager*));
 
     //if this is set, it will exit after config, even if connection is unsucessful.
     void          setBreakAfterConfig(bool shouldBreak);
@@ -196,48 +605,66 @@ class ESPAsync_WiFiManager
     // return SSID of router in STA mode got from config portal. NULL if no user's input //KH
     String				getSSID() 
     {
-      return _ssid;
+      return getSSID(0);
     }
 
     // return password of router in STA mode got from config portal. NULL if no user's input //KH
     String				getPW() 
     {
-      return _pass;
+      return getPW(0);
     }
     
     // New from v1.1.0
     // return SSID of router in STA mode got from config portal. NULL if no user's input //KH
     String				getSSID1() 
     {
-      return _ssid1;
+      return getSSID(1);
     }
 
     // return password of router in STA mode got from config portal. NULL if no user's input //KH
     String				getPW1() 
     {
-      return _pass1;
+      return getPW(1);
     }
     
-    #define MAX_WIFI_CREDENTIALS        2
+    // Capacity of the credential store, see WIFI_CREDENTIALS_CAPACITY
+    #define MAX_WIFI_CREDENTIALS        WIFI_CREDENTIALS_CAPACITY
     
-    String				getSSID(uint8_t index) 
+    uint16_t      getCredentialCount()
     {
-      if (index == 0)
-        return _ssid;
-      else if (index == 1)
-        return _ssid1;
-      else     
-        return String("");
+      return _credentials.count();
     }
     
-    String				getPW(uint8_t index) 
+    // Index of the credential for this SSID, -1 if not stored
+    int           findCredential(const char* ssid)
     {
-      if (index == 0)
-        return _pass;
-      else if (index == 1)
-        return _pass1;
-      else     
-        return String("");
+      return _credentials.find(ssid);
+    }
+    
+    // Insert or update, saved to NVS at once. The credential moves to index 0
+    int           addCredential(const char* ssid, const char* pass);
+    bool          removeCredential(uint16_t index);
+    
+    // Channel the credential was last found on by a scan, 0 if unknown
+    uint8_t       getChannel(uint16_t index)
+    {
+      const WiFi_Credential* credential = _credentials.get(index);
+      
+      return credential ? credential->channel : 0;
+    }
+    
+    String				getSSID(uint16_t index) 
+    {
+      const WiFi_Credential* credential = _credentials.get(index);
+      
+      return credential ? String(credential->SSID) : String("");
+    }
+    
+    String				getPW(uint16_t index) 
+    {
+      const WiFi_Credential* credential = _credentials.get(index);
+      
+      return credential ? String(credential->password) : String("");
     }
     //////
     
@@ -278,6 +705,14 @@ class ESPAsync_WiFiManager
     {
       return getStoredWiFiPass();
     }
+    
+    // Same without a String : views of a RAM copy, read from the driver once and after each config change.
+    // Loop side only, the copy is refilled here
+    const char*   storedSSID();
+    const char*   storedPass();
+    
+    // HTTP handler side : the copy as last published by the loop, never calls into the driver
+    void          sharedStoredConfig(WiFi_StoredConfig& config);
 
     void setHostname()
     {
@@ -299,11 +734,41 @@ class ESPAsync_WiFiManager
     AsyncWebServer *server;
 
     bool            _modeless;
-    int             scannow;
     int             shouldscan;
-    bool            needInfo = true;
+    // Pre-serialized /i and /state payloads and the static IP part of /wifi, rebuilt on the loop by setInfo() once
+    // needInfo is set (also from the WiFi event task). The handlers copy them under _infoLock, see sharedPage()
+    std::atomic<bool> needInfo { true };
     String          pager;
+    String          _statePage;
+    String          _staticIPPage;
     wl_status_t     wifiStatus;
+    
+    // /stats payload, rebuilt on the loop every WIFI_STATS_PUBLISH_MS by publishStats()
+    String          _statsPage;
+    SemaphoreHandle_t _infoLock             = NULL;
+    wifi_event_id_t _wifiEventId;
+    
+    // Set from the WiFi event handler, waited on by waitForConnectEvent()
+    #define WIFI_CONNECTED_BIT      BIT0
+    #define WIFI_FAIL_BIT           BIT1
+    
+    #ifndef WIFI_CONNECT_DEFAULT_TIMEOUT
+      #define WIFI_CONNECT_DEFAULT_TIMEOUT    10000UL
+    #endif
+    
+    EventGroupHandle_t  _wifiEventGroup;
+    
+    // Shared with the event task : the loop arms them before a WiFi.begin(), the event task matches the SSID
+    // against its length and hash and records why the attempt failed. Atomics, no SSID string shared
+    std::atomic<uint8_t>  _lastDisconnectReason { 0 };
+    std::atomic<uint8_t>  _connectingSSIDLength { 0 };
+    std::atomic<uint32_t> _connectingSSIDHash   { 0 };
+    
+    // Bumped whenever /scan or /state content changes, exposed as ETag for conditional GETs
+    uint32_t        _scanGeneration       = 0;
+    std::atomic<uint32_t> _stateGeneration { 0 };
+    uint32_t        _statePageGeneration  = 0;        // generation _statePage was built at, under _infoLock
+    uint32_t        _etagSeed             = 0;
 
 #define RFC952_HOSTNAME_MAXLEN      24
     char RFC952_hostname[RFC952_HOSTNAME_MAXLEN + 1];
@@ -311,30 +776,86 @@ class ESPAsync_WiFiManager
     char* getRFC952_hostname(const char* iHostname);
 
     void          setupConfigPortal();
+    void          startAccessPoint();
+    void          startPortalServer();
     void          startWPS();
 
     const char*   _apName               = "no-net";
     const char*   _apPassword           = NULL;
     
-    String        _ssid                 = "";
-    String        _pass                 = "";
+    // Credentials from the config portal / API, index 0 most recent
+    WiFiCredentialStore _credentials;
     
-    // New from v1.1.0
-    String        _ssid1  = "";
-    String        _pass1  = "";
-    //////
+    uint8_t       _storedChannel                            = 0;
 
     unsigned long _configPortalTimeout  = 0;
 
     unsigned long _connectTimeout       = 0;
-    unsigned long _configPortalStart    = 0;
+    unsigned long _connectPlanTimeout   = WIFI_CONNECT_PLAN_TIMEOUT;
+    
+    // Modeless reconnect scheduler, see reconnectStep()
+    unsigned long _reconnectBackoffMin  = WIFI_RECONNECT_BACKOFF_MIN;
+    unsigned long _reconnectBackoffMax  = WIFI_RECONNECT_BACKOFF_MAX;
+    unsigned long _reconnectStartedAt   = 0;
+    uint8_t       _reconnectAttempt     = 0;
+    bool          _reconnectScheduled   = false;
+    bool          _reconnectInFlight    = false;
+    int           _reconnectCredential  = -1;     // credential being tried, -1 for the driver config
+    uint32_t      _jitterState          = 1;
+    
+    // Roaming monitor, see roamLoop()
+    int8_t        _roamThreshold        = 0;
+    unsigned long _roamHysteresis       = WIFI_ROAM_HYSTERESIS;
+    uint64_t      _roamWeakSince        = 0;
+    uint64_t      _roamStartedAt        = 0;
+    bool          _roamWeak             = false;
+    bool          _roamScanPending      = false;
+    bool          _roamInFlight         = false;
+    WiFi_RoamCounters _roamStats;
+    
+    WiFiLinkHistory _linkHistory;
+    
+    // Link up / down bookkeeping from the WiFi events
+    std::atomic<bool>     _linkUp         { false };
+    std::atomic<bool>     _linkDropped    { false };
+    std::atomic<uint32_t> _linkDownSince  { 0 };
+    
+    // Address is the cached lease until the restarted DHCP client binds, see fastReconnect()
+    std::atomic<bool>     _leaseFromCache { false };
+    std::atomic<bool>     _leaseRenewing  { false };
+    unsigned long _scanResultMaxAge     = WIFI_SCAN_MAX_AGE;
+    uint64_t      _configPortalStart    = 0;
+    unsigned long _portalTimeoutArmed   = 0;      // _configPortalTimeout the portal timer was armed with
+    std::atomic<bool> _portalHeld       { false };  // WM_CMD_HOLD posted, cleared when a timeout is armed again
+    
+    // Scans, portal timeout, backoff and sampling deadlines, see WiFi_TimerId
+    WiFiTimerWheel  _timers;
+    
+    uint64_t      pollTimers();
+    bool          configPortalExpired();
 
     int                 numberOfNetworks;
     int                 *networkIndices;
     
-    WiFiResult          *wifiSSIDs;
-    wifi_ssid_count_t   wifiSSIDCount;
+    WiFiScanRecord      wifiSSIDs[WIFI_SCAN_MAX_RESULTS];
+    wifi_ssid_count_t   wifiSSIDCount       = 0;
     bool                wifiSSIDscan;
+    bool                _scanInFlight       = false;
+    bool                _scanReady          = false;
+    bool                _scanRequested      = false;
+    uint32_t            _scanStartedAt      = 0;
+    uint8_t             _scanChannels[WIFI_SCAN_MAX_CHANNELS];
+    uint8_t             _scanChannelCount   = 0;
+    uint8_t             _scanChannelIndex   = 0;
+    
+    // What the HTTP handlers read, see publishScanResults(). wifiSSIDs itself is only touched by the loop
+    WiFiScanSnapshots   _scanSnapshots;
+    bool                _scanPublishPending = false;
+    
+    bool          startChannelScan();
+    void          publishScanResults();
+    void          processScanResults(wifi_ssid_count_t n);
+    int           findScanResult(const char* ssid);
     
     // To enable dynamic/random channel
     // default to channel 1
@@ -353,6 +874,18 @@ class ESPAsync_WiFiManager
     int           _minimumQuality           = -1;
     bool          _removeDuplicateAPs       = true;
     bool          _shouldBreakAfterConfig   = false;
+    
+    // RAM copy of the config stored by the driver, see storedSSID(). Loop only
+    WiFi_StoredConfig _storedConfig;
+    bool          _storedConfigValid        = false;
+    
+    // What the handlers read, published by loadStoredConfig() under _storedConfigLock
+    WiFi_StoredConfig _storedConfigShared;
+    SemaphoreHandle_t _storedConfigLock     = NULL;
+    
+    // Set by handleWifiSave()
+    bool          _staIPConfigChanged       = false;
+    bool          _savedConfigUnchanged     = false;
     bool          _tryWPS                   = false;
 
     const char*   _customHeadElement        = "";
@@ -366,17 +899,64 @@ class ESPAsync_WiFiManager
     //////
 
     void          setWifiStaticIP();
+    void          eraseDriverConfig();
     
     // New v1.1.0
     int           reconnectWifi();
     //////
     
-    int           connectWifi(String ssid = "", String pass = "");
+    int           connectWifi(String ssid = "", String pass = "", uint8_t channel = 0);
+    int           beginConnect(String ssid, String pass, uint8_t channel);
+    bool          saveConnectStep(uint64_t now, unsigned long settle, int& result);
+    bool          persistSavedConfig(bool deferred = false);
+    uint16_t      blindCandidates(WiFi_ConnectCandidate* candidates);
+    int           beginCandidate(const WiFi_ConnectCandidate& candidate);
+    void          reconnectStep();
+    void          startRoamScan();
+    void          roamToBest();
+    void          sampleLink();
+    unsigned long reconnectBackoff();
+    void          loadSTAStaticIPConfig();
+    void          loadStoredConfig();
+    
+    // After anything that may change the driver config : WiFi.begin() with new credentials, erase, WPS
+    void          invalidateStoredConfig()
+    {
+      _storedConfigValid = false;
+    }
+    bool          saveSTAStaticIPConfig();
+    uint16_t      planConnect(WiFi_ConnectCandidate* candidates);
+    uint16_t      matchKnownNetworks(WiFi_ConnectCandidate* candidates);
+    int16_t       historyScore(uint16_t index);
+    String        statsAsString();
+    void          publishStats();
+    String        staticIPAsString();
+    
+    // HTTP handler side
+    String        sharedPage(const String& page, uint32_t* generation = NULL);
+    void          holdConfigPortal();
     
     wl_status_t   waitForConnectResult();
+    wl_status_t   waitForConnectEvent(unsigned long timeout);
+    void          prepareConnectWait(const char* ssid);
+    bool          isDefiniteConnectFailure(uint8_t reason);
+    
+#if AUTOCONNECT_FAST_RECONNECT
+    bool          fastReconnect();
+    bool          loadReconnectCache(WiFi_ReconnectCache& cache, bool& warm);
+    bool          peekReconnectCache(WiFi_ReconnectCache& cache);
+    void          preloadReconnectCache();
+    bool          isLeaseFresh(const WiFi_ReconnectCache& cache, bool warm);
+    void          saveReconnectCache();
+    void          unpinDriverConfig();
+    uint32_t      reconnectCacheChecksum(const WiFi_ReconnectCache& cache);
+#endif
     
     void          setInfo();
-    String        networkListAsString();
+    void          invalidateInfo();
+    String        stateAsString();
+    void          onWiFiEvent(WiFiEvent_t event, WiFiEventInfo_t info);
+    String        networkListAsString(const WiFi_ScanSnapshot* snapshot);
     
     void          handleRoot(AsyncWebServerRequest *request);
     void          handleWifi(AsyncWebServerRequest *request);
@@ -385,6 +965,14 @@ class ESPAsync_WiFiManager
     void          handleInfo(AsyncWebServerRequest *request);
     void          handleState(AsyncWebServerRequest *request);
     void          handleScan(AsyncWebServerRequest *request);
+    void          handleStats(AsyncWebServerRequest *request);
+    void          handleLink(AsyncWebServerRequest *request);
+    size_t        serializeScanRecord(char* buf, size_t len, const WiFiScanRecord& record, bool first);
+    
+    #define WIFI_ETAG_MAXLEN      24
+    
+    void          formatETag(char* etag, char kind, uint32_t generation);
+    bool          sendNotModified(AsyncWebServerRequest *request, const char* etag);
     void          handleReset(AsyncWebServerRequest *request);
     void          handleNotFound(AsyncWebServerRequest *request);
     bool          captivePortal(AsyncWebServerRequest *request);   
@@ -402,10 +990,97 @@ class ESPAsync_WiFiManager
     bool          connect;
     bool          stopConfigPortal = false;
     
+    // HTTP handlers -> control loop. The handlers only parse and post, the loops apply
+    WiFiCommandQueue  _commands;
+    
+    bool          postCommand(const WiFi_Command& command);
+    bool          postCommand(uint8_t type);
+    void          processCommands();
+    void          applySaveCommand(const WiFi_Command& command);
+    
+    // Config portal task mode
+    bool                _portalTask           = false;
+    int                 _portalTaskCore       = WIFI_PORTAL_TASK_CORE;
+    uint32_t            _portalTaskStack      = WIFI_PORTAL_TASK_STACK;
+    UBaseType_t         _portalTaskPriority   = WIFI_PORTAL_TASK_PRIORITY;
+    TaskHandle_t        _portalTaskHandle     = NULL;
+    EventGroupHandle_t  _portalEvents         = NULL;
+    bool                _portalTimedOut       = true;
+    std::atomic<bool>   _portalTaskRunning    { false };    // until the task stopped touching the manager
+    
+    // /wifisave connect in progress, see saveConnectStep()
+    WiFi_SaveConnect    _saveConnect          = WM_SAVE_CONNECT_IDLE;
+    
+    bool          configPortalStep();
+    bool          finishConfigPortal();
+    unsigned long configPortalSleep();
+    void          runConfigPortalTask();
+    static void   configPortalTask(void* param);
+    
+    // From the handlers and the WiFi event task, so the atomic flag rather than the task handle
+    void          wakeConfigPortal()
+    {
+      if (_portalTaskRunning)
+        xEventGroupSetBits(_portalEvents, PORTAL_WAKE_BIT);
+    }
+    
+    // Cooperative lifecycle, see tick(). One handler pair per state in _stateTable
+    typedef void        (ESPAsync_WiFiManager::*StateEnter)(uint64_t now);
+    typedef WiFi_State  (ESPAsync_WiFiManager::*StateRun)(uint64_t now);
+    
+    typedef struct
+    {
+      const char* name;
+      StateEnter  enter;
+      StateRun    run;
+    }  WiFi_StateEntry;
+    
+    static const WiFi_StateEntry  _stateTable[WM_STATE_COUNT];
+    
+    WiFi_State    _state                = WM_STATE_IDLE;
+    WiFi_State    _pendingState         = WM_STATE_COUNT;   // transition for the next tick(), WM_STATE_COUNT if none
+    uint64_t      _stateSince           = 0;
+    uint32_t      _maxTickTime          = 0;
+    uint8_t       _tickOps              = 0;      // blocking driver / NVS calls in this tick()
+    uint8_t       _pendingWrites        = 0;      // WM_WRITE_* bits
+    
+    // Candidates of the running connect plan, filled before entering WM_STATE_CONNECTING
+    WiFi_ConnectCandidate _plan[WIFI_SCAN_MAX_RESULTS];
+    uint16_t      _planCount            = 0;      // 0 : the config stored by the driver
+    uint16_t      _planIndex            = 0;
+    bool          _planFromPortal       = false;
+    bool          _attemptInFlight      = false;
+    uint64_t      _attemptStartedAt     = 0;
+    
+    bool          _portalUp             = false;
+    WiFi_PortalStep _portalStep         = WM_PORTAL_DOWN;
+    bool          _portalOpened         = false;  // since begin(), a failed plan then backs off instead
+    
+    void          enterState(WiFi_State state);
+    void          closePortal();
+    bool          flushPendingWrite();
+    
+    void          enterIdle(uint64_t now);
+    void          enterScanning(uint64_t now);
+    void          enterConnecting(uint64_t now);
+    void          enterPortal(uint64_t now);
+    void          enterConnected(uint64_t now);
+    void          enterBackoff(uint64_t now);
+    
+    WiFi_State    runIdle(uint64_t now);
+    WiFi_State    runScanning(uint64_t now);
+    WiFi_State    runConnecting(uint64_t now);
+    WiFi_State    runPortal(uint64_t now);
+    WiFi_State    runConnected(uint64_t now);
+    WiFi_State    runBackoff(uint64_t now);
+    
+    WiFi_State    connectFailed();
+    
     bool          _debug = false;     //true;
     
     void(*_apcallback)(ESPAsync_WiFiManager*) = NULL;
     void(*_savecallback)()                = NULL;
+    void(*_scandonecallback)(ESPAsync_WiFiManager*) = NULL;
 
     template <typename Generic>
     void          DEBUG_WM(Generic text);
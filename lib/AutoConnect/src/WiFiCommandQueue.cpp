@@ -0,0 +1,41 @@
+#include "WiFiCommandQueue.h"
+
+bool WiFiCommandQueue::push(const WiFi_Command& command)
+{
+  uint32_t head = _head.load(std::memory_order_relaxed);
+
+  // The consumer frees slots by moving the tail, acquire so its wipe is done before we write
+  if (head - _tail.load(std::memory_order_acquire) >= WIFI_COMMAND_QUEUE_SIZE)
+  {
+    _dropped.fetch_add(1, std::memory_order_relaxed);
+
+    return false;
+  }
+
+  _ring[head & (WIFI_COMMAND_QUEUE_SIZE - 1)] = command;
+
+  _head.store(head + 1, std::memory_order_release);
+
+  return true;
+}
+
+//////////////////////////////////////////
+
+bool WiFiCommandQueue::pop(WiFi_Command& command)
+{
+  uint32_t tail = _tail.load(std::memory_order_relaxed);
+
+  if (tail == _head.load(std::memory_order_acquire))
+    return false;
+
+  WiFi_Command& slot = _ring[tail & (WIFI_COMMAND_QUEUE_SIZE - 1)];
+
+  command = slot;
+
+  // No password left behind in the ring
+  memset(&slot, 0, sizeof(slot));
+
+  _tail.store(tail + 1, std::memory_order_release);
+
+  return true;
+}
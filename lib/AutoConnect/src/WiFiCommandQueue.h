@@ -0,0 +1,75 @@
+#pragma once
+
+#include <Arduino.h>
+#include <atomic>
+
+#include "WiFiCredentialStore.h"
+
+#ifndef WIFI_COMMAND_QUEUE_SIZE
+  // Commands waiting for the control loop, power of 2. A full queue rejects the command
+  #define WIFI_COMMAND_QUEUE_SIZE       8
+#endif
+
+// Commands the HTTP handlers post to the control loop
+#define WM_CMD_SAVE                   1     // credentials and static IP from /wifisave, then connect
+#define WM_CMD_CLOSE                  2     // /close
+#define WM_CMD_RESCAN                 3     // /scan?refresh=1
+#define WM_CMD_RESET                  4     // /r : erase settings and restart
+#define WM_CMD_HOLD                   5     // portal page opened, suspend the portal timeout
+
+// Static IP fields present in a WM_CMD_SAVE
+#define WM_CMD_IP                     0x01
+#define WM_CMD_GW                     0x02
+#define WM_CMD_SN                     0x04
+#define WM_CMD_DNS1                   0x08
+#define WM_CMD_DNS2                   0x10
+
+// One command, copied by value through the ring. Only WM_CMD_SAVE uses the payload
+typedef struct
+{
+  uint8_t   type;
+  uint8_t   IPFields;
+  char      SSID[WIFI_SSID_MAXLEN + 1];
+  char      password[WIFI_PASS_MAXLEN + 1];
+  char      SSID1[WIFI_SSID_MAXLEN + 1];
+  char      password1[WIFI_PASS_MAXLEN + 1];
+  uint32_t  ip;
+  uint32_t  gw;
+  uint32_t  sn;
+  uint32_t  dns1;
+  uint32_t  dns2;
+}  WiFi_Command;
+
+/////////////////////////////////////////////////////////////////////////////
+
+// Lock-free single-producer / single-consumer ring. The producer is the AsyncTCP task running the HTTP
+// handlers, the consumer the task running the manager loop. Each side only writes its own index, and the
+// release / acquire pair on it publishes the slot contents. No lock, no heap.
+class WiFiCommandQueue
+{
+  public:
+
+    // Producer side. Returns false if the queue is full
+    bool        push(const WiFi_Command& command);
+
+    // Consumer side. Returns false if the queue is empty. The slot is wiped once copied out
+    bool        pop(WiFi_Command& command);
+
+    bool        empty()
+    {
+      return _head.load(std::memory_order_acquire) == _tail.load(std::memory_order_acquire);
+    }
+
+    // Commands rejected on a full queue since boot
+    uint32_t    dropped()
+    {
+      return _dropped.load(std::memory_order_relaxed);
+    }
+
+  private:
+
+    WiFi_Command            _ring[WIFI_COMMAND_QUEUE_SIZE];
+    std::atomic<uint32_t>   _head     { 0 };    // next slot written, producer only
+    std::atomic<uint32_t>   _tail     { 0 };    // next slot read, consumer only
+    std::atomic<uint32_t>   _dropped  { 0 };
+};
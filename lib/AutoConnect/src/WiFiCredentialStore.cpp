@@ -0,0 +1,433 @@
+#include "WiFiCredentialStore.h"
+
+#include <Preferences.h>
+
+#include <algorithm>
+
+WiFiCredentialStore::WiFiCredentialStore()
+{
+  memset(&_blob, 0, sizeof(_blob));
+  memset(_index, 0, sizeof(_index));
+}
+
+//////////////////////////////////////////
+
+// NVS isn't up yet when global objects are constructed, so load lazily on first access
+void WiFiCredentialStore::load()
+{
+  if (_loaded)
+    return;
+    
+  _loaded = true;
+  _blob.header.count  = 0;
+  
+  Preferences prefs;
+  
+  if (!prefs.begin(WIFI_PREFS_NAMESPACE, true))
+  {
+    log_d("No stored credentials");
+    
+    // Nothing to write back as long as it stays empty
+    _savedHash = blobHash();
+    return;
+  }
+  
+  size_t len = prefs.getBytesLength(WIFI_CREDENTIALS_KEY);
+  
+  bool migrated = false;
+  
+  if ( (len >= WIFI_CREDENTIAL_V1_HEADER) && (len <= sizeof(_blob)) )
+  {
+    prefs.getBytes(WIFI_CREDENTIALS_KEY, &_blob, len);
+    
+    if ( (_blob.header.version == 1) && migrate(len) )
+    {
+      // Written back in the new layout with the next save()
+      log_i("Credentials migrated from version 1");
+      
+      migrated = true;
+    }
+    else if ( (_blob.header.version != WIFI_CREDENTIALS_VERSION) || (_blob.header.recordSize != sizeof(WiFi_Credential)) ||
+         (_blob.header.count > WIFI_CREDENTIALS_CAPACITY) || (len != sizeof(WiFi_CredentialHeader) + _blob.header.count * sizeof(WiFi_Credential)) )
+    {
+      log_e("Stored credentials invalid, ignored");
+      
+      memset(&_blob, 0, sizeof(_blob));
+    }
+  }
+  
+  prefs.end();
+  
+  rebuildIndex();
+  
+  // What NVS holds now, save() skips the write while the blob still matches it
+  _savedHash = migrated ? 0 : blobHash();
+  
+  log_i("Loaded %i credentials", _blob.header.count);
+}
+
+//////////////////////////////////////////
+
+// Version 1 blob already read into _blob : spread the records out in place, last first, stats zeroed
+bool WiFiCredentialStore::migrate(size_t len)
+{
+  uint16_t count = _blob.header.count;
+  
+  if ( (_blob.header.recordSize != WIFI_CREDENTIAL_V1_SIZE) || (count > WIFI_CREDENTIALS_CAPACITY) ||
+       (len != WIFI_CREDENTIAL_V1_HEADER + count * WIFI_CREDENTIAL_V1_SIZE) )
+    return false;
+  
+  uint8_t* raw = reinterpret_cast<uint8_t*>(&_blob);
+  
+  for (int i = count - 1; i >= 0; i--)
+  {
+    memmove(&_blob.records[i], raw + WIFI_CREDENTIAL_V1_HEADER + i * WIFI_CREDENTIAL_V1_SIZE, WIFI_CREDENTIAL_V1_SIZE);
+    memset(&_blob.records[i].stats, 0, sizeof(WiFi_CredentialStats));
+  }
+  
+  _blob.header.sequence = 0;
+  _dirty = true;
+  
+  return true;
+}
+
+//////////////////////////////////////////
+
+// FNV-1a over the bytes save() would write
+uint32_t WiFiCredentialStore::blobHash(size_t* length)
+{
+  _blob.header.version    = WIFI_CREDENTIALS_VERSION;
+  _blob.header.recordSize = sizeof(WiFi_Credential);
+  
+  size_t len = sizeof(WiFi_CredentialHeader) + _blob.header.count * sizeof(WiFi_Credential);
+  
+  if (length)
+    *length = len;
+  
+  return WiFi_SSIDHash(reinterpret_cast<const char*>(&_blob), len);
+}
+
+//////////////////////////////////////////
+
+// Only on a hash match : compare the bytes save() would write with what NVS holds, so a collision
+// can't pass a real change off as unchanged. Costs one blob read, no write
+bool WiFiCredentialStore::matchesStored(size_t len)
+{
+  Preferences prefs;
+  
+  if (!prefs.begin(WIFI_PREFS_NAMESPACE, true))
+    return (_blob.header.count == 0);
+  
+  size_t  storedLen = prefs.getBytesLength(WIFI_CREDENTIALS_KEY);
+  bool    same      = false;
+  
+  if (storedLen == 0)
+  {
+    // Never written, an empty store is the same
+    same = (_blob.header.count == 0);
+  }
+  else if (storedLen == len)
+  {
+    uint8_t* stored = (uint8_t*) malloc(len);
+    
+    if (stored != NULL)
+    {
+      same = (prefs.getBytes(WIFI_CREDENTIALS_KEY, stored, len) == len) && (memcmp(stored, &_blob, len) == 0);
+      
+      free(stored);
+    }
+  }
+  
+  prefs.end();
+  
+  return same;
+}
+
+//////////////////////////////////////////
+
+// True if save() would actually write, i.e. the records differ from what NVS holds
+bool WiFiCredentialStore::changed()
+{
+  load();
+  
+  if (!_dirty)
+    return false;
+  
+  size_t len;
+  
+  return (blobHash(&len) != _savedHash) || !matchesStored(len);
+}
+
+//////////////////////////////////////////
+
+uint16_t WiFiCredentialStore::count()
+{
+  load();
+  
+  return _blob.header.count;
+}
+
+//////////////////////////////////////////
+
+const WiFi_Credential* WiFiCredentialStore::get(uint16_t index)
+{
+  load();
+  
+  return (index < _blob.header.count) ? &_blob.records[index] : NULL;
+}
+
+//////////////////////////////////////////
+
+int WiFiCredentialStore::find(const char* ssid)
+{
+  size_t len = strnlen(ssid, WIFI_SSID_MAXLEN + 1);
+  
+  return find(ssid, len, WiFi_SSIDHash(ssid, len));
+}
+
+//////////////////////////////////////////
+
+// O(1) on average whatever the store size : probe by hash, compare strings only on a hash match
+int WiFiCredentialStore::find(const char* ssid, size_t len, uint32_t hash)
+{
+  load();
+  
+  if ( (len == 0) || (len > WIFI_SSID_MAXLEN) )
+    return -1;
+  
+  for (uint16_t slot = hash & (WIFI_CREDENTIALS_INDEX_SIZE - 1); _index[slot] != 0; slot = (slot + 1) & (WIFI_CREDENTIALS_INDEX_SIZE - 1))
+  {
+    uint16_t i = _index[slot] - 1;
+    
+    if ( (_hashes[i] == hash) && (memcmp(_blob.records[i].SSID, ssid, len) == 0) && (_blob.records[i].SSID[len] == 0) )
+      return i;
+  }
+  
+  return -1;
+}
+
+//////////////////////////////////////////
+
+// Records are few and rarely change, a full rebuild is simpler than keeping moved indexes in sync
+void WiFiCredentialStore::rebuildIndex()
+{
+  memset(_index, 0, sizeof(_index));
+  
+  for (uint16_t i = 0; i < _blob.header.count; i++)
+  {
+    _hashes[i] = WiFi_SSIDHash(_blob.records[i].SSID, strnlen(_blob.records[i].SSID, WIFI_SSID_MAXLEN));
+    
+    uint16_t slot = _hashes[i] & (WIFI_CREDENTIALS_INDEX_SIZE - 1);
+    
+    while (_index[slot] != 0)
+      slot = (slot + 1) & (WIFI_CREDENTIALS_INDEX_SIZE - 1);
+      
+    _index[slot] = i + 1;
+  }
+}
+
+//////////////////////////////////////////
+
+int WiFiCredentialStore::add(const char* ssid, const char* pass)
+{
+  if ( (ssid == NULL) || (ssid[0] == 0) || (strlen(ssid) > WIFI_SSID_MAXLEN) || ( (pass != NULL) && (strlen(pass) > WIFI_PASS_MAXLEN) ) )
+  {
+    log_e("Invalid credential");
+    return -1;
+  }
+  
+  int index = find(ssid);
+  
+  WiFi_Credential record;
+  
+  // Padding included, so an unchanged record hashes the same
+  memset(&record, 0, sizeof(record));
+  
+  if (index >= 0)
+  {
+    record = _blob.records[index];
+  }
+  else
+  {
+    strncpy(record.SSID, ssid, WIFI_SSID_MAXLEN);
+    
+    // Full : the least recently saved one goes
+    index = (_blob.header.count < WIFI_CREDENTIALS_CAPACITY) ? _blob.header.count++ : _blob.header.count - 1;
+  }
+  
+  char password[WIFI_PASS_MAXLEN + 1] = { 0 };
+  
+  if (pass != NULL)
+    strncpy(password, pass, WIFI_PASS_MAXLEN);
+  
+  // New password, the history of the old one says nothing about it
+  if (memcmp(record.password, password, sizeof(password)) != 0)
+  {
+    memcpy(record.password, password, sizeof(password));
+    memset(&record.stats, 0, sizeof(record.stats));
+  }
+  
+  if ( (index == 0) && (memcmp(&_blob.records[0], &record, sizeof(record)) == 0) )
+    return 0;
+  
+  // Most recently saved first
+  memmove(&_blob.records[1], &_blob.records[0], index * sizeof(WiFi_Credential));
+  _blob.records[0] = record;
+  
+  rebuildIndex();
+  
+  _dirty = true;
+  
+  return 0;
+}
+
+//////////////////////////////////////////
+
+bool WiFiCredentialStore::remove(uint16_t index)
+{
+  load();
+  
+  if (index >= _blob.header.count)
+    return false;
+    
+  memmove(&_blob.records[index], &_blob.records[index + 1], (_blob.header.count - index - 1) * sizeof(WiFi_Credential));
+  
+  _blob.header.count--;
+  memset(&_blob.records[_blob.header.count], 0, sizeof(WiFi_Credential));
+  
+  rebuildIndex();
+  
+  _dirty = true;
+  
+  return true;
+}
+
+//////////////////////////////////////////
+
+void WiFiCredentialStore::clear()
+{
+  load();
+  
+  if (_blob.header.count == 0)
+    return;
+  
+  memset(&_blob, 0, sizeof(_blob));
+  memset(_index, 0, sizeof(_index));
+  _dirty = true;
+}
+
+//////////////////////////////////////////
+
+void WiFiCredentialStore::setChannel(uint16_t index, uint8_t channel)
+{
+  load();
+  
+  if ( (index < _blob.header.count) && (_blob.records[index].channel != channel) )
+  {
+    _blob.records[index].channel = channel;
+    _dirty = true;
+  }
+}
+
+//////////////////////////////////////////
+
+void WiFiCredentialStore::recordAttempt(uint16_t index, bool success, unsigned long timeToIP)
+{
+  load();
+  
+  if (index >= _blob.header.count)
+    return;
+  
+  WiFi_CredentialStats& stats = _blob.records[index].stats;
+  
+  // Aging : halving keeps the success ratio, but lets new attempts move it faster
+  if (stats.attempts >= WIFI_CREDENTIAL_STATS_WINDOW)
+  {
+    stats.attempts  /= 2;
+    stats.successes /= 2;
+  }
+  
+  _blob.header.sequence++;
+  stats.attempts++;
+  stats.lastAttempt = _blob.header.sequence;
+  
+  if (success)
+  {
+    stats.successes++;
+    stats.lastSuccess = _blob.header.sequence;
+    
+    stats.timeToIP[stats.nextSample] = (timeToIP > 0xFFFF) ? 0xFFFF : timeToIP;
+    stats.nextSample = (stats.nextSample + 1) % WIFI_CREDENTIAL_TTI_SAMPLES;
+    
+    if (stats.samples < WIFI_CREDENTIAL_TTI_SAMPLES)
+      stats.samples++;
+  }
+  
+  _dirty = true;
+}
+
+//////////////////////////////////////////
+
+// 0 if never connected
+uint16_t WiFiCredentialStore::medianTimeToIP(uint16_t index)
+{
+  load();
+  
+  if ( (index >= _blob.header.count) || (_blob.records[index].stats.samples == 0) )
+    return 0;
+  
+  const WiFi_CredentialStats& stats = _blob.records[index].stats;
+  
+  uint16_t sorted[WIFI_CREDENTIAL_TTI_SAMPLES];
+  
+  memcpy(sorted, stats.timeToIP, stats.samples * sizeof(uint16_t));
+  std::sort(sorted, sorted + stats.samples);
+  
+  return sorted[stats.samples / 2];
+}
+
+//////////////////////////////////////////
+
+// One blob write of the used records only, skipped when nothing changed.
+// Edits that cancel out (same credentials re-submitted, MRU order restored) leave the blob as stored : no write either.
+// The hash only rules a write in, a match is confirmed against the stored bytes
+bool WiFiCredentialStore::save()
+{
+  if (!_dirty)
+    return true;
+  
+  size_t    len;
+  uint32_t  hash = blobHash(&len);
+  
+  if ( (hash == _savedHash) && matchesStored(len) )
+  {
+    log_d("Credentials unchanged, not saved");
+    
+    _dirty = false;
+    return true;
+  }
+    
+  Preferences prefs;
+  
+  if (!prefs.begin(WIFI_PREFS_NAMESPACE, false))
+  {
+    log_e("Can't open NVS for credentials");
+    return false;
+  }
+  
+  bool ok = (prefs.putBytes(WIFI_CREDENTIALS_KEY, &_blob, len) == len);
+  
+  prefs.end();
+  
+  _writes++;
+  
+  if (ok)
+  {
+    _dirty      = false;
+    _savedHash  = hash;
+  }
+  
+  log_i("Saved %i credentials, %i bytes", _blob.header.count, len);
+  
+  return ok;
+}
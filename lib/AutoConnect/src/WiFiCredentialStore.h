@@ -0,0 +1,161 @@
+#pragma once
+
+#include <Arduino.h>
+
+#ifndef WIFI_CREDENTIALS_CAPACITY
+  #define WIFI_CREDENTIALS_CAPACITY     32
+#endif
+
+#define WIFI_SSID_MAXLEN              32
+#define WIFI_PASS_MAXLEN              64
+
+// NVS namespace shared by everything the library persists
+#define WIFI_PREFS_NAMESPACE          "AutoConnect"
+
+#define WIFI_CREDENTIALS_KEY          "creds"
+#define WIFI_CREDENTIALS_VERSION      2
+
+#ifndef WIFI_CREDENTIAL_TTI_SAMPLES
+  // Time-to-IP samples kept per credential for the median
+  #define WIFI_CREDENTIAL_TTI_SAMPLES   5
+#endif
+
+#ifndef WIFI_CREDENTIAL_STATS_WINDOW
+  // attempts / successes are halved past this, so old history weighs less and less
+  #define WIFI_CREDENTIAL_STATS_WINDOW  16
+#endif
+
+// FNV-1a over the SSID bytes, computed once per record so dedup / lookups compare hashes before strings
+inline uint32_t WiFi_SSIDHash(const char* ssid, size_t len)
+{
+  uint32_t hash = 2166136261UL;
+  
+  for (size_t i = 0; i < len; i++)
+  {
+    hash ^= (uint8_t) ssid[i];
+    hash *= 16777619UL;
+  }
+  
+  return hash;
+}
+
+// Connect history of one credential. Times are store sequence numbers, the store has no wall clock
+typedef struct
+{
+  uint16_t  attempts;
+  uint16_t  successes;
+  uint16_t  timeToIP[WIFI_CREDENTIAL_TTI_SAMPLES];    // ms, saturated
+  uint8_t   samples;
+  uint8_t   nextSample;
+  uint32_t  lastAttempt;    // sequence of the last attempt
+  uint32_t  lastSuccess;    // sequence of the last successful attempt, 0 if never
+}  WiFi_CredentialStats;
+
+// Fixed-size record, the whole store is packed into one NVS blob
+typedef struct
+{
+  char      SSID[WIFI_SSID_MAXLEN + 1];
+  char      password[WIFI_PASS_MAXLEN + 1];
+  uint8_t   channel;        // channel last found on by a scan, 0 if unknown
+  WiFi_CredentialStats  stats;
+}  WiFi_Credential;
+
+// Version 1 records stopped before stats, and had no sequence in the header
+#define WIFI_CREDENTIAL_V1_SIZE       (offsetof(WiFi_Credential, channel) + 1)
+#define WIFI_CREDENTIAL_V1_HEADER     4
+
+// count was a uint8 followed by a zero reserved byte in earlier versions, same bytes little-endian
+typedef struct
+{
+  uint8_t   version;
+  uint8_t   recordSize;
+  uint16_t  count;
+  uint32_t  sequence;       // bumped on every recorded connect attempt
+}  WiFi_CredentialHeader;
+
+// recordSize is one byte in the stored layout, a larger WIFI_CREDENTIAL_TTI_SAMPLES mustn't truncate it
+static_assert(sizeof(WiFi_Credential) <= UINT8_MAX, "WiFi_Credential too large for WiFi_CredentialHeader.recordSize");
+
+// SSID hash -> record index, open addressing. At least twice the capacity, so a miss ends on an empty slot quickly
+constexpr uint16_t WiFi_CredentialIndexSize(uint16_t capacity, uint16_t size = 1)
+{
+  return (size >= 2 * capacity) ? size : WiFi_CredentialIndexSize(capacity, size * 2);
+}
+
+#define WIFI_CREDENTIALS_INDEX_SIZE   WiFi_CredentialIndexSize(WIFI_CREDENTIALS_CAPACITY)
+
+// Header and records laid out as stored, only header + count records are written
+typedef struct
+{
+  WiFi_CredentialHeader   header;
+  WiFi_Credential         records[WIFI_CREDENTIALS_CAPACITY];
+}  WiFi_CredentialBlob;
+
+/////////////////////////////////////////////////////////////////////////////
+
+// Credentials cached in RAM, loaded once from NVS on first use. Index 0 is the most recently saved.
+// Writes only happen in save(), and only if the bytes differ from what NVS holds.
+class WiFiCredentialStore
+{
+  public:
+  
+    WiFiCredentialStore();
+    
+    uint16_t    count();
+    
+    uint16_t    capacity()
+    {
+      return WIFI_CREDENTIALS_CAPACITY;
+    }
+    
+    const WiFi_Credential*  get(uint16_t index);
+    int                     find(const char* ssid);
+    
+    // Same with the hash already known, e.g. from a scan record. ssid needn't be terminated
+    int                     find(const char* ssid, size_t len, uint32_t hash);
+    
+    // Insert or update, the entry moves to index 0. Returns its index, -1 if invalid
+    int         add(const char* ssid, const char* pass);
+    bool        remove(uint16_t index);
+    void        clear();
+    
+    void        setChannel(uint16_t index, uint8_t channel);
+    
+    // Connect history, persisted with the next save()
+    void        recordAttempt(uint16_t index, bool success, unsigned long timeToIP);
+    uint16_t    medianTimeToIP(uint16_t index);
+    
+    uint32_t    sequence()
+    {
+      load();
+      
+      return _blob.header.sequence;
+    }
+    
+    bool        save();
+    bool        changed();
+    
+    // NVS writes since boot
+    uint32_t    writes()
+    {
+      return _writes;
+    }
+    
+  private:
+  
+    WiFi_CredentialBlob   _blob;
+    
+    // RAM only, rebuilt whenever records move
+    uint32_t              _hashes[WIFI_CREDENTIALS_CAPACITY];
+    uint16_t              _index[WIFI_CREDENTIALS_INDEX_SIZE];    // record index + 1, 0 is empty
+    bool                  _loaded     = false;
+    bool                  _dirty      = false;
+    uint32_t              _savedHash  = 0;
+    uint32_t              _writes     = 0;
+    
+    void        load();
+    bool        migrate(size_t len);
+    void        rebuildIndex();
+    uint32_t    blobHash(size_t* length = NULL);
+    bool        matchesStored(size_t len);
+};
@@ -0,0 +1,271 @@
+#include "WiFiLinkHistory.h"
+
+#include <algorithm>
+
+WiFiLinkHistory::WiFiLinkHistory()
+{
+  _lock = xSemaphoreCreateMutex();
+
+  clear();
+}
+
+//////////////////////////////////////////
+
+WiFiLinkHistory::~WiFiLinkHistory()
+{
+  vSemaphoreDelete(_lock);
+}
+
+//////////////////////////////////////////
+
+void WiFiLinkHistory::clear()
+{
+  lock();
+
+  memset(_samples, 0, sizeof(_samples));
+  memset(_histogram, 0, sizeof(_histogram));
+
+  _head       = 0;
+  _count      = 0;
+  _connected  = 0;
+  _sumRSSI    = 0;
+
+  unlock();
+}
+
+//////////////////////////////////////////
+
+// Add (sign 1) or remove (sign -1) a sample from the running statistics
+void WiFiLinkHistory::account(const WiFi_LinkSample& sample, int sign)
+{
+  if (!sample.connected)
+    return;
+
+  _histogram[bucket(sample.RSSI)] += sign;
+  _connected  += sign;
+  _sumRSSI    += sign * sample.RSSI;
+}
+
+//////////////////////////////////////////
+
+void WiFiLinkHistory::add(const WiFi_LinkSample& sample)
+{
+  lock();
+
+  // Full : the oldest sample leaves the statistics as it is overwritten
+  if (_count == WIFI_LINK_HISTORY_SIZE)
+    account(_samples[_head], -1);
+  else
+    _count++;
+
+  _samples[_head] = sample;
+  account(sample, 1);
+
+  _head = (_head + 1) % WIFI_LINK_HISTORY_SIZE;
+
+  unlock();
+}
+
+//////////////////////////////////////////
+
+uint16_t WiFiLinkHistory::count()
+{
+  lock();
+
+  uint16_t count = _count;
+
+  unlock();
+
+  return count;
+}
+
+//////////////////////////////////////////
+
+uint16_t WiFiLinkHistory::connectedCount()
+{
+  lock();
+
+  uint16_t connected = _connected;
+
+  unlock();
+
+  return connected;
+}
+
+//////////////////////////////////////////
+
+const WiFi_LinkSample& WiFiLinkHistory::slot(uint16_t index)
+{
+  uint16_t oldest = (_head + WIFI_LINK_HISTORY_SIZE - _count) % WIFI_LINK_HISTORY_SIZE;
+
+  return _samples[(oldest + index) % WIFI_LINK_HISTORY_SIZE];
+}
+
+//////////////////////////////////////////
+
+WiFi_LinkSample WiFiLinkHistory::at(uint16_t index)
+{
+  lock();
+
+  WiFi_LinkSample sample = slot(index);
+
+  unlock();
+
+  return sample;
+}
+
+//////////////////////////////////////////
+
+size_t WiFiLinkHistory::copy(size_t offset, uint8_t* buffer, size_t len)
+{
+  size_t copied = 0;
+
+  lock();
+
+  while ( (copied < len) && (offset < _count * sizeof(WiFi_LinkSample)) )
+  {
+    uint16_t  index = offset / sizeof(WiFi_LinkSample);
+    size_t    pos   = offset % sizeof(WiFi_LinkSample);
+    size_t    chunk = std::min(len - copied, sizeof(WiFi_LinkSample) - pos);
+
+    memcpy(buffer + copied, reinterpret_cast<const uint8_t*>(&slot(index)) + pos, chunk);
+
+    copied += chunk;
+    offset += chunk;
+  }
+
+  unlock();
+
+  return copied;
+}
+
+//////////////////////////////////////////
+
+int8_t WiFiLinkHistory::lowest()
+{
+  for (int i = WIFI_LINK_RSSI_BUCKETS - 1; (i >= 0) && (_connected > 0); i--)
+  {
+    if (_histogram[i])
+      return -i;
+  }
+
+  return 0;
+}
+
+//////////////////////////////////////////
+
+int8_t WiFiLinkHistory::highest()
+{
+  for (int i = 0; (i < WIFI_LINK_RSSI_BUCKETS) && (_connected > 0); i++)
+  {
+    if (_histogram[i])
+      return -i;
+  }
+
+  return 0;
+}
+
+//////////////////////////////////////////
+
+int8_t WiFiLinkHistory::mean()
+{
+  return (_connected > 0) ? (_sumRSSI / _connected) : 0;
+}
+
+//////////////////////////////////////////
+
+int8_t WiFiLinkHistory::percentile(uint8_t pct)
+{
+  if (_connected == 0)
+    return 0;
+
+  // Nearest rank, counted from the weakest bucket up
+  uint32_t  rank  = (pct * (uint32_t) _connected + 99) / 100;
+  uint32_t  seen  = 0;
+
+  if (rank == 0)
+    rank = 1;
+
+  for (int i = WIFI_LINK_RSSI_BUCKETS - 1; i >= 0; i--)
+  {
+    seen += _histogram[i];
+
+    if (seen >= rank)
+      return -i;
+  }
+
+  return highest();
+}
+
+//////////////////////////////////////////
+
+int8_t WiFiLinkHistory::minRSSI()
+{
+  lock();
+
+  int8_t rssi = lowest();
+
+  unlock();
+
+  return rssi;
+}
+
+//////////////////////////////////////////
+
+int8_t WiFiLinkHistory::maxRSSI()
+{
+  lock();
+
+  int8_t rssi = highest();
+
+  unlock();
+
+  return rssi;
+}
+
+//////////////////////////////////////////
+
+int8_t WiFiLinkHistory::meanRSSI()
+{
+  lock();
+
+  int8_t rssi = mean();
+
+  unlock();
+
+  return rssi;
+}
+
+//////////////////////////////////////////
+
+int8_t WiFiLinkHistory::percentileRSSI(uint8_t pct)
+{
+  lock();
+
+  int8_t rssi = percentile(pct);
+
+  unlock();
+
+  return rssi;
+}
+
+//////////////////////////////////////////
+
+WiFi_LinkSummary WiFiLinkHistory::summary()
+{
+  WiFi_LinkSummary summary;
+
+  lock();
+
+  summary.samples   = _count;
+  summary.connected = _connected;
+  summary.minRSSI   = lowest();
+  summary.maxRSSI   = highest();
+  summary.meanRSSI  = mean();
+  summary.p5RSSI    = percentile(5);
+  summary.p95RSSI   = percentile(95);
+
+  unlock();
+
+  return summary;
+}
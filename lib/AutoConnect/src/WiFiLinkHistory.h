@@ -0,0 +1,118 @@
+#pragma once
+
+#include <Arduino.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+
+#ifndef WIFI_LINK_HISTORY_SIZE
+  // Samples kept, the oldest is overwritten. 180 x 10 s is the last half hour
+  #define WIFI_LINK_HISTORY_SIZE        180
+#endif
+
+#ifndef WIFI_LINK_SAMPLE_INTERVAL
+  #define WIFI_LINK_SAMPLE_INTERVAL     10000UL
+#endif
+
+// RSSI histogram covers 0 .. -127 dBm, one bucket per dB
+#define WIFI_LINK_RSSI_BUCKETS        128
+
+// One periodic link sample, 8 bytes, served as is by /link?raw=1 (little-endian)
+typedef struct
+{
+  uint32_t  time;           // millis() when taken
+  int8_t    RSSI;           // 0 when not connected
+  uint8_t   channel;
+  uint8_t   connected;
+  uint8_t   disconnects;    // link drops since boot, low 8 bits
+}  WiFi_LinkSample;
+
+// RSSI statistics of the connected samples, all taken at once. RSSI fields are 0 if there are none
+typedef struct
+{
+  uint16_t  samples;
+  uint16_t  connected;
+  int8_t    minRSSI;
+  int8_t    maxRSSI;
+  int8_t    meanRSSI;
+  int8_t    p5RSSI;
+  int8_t    p95RSSI;
+}  WiFi_LinkSummary;
+
+/////////////////////////////////////////////////////////////////////////////
+
+// Fixed-memory ring of link samples. Statistics over the connected samples in the ring are kept up to date
+// on add() through an RSSI histogram, so add() is O(1), and min / max / percentiles walk at most 128 buckets.
+// No heap use beyond its mutex : the loop adds samples while the HTTP handlers read, every call holds it.
+class WiFiLinkHistory
+{
+  public:
+
+    WiFiLinkHistory();
+    ~WiFiLinkHistory();
+
+    void        add(const WiFi_LinkSample& sample);
+    void        clear();
+
+    uint16_t    count();
+
+    uint16_t    capacity()
+    {
+      return WIFI_LINK_HISTORY_SIZE;
+    }
+
+    // 0 is the oldest
+    WiFi_LinkSample  at(uint16_t index);
+
+    // Raw bytes of the samples, oldest first, from byte offset. Returns the length copied
+    size_t      copy(size_t offset, uint8_t* buffer, size_t len);
+
+    // RSSI statistics of the connected samples, 0 if there are none
+    uint16_t    connectedCount();
+
+    int8_t      minRSSI();
+    int8_t      maxRSSI();
+    int8_t      meanRSSI();
+
+    // RSSI that pct % of the connected samples are at or below
+    int8_t      percentileRSSI(uint8_t pct);
+
+    // All of the above from the same samples, for /link
+    WiFi_LinkSummary  summary();
+
+  private:
+
+    SemaphoreHandle_t _lock;
+
+    WiFi_LinkSample   _samples[WIFI_LINK_HISTORY_SIZE];
+    uint16_t          _head       = 0;      // next slot written
+    uint16_t          _count      = 0;
+
+    uint16_t          _histogram[WIFI_LINK_RSSI_BUCKETS];
+    uint16_t          _connected  = 0;
+    int32_t           _sumRSSI    = 0;
+
+    uint8_t     bucket(int8_t rssi)
+    {
+      return (rssi > 0) ? 0 : (rssi < -(WIFI_LINK_RSSI_BUCKETS - 1)) ? (WIFI_LINK_RSSI_BUCKETS - 1) : -rssi;
+    }
+
+    void        account(const WiFi_LinkSample& sample, int sign);
+
+    // Callers hold _lock
+    const WiFi_LinkSample&  slot(uint16_t index);
+    int8_t      lowest();
+    int8_t      highest();
+    int8_t      mean();
+    int8_t      percentile(uint8_t pct);
+
+    void        lock()
+    {
+      xSemaphoreTake(_lock, portMAX_DELAY);
+    }
+
+    void        unlock()
+    {
+      xSemaphoreGive(_lock);
+    }
+};
@@ -0,0 +1,69 @@
+#include "WiFiScanSnapshot.h"
+
+WiFiScanSnapshots::WiFiScanSnapshots()
+{
+  memset(_slots, 0, sizeof(_slots));
+
+  for (uint8_t i = 0; i < WIFI_SCAN_SNAPSHOTS; i++)
+    _refs[i].store(0, std::memory_order_relaxed);
+
+  _generation.store(0, std::memory_order_relaxed);
+
+  // An empty table until the first scan is published
+  _current.store(&_slots[0], std::memory_order_release);
+}
+
+//////////////////////////////////////////
+
+const WiFi_ScanSnapshot* WiFiScanSnapshots::acquire()
+{
+  for (;;)
+  {
+    WiFi_ScanSnapshot*  snapshot  = _current.load(std::memory_order_acquire);
+    uint32_t            refs      = _refs[index(snapshot)].fetch_add(1, std::memory_order_acq_rel);
+
+    // Not claimed : either still current, or an older complete one, fine to read until released.
+    // Claimed : it was retired and the writer is refilling it since we loaded the pointer, take the new one
+    if (!(refs & WIFI_SNAPSHOT_CLAIMED))
+      return snapshot;
+
+    _refs[index(snapshot)].fetch_sub(1, std::memory_order_release);
+  }
+}
+
+//////////////////////////////////////////
+
+void WiFiScanSnapshots::release(const WiFi_ScanSnapshot* snapshot)
+{
+  if (snapshot)
+    _refs[index(snapshot)].fetch_sub(1, std::memory_order_release);
+}
+
+//////////////////////////////////////////
+
+WiFi_ScanSnapshot* WiFiScanSnapshots::claim()
+{
+  WiFi_ScanSnapshot* current = _current.load(std::memory_order_relaxed);
+
+  for (uint8_t i = 0; i < WIFI_SCAN_SNAPSHOTS; i++)
+  {
+    uint32_t unused = 0;
+
+    // Acquire pairs with the readers' release : they are done reading before we overwrite
+    if ( (&_slots[i] != current) && _refs[i].compare_exchange_strong(unused, WIFI_SNAPSHOT_CLAIMED, std::memory_order_acquire) )
+      return &_slots[i];
+  }
+
+  return NULL;
+}
+
+//////////////////////////////////////////
+
+void WiFiScanSnapshots::publish(WiFi_ScanSnapshot* snapshot)
+{
+  // Readers that bumped the count while it was claimed keep their (backed out) share
+  _refs[index(snapshot)].fetch_and(~ (uint32_t) WIFI_SNAPSHOT_CLAIMED, std::memory_order_release);
+
+  _generation.store(snapshot->generation, std::memory_order_release);
+  _current.store(snapshot, std::memory_order_release);
+}
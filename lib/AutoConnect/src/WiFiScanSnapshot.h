@@ -0,0 +1,86 @@
+#pragma once
+
+#include <Arduino.h>
+#include <atomic>
+
+#include "WiFiCredentialStore.h"
+
+#ifndef WIFI_SCAN_MAX_RESULTS
+  #define WIFI_SCAN_MAX_RESULTS       64
+#endif
+
+#ifndef WIFI_SCAN_SNAPSHOTS
+  // Published scan tables : the current one, one a slow /scan client may still stream, one being filled
+  #define WIFI_SCAN_SNAPSHOTS         3
+#endif
+
+// Fixed-size scan record, everything inline so the table is one contiguous block without heap traffic.
+// Records are keyed by BSSID and merged in place across scans.
+typedef struct
+{
+  char      SSID[WIFI_SSID_MAXLEN + 1];
+  uint8_t   SSIDLength;
+  uint8_t   BSSID[6];
+  int8_t    RSSI;           // smoothed, RSSIx16 / 16
+  int16_t   RSSIx16;        // exponentially weighted RSSI, fixed point
+  uint16_t  hits;
+  uint32_t  lastSeen;
+  uint8_t   channel;
+  uint8_t   encryptionType;
+  uint8_t   quality;
+  bool      duplicate;
+  bool      isHidden;
+  uint32_t  SSIDHash;
+}  WiFiScanRecord;
+
+// Immutable copy of the scan table, as published to the HTTP handlers
+typedef struct
+{
+  uint32_t        generation;
+  uint16_t        count;
+  WiFiScanRecord  records[WIFI_SCAN_MAX_RESULTS];
+}  WiFi_ScanSnapshot;
+
+/////////////////////////////////////////////////////////////////////////////
+
+// RCU-style publication of scan tables from one writer (the manager loop) to any number of readers
+// (the AsyncTCP task). The writer fills a free slot of a fixed pool and swaps the current pointer to it.
+// Readers take a reference on the current slot, which then can't be reused until they release it.
+// Nobody waits : a reader retries if it raced with a claim, the writer defers if every slot is held.
+class WiFiScanSnapshots
+{
+  public:
+
+    WiFiScanSnapshots();
+
+    // Reader side, any task. Never NULL. Must be released, the slot stays held until then
+    const WiFi_ScanSnapshot*  acquire();
+    void                      release(const WiFi_ScanSnapshot* snapshot);
+
+    // Generation of the current snapshot, without taking a reference
+    uint32_t    generation()
+    {
+      return _generation.load(std::memory_order_acquire);
+    }
+
+    // Writer side, a single task. A slot neither current nor held by a reader, NULL if there is none
+    WiFi_ScanSnapshot*  claim();
+
+    // Make a claimed slot the current one. The previous one is reused once its last reader released it
+    void        publish(WiFi_ScanSnapshot* snapshot);
+
+  private:
+
+    // Set in a slot's reference count while the writer fills it
+    #define WIFI_SNAPSHOT_CLAIMED     0x80000000UL
+
+    WiFi_ScanSnapshot                 _slots[WIFI_SCAN_SNAPSHOTS];
+    std::atomic<uint32_t>             _refs[WIFI_SCAN_SNAPSHOTS];
+    std::atomic<WiFi_ScanSnapshot*>   _current;
+    std::atomic<uint32_t>             _generation;
+
+    uint8_t     index(const WiFi_ScanSnapshot* snapshot)
+    {
+      return snapshot - _slots;
+    }
+};
@@ -0,0 +1,154 @@
+#include "WiFiTimerWheel.h"
+
+WiFiTimerWheel::WiFiTimerWheel()
+{
+  memset(_slots, WIFI_TIMER_NONE, sizeof(_slots));
+
+  for (uint8_t id = 0; id < WIFI_TIMERS_MAX; id++)
+  {
+    _timers[id].deadline  = WIFI_TIMER_NEVER;
+    _timers[id].slot      = 0;
+    _timers[id].next      = WIFI_TIMER_NONE;
+    _timers[id].prev      = WIFI_TIMER_NONE;
+    _timers[id].pending   = false;
+    _timers[id].expired   = false;
+  }
+}
+
+//////////////////////////////////////////
+
+void WiFiTimerWheel::unlink(uint8_t id)
+{
+  WiFi_Timer& timer = _timers[id];
+
+  if (timer.prev != WIFI_TIMER_NONE)
+    _timers[timer.prev].next = timer.next;
+  else
+    _slots[timer.slot] = timer.next;
+
+  if (timer.next != WIFI_TIMER_NONE)
+    _timers[timer.next].prev = timer.prev;
+
+  timer.next    = WIFI_TIMER_NONE;
+  timer.prev    = WIFI_TIMER_NONE;
+  timer.pending = false;
+
+  // Only the earliest leaving changes the next deadline
+  if (timer.deadline == _next)
+    _nextValid = false;
+}
+
+//////////////////////////////////////////
+
+void WiFiTimerWheel::schedule(uint8_t id, uint64_t deadline)
+{
+  if (id >= WIFI_TIMERS_MAX)
+    return;
+
+  WiFi_Timer& timer = _timers[id];
+
+  if (timer.pending)
+    unlink(id);
+
+  // Slots up to the cursor's were walked already, except the cursor's own which poll() walks again
+  uint8_t index = (deadline / WIFI_TIMER_SLOT_MS <= _cursor) ? (_cursor & (WIFI_TIMER_SLOTS - 1)) : slot(deadline);
+
+  timer.deadline  = deadline;
+  timer.slot      = index;
+  timer.expired   = false;
+  timer.pending   = true;
+  timer.prev      = WIFI_TIMER_NONE;
+  timer.next      = _slots[index];
+
+  if (timer.next != WIFI_TIMER_NONE)
+    _timers[timer.next].prev = id;
+
+  _slots[index] = id;
+
+  if (_nextValid && (deadline < _next))
+    _next = deadline;
+}
+
+//////////////////////////////////////////
+
+void WiFiTimerWheel::cancel(uint8_t id)
+{
+  if (id >= WIFI_TIMERS_MAX)
+    return;
+
+  if (_timers[id].pending)
+    unlink(id);
+
+  _timers[id].expired   = false;
+  _timers[id].deadline  = WIFI_TIMER_NEVER;
+}
+
+//////////////////////////////////////////
+
+uint64_t WiFiTimerWheel::deadline(uint8_t id)
+{
+  if ( (id >= WIFI_TIMERS_MAX) || !(_timers[id].pending || _timers[id].expired) )
+    return WIFI_TIMER_NEVER;
+
+  return _timers[id].deadline;
+}
+
+//////////////////////////////////////////
+
+uint32_t WiFiTimerWheel::poll(uint64_t now)
+{
+  uint32_t  fired = 0;
+  uint64_t  tick  = now / WIFI_TIMER_SLOT_MS;
+
+  if (tick < _cursor)
+    return 0;
+
+  // The slot of the current tick is walked again next time, it may hold deadlines later in the tick.
+  // After a long gap one turn of the wheel covers every slot.
+  uint64_t  first = (tick - _cursor >= WIFI_TIMER_SLOTS) ? (tick - WIFI_TIMER_SLOTS + 1) : _cursor;
+
+  for (uint64_t t = first; t <= tick; t++)
+  {
+    int8_t id = _slots[t & (WIFI_TIMER_SLOTS - 1)];
+
+    while (id != WIFI_TIMER_NONE)
+    {
+      int8_t next = _timers[id].next;
+
+      // Others in the slot are due on a later turn
+      if (_timers[id].deadline <= now)
+      {
+        unlink(id);
+
+        _timers[id].expired = true;
+        fired |= (1UL << id);
+      }
+
+      id = next;
+    }
+  }
+
+  _cursor = tick;
+
+  return fired;
+}
+
+//////////////////////////////////////////
+
+uint64_t WiFiTimerWheel::nextDeadline()
+{
+  if (!_nextValid)
+  {
+    _next = WIFI_TIMER_NEVER;
+
+    for (uint8_t id = 0; id < WIFI_TIMERS_MAX; id++)
+    {
+      if (_timers[id].pending && (_timers[id].deadline < _next))
+        _next = _timers[id].deadline;
+    }
+
+    _nextValid = true;
+  }
+
+  return _next;
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <Arduino.h>
+#include <esp_timer.h>
+
+#ifndef WIFI_TIMER_SLOTS
+  // Wheel size, power of 2. Deadlines further out than SLOTS x SLOT_MS simply stay in their slot for more turns
+  #define WIFI_TIMER_SLOTS              32
+#endif
+
+#ifndef WIFI_TIMER_SLOT_MS
+  #define WIFI_TIMER_SLOT_MS            250
+#endif
+
+// Timers held, ids 0 .. WIFI_TIMERS_MAX - 1
+#define WIFI_TIMERS_MAX               16
+
+#define WIFI_TIMER_NONE               -1
+#define WIFI_TIMER_NEVER              UINT64_MAX
+
+/////////////////////////////////////////////////////////////////////////////
+
+// Hashed timer wheel for a fixed set of timers, on a 64-bit millisecond clock that doesn't wrap.
+// schedule() and cancel() are O(1), linking the timer into the slot of its deadline. poll() walks the slots
+// passed since the last poll and moves due timers to expired, where they stay until rescheduled or cancelled.
+// A deadline already due, or due within the tick last polled, goes into the slot poll() walks first, so it
+// expires on the next poll() rather than a turn of the wheel later.
+// The time is always passed in, so the wheel runs as well on a fake clock. No heap use.
+class WiFiTimerWheel
+{
+  public:
+
+    WiFiTimerWheel();
+
+    // Monotonic ms since boot, from esp_timer
+    static uint64_t now()
+    {
+      return esp_timer_get_time() / 1000;
+    }
+
+    // Replaces a pending or expired deadline of the same id
+    void        schedule(uint8_t id, uint64_t deadline);
+    void        cancel(uint8_t id);
+
+    bool        pending(uint8_t id)
+    {
+      return (id < WIFI_TIMERS_MAX) && _timers[id].pending;
+    }
+
+    bool        expired(uint8_t id)
+    {
+      return (id < WIFI_TIMERS_MAX) && _timers[id].expired;
+    }
+
+    // Deadline of a pending or expired timer, WIFI_TIMER_NEVER if not armed
+    uint64_t    deadline(uint8_t id);
+
+    // Expire what is due at now. Returns a bit mask of the timers expired by this call
+    uint32_t    poll(uint64_t now);
+
+    // Earliest pending deadline, WIFI_TIMER_NEVER if none
+    uint64_t    nextDeadline();
+
+  private:
+
+    typedef struct
+    {
+      uint64_t  deadline;
+      uint8_t   slot;           // linked into, not always the slot of the deadline
+      int8_t    next;
+      int8_t    prev;
+      bool      pending;
+      bool      expired;
+    }  WiFi_Timer;
+
+    WiFi_Timer  _timers[WIFI_TIMERS_MAX];
+    int8_t      _slots[WIFI_TIMER_SLOTS];     // first timer of each slot
+    uint64_t    _cursor     = 0;              // slot tick polled last
+    uint64_t    _next       = WIFI_TIMER_NEVER;
+    bool        _nextValid  = true;
+
+    uint8_t     slot(uint64_t deadline)
+    {
+      return (deadline / WIFI_TIMER_SLOT_MS) & (WIFI_TIMER_SLOTS - 1);
+    }
+
+    void        unlink(uint8_t id);
+};
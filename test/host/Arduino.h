@@ -0,0 +1,388 @@
+// Host stand-in for the Arduino core: String, IPAddress, ESP, timing on the simulated clock
+#pragma once
+
+#include <cctype>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <string>
+#include <utility>
+
+#include "HostSim.h"
+
+typedef uint8_t byte;
+
+#define PROGMEM
+// RTC memory survives a reboot within a test binary, HostSim::powerOff() clears it like a cold boot
+#define RTC_DATA_ATTR   __attribute__((section("host_rtc"), used))
+#define IRAM_ATTR
+#define ARDUINO_BOARD   "host"
+#define HEX             16
+#define DEC             10
+
+class __FlashStringHelper;
+#define F(s)            (reinterpret_cast<const __FlashStringHelper*>(s))
+#define FPSTR(s)        (reinterpret_cast<const __FlashStringHelper*>(s))
+
+#ifdef HOSTSIM_LOG
+  #define log_e(fmt, ...)   printf("[E] " fmt "\n", ##__VA_ARGS__)
+  #define log_w(fmt, ...)   printf("[W] " fmt "\n", ##__VA_ARGS__)
+  #define log_i(fmt, ...)   printf("[I] " fmt "\n", ##__VA_ARGS__)
+  #define log_d(fmt, ...)   printf("[D] " fmt "\n", ##__VA_ARGS__)
+  #define log_v(fmt, ...)   do {} while (0)
+#else
+  #define log_e(...)        do {} while (0)
+  #define log_w(...)        do {} while (0)
+  #define log_i(...)        do {} while (0)
+  #define log_d(...)        do {} while (0)
+  #define log_v(...)        do {} while (0)
+#endif
+
+// 32 bits as on the ESP32, so it wraps after 49.7 days of simulated time
+inline unsigned long millis()
+{
+  return (uint32_t) (HostSim::nowUs() / 1000);
+}
+
+inline unsigned long micros()
+{
+  return (unsigned long) HostSim::nowUs();
+}
+
+inline void delay(unsigned long ms)
+{
+  HostSim::advanceMs(ms);
+}
+
+// A pass of a busy loop isn't free, and a spinning loop must not stop the simulated clock
+inline void yield()
+{
+  HostSim::advanceUs(100);
+}
+
+inline void randomSeed(unsigned long seed)
+{
+  srand((unsigned) seed);
+}
+
+inline long random(long howbig)
+{
+  return (howbig <= 0) ? 0 : (rand() % howbig);
+}
+
+inline long random(long howsmall, long howbig)
+{
+  return (howsmall >= howbig) ? howsmall : (howsmall + random(howbig - howsmall));
+}
+
+//////////////////////////////////////////
+
+class String
+{
+  public:
+
+    String() {}
+    String(const char* cstr)                    { if (cstr) _s = cstr; }
+    String(const char* cstr, unsigned int len)  { if (cstr) _s.assign(cstr, len); }
+    String(const __FlashStringHelper* str)      { if (str) _s = reinterpret_cast<const char*>(str); }
+    String(const String& other) = default;
+    String(String&& other) = default;
+    explicit String(char c)                     { _s = c; }
+    explicit String(unsigned char v, unsigned char base = 10) { _s = toBase((unsigned long long) v, base); }
+    explicit String(int v, unsigned char base = 10)           { _s = signedBase(v, base); }
+    explicit String(unsigned int v, unsigned char base = 10)  { _s = toBase(v, base); }
+    explicit String(long v, unsigned char base = 10)          { _s = signedBase(v, base); }
+    explicit String(unsigned long v, unsigned char base = 10) { _s = toBase(v, base); }
+    explicit String(long long v, unsigned char base = 10)     { _s = signedBase(v, base); }
+    explicit String(unsigned long long v, unsigned char base = 10) { _s = toBase(v, base); }
+    explicit String(float v, unsigned int decimals = 2)       { _s = fixed(v, decimals); }
+    explicit String(double v, unsigned int decimals = 2)      { _s = fixed(v, decimals); }
+
+    String& operator=(const String& other) = default;
+    String& operator=(String&& other) = default;
+    String& operator=(const char* cstr)         { _s = cstr ? cstr : ""; return *this; }
+    String& operator=(const __FlashStringHelper* str) { _s = reinterpret_cast<const char*>(str); return *this; }
+
+    const char*   c_str() const                 { return _s.c_str(); }
+    unsigned int  length() const                { return (unsigned int) _s.size(); }
+    bool          isEmpty() const               { return _s.empty(); }
+    bool          reserve(unsigned int size)    { _s.reserve(size); return true; }
+
+    bool concat(const String& s)                { _s += s._s; return true; }
+    bool concat(const char* cstr)               { if (cstr) _s += cstr; return true; }
+    bool concat(const char* cstr, unsigned int len) { if (cstr) _s.append(cstr, len); return true; }
+    bool concat(const __FlashStringHelper* str) { _s += reinterpret_cast<const char*>(str); return true; }
+    bool concat(char c)                         { _s += c; return true; }
+    bool concat(unsigned char v)                { _s += std::to_string(v); return true; }
+    bool concat(int v)                          { _s += std::to_string(v); return true; }
+    bool concat(unsigned int v)                 { _s += std::to_string(v); return true; }
+    bool concat(long v)                         { _s += std::to_string(v); return true; }
+    bool concat(unsigned long v)                { _s += std::to_string(v); return true; }
+    bool concat(long long v)                    { _s += std::to_string(v); return true; }
+    bool concat(unsigned long long v)           { _s += std::to_string(v); return true; }
+    bool concat(float v)                        { _s += fixed(v, 2); return true; }
+    bool concat(double v)                       { _s += fixed(v, 2); return true; }
+
+    template <typename T>
+    String& operator+=(const T& v)              { concat(v); return *this; }
+
+    bool operator==(const String& s) const      { return _s == s._s; }
+    bool operator==(const char* cstr) const     { return _s == (cstr ? cstr : ""); }
+    bool operator!=(const String& s) const      { return _s != s._s; }
+    bool operator!=(const char* cstr) const     { return !(*this == cstr); }
+    bool operator<(const String& s) const       { return _s < s._s; }
+    bool equals(const String& s) const          { return _s == s._s; }
+    bool equals(const char* cstr) const         { return *this == cstr; }
+
+    bool equalsIgnoreCase(const String& s) const
+    {
+      if (_s.size() != s._s.size())
+        return false;
+
+      for (size_t i = 0; i < _s.size(); i++)
+      {
+        if (tolower((unsigned char) _s[i]) != tolower((unsigned char) s._s[i]))
+          return false;
+      }
+
+      return true;
+    }
+
+    bool startsWith(const String& s) const      { return _s.compare(0, s._s.size(), s._s) == 0; }
+    bool endsWith(const String& s) const
+    {
+      return (_s.size() >= s._s.size()) && (_s.compare(_s.size() - s._s.size(), s._s.size(), s._s) == 0);
+    }
+
+    char  charAt(unsigned int i) const          { return (i < _s.size()) ? _s[i] : 0; }
+    void  setCharAt(unsigned int i, char c)     { if (i < _s.size()) _s[i] = c; }
+    char  operator[](unsigned int i) const      { return charAt(i); }
+    char& operator[](unsigned int i)            { return _s[i]; }
+
+    int indexOf(char c, unsigned int from = 0) const { size_t p = _s.find(c, from); return p == std::string::npos ? -1 : (int) p; }
+    int indexOf(const String& s, unsigned int from = 0) const { size_t p = _s.find(s._s, from); return p == std::string::npos ? -1 : (int) p; }
+    int lastIndexOf(char c) const               { size_t p = _s.rfind(c); return p == std::string::npos ? -1 : (int) p; }
+    int lastIndexOf(const String& s) const      { size_t p = _s.rfind(s._s); return p == std::string::npos ? -1 : (int) p; }
+
+    String substring(unsigned int from) const   { return (from >= _s.size()) ? String() : String(_s.substr(from).c_str()); }
+    String substring(unsigned int from, unsigned int to) const
+    {
+      if (from > to)
+        std::swap(from, to);
+
+      if (from >= _s.size())
+        return String();
+
+      return String(_s.substr(from, to - from).c_str());
+    }
+
+    void replace(const String& find, const String& with)
+    {
+      if (find._s.empty())
+        return;
+
+      size_t p = 0;
+
+      while ((p = _s.find(find._s, p)) != std::string::npos)
+      {
+        _s.replace(p, find._s.size(), with._s);
+        p += with._s.size();
+      }
+    }
+
+    void replace(char find, char with)          { std::replace(_s.begin(), _s.end(), find, with); }
+    void remove(unsigned int index)             { if (index < _s.size()) _s.erase(index); }
+    void remove(unsigned int index, unsigned int count) { if (index < _s.size()) _s.erase(index, count); }
+    void toUpperCase()                          { for (char& c : _s) c = toupper((unsigned char) c); }
+    void toLowerCase()                          { for (char& c : _s) c = tolower((unsigned char) c); }
+
+    void trim()
+    {
+      size_t b = _s.find_first_not_of(" \t\r\n");
+      size_t e = _s.find_last_not_of(" \t\r\n");
+
+      _s = (b == std::string::npos) ? std::string() : _s.substr(b, e - b + 1);
+    }
+
+    long  toInt() const                         { return atol(_s.c_str()); }
+    float toFloat() const                       { return (float) atof(_s.c_str()); }
+
+    void getBytes(unsigned char* buf, unsigned int bufsize, unsigned int index = 0) const
+    {
+      if (!bufsize || !buf)
+        return;
+
+      size_t n = (index < _s.size()) ? std::min((size_t) bufsize - 1, _s.size() - index) : 0;
+
+      memcpy(buf, _s.c_str() + index, n);
+      buf[n] = 0;
+    }
+
+    void toCharArray(char* buf, unsigned int bufsize, unsigned int index = 0) const
+    {
+      getBytes((unsigned char*) buf, bufsize, index);
+    }
+
+  private:
+
+    static std::string toBase(unsigned long long v, unsigned char base)
+    {
+      if (base == 10)
+        return std::to_string(v);
+
+      std::string out;
+
+      do
+      {
+        out.insert(out.begin(), "0123456789abcdefghijklmnopqrstuvwxyz"[v % base]);
+        v /= base;
+      } while (v);
+
+      return out;
+    }
+
+    static std::string signedBase(long long v, unsigned char base)
+    {
+      if (base == 10)
+        return std::to_string(v);
+
+      return toBase((unsigned long long) v, base);
+    }
+
+    static std::string fixed(double v, unsigned int decimals)
+    {
+      char buf[64];
+
+      snprintf(buf, sizeof(buf), "%.*f", (int) decimals, v);
+
+      return buf;
+    }
+
+    std::string _s;
+};
+
+template <typename T>
+inline String operator+(const String& lhs, const T& rhs)
+{
+  String s(lhs);
+
+  s += rhs;
+
+  return s;
+}
+
+inline String operator+(const char* lhs, const String& rhs)
+{
+  String s(lhs);
+
+  s += rhs;
+
+  return s;
+}
+
+inline String operator+(const __FlashStringHelper* lhs, const String& rhs)
+{
+  String s(lhs);
+
+  s += rhs;
+
+  return s;
+}
+
+//////////////////////////////////////////
+
+class IPAddress
+{
+  public:
+
+    IPAddress() {}
+    IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d) : _addr((uint32_t) a | ((uint32_t) b << 8) | ((uint32_t) c << 16) | ((uint32_t) d << 24)) {}
+    IPAddress(uint32_t addr) : _addr(addr) {}
+
+    operator uint32_t() const                   { return _addr; }
+    uint8_t operator[](int i) const             { return (uint8_t) (_addr >> (8 * i)); }
+    bool operator==(const IPAddress& o) const   { return _addr == o._addr; }
+    bool operator!=(const IPAddress& o) const   { return _addr != o._addr; }
+    bool operator==(uint32_t addr) const        { return _addr == addr; }
+
+    String toString() const
+    {
+      char buf[16];
+
+      snprintf(buf, sizeof(buf), "%u.%u.%u.%u", (*this)[0], (*this)[1], (*this)[2], (*this)[3]);
+
+      return String(buf);
+    }
+
+    bool fromString(const char* address)
+    {
+      unsigned a, b, c, d;
+      char     tail;
+
+      if ( !address || (sscanf(address, "%u.%u.%u.%u%c", &a, &b, &c, &d, &tail) != 4) || (a > 255) || (b > 255) || (c > 255) || (d > 255) )
+        return false;
+
+      *this = IPAddress(a, b, c, d);
+
+      return true;
+    }
+
+    bool fromString(const String& address)      { return fromString(address.c_str()); }
+
+  private:
+
+    uint32_t _addr = 0;
+};
+
+inline IPAddress INADDR_NONE(0, 0, 0, 0);
+
+//////////////////////////////////////////
+
+class EspClass
+{
+  public:
+
+    uint64_t  getEfuseMac()                     { return efuseMac; }
+    uint32_t  getChipId()                       { return (uint32_t) efuseMac; }
+    uint32_t  getFlashChipSize()                { return 4 * 1024 * 1024; }
+    uint32_t  getFreeHeap()                     { return 200 * 1024; }
+    uint32_t  getCycleCount()                   { return (uint32_t) (HostSim::nowUs() * 240); }
+    void      restart()                         { restarts++; }
+
+    uint64_t          efuseMac  = 0x0000A1B2C3D4E5F6ULL;
+    std::atomic<int>  restarts  { 0 };
+};
+
+inline EspClass ESP;
+
+class Print
+{
+  public:
+
+    size_t print(const char* s)                 { return s ? strlen(s) : 0; }
+    size_t print(const String& s)               { return s.length(); }
+    size_t println(const char* s = "")          { return print(s) + 1; }
+    size_t println(const String& s)             { return s.length() + 1; }
+    size_t println(const IPAddress& ip)         { return ip.toString().length() + 1; }
+
+    template <typename T>
+    size_t print(const T&)                      { return 0; }
+
+    template <typename T>
+    size_t println(const T&)                    { return 1; }
+};
+
+class HardwareSerial : public Print
+{
+  public:
+
+    void begin(unsigned long)                   {}
+    operator bool() const                       { return true; }
+};
+
+inline HardwareSerial Serial;
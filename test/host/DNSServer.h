@@ -0,0 +1,25 @@
+// Host stand-in: counts the polls, so tests can see how often the portal loop runs
+#pragma once
+
+#include <atomic>
+
+#include "Arduino.h"
+
+enum class DNSReplyCode
+{
+  NoError   = 0,
+  NonExistentDomain = 3
+};
+
+class DNSServer
+{
+  public:
+
+    void processNextRequest()                   { polls++; }
+    void setErrorReplyCode(DNSReplyCode)        {}
+    bool start(uint16_t, const String&, IPAddress) { running = true; return true; }
+    void stop()                                 { running = false; }
+
+    std::atomic<uint32_t> polls   { 0 };
+    std::atomic<bool>     running { false };
+};
@@ -0,0 +1,426 @@
+// Host stand-in for ESPAsyncWebServer. Tests build a request, hand it to AsyncWebServer::handle() as the
+// AsyncTCP task would, and read back what the handler sent. Chunked bodies are pulled through the filler
+// with body(), which runs a callback whenever the filler answers RESPONSE_TRY_AGAIN.
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "Arduino.h"
+#include "WiFi.h"
+
+#define RESPONSE_TRY_AGAIN  0xFFFFFFFF
+
+typedef enum
+{
+  HTTP_GET    = 0b00000001,
+  HTTP_POST   = 0b00000010,
+  HTTP_ANY    = 0b01111111
+} WebRequestMethod;
+
+class AsyncWebServerRequest;
+
+typedef std::function<size_t(uint8_t* buffer, size_t maxLen, size_t index)>  AwsResponseFiller;
+typedef std::function<void(AsyncWebServerRequest* request)>                 ArRequestHandlerFunction;
+typedef std::function<bool(AsyncWebServerRequest* request)>                 ArRequestFilterFunction;
+typedef std::function<void(void)>                                           ArDisconnectHandler;
+
+inline bool ON_AP_FILTER(AsyncWebServerRequest*)    { return true; }
+inline bool ON_STA_FILTER(AsyncWebServerRequest*)   { return true; }
+
+class AsyncClient
+{
+  public:
+
+    IPAddress localIP()                         { return WiFi.softAPIP(); }
+};
+
+class AsyncWebHeader
+{
+  public:
+
+    AsyncWebHeader(const String& name, const String& value) : _name(name), _value(value) {}
+
+    const String& name() const                  { return _name; }
+    const String& value() const                 { return _value; }
+
+  private:
+
+    String _name;
+    String _value;
+};
+
+//////////////////////////////////////////
+
+class AsyncWebServerResponse
+{
+  public:
+
+    virtual ~AsyncWebServerResponse() {}
+
+    void addHeader(const String& name, const String& value)
+    {
+      headers.push_back(AsyncWebHeader(name, value));
+    }
+
+    void setCode(int value)                     { code = value; }
+
+    String header(const char* name) const
+    {
+      for (const AsyncWebHeader& h : headers)
+      {
+        if (h.name().equalsIgnoreCase(name))
+          return h.value();
+      }
+
+      return String();
+    }
+
+    bool hasHeader(const char* name) const
+    {
+      for (const AsyncWebHeader& h : headers)
+      {
+        if (h.name().equalsIgnoreCase(name))
+          return true;
+      }
+
+      return false;
+    }
+
+    int                         code        = 200;
+    String                      contentType;
+    String                      content;
+    std::vector<AsyncWebHeader> headers;
+    AwsResponseFiller           filler;
+    bool                        chunked     = false;
+    size_t                      length      = 0;
+};
+
+class AsyncResponseStream : public AsyncWebServerResponse, public Print
+{
+  public:
+
+    size_t write(const uint8_t* data, size_t len)
+    {
+      content.concat((const char*) data, (unsigned int) len);
+      return len;
+    }
+
+    size_t write(uint8_t c)
+    {
+      content.concat((char) c);
+      return 1;
+    }
+};
+
+//////////////////////////////////////////
+
+class AsyncWebServerRequest
+{
+  public:
+
+    AsyncWebServerRequest(const char* url, WebRequestMethod method = HTTP_GET) : _url(url), _method(method) {}
+
+    ~AsyncWebServerRequest()
+    {
+      if (_onDisconnect)
+        _onDisconnect();
+    }
+
+    // Test side
+    AsyncWebServerRequest& withArg(const char* name, const char* value)
+    {
+      _args.push_back(AsyncWebHeader(name, value));
+      return *this;
+    }
+
+    AsyncWebServerRequest& withHeader(const char* name, const char* value)
+    {
+      _headers.push_back(AsyncWebHeader(name, value));
+      return *this;
+    }
+
+    AsyncWebServerRequest& withHost(const char* host)
+    {
+      _host = host;
+      return *this;
+    }
+
+    AsyncWebServerResponse* response()          { return _sent; }
+    int                     sends() const       { return _sends; }
+
+    // Whole body: the content, or what the filler produces in maxLen chunks. retry runs on each
+    // RESPONSE_TRY_AGAIN, up to tries times
+    String body(size_t maxLen = 1460, std::function<void()> retry = std::function<void()>(), int tries = 100000)
+    {
+      if (!_sent)
+        return String();
+
+      if (!_sent->filler)
+        return _sent->content;
+
+      String                out;
+      std::vector<uint8_t>  buf(maxLen);
+      size_t                index = 0;
+
+      while (true)
+      {
+        size_t n = _sent->filler(buf.data(), maxLen, index);
+
+        if (n == RESPONSE_TRY_AGAIN)
+        {
+          if (!retry || (tries-- <= 0))
+            break;
+
+          retry();
+          continue;
+        }
+
+        if (n == 0)
+          break;
+
+        out.concat((const char*) buf.data(), (unsigned int) n);
+        index += n;
+
+        // A sized response ends at its length
+        if (!_sent->chunked && (index >= _sent->length))
+          break;
+      }
+
+      return out;
+    }
+
+    // Handler side
+    AsyncWebServerResponse* beginResponse(int code, const String& contentType = String(), const String& content = String())
+    {
+      AsyncWebServerResponse* response = keep(new AsyncWebServerResponse());
+
+      response->code        = code;
+      response->contentType = contentType;
+      response->content     = content;
+      response->length      = content.length();
+
+      return response;
+    }
+
+    AsyncWebServerResponse* beginChunkedResponse(const String& contentType, AwsResponseFiller callback)
+    {
+      AsyncWebServerResponse* response = keep(new AsyncWebServerResponse());
+
+      response->contentType = contentType;
+      response->filler      = callback;
+      response->chunked     = true;
+
+      return response;
+    }
+
+    AsyncWebServerResponse* beginResponse(const String& contentType, size_t len, AwsResponseFiller callback)
+    {
+      AsyncWebServerResponse* response = keep(new AsyncWebServerResponse());
+
+      response->contentType = contentType;
+      response->filler      = callback;
+      response->length      = len;
+
+      return response;
+    }
+
+    AsyncResponseStream* beginResponseStream(const String& contentType, size_t = 1460)
+    {
+      AsyncResponseStream* response = new AsyncResponseStream();
+
+      keep(response);
+      response->contentType = contentType;
+
+      return response;
+    }
+
+    void send(AsyncWebServerResponse* response)
+    {
+      _sent = response;
+      _sends++;
+    }
+
+    void send(int code, const String& contentType = String(), const String& content = String())
+    {
+      send(beginResponse(code, contentType, content));
+    }
+
+    bool hasHeader(const String& name) const    { return find(_headers, name) != NULL; }
+
+    String header(const char* name) const
+    {
+      const AsyncWebHeader* h = find(_headers, name);
+
+      return h ? h->value() : String();
+    }
+
+    AsyncWebHeader* getHeader(const String& name) const { return const_cast<AsyncWebHeader*>(find(_headers, name)); }
+    AsyncWebHeader* getHeader(size_t i) const   { return (i < _headers.size()) ? const_cast<AsyncWebHeader*>(&_headers[i]) : NULL; }
+    size_t          headers() const             { return _headers.size(); }
+
+    bool hasArg(const char* name) const         { return find(_args, name) != NULL; }
+
+    const String& arg(const String& name) const
+    {
+      const AsyncWebHeader* a = find(_args, name);
+
+      return a ? a->value() : _empty;
+    }
+
+    const String& arg(size_t i) const           { return (i < _args.size()) ? _args[i].value() : _empty; }
+    const String& argName(size_t i) const       { return (i < _args.size()) ? _args[i].name() : _empty; }
+    size_t        args() const                  { return _args.size(); }
+    bool          hasParam(const String& name, bool = false) const { return find(_args, name) != NULL; }
+
+    const String&     url() const               { return _url; }
+    const String&     host() const              { return _host; }
+    WebRequestMethod  method() const            { return _method; }
+    AsyncClient*      client()                  { return &_client; }
+    void              onDisconnect(ArDisconnectHandler fn) { _onDisconnect = fn; }
+
+  private:
+
+    AsyncWebServerResponse* keep(AsyncWebServerResponse* response)
+    {
+      _responses.push_back(std::unique_ptr<AsyncWebServerResponse>(response));
+      return response;
+    }
+
+    static const AsyncWebHeader* find(const std::vector<AsyncWebHeader>& list, const String& name)
+    {
+      for (const AsyncWebHeader& h : list)
+      {
+        if (h.name().equalsIgnoreCase(name))
+          return &h;
+      }
+
+      return NULL;
+    }
+
+    String                                                _url;
+    WebRequestMethod                                      _method;
+    String                                                _host   = "192.168.4.1";
+    String                                                _empty;
+    std::vector<AsyncWebHeader>                           _args;
+    std::vector<AsyncWebHeader>                           _headers;
+    std::vector<std::unique_ptr<AsyncWebServerResponse>>  _responses;
+    AsyncWebServerResponse*                               _sent   = NULL;
+    int                                                   _sends  = 0;
+    AsyncClient                                           _client;
+    ArDisconnectHandler                                   _onDisconnect;
+};
+
+//////////////////////////////////////////
+
+class AsyncCallbackWebHandler
+{
+  public:
+
+    AsyncCallbackWebHandler& setFilter(ArRequestFilterFunction fn)
+    {
+      filter = fn;
+      return *this;
+    }
+
+    String                    uri;
+    WebRequestMethod          method  = HTTP_ANY;
+    ArRequestHandlerFunction  handler;
+    ArRequestFilterFunction   filter;
+};
+
+class AsyncWebServer
+{
+  public:
+
+    AsyncWebServer(uint16_t port) : _port(port) {}
+
+    void begin()                                { std::lock_guard<std::mutex> guard(_lock); _running = true; }
+    void end()                                  { std::lock_guard<std::mutex> guard(_lock); _running = false; }
+
+    void reset()
+    {
+      std::lock_guard<std::mutex> guard(_lock);
+
+      _handlers.clear();
+      _notFound = ArRequestHandlerFunction();
+    }
+
+    AsyncCallbackWebHandler& on(const char* uri, ArRequestHandlerFunction fn)
+    {
+      return on(uri, HTTP_ANY, fn);
+    }
+
+    AsyncCallbackWebHandler& on(const char* uri, WebRequestMethod method, ArRequestHandlerFunction fn)
+    {
+      std::lock_guard<std::mutex> guard(_lock);
+
+      std::shared_ptr<AsyncCallbackWebHandler> handler(new AsyncCallbackWebHandler());
+
+      handler->uri      = uri;
+      handler->method   = method;
+      handler->handler  = fn;
+
+      _handlers.push_back(handler);
+
+      return *handler;
+    }
+
+    void onNotFound(ArRequestHandlerFunction fn)
+    {
+      std::lock_guard<std::mutex> guard(_lock);
+
+      _notFound = fn;
+    }
+
+    bool has(const char* uri)
+    {
+      std::lock_guard<std::mutex> guard(_lock);
+
+      for (auto& h : _handlers)
+      {
+        if (h->uri == uri)
+          return true;
+      }
+
+      return false;
+    }
+
+    // Dispatch as the AsyncTCP task does. Returns false if nothing took the request
+    bool handle(AsyncWebServerRequest& request)
+    {
+      ArRequestHandlerFunction fn;
+
+      {
+        std::lock_guard<std::mutex> guard(_lock);
+
+        for (auto& h : _handlers)
+        {
+          if ( (h->uri == request.url()) && (h->method & request.method()) && (!h->filter || h->filter(&request)) )
+          {
+            fn = h->handler;
+            break;
+          }
+        }
+
+        if (!fn)
+          fn = _notFound;
+      }
+
+      if (!fn)
+        return false;
+
+      fn(&request);
+
+      return true;
+    }
+
+  private:
+
+    uint16_t                                              _port;
+    bool                                                  _running  = false;
+    std::mutex                                            _lock;
+    std::vector<std::shared_ptr<AsyncCallbackWebHandler>> _handlers;
+    ArRequestHandlerFunction                              _notFound;
+};
@@ -0,0 +1,291 @@
+// Host simulation of the ESP32 pieces the library talks to. Header-only, so the native test env needs no
+// extra sources. The clock is simulated: it only moves when the code under test delays, waits or does a
+// blocking driver / NVS operation, and timed driver events (scan done, connected, got IP) are delivered
+// as it passes them, on the thread that moved it. realTime(true) switches to the wall clock for the tests
+// that run the portal task on a real thread.
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <thread>
+
+// Bounds of the RTC_DATA_ATTR variables, provided by the linker
+extern "C" char __start_host_rtc[] __attribute__((weak));
+extern "C" char __stop_host_rtc[] __attribute__((weak));
+
+namespace HostSim
+{
+  static const uint64_t NEVER = UINT64_MAX;
+
+  struct Action
+  {
+    uint64_t              at;
+    std::function<void()> fn;
+  };
+
+  struct Core
+  {
+    std::recursive_mutex                      lock;
+    std::atomic<uint64_t>                     manualUs    { 0 };
+    std::atomic<bool>                         realTime    { false };
+    std::chrono::steady_clock::time_point     origin;
+    uint64_t                                  originUs    = 0;
+    std::multimap<uint64_t, uint64_t>         queue;        // due time -> action id, time order
+    std::map<uint64_t, Action>                actions;
+    uint64_t                                  nextId      = 1;
+
+    // Wall clock, time() = epochS + seconds since boot. 0 : never synced, time() only counts since boot
+    std::atomic<int64_t>                      epochS      { 1790000000 };
+
+    // Blocking operations (mode switch, softAP, flash writes), for the tick duration tests
+    std::atomic<uint32_t>                     blockingOps { 0 };
+    std::atomic<uint64_t>                     blockingUs  { 0 };
+  };
+
+  inline Core& core()
+  {
+    static Core c;
+    return c;
+  }
+
+  inline uint64_t nowUs()
+  {
+    Core& c = core();
+
+    if (c.realTime.load())
+    {
+      return c.originUs + std::chrono::duration_cast<std::chrono::microseconds>(
+               std::chrono::steady_clock::now() - c.origin).count();
+    }
+
+    return c.manualUs.load();
+  }
+
+  // Runs fn once the clock reaches at. Returns an id for cancel()
+  inline uint64_t schedule(uint64_t at, std::function<void()> fn)
+  {
+    std::lock_guard<std::recursive_mutex> guard(core().lock);
+
+    uint64_t id = core().nextId++;
+
+    core().actions[id] = Action { at, fn };
+    core().queue.insert(std::make_pair(at, id));
+
+    return id;
+  }
+
+  inline void cancel(uint64_t id)
+  {
+    std::lock_guard<std::recursive_mutex> guard(core().lock);
+
+    auto it = core().actions.find(id);
+
+    if (it == core().actions.end())
+      return;
+
+    auto range = core().queue.equal_range(it->second.at);
+
+    for (auto q = range.first; q != range.second; ++q)
+    {
+      if (q->second == id)
+      {
+        core().queue.erase(q);
+        break;
+      }
+    }
+
+    core().actions.erase(it);
+  }
+
+  inline uint64_t nextActionUs()
+  {
+    std::lock_guard<std::recursive_mutex> guard(core().lock);
+
+    return core().queue.empty() ? NEVER : core().queue.begin()->first;
+  }
+
+  // Delivers every action due at or before limit, in time order. In manual mode the clock steps to each
+  inline void runUntil(uint64_t limit)
+  {
+    Core& c = core();
+
+    std::lock_guard<std::recursive_mutex> guard(c.lock);
+
+    while (!c.queue.empty() && (c.queue.begin()->first <= limit))
+    {
+      uint64_t at = c.queue.begin()->first;
+      uint64_t id = c.queue.begin()->second;
+
+      c.queue.erase(c.queue.begin());
+
+      std::function<void()> fn = c.actions[id].fn;
+
+      c.actions.erase(id);
+
+      if (!c.realTime.load() && (at > c.manualUs.load()))
+        c.manualUs.store(at);
+
+      fn();
+    }
+  }
+
+  inline void pump()
+  {
+    runUntil(nowUs());
+  }
+
+  // Moves the clock forward, delivering what falls due on the way
+  inline void advanceUs(uint64_t us)
+  {
+    Core& c = core();
+
+    if (c.realTime.load())
+    {
+      uint64_t until = nowUs() + us;
+
+      while (nowUs() < until)
+      {
+        pump();
+
+        uint64_t left = until - nowUs();
+
+        std::this_thread::sleep_for(std::chrono::microseconds(left > 1000 ? 1000 : left));
+      }
+
+      pump();
+      return;
+    }
+
+    std::lock_guard<std::recursive_mutex> guard(c.lock);
+
+    uint64_t until = c.manualUs.load() + us;
+
+    runUntil(until);
+
+    if (c.manualUs.load() < until)
+      c.manualUs.store(until);
+  }
+
+  inline void advanceMs(uint64_t ms)
+  {
+    advanceUs(ms * 1000);
+  }
+
+  // A driver / NVS call that holds the caller for ms
+  inline void block(uint32_t ms)
+  {
+    if (ms == 0)
+      return;
+
+    core().blockingOps++;
+    core().blockingUs += (uint64_t) ms * 1000;
+
+    advanceMs(ms);
+  }
+
+  // Manual mode: steps the clock to the next action until done() or the deadline.
+  // Returns done(), false on timeout.
+  inline bool waitUntil(uint64_t deadlineUs, std::function<bool()> done)
+  {
+    while (true)
+    {
+      if (done())
+        return true;
+
+      uint64_t now = nowUs();
+
+      if (now >= deadlineUs)
+        return false;
+
+      uint64_t next = nextActionUs();
+
+      if (core().realTime.load())
+      {
+        pump();
+
+        std::this_thread::sleep_for(std::chrono::microseconds(200));
+        continue;
+      }
+
+      if ( (next == NEVER) && (deadlineUs == NEVER) )
+      {
+        fprintf(stderr, "HostSim: wait forever with nothing scheduled\n");
+        abort();
+      }
+
+      runUntil(next < deadlineUs ? next : deadlineUs);
+
+      if (core().manualUs.load() < (next < deadlineUs ? next : deadlineUs))
+        core().manualUs.store(next < deadlineUs ? next : deadlineUs);
+    }
+  }
+
+  inline void realTime(bool on)
+  {
+    Core& c = core();
+
+    std::lock_guard<std::recursive_mutex> guard(c.lock);
+
+    if (on == c.realTime.load())
+      return;
+
+    if (on)
+    {
+      c.originUs  = c.manualUs.load();
+      c.origin    = std::chrono::steady_clock::now();
+    }
+    else
+    {
+      c.manualUs.store(nowUs());
+    }
+
+    c.realTime.store(on);
+  }
+
+  // Drops pending actions and puts the clock at startUs. Driver and NVS state have their own resets
+  inline void resetClock(uint64_t startUs = 1000000)
+  {
+    Core& c = core();
+
+    std::lock_guard<std::recursive_mutex> guard(c.lock);
+
+    c.realTime.store(false);
+    c.queue.clear();
+    c.actions.clear();
+    c.manualUs.store(startUs);
+    c.blockingOps.store(0);
+    c.blockingUs.store(0);
+  }
+
+  // Cold boot : RTC memory is lost, unlike on a reset or wake from deep sleep
+  inline void powerOff()
+  {
+    if (__start_host_rtc && __stop_host_rtc)
+      memset(__start_host_rtc, 0, __stop_host_rtc - __start_host_rtc);
+  }
+
+  // Wall clock seen through time(), as set by SNTP. 0 : not synced
+  inline void setEpoch(int64_t seconds)
+  {
+    core().epochS.store(seconds);
+  }
+}
+
+// time() on the simulated clock, the native envs link with -Wl,--wrap=time
+extern "C" inline __attribute__((used)) time_t __wrap_time(time_t* out)
+{
+  time_t now = (time_t) (HostSim::core().epochS.load() + (int64_t) (HostSim::nowUs() / 1000000));
+
+  if (out)
+    *out = now;
+
+  return now;
+}
@@ -0,0 +1,631 @@
+// Simulated WiFi driver behind the esp_wifi_* calls and the WiFi object. Access points are scripted by the
+// test; scans, joins and DHCP take simulated time and report through the Arduino events like the real
+// driver: a join sweeps the channels (or only the given one) looking for the SSID / BSSID, associates, then
+// waits for DHCP unless a static IP is configured. The RAM and flash copies of the STA config are kept
+// apart, so tests can see what a join leaves behind for the next boot or the driver's auto-reconnect.
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "HostSim.h"
+
+typedef enum
+{
+  WL_NO_SHIELD        = 255,
+  WL_IDLE_STATUS      = 0,
+  WL_NO_SSID_AVAIL    = 1,
+  WL_SCAN_COMPLETED   = 2,
+  WL_CONNECTED        = 3,
+  WL_CONNECT_FAILED   = 4,
+  WL_CONNECTION_LOST  = 5,
+  WL_DISCONNECTED     = 6
+} wl_status_t;
+
+#define WIFI_SCAN_RUNNING   (-1)
+#define WIFI_SCAN_FAILED    (-2)
+
+typedef enum
+{
+  ARDUINO_EVENT_WIFI_READY = 0,
+  ARDUINO_EVENT_WIFI_SCAN_DONE,
+  ARDUINO_EVENT_WIFI_STA_START,
+  ARDUINO_EVENT_WIFI_STA_STOP,
+  ARDUINO_EVENT_WIFI_STA_CONNECTED,
+  ARDUINO_EVENT_WIFI_STA_DISCONNECTED,
+  ARDUINO_EVENT_WIFI_STA_AUTHMODE_CHANGE,
+  ARDUINO_EVENT_WIFI_STA_GOT_IP,
+  ARDUINO_EVENT_WIFI_STA_GOT_IP6,
+  ARDUINO_EVENT_WIFI_STA_LOST_IP,
+  ARDUINO_EVENT_WIFI_AP_START,
+  ARDUINO_EVENT_WIFI_AP_STOP,
+  ARDUINO_EVENT_WIFI_AP_STACONNECTED,
+  ARDUINO_EVENT_WIFI_AP_STADISCONNECTED,
+  ARDUINO_EVENT_MAX
+} arduino_event_id_t;
+
+typedef struct
+{
+  uint8_t   ssid[32];
+  uint8_t   ssid_len;
+  uint8_t   bssid[6];
+  uint8_t   reason;
+} wifi_event_sta_disconnected_t;
+
+typedef struct
+{
+  uint8_t   ssid[32];
+  uint8_t   ssid_len;
+  uint8_t   bssid[6];
+  uint8_t   channel;
+} wifi_event_sta_connected_t;
+
+typedef struct
+{
+  struct
+  {
+    struct { uint32_t addr; } ip, netmask, gw;
+  } ip_info;
+  bool ip_changed;
+} ip_event_got_ip_t;
+
+typedef union
+{
+  wifi_event_sta_disconnected_t wifi_sta_disconnected;
+  wifi_event_sta_connected_t    wifi_sta_connected;
+  ip_event_got_ip_t             got_ip;
+} arduino_event_info_t;
+
+typedef arduino_event_id_t    WiFiEvent_t;
+typedef arduino_event_info_t  WiFiEventInfo_t;
+typedef size_t                wifi_event_id_t;
+
+typedef std::function<void(arduino_event_id_t event, arduino_event_info_t info)> WiFiEventFuncCb;
+
+namespace HostWiFi
+{
+  struct AP
+  {
+    std::string       ssid;
+    uint8_t           bssid[6];
+    uint8_t           channel   = 1;
+    int8_t            rssi      = -60;
+    wifi_auth_mode_t  auth      = WIFI_AUTH_WPA2_PSK;
+    std::string       password;
+    uint32_t          assocMs   = 300;      // authentication + association
+    uint32_t          dhcpMs    = 1500;     // DISCOVER .. ACK
+    bool              up        = true;
+    uint32_t          lease     = 0;        // address DHCP hands out, 0 : 192.168.1.(100 + index)
+  };
+
+  struct Driver
+  {
+    std::vector<AP>           aps;
+
+    wifi_mode_t               mode            = WIFI_MODE_NULL;
+    wifi_storage_t            storage         = WIFI_STORAGE_FLASH;
+    wifi_sta_config_t         ram             = {};
+    wifi_sta_config_t         flash           = {};
+    bool                      autoConnect     = true;
+    bool                      autoReconnect   = true;
+    std::string               hostname        = "esp32-host";
+
+    // Link and IP
+    wl_status_t               status          = WL_NO_SHIELD;
+    int                       ap              = -1;       // associated AP, -1 none
+    bool                      dhcp            = true;
+    bool                      hasIP           = false;
+    uint32_t                  ip = 0, gw = 0, sn = 0, dns1 = 0, dns2 = 0;
+    uint32_t                  staticIP = 0, staticGW = 0, staticSN = 0, staticDNS1 = 0, staticDNS2 = 0;
+
+    // Current join: its pending steps are dropped by the next begin() / disconnect()
+    std::vector<uint64_t>     steps;
+
+    // Scan
+    bool                      scanning        = false;
+    bool                      scanValid       = false;
+    std::vector<wifi_ap_record_t> results;
+
+    // Soft AP
+    bool                      apUp            = false;
+    std::string               apSSID;
+    uint32_t                  apIP            = 0x0104A8C0;   // 192.168.4.1
+
+    // Timing, ms
+    uint32_t                  channelDwellMs  = 150;      // scan time per channel, max_ms_per_chan caps it
+    uint32_t                  connectDwellMs  = 100;      // join sweep, per channel visited
+    uint32_t                  modeMs          = 0;        // blocking WiFi.mode() switch
+    uint32_t                  softAPMs        = 0;        // blocking WiFi.softAP()
+    uint32_t                  flashWriteMs    = 0;        // blocking STA config write to flash
+
+    // What the code under test did
+    uint32_t                  scansStarted    = 0;
+    uint32_t                  begins          = 0;
+    uint32_t                  getConfigCalls  = 0;
+    uint32_t                  flashWrites     = 0;
+    uint32_t                  modeChanges     = 0;
+    uint32_t                  softAPCalls     = 0;
+    uint32_t                  configCalls     = 0;
+    uint32_t                  disconnects     = 0;
+    uint32_t                  dhcpStarts      = 0;
+    uint8_t                   lastScanChannel = 0;
+    int32_t                   lastBeginChannel = 0;
+    bool                      lastBeginPinned = false;
+    std::string               lastBeginSSID;
+
+    std::vector<std::pair<wifi_event_id_t, WiFiEventFuncCb>> handlers;
+    wifi_event_id_t           nextHandler     = 1;
+  };
+
+  inline Driver& driver()
+  {
+    static Driver d;
+    return d;
+  }
+
+  inline std::recursive_mutex& lock()
+  {
+    return HostSim::core().lock;
+  }
+
+  // Power-on state. Flash config and APs survive unless wipe
+  inline void boot(bool wipe = false)
+  {
+    std::lock_guard<std::recursive_mutex> guard(lock());
+
+    Driver& d = driver();
+    Driver  fresh;
+
+    if (!wipe)
+    {
+      fresh.aps   = d.aps;
+      fresh.flash = d.flash;
+    }
+
+    fresh.ram = fresh.flash;
+
+    d = fresh;
+  }
+
+  inline int addAP(const char* ssid, const char* password, uint8_t channel, int8_t rssi, uint8_t bssidTail = 0)
+  {
+    std::lock_guard<std::recursive_mutex> guard(lock());
+
+    AP ap;
+
+    ap.ssid     = ssid;
+    ap.password = password ? password : "";
+    ap.auth     = (password && password[0]) ? WIFI_AUTH_WPA2_PSK : WIFI_AUTH_OPEN;
+    ap.channel  = channel;
+    ap.rssi     = rssi;
+
+    uint8_t tail = bssidTail ? bssidTail : (uint8_t) (driver().aps.size() + 1);
+    uint8_t bssid[6] = { 0x02, 0x11, 0x22, 0x33, 0x44, tail };
+
+    memcpy(ap.bssid, bssid, 6);
+
+    driver().aps.push_back(ap);
+
+    return (int) driver().aps.size() - 1;
+  }
+
+  inline AP& ap(int index)
+  {
+    return driver().aps[index];
+  }
+
+  inline uint32_t leaseOf(int index)
+  {
+    AP& a = driver().aps[index];
+
+    return a.lease ? a.lease : (0x0001A8C0 | ((uint32_t) (100 + index) << 24));
+  }
+
+  inline void dispatch(arduino_event_id_t event, const arduino_event_info_t& info);
+
+  inline void post(arduino_event_id_t event, arduino_event_info_t info, uint64_t delayMs = 0, bool step = false)
+  {
+    uint64_t id = HostSim::schedule(HostSim::nowUs() + delayMs * 1000, [event, info]()
+    {
+      dispatch(event, info);
+    });
+
+    if (step)
+      driver().steps.push_back(id);
+  }
+
+  inline void schedule(uint64_t delayMs, std::function<void()> fn)
+  {
+    driver().steps.push_back(HostSim::schedule(HostSim::nowUs() + delayMs * 1000, fn));
+  }
+
+  inline void dropSteps()
+  {
+    for (uint64_t id : driver().steps)
+      HostSim::cancel(id);
+
+    driver().steps.clear();
+  }
+
+  inline arduino_event_info_t disconnectInfo(const char* ssid, uint8_t reason)
+  {
+    arduino_event_info_t info;
+
+    memset(&info, 0, sizeof(info));
+
+    size_t len = strnlen(ssid, 32);
+
+    memcpy(info.wifi_sta_disconnected.ssid, ssid, len);
+    info.wifi_sta_disconnected.ssid_len = (uint8_t) len;
+    info.wifi_sta_disconnected.reason   = reason;
+
+    return info;
+  }
+
+  // Link gone : clear it now, report it through the event task
+  inline void dropLink(uint8_t reason)
+  {
+    Driver& d = driver();
+
+    if (d.ap < 0)
+      return;
+
+    std::string ssid = d.aps[d.ap].ssid;
+
+    d.ap    = -1;
+    d.hasIP = false;
+    d.ip    = 0;
+
+    post(ARDUINO_EVENT_WIFI_STA_DISCONNECTED, disconnectInfo(ssid.c_str(), reason));
+  }
+
+  inline void gotIP(bool fromDHCP)
+  {
+    Driver& d = driver();
+
+    if (fromDHCP)
+    {
+      d.ip    = leaseOf(d.ap);
+      d.gw    = 0x0101A8C0;
+      d.sn    = 0x00FFFFFF;
+      d.dns1  = 0x0101A8C0;
+      d.dns2  = 0;
+    }
+    else
+    {
+      d.ip    = d.staticIP;
+      d.gw    = d.staticGW;
+      d.sn    = d.staticSN;
+      d.dns1  = d.staticDNS1;
+      d.dns2  = d.staticDNS2;
+    }
+
+    d.hasIP = true;
+
+    arduino_event_info_t info;
+
+    memset(&info, 0, sizeof(info));
+    info.got_ip.ip_info.ip.addr       = d.ip;
+    info.got_ip.ip_info.gw.addr       = d.gw;
+    info.got_ip.ip_info.netmask.addr  = d.sn;
+
+    dispatch(ARDUINO_EVENT_WIFI_STA_GOT_IP, info);
+  }
+
+  // esp_wifi_connect() with the RAM config
+  inline void connect()
+  {
+    Driver& d = driver();
+
+    dropSteps();
+
+    if (d.ap >= 0)
+      dropLink(WIFI_REASON_ASSOC_LEAVE);
+
+    wifi_sta_config_t cfg = d.ram;
+    char ssid[33] = { 0 };
+
+    memcpy(ssid, cfg.ssid, 32);
+
+    if (!ssid[0])
+      return;
+
+    // Fast scan : visit the channels in order, take the strongest match on the first channel that has one
+    int     found   = -1;
+    int     visited = 0;
+
+    for (uint8_t ch = (cfg.channel ? cfg.channel : 1); ch <= (cfg.channel ? cfg.channel : 13); ch++)
+    {
+      visited++;
+
+      for (size_t i = 0; i < d.aps.size(); i++)
+      {
+        AP& a = d.aps[i];
+
+        if ( !a.up || (a.channel != ch) || (a.ssid != ssid) || (cfg.bssid_set && memcmp(cfg.bssid, a.bssid, 6)) )
+          continue;
+
+        if ( (found < 0) || (a.rssi > d.aps[found].rssi) )
+          found = (int) i;
+      }
+
+      if (found >= 0)
+        break;
+    }
+
+    uint64_t sweepMs = (uint64_t) visited * d.connectDwellMs;
+
+    if (found < 0)
+    {
+      std::string name = ssid;
+
+      schedule(sweepMs, [name]()
+      {
+        driver().steps.clear();
+        dispatch(ARDUINO_EVENT_WIFI_STA_DISCONNECTED, disconnectInfo(name.c_str(), WIFI_REASON_NO_AP_FOUND));
+      });
+
+      return;
+    }
+
+    AP&       a       = d.aps[found];
+    uint64_t  assocAt = sweepMs + a.assocMs;
+
+    if ( (a.auth != WIFI_AUTH_OPEN) && (a.password != std::string((const char*) cfg.password, strnlen((const char*) cfg.password, 64))) )
+    {
+      std::string name = ssid;
+
+      schedule(assocAt, [name]()
+      {
+        driver().steps.clear();
+        dispatch(ARDUINO_EVENT_WIFI_STA_DISCONNECTED, disconnectInfo(name.c_str(), WIFI_REASON_AUTH_FAIL));
+      });
+
+      return;
+    }
+
+    uint32_t dhcpMs = a.dhcpMs;
+
+    schedule(assocAt, [found, dhcpMs]()
+    {
+      Driver& d = driver();
+
+      d.ap = found;
+
+      arduino_event_info_t info;
+
+      memset(&info, 0, sizeof(info));
+      memcpy(info.wifi_sta_connected.ssid, d.aps[found].ssid.c_str(), d.aps[found].ssid.size());
+      info.wifi_sta_connected.ssid_len  = (uint8_t) d.aps[found].ssid.size();
+      info.wifi_sta_connected.channel   = d.aps[found].channel;
+      memcpy(info.wifi_sta_connected.bssid, d.aps[found].bssid, 6);
+
+      dispatch(ARDUINO_EVENT_WIFI_STA_CONNECTED, info);
+
+      if (!d.dhcp)
+      {
+        gotIP(false);
+        return;
+      }
+
+      schedule(dhcpMs, []()
+      {
+        driver().steps.clear();
+        gotIP(true);
+      });
+    });
+  }
+
+  // Arduino's own handling runs first, then the registered callbacks
+  inline void dispatch(arduino_event_id_t event, const arduino_event_info_t& info)
+  {
+    Driver& d = driver();
+    bool    reconnect = false;
+
+    switch (event)
+    {
+      case ARDUINO_EVENT_WIFI_STA_START:
+        d.status = WL_DISCONNECTED;
+        break;
+
+      case ARDUINO_EVENT_WIFI_STA_GOT_IP:
+        d.status = WL_CONNECTED;
+        break;
+
+      case ARDUINO_EVENT_WIFI_STA_DISCONNECTED:
+      {
+        uint8_t reason = info.wifi_sta_disconnected.reason;
+
+        if (reason == WIFI_REASON_NO_AP_FOUND)
+          d.status = WL_NO_SSID_AVAIL;
+        else if ( (reason == WIFI_REASON_AUTH_FAIL) || (reason == WIFI_REASON_4WAY_HANDSHAKE_TIMEOUT) )
+          d.status = WL_CONNECT_FAILED;
+        else if ( (reason == WIFI_REASON_BEACON_TIMEOUT) || (reason == WIFI_REASON_HANDSHAKE_TIMEOUT) )
+          d.status = WL_CONNECTION_LOST;
+        else
+          d.status = WL_DISCONNECTED;
+
+        reconnect = d.autoReconnect && ( (reason == WIFI_REASON_AUTH_EXPIRE) ||
+                                         ((reason >= WIFI_REASON_BEACON_TIMEOUT) && (reason != WIFI_REASON_AUTH_FAIL)) );
+        break;
+      }
+
+      default:
+        break;
+    }
+
+    if (reconnect)
+      connect();
+
+    std::vector<std::pair<wifi_event_id_t, WiFiEventFuncCb>> handlers = d.handlers;
+
+    for (auto& handler : handlers)
+      handler.second(event, info);
+  }
+
+  // The AP goes away or comes back. An associated station loses it on the beacon timeout
+  inline void setUp(int index, bool up)
+  {
+    std::lock_guard<std::recursive_mutex> guard(lock());
+
+    Driver& d = driver();
+
+    d.aps[index].up = up;
+
+    if (!up && (d.ap == index))
+    {
+      dropSteps();
+      dropLink(WIFI_REASON_BEACON_TIMEOUT);
+    }
+  }
+
+  inline void writeConfig(const wifi_sta_config_t& cfg)
+  {
+    Driver& d = driver();
+
+    d.ram = cfg;
+
+    if ( (d.storage == WIFI_STORAGE_FLASH) && memcmp(&d.flash, &cfg, sizeof(cfg)) )
+    {
+      d.flash = cfg;
+      d.flashWrites++;
+
+      HostSim::block(d.flashWriteMs);
+    }
+  }
+
+  inline bool setMode(wifi_mode_t mode)
+  {
+    Driver& d = driver();
+
+    if (mode == d.mode)
+      return true;
+
+    wifi_mode_t old = d.mode;
+
+    d.modeChanges++;
+    d.mode = mode;
+
+    HostSim::block(d.modeMs);
+
+    arduino_event_info_t info;
+
+    memset(&info, 0, sizeof(info));
+
+    bool staWas = (old == WIFI_MODE_STA) || (old == WIFI_MODE_APSTA);
+    bool staNow = (mode == WIFI_MODE_STA) || (mode == WIFI_MODE_APSTA);
+    bool apNow  = (mode == WIFI_MODE_AP) || (mode == WIFI_MODE_APSTA);
+
+    if (staNow && !staWas)
+    {
+      d.status = WL_DISCONNECTED;
+      post(ARDUINO_EVENT_WIFI_STA_START, info);
+    }
+    else if (!staNow && staWas)
+    {
+      dropSteps();
+      dropLink(WIFI_REASON_ASSOC_LEAVE);
+      d.status = WL_NO_SHIELD;
+      post(ARDUINO_EVENT_WIFI_STA_STOP, info);
+    }
+
+    if (!apNow && d.apUp)
+    {
+      d.apUp = false;
+      post(ARDUINO_EVENT_WIFI_AP_STOP, info);
+    }
+
+    return true;
+  }
+
+  inline std::vector<wifi_ap_record_t> scanChannels(uint8_t channel)
+  {
+    std::vector<wifi_ap_record_t> out;
+
+    for (AP& a : driver().aps)
+    {
+      if (!a.up || (channel && (a.channel != channel)))
+        continue;
+
+      wifi_ap_record_t record;
+
+      memset(&record, 0, sizeof(record));
+      memcpy(record.ssid, a.ssid.c_str(), std::min<size_t>(a.ssid.size(), 32));
+      memcpy(record.bssid, a.bssid, 6);
+      record.primary  = a.channel;
+      record.rssi     = a.rssi;
+      record.authmode = a.auth;
+
+      out.push_back(record);
+    }
+
+    return out;
+  }
+
+  inline void reset()
+  {
+    {
+      std::lock_guard<std::recursive_mutex> guard(lock());
+
+      driver() = Driver();
+    }
+  }
+}
+
+inline esp_err_t esp_wifi_get_config(wifi_interface_t, wifi_config_t* conf)
+{
+  std::lock_guard<std::recursive_mutex> guard(HostWiFi::lock());
+
+  HostWiFi::driver().getConfigCalls++;
+
+  if (HostWiFi::driver().mode == WIFI_MODE_NULL)
+    return ESP_ERR_WIFI_NOT_INIT;
+
+  conf->sta = HostWiFi::driver().ram;
+
+  return ESP_OK;
+}
+
+inline esp_err_t esp_wifi_set_config(wifi_interface_t, wifi_config_t* conf)
+{
+  std::lock_guard<std::recursive_mutex> guard(HostWiFi::lock());
+
+  if (HostWiFi::driver().mode == WIFI_MODE_NULL)
+    return ESP_ERR_WIFI_NOT_INIT;
+
+  HostWiFi::writeConfig(conf->sta);
+
+  return ESP_OK;
+}
+
+inline esp_err_t esp_wifi_set_storage(wifi_storage_t storage)
+{
+  std::lock_guard<std::recursive_mutex> guard(HostWiFi::lock());
+
+  HostWiFi::driver().storage = storage;
+
+  return ESP_OK;
+}
+
+inline esp_err_t esp_wifi_sta_get_ap_info(wifi_ap_record_t* record)
+{
+  std::lock_guard<std::recursive_mutex> guard(HostWiFi::lock());
+
+  HostWiFi::Driver& d = HostWiFi::driver();
+
+  if (d.ap < 0)
+    return ESP_ERR_WIFI_NOT_CONNECT;
+
+  memset(record, 0, sizeof(*record));
+  memcpy(record->ssid, d.aps[d.ap].ssid.c_str(), std::min<size_t>(d.aps[d.ap].ssid.size(), 32));
+  memcpy(record->bssid, d.aps[d.ap].bssid, 6);
+  record->primary = d.aps[d.ap].channel;
+  record->rssi    = d.aps[d.ap].rssi;
+
+  return ESP_OK;
+}
@@ -0,0 +1,214 @@
+// Host stand-in for NVS: namespaces of keys in memory, shared by every Preferences object. Every put or
+// remove counts as a flash write and blocks for HostNVS::writeMs, every get is counted as a read.
+#pragma once
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "Arduino.h"
+
+namespace HostNVS
+{
+  typedef std::map<std::string, std::vector<uint8_t>>  Namespace;
+
+  struct Store
+  {
+    std::recursive_mutex                  lock;
+    std::map<std::string, Namespace>      spaces;
+    std::map<std::string, uint32_t>       writesByKey;
+    uint32_t                              writes    = 0;
+    uint32_t                              reads     = 0;
+    uint32_t                              writeMs   = 0;
+  };
+
+  inline Store& store()
+  {
+    static Store s;
+    return s;
+  }
+
+  inline uint32_t writes()
+  {
+    std::lock_guard<std::recursive_mutex> guard(store().lock);
+
+    return store().writes;
+  }
+
+  inline uint32_t writes(const char* key)
+  {
+    std::lock_guard<std::recursive_mutex> guard(store().lock);
+
+    return store().writesByKey[key];
+  }
+
+  inline uint32_t reads()
+  {
+    std::lock_guard<std::recursive_mutex> guard(store().lock);
+
+    return store().reads;
+  }
+
+  inline void reset()
+  {
+    std::lock_guard<std::recursive_mutex> guard(store().lock);
+
+    store().spaces.clear();
+    store().writesByKey.clear();
+    store().writes  = 0;
+    store().reads   = 0;
+    store().writeMs = 0;
+  }
+
+  inline void countWrite(const char* key)
+  {
+    uint32_t ms;
+
+    {
+      std::lock_guard<std::recursive_mutex> guard(store().lock);
+
+      store().writes++;
+      store().writesByKey[key]++;
+      ms = store().writeMs;
+    }
+
+    HostSim::block(ms);
+  }
+}
+
+class Preferences
+{
+  public:
+
+    bool begin(const char* name, bool readOnly = false, const char* = NULL)
+    {
+      std::lock_guard<std::recursive_mutex> guard(HostNVS::store().lock);
+
+      // Like nvs_open(), a namespace never written can't be opened read-only
+      if (readOnly && !HostNVS::store().spaces.count(name))
+        return false;
+
+      _name     = name;
+      _readOnly = readOnly;
+      _open     = true;
+
+      HostNVS::store().spaces[_name];
+
+      return true;
+    }
+
+    void end()
+    {
+      _open = false;
+    }
+
+    size_t putBytes(const char* key, const void* value, size_t len)
+    {
+      if (!_open || _readOnly)
+        return 0;
+
+      {
+        std::lock_guard<std::recursive_mutex> guard(HostNVS::store().lock);
+
+        space()[key].assign((const uint8_t*) value, (const uint8_t*) value + len);
+      }
+
+      HostNVS::countWrite(key);
+
+      return len;
+    }
+
+    size_t getBytesLength(const char* key)
+    {
+      std::lock_guard<std::recursive_mutex> guard(HostNVS::store().lock);
+
+      HostNVS::store().reads++;
+
+      if (!_open || !space().count(key))
+        return 0;
+
+      return space()[key].size();
+    }
+
+    size_t getBytes(const char* key, void* buf, size_t maxLen)
+    {
+      std::lock_guard<std::recursive_mutex> guard(HostNVS::store().lock);
+
+      HostNVS::store().reads++;
+
+      if (!_open || !space().count(key))
+        return 0;
+
+      std::vector<uint8_t>& value = space()[key];
+
+      // nvs_get_blob() fails on a short buffer
+      if (value.size() > maxLen)
+        return 0;
+
+      memcpy(buf, value.data(), value.size());
+
+      return value.size();
+    }
+
+    size_t putUInt(const char* key, uint32_t value)
+    {
+      return putBytes(key, &value, sizeof(value));
+    }
+
+    uint32_t getUInt(const char* key, uint32_t defaultValue = 0)
+    {
+      uint32_t value;
+
+      return (getBytes(key, &value, sizeof(value)) == sizeof(value)) ? value : defaultValue;
+    }
+
+    bool isKey(const char* key)
+    {
+      std::lock_guard<std::recursive_mutex> guard(HostNVS::store().lock);
+
+      return _open && space().count(key);
+    }
+
+    bool remove(const char* key)
+    {
+      if (!_open || _readOnly)
+        return false;
+
+      bool found;
+
+      {
+        std::lock_guard<std::recursive_mutex> guard(HostNVS::store().lock);
+
+        found = space().erase(key) != 0;
+      }
+
+      if (found)
+        HostNVS::countWrite(key);
+
+      return found;
+    }
+
+    bool clear()
+    {
+      if (!_open || _readOnly)
+        return false;
+
+      std::lock_guard<std::recursive_mutex> guard(HostNVS::store().lock);
+
+      space().clear();
+
+      return true;
+    }
+
+  private:
+
+    HostNVS::Namespace& space()
+    {
+      return HostNVS::store().spaces[_name];
+    }
+
+    std::string _name;
+    bool        _readOnly = false;
+    bool        _open     = false;
+};
@@ -0,0 +1,434 @@
+// Host stand-in for the Arduino WiFi object, over the simulated driver in HostWiFi.h
+#pragma once
+
+#include "Arduino.h"
+#include "esp_wifi.h"
+
+class WiFiClass
+{
+  public:
+
+    wl_status_t status()
+    {
+      Guard guard;
+      return HostWiFi::driver().status;
+    }
+
+    bool mode(wifi_mode_t mode)
+    {
+      Guard guard;
+      return HostWiFi::setMode(mode);
+    }
+
+    wifi_mode_t getMode()
+    {
+      Guard guard;
+      return HostWiFi::driver().mode;
+    }
+
+    bool getAutoConnect()               { Guard guard; return HostWiFi::driver().autoConnect; }
+    bool setAutoConnect(bool on)        { Guard guard; HostWiFi::driver().autoConnect = on; return true; }
+    bool getAutoReconnect()             { Guard guard; return HostWiFi::driver().autoReconnect; }
+    bool setAutoReconnect(bool on)      { Guard guard; HostWiFi::driver().autoReconnect = on; return true; }
+    void persistent(bool)               {}
+    bool setHostname(const char* name)  { Guard guard; HostWiFi::driver().hostname = name; return true; }
+    const char* getHostname()           { Guard guard; return HostWiFi::driver().hostname.c_str(); }
+
+    //////////////////////////////////////////
+
+    wl_status_t begin(const char* ssid, const char* passphrase = NULL, int32_t channel = 0, const uint8_t* bssid = NULL,
+                      bool connect = true)
+    {
+      Guard guard;
+      HostWiFi::Driver& d = HostWiFi::driver();
+
+      d.begins++;
+      d.lastBeginSSID     = ssid ? ssid : "";
+      d.lastBeginChannel  = channel;
+      d.lastBeginPinned   = (bssid != NULL);
+
+      if (!enableSTA() || !ssid || !ssid[0] || (strlen(ssid) > 32))
+        return WL_CONNECT_FAILED;
+
+      wifi_sta_config_t cfg = {};
+
+      memcpy(cfg.ssid, ssid, strlen(ssid));
+
+      if (passphrase)
+        memcpy(cfg.password, passphrase, std::min<size_t>(strlen(passphrase), 64));
+
+      cfg.channel = (uint8_t) channel;
+
+      if (bssid)
+      {
+        cfg.bssid_set = true;
+        memcpy(cfg.bssid, bssid, 6);
+      }
+
+      // Same config and connected : nothing to do, like the real begin()
+      if (!memcmp(&cfg, &d.ram, sizeof(cfg)) && (d.status == WL_CONNECTED))
+        return WL_CONNECTED;
+
+      HostWiFi::writeConfig(cfg);
+
+      if (connect)
+        HostWiFi::connect();
+
+      return d.status;
+    }
+
+    wl_status_t begin(const String& ssid, const String& passphrase = String(), int32_t channel = 0, const uint8_t* bssid = NULL,
+                      bool connect = true)
+    {
+      return begin(ssid.c_str(), passphrase.c_str(), channel, bssid, connect);
+    }
+
+    wl_status_t begin()
+    {
+      Guard guard;
+      HostWiFi::Driver& d = HostWiFi::driver();
+
+      d.begins++;
+      d.lastBeginSSID     = std::string((const char*) d.ram.ssid, strnlen((const char*) d.ram.ssid, 32));
+      d.lastBeginChannel  = d.ram.channel;
+      d.lastBeginPinned   = d.ram.bssid_set;
+
+      if (!enableSTA() || !d.ram.ssid[0])
+        return WL_CONNECT_FAILED;
+
+      if (d.status != WL_CONNECTED)
+        HostWiFi::connect();
+
+      return d.status;
+    }
+
+    bool disconnect(bool wifioff = false, bool eraseap = false)
+    {
+      Guard guard;
+      HostWiFi::Driver& d = HostWiFi::driver();
+
+      d.disconnects++;
+
+      HostWiFi::dropSteps();
+
+      if (eraseap)
+      {
+        wifi_sta_config_t empty = {};
+
+        HostWiFi::writeConfig(empty);
+      }
+
+      if (d.ap >= 0)
+        HostWiFi::dropLink(WIFI_REASON_ASSOC_LEAVE);
+
+      if (d.status != WL_NO_SHIELD)
+        d.status = WL_DISCONNECTED;
+
+      if (wifioff)
+        HostWiFi::setMode((d.mode == WIFI_MODE_APSTA) ? WIFI_MODE_AP : WIFI_MODE_NULL);
+
+      return true;
+    }
+
+    // INADDR_NONE as the address hands the interface (back) to DHCP. On a live link that restarts the DHCP
+    // client, the address is gone until it binds again.
+    bool config(IPAddress local, IPAddress gateway, IPAddress subnet, IPAddress dns1 = IPAddress(), IPAddress dns2 = IPAddress())
+    {
+      Guard guard;
+      HostWiFi::Driver& d = HostWiFi::driver();
+
+      d.configCalls++;
+
+      if ((uint32_t) local == 0)
+      {
+        bool wasStatic = !d.dhcp;
+
+        d.dhcp = true;
+
+        if (wasStatic && (d.ap >= 0))
+        {
+          d.hasIP = false;
+          d.ip    = 0;
+
+          int ap = d.ap;
+
+          HostWiFi::schedule(d.aps[ap].dhcpMs, []()
+          {
+            HostWiFi::driver().steps.clear();
+            HostWiFi::gotIP(true);
+          });
+        }
+
+        return true;
+      }
+
+      d.dhcp        = false;
+      d.staticIP    = local;
+      d.staticGW    = gateway;
+      d.staticSN    = subnet;
+      d.staticDNS1  = dns1;
+      d.staticDNS2  = dns2;
+
+      if (d.ap >= 0)
+      {
+        HostWiFi::schedule(0, []()
+        {
+          HostWiFi::gotIP(false);
+        });
+      }
+
+      return true;
+    }
+
+    //////////////////////////////////////////
+
+    IPAddress localIP()                 { Guard guard; return HostWiFi::driver().hasIP ? IPAddress(HostWiFi::driver().ip) : IPAddress(); }
+    IPAddress gatewayIP()               { Guard guard; return HostWiFi::driver().hasIP ? IPAddress(HostWiFi::driver().gw) : IPAddress(); }
+    IPAddress subnetMask()              { Guard guard; return HostWiFi::driver().hasIP ? IPAddress(HostWiFi::driver().sn) : IPAddress(); }
+
+    IPAddress dnsIP(uint8_t index = 0)
+    {
+      Guard guard;
+
+      if (!HostWiFi::driver().hasIP)
+        return IPAddress();
+
+      return IPAddress(index ? HostWiFi::driver().dns2 : HostWiFi::driver().dns1);
+    }
+
+    String macAddress()                 { return String("24:6F:28:00:00:01"); }
+
+    // Like the real one, a read of the driver config
+    String psk()
+    {
+      Guard guard;
+      HostWiFi::driver().getConfigCalls++;
+      return String((const char*) HostWiFi::driver().ram.password, strnlen((const char*) HostWiFi::driver().ram.password, 64));
+    }
+
+    String SSID()
+    {
+      Guard guard;
+      HostWiFi::Driver& d = HostWiFi::driver();
+
+      return (d.ap >= 0) ? String(d.aps[d.ap].ssid.c_str()) : String();
+    }
+
+    int8_t RSSI()
+    {
+      Guard guard;
+      HostWiFi::Driver& d = HostWiFi::driver();
+
+      return (d.ap >= 0) ? d.aps[d.ap].rssi : 0;
+    }
+
+    uint8_t* BSSID()
+    {
+      Guard guard;
+      HostWiFi::Driver& d = HostWiFi::driver();
+
+      if (d.ap < 0)
+        return NULL;
+
+      memcpy(_bssid, d.aps[d.ap].bssid, 6);
+
+      return _bssid;
+    }
+
+    String BSSIDstr()
+    {
+      uint8_t* bssid = BSSID();
+      char     buf[18] = { 0 };
+
+      if (bssid)
+        snprintf(buf, sizeof(buf), "%02X:%02X:%02X:%02X:%02X:%02X", bssid[0], bssid[1], bssid[2], bssid[3], bssid[4], bssid[5]);
+
+      return String(buf);
+    }
+
+    int32_t channel()
+    {
+      Guard guard;
+      HostWiFi::Driver& d = HostWiFi::driver();
+
+      return (d.ap >= 0) ? d.aps[d.ap].channel : 0;
+    }
+
+    //////////////////////////////////////////
+
+    bool softAPConfig(IPAddress local, IPAddress, IPAddress)
+    {
+      Guard guard;
+      HostWiFi::driver().apIP = local;
+      return true;
+    }
+
+    bool softAP(const char* ssid, const char* passphrase = NULL, int channel = 1, int hidden = 0, int maxConnections = 4)
+    {
+      Guard guard;
+      HostWiFi::Driver& d = HostWiFi::driver();
+
+      (void) passphrase; (void) channel; (void) hidden; (void) maxConnections;
+
+      if ( (d.mode != WIFI_MODE_AP) && (d.mode != WIFI_MODE_APSTA) )
+        HostWiFi::setMode((d.mode == WIFI_MODE_STA) ? WIFI_MODE_APSTA : WIFI_MODE_AP);
+
+      d.softAPCalls++;
+      d.apSSID = ssid ? ssid : "";
+
+      HostSim::block(d.softAPMs);
+
+      d.apUp = true;
+
+      arduino_event_info_t info;
+
+      memset(&info, 0, sizeof(info));
+      HostWiFi::post(ARDUINO_EVENT_WIFI_AP_START, info);
+
+      return true;
+    }
+
+    IPAddress softAPIP()                { Guard guard; return IPAddress(HostWiFi::driver().apIP); }
+    String    softAPmacAddress()        { return String("24:6F:28:00:00:02"); }
+
+    //////////////////////////////////////////
+
+    int16_t scanNetworks(bool async = false, bool show_hidden = false, bool passive = false, uint32_t max_ms_per_chan = 300,
+                         uint8_t channel = 0, const char* ssid = NULL, const uint8_t* bssid = NULL)
+    {
+      Guard guard;
+      HostWiFi::Driver& d = HostWiFi::driver();
+
+      (void) show_hidden; (void) passive; (void) ssid; (void) bssid;
+
+      if (d.scanning)
+        return WIFI_SCAN_RUNNING;
+
+      enableSTA();
+
+      d.scansStarted++;
+      d.lastScanChannel = channel;
+      d.scanning        = true;
+      d.scanValid       = false;
+      d.results.clear();
+
+      uint64_t durationMs = (uint64_t) (channel ? 1 : 13) * std::min<uint32_t>(max_ms_per_chan, d.channelDwellMs);
+
+      if (!async)
+      {
+        HostSim::advanceMs(durationMs);
+
+        d.results   = HostWiFi::scanChannels(channel);
+        d.scanning  = false;
+        d.scanValid = true;
+
+        return (int16_t) d.results.size();
+      }
+
+      HostSim::schedule(HostSim::nowUs() + durationMs * 1000, [channel]()
+      {
+        HostWiFi::Driver& d = HostWiFi::driver();
+
+        d.results   = HostWiFi::scanChannels(channel);
+        d.scanning  = false;
+        d.scanValid = true;
+
+        arduino_event_info_t info;
+
+        memset(&info, 0, sizeof(info));
+        HostWiFi::dispatch(ARDUINO_EVENT_WIFI_SCAN_DONE, info);
+      });
+
+      return WIFI_SCAN_RUNNING;
+    }
+
+    int16_t scanComplete()
+    {
+      Guard guard;
+      HostWiFi::Driver& d = HostWiFi::driver();
+
+      if (d.scanning)
+        return WIFI_SCAN_RUNNING;
+
+      return d.scanValid ? (int16_t) d.results.size() : WIFI_SCAN_FAILED;
+    }
+
+    void scanDelete()
+    {
+      Guard guard;
+
+      HostWiFi::driver().results.clear();
+      HostWiFi::driver().scanValid = false;
+    }
+
+    void* getScanInfoByIndex(int i)
+    {
+      Guard guard;
+      HostWiFi::Driver& d = HostWiFi::driver();
+
+      if ( (i < 0) || (i >= (int) d.results.size()) )
+        return NULL;
+
+      return &d.results[i];
+    }
+
+    //////////////////////////////////////////
+
+    wifi_event_id_t onEvent(WiFiEventFuncCb cb, arduino_event_id_t event = ARDUINO_EVENT_MAX)
+    {
+      Guard guard;
+      HostWiFi::Driver& d = HostWiFi::driver();
+
+      wifi_event_id_t id = d.nextHandler++;
+
+      d.handlers.push_back(std::make_pair(id, [cb, event](arduino_event_id_t e, arduino_event_info_t info)
+      {
+        if ( (event == ARDUINO_EVENT_MAX) || (event == e) )
+          cb(e, info);
+      }));
+
+      return id;
+    }
+
+    void removeEvent(wifi_event_id_t id)
+    {
+      Guard guard;
+      auto& handlers = HostWiFi::driver().handlers;
+
+      for (auto it = handlers.begin(); it != handlers.end(); ++it)
+      {
+        if (it->first == id)
+        {
+          handlers.erase(it);
+          break;
+        }
+      }
+    }
+
+  private:
+
+    // Driver calls are serialized with the simulated event task, and deliver what fell due
+    struct Guard
+    {
+      Guard() : lock(HostWiFi::lock())
+      {
+        HostSim::pump();
+      }
+
+      std::lock_guard<std::recursive_mutex> lock;
+    };
+
+    bool enableSTA()
+    {
+      HostWiFi::Driver& d = HostWiFi::driver();
+
+      if ( (d.mode == WIFI_MODE_STA) || (d.mode == WIFI_MODE_APSTA) )
+        return true;
+
+      return HostWiFi::setMode((d.mode == WIFI_MODE_AP) ? WIFI_MODE_APSTA : WIFI_MODE_STA);
+    }
+
+    uint8_t _bssid[6];
+};
+
+inline WiFiClass WiFi;
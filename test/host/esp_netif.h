@@ -0,0 +1,49 @@
+// Host stand-in for the ESP-IDF network interface API. Only the STA DHCP client is modelled: starting it
+// keeps the current address until the simulated DHCP server answers, as lwIP does
+#pragma once
+
+#include "esp_wifi.h"
+
+#define ESP_ERR_ESP_NETIF_INVALID_PARAMS          0x5001
+#define ESP_ERR_ESP_NETIF_DHCP_ALREADY_STARTED    0x5004
+
+struct esp_netif_obj
+{
+  const char* key;
+};
+
+typedef struct esp_netif_obj esp_netif_t;
+
+inline esp_netif_t* esp_netif_get_handle_from_ifkey(const char* if_key)
+{
+  static esp_netif_t sta = { "WIFI_STA_DEF" };
+
+  return (strcmp(if_key, sta.key) == 0) ? &sta : NULL;
+}
+
+inline esp_err_t esp_netif_dhcpc_start(esp_netif_t* esp_netif)
+{
+  std::lock_guard<std::recursive_mutex> guard(HostWiFi::lock());
+
+  HostWiFi::Driver& d = HostWiFi::driver();
+
+  if (esp_netif == NULL)
+    return ESP_ERR_ESP_NETIF_INVALID_PARAMS;
+
+  if (d.dhcp)
+    return ESP_ERR_ESP_NETIF_DHCP_ALREADY_STARTED;
+
+  d.dhcp = true;
+  d.dhcpStarts++;
+
+  if (d.ap >= 0)
+  {
+    HostWiFi::schedule(d.aps[d.ap].dhcpMs, []()
+    {
+      HostWiFi::driver().steps.clear();
+      HostWiFi::gotIP(true);
+    });
+  }
+
+  return ESP_OK;
+}
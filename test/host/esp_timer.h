@@ -0,0 +1,9 @@
+// Host stand-in: the 64-bit microsecond clock since boot, on the simulated clock
+#pragma once
+
+#include "HostSim.h"
+
+inline int64_t esp_timer_get_time()
+{
+  return (int64_t) HostSim::nowUs();
+}
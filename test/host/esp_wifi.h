@@ -0,0 +1,96 @@
+// Host stand-in for the ESP-IDF WiFi driver API. The simulated driver itself is in HostWiFi.h
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+
+typedef int esp_err_t;
+
+#define ESP_OK                      0
+#define ESP_FAIL                    -1
+#define ESP_ERR_WIFI_NOT_INIT       0x3001
+#define ESP_ERR_WIFI_NOT_CONNECT    0x300F
+
+typedef enum
+{
+  WIFI_IF_STA = 0,
+  WIFI_IF_AP
+} wifi_interface_t;
+
+typedef enum
+{
+  WIFI_MODE_NULL = 0,
+  WIFI_MODE_STA,
+  WIFI_MODE_AP,
+  WIFI_MODE_APSTA
+} wifi_mode_t;
+
+#define WIFI_OFF    WIFI_MODE_NULL
+#define WIFI_STA    WIFI_MODE_STA
+#define WIFI_AP     WIFI_MODE_AP
+#define WIFI_AP_STA WIFI_MODE_APSTA
+
+typedef enum
+{
+  WIFI_AUTH_OPEN = 0,
+  WIFI_AUTH_WEP,
+  WIFI_AUTH_WPA_PSK,
+  WIFI_AUTH_WPA2_PSK,
+  WIFI_AUTH_WPA_WPA2_PSK,
+  WIFI_AUTH_WPA2_ENTERPRISE,
+  WIFI_AUTH_WPA3_PSK,
+  WIFI_AUTH_WPA2_WPA3_PSK,
+  WIFI_AUTH_MAX
+} wifi_auth_mode_t;
+
+typedef enum
+{
+  WIFI_STORAGE_FLASH,
+  WIFI_STORAGE_RAM
+} wifi_storage_t;
+
+typedef enum
+{
+  WIFI_REASON_UNSPECIFIED             = 1,
+  WIFI_REASON_AUTH_EXPIRE             = 2,
+  WIFI_REASON_AUTH_LEAVE              = 3,
+  WIFI_REASON_ASSOC_LEAVE             = 8,
+  WIFI_REASON_4WAY_HANDSHAKE_TIMEOUT  = 15,
+  WIFI_REASON_BEACON_TIMEOUT          = 200,
+  WIFI_REASON_NO_AP_FOUND             = 201,
+  WIFI_REASON_AUTH_FAIL               = 202,
+  WIFI_REASON_ASSOC_FAIL              = 203,
+  WIFI_REASON_HANDSHAKE_TIMEOUT       = 204
+} wifi_err_reason_t;
+
+typedef struct
+{
+  uint8_t           bssid[6];
+  uint8_t           ssid[33];
+  uint8_t           primary;
+  int               second;
+  int8_t            rssi;
+  wifi_auth_mode_t  authmode;
+} wifi_ap_record_t;
+
+typedef struct
+{
+  uint8_t   ssid[32];
+  uint8_t   password[64];
+  int       scan_method;
+  bool      bssid_set;
+  uint8_t   bssid[6];
+  uint8_t   channel;
+} wifi_sta_config_t;
+
+typedef union
+{
+  wifi_sta_config_t sta;
+} wifi_config_t;
+
+esp_err_t esp_wifi_get_config(wifi_interface_t interface, wifi_config_t* conf);
+esp_err_t esp_wifi_set_config(wifi_interface_t interface, wifi_config_t* conf);
+esp_err_t esp_wifi_set_storage(wifi_storage_t storage);
+esp_err_t esp_wifi_sta_get_ap_info(wifi_ap_record_t* record);
+
+#include "HostWiFi.h"
@@ -0,0 +1,32 @@
+// Host stand-in: FreeRTOS types, one tick per millisecond
+#pragma once
+
+#include <cstdint>
+
+typedef uint32_t  TickType_t;
+typedef int       BaseType_t;
+typedef unsigned  UBaseType_t;
+typedef uint32_t  EventBits_t;
+
+typedef struct HostEventGroup*  EventGroupHandle_t;
+typedef struct HostTask*        TaskHandle_t;
+typedef struct HostSemaphore*   SemaphoreHandle_t;
+typedef void (*TaskFunction_t)(void*);
+
+#define pdTRUE              1
+#define pdFALSE             0
+#define pdPASS              1
+#define pdFAIL              0
+#define portMAX_DELAY       0xffffffffUL
+#define portTICK_PERIOD_MS  1
+#define pdMS_TO_TICKS(x)    ((TickType_t) (x))
+#define tskNO_AFFINITY      0x7FFFFFFF
+
+#define BIT0                0x01
+#define BIT1                0x02
+#define BIT2                0x04
+#define BIT3                0x08
+#define BIT4                0x10
+#define BIT5                0x20
+#define BIT6                0x40
+#define BIT7                0x80
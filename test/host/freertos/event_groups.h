@@ -0,0 +1,110 @@
+// Host stand-in: event groups over a mutex / condition variable. Waits move the simulated clock in
+// manual mode, and poll the timed driver events in real time mode.
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+
+#include "FreeRTOS.h"
+#include "../HostSim.h"
+
+struct HostEventGroup
+{
+  std::mutex              lock;
+  std::condition_variable changed;
+  EventBits_t             bits = 0;
+};
+
+inline EventGroupHandle_t xEventGroupCreate()
+{
+  return new HostEventGroup();
+}
+
+inline void vEventGroupDelete(EventGroupHandle_t group)
+{
+  delete group;
+}
+
+inline EventBits_t xEventGroupSetBits(EventGroupHandle_t group, EventBits_t bits)
+{
+  std::lock_guard<std::mutex> guard(group->lock);
+
+  group->bits |= bits;
+  group->changed.notify_all();
+
+  return group->bits;
+}
+
+inline EventBits_t xEventGroupClearBits(EventGroupHandle_t group, EventBits_t bits)
+{
+  std::lock_guard<std::mutex> guard(group->lock);
+
+  EventBits_t before = group->bits;
+
+  group->bits &= ~bits;
+
+  return before;
+}
+
+inline EventBits_t xEventGroupGetBits(EventGroupHandle_t group)
+{
+  std::lock_guard<std::mutex> guard(group->lock);
+
+  return group->bits;
+}
+
+inline EventBits_t xEventGroupWaitBits(EventGroupHandle_t group, EventBits_t bits, BaseType_t clearOnExit,
+                                       BaseType_t waitForAll, TickType_t ticks)
+{
+  uint64_t    deadline  = (ticks == portMAX_DELAY) ? HostSim::NEVER : HostSim::nowUs() + (uint64_t) ticks * 1000;
+  EventBits_t seen      = 0;
+
+  auto met = [&]()
+  {
+    return waitForAll ? ((group->bits & bits) == bits) : ((group->bits & bits) != 0);
+  };
+
+  auto take = [&]()
+  {
+    std::lock_guard<std::mutex> guard(group->lock);
+
+    seen = group->bits;
+
+    if (!met())
+      return false;
+
+    if (clearOnExit)
+      group->bits &= ~bits;
+
+    return true;
+  };
+
+  if (!HostSim::core().realTime.load())
+  {
+    HostSim::waitUntil(deadline, take);
+
+    return seen;
+  }
+
+  while (true)
+  {
+    HostSim::pump();
+
+    if (take())
+      return seen;
+
+    uint64_t now = HostSim::nowUs();
+
+    if (now >= deadline)
+      return seen;
+
+    // Wake for the next driver event, at least every 2 ms so other threads' events get delivered
+    uint64_t next = std::min<uint64_t>(deadline, HostSim::nextActionUs());
+    uint64_t wait = std::min<uint64_t>(std::max<uint64_t>((next > now) ? (next - now) : 0, 100), 2000);
+
+    std::unique_lock<std::mutex> guard(group->lock);
+
+    group->changed.wait_for(guard, std::chrono::microseconds(wait), met);
+  }
+}
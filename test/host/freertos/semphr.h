@@ -0,0 +1,41 @@
+// Host stand-in: mutex semaphores
+#pragma once
+
+#include <chrono>
+#include <mutex>
+
+#include "FreeRTOS.h"
+
+struct HostSemaphore
+{
+  std::timed_mutex  lock;
+};
+
+inline SemaphoreHandle_t xSemaphoreCreateMutex()
+{
+  return new HostSemaphore();
+}
+
+inline void vSemaphoreDelete(SemaphoreHandle_t semaphore)
+{
+  delete semaphore;
+}
+
+inline BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticks)
+{
+  if (ticks == portMAX_DELAY)
+  {
+    semaphore->lock.lock();
+
+    return pdTRUE;
+  }
+
+  return semaphore->lock.try_lock_for(std::chrono::milliseconds(ticks)) ? pdTRUE : pdFALSE;
+}
+
+inline BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore)
+{
+  semaphore->lock.unlock();
+
+  return pdTRUE;
+}
@@ -0,0 +1,55 @@
+// Host stand-in: tasks are detached threads. A task can't be killed from outside, vTaskDelete() on
+// another task's handle is only counted so tests can check nobody relies on it.
+#pragma once
+
+#include <atomic>
+#include <thread>
+
+#include "FreeRTOS.h"
+#include "../HostSim.h"
+
+struct HostTask
+{
+  std::atomic<bool> running { true };
+};
+
+inline std::atomic<int>  hostTasksRunning   { 0 };
+inline std::atomic<int>  hostTaskKills      { 0 };
+
+inline BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char*, uint32_t, void* param, UBaseType_t,
+                                          TaskHandle_t* handle, BaseType_t)
+{
+  HostTask* task = new HostTask();
+
+  hostTasksRunning++;
+
+  if (handle)
+    *handle = task;
+
+  std::thread([fn, param, task]()
+  {
+    fn(param);
+
+    task->running = false;
+    hostTasksRunning--;
+  }).detach();
+
+  return pdPASS;
+}
+
+inline void vTaskDelete(TaskHandle_t task)
+{
+  // NULL : the calling task ends, which it does by returning from its function right after
+  if (task != NULL)
+    hostTaskKills++;
+}
+
+inline void vTaskDelay(TickType_t ticks)
+{
+  HostSim::advanceMs(ticks);
+}
+
+inline TaskHandle_t xTaskGetCurrentTaskHandle()
+{
+  return NULL;
+}
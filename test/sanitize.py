@@ -0,0 +1,4 @@
+# The sanitizer runtime must be linked too, build_flags only reach the compiler
+Import("env")
+
+env.Append(LINKFLAGS=["-fsanitize=thread"])
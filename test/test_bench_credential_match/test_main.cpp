@@ -0,0 +1,222 @@
+// Matching a scan against the stored credentials through the SSID hash index, against the nested string
+// compare it replaced, at several store sizes, and a connect plan longer than 255 candidates. Run with the
+// native_bench env (WIFI_CREDENTIALS_CAPACITY 512).
+#include <unity.h>
+
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+#include <Preferences.h>
+
+#include "AutoConnect.h"
+
+static const int scanSize = 60;
+
+typedef struct
+{
+  char      SSID[WIFI_SSID_MAXLEN + 1];
+  uint8_t   SSIDLength;
+  uint32_t  SSIDHash;
+} ScanEntry;
+
+// Store of n "site-NNNN" networks
+static void fill(WiFiCredentialStore& store, int n)
+{
+  char ssid[WIFI_SSID_MAXLEN + 1];
+
+  for (int i = 0; i < n; i++)
+  {
+    snprintf(ssid, sizeof(ssid), "site-%04d", i);
+    store.add(ssid, "password");
+  }
+
+  store.save();
+}
+
+// A scan with every other entry a stored network, spread over the store, the rest unknown
+static std::vector<ScanEntry> scan(int stored)
+{
+  std::vector<ScanEntry> entries(scanSize);
+
+  for (int i = 0; i < scanSize; i++)
+  {
+    ScanEntry& e = entries[i];
+
+    if (i % 2 == 0)
+      snprintf(e.SSID, sizeof(e.SSID), "site-%04d", (i * 7919) % stored);
+    else
+      snprintf(e.SSID, sizeof(e.SSID), "neighbour-%04d", i);
+
+    e.SSIDLength  = (uint8_t) strlen(e.SSID);
+    e.SSIDHash    = WiFi_SSIDHash(e.SSID, e.SSIDLength);
+  }
+
+  return entries;
+}
+
+// What matching did before the index : every scan entry compared with every stored SSID
+static int legacyFind(WiFiCredentialStore& store, const char* ssid)
+{
+  for (uint16_t i = 0; i < store.count(); i++)
+  {
+    if (strcmp(store.get(i)->SSID, ssid) == 0)
+      return i;
+  }
+
+  return -1;
+}
+
+template<typename F>
+static double bestOfUs(int rounds, F fn)
+{
+  double best = 1e30;
+
+  for (int round = 0; round < rounds; round++)
+  {
+    auto start = std::chrono::steady_clock::now();
+
+    fn();
+
+    best = std::min(best, std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count());
+  }
+
+  return best;
+}
+
+void setUp()
+{
+  HostSim::resetClock();
+  HostWiFi::reset();
+  HostNVS::reset();
+}
+
+void tearDown()
+{
+}
+
+//////////////////////////////////////////
+
+static void test_index_matches_linear_search()
+{
+  const int stored = std::min(500, WIFI_CREDENTIALS_CAPACITY);
+
+  WiFiCredentialStore store;
+
+  fill(store, stored);
+
+  TEST_ASSERT_EQUAL(stored, store.count());
+
+  for (const ScanEntry& e : scan(stored))
+    TEST_ASSERT_EQUAL(legacyFind(store, e.SSID), store.find(e.SSID, e.SSIDLength, e.SSIDHash));
+
+  // Still right after records moved : a removal and a re-add shift every index
+  store.remove(stored / 2);
+  store.add("site-0000", "other");
+
+  for (const ScanEntry& e : scan(stored))
+    TEST_ASSERT_EQUAL(legacyFind(store, e.SSID), store.find(e.SSID, e.SSIDLength, e.SSIDHash));
+}
+
+static void test_scaling()
+{
+  const int sizes[]   = { 8, 64, 256, 500 };
+  double    indexUs8  = 0;
+  char      message[160];
+
+  for (int n : sizes)
+  {
+    if (n > WIFI_CREDENTIALS_CAPACITY)
+      continue;
+
+    HostNVS::reset();
+
+    WiFiCredentialStore     store;
+    std::vector<ScanEntry>  entries;
+    volatile int            found = 0;
+
+    fill(store, n);
+    entries = scan(n);
+
+    double indexUs = bestOfUs(50, [&]()
+    {
+      for (const ScanEntry& e : entries)
+        found += store.find(e.SSID, e.SSIDLength, e.SSIDHash) >= 0;
+    });
+
+    double legacyUs = bestOfUs(50, [&]()
+    {
+      for (const ScanEntry& e : entries)
+        found += legacyFind(store, e.SSID) >= 0;
+    });
+
+    // The whole targeted scan + match + plan, scan time is simulated and costs no wall time
+    AsyncWebServer  server(80);
+    DNSServer       dns;
+
+    HostSim::resetClock();
+    HostWiFi::reset();
+
+    for (int i = 0; i < scanSize; i++)
+      HostWiFi::addAP(entries[i].SSID, "password", 1 + (i % 13), (int8_t) (-40 - i / 2), (uint8_t) i);
+
+    std::unique_ptr<ESPAsync_WiFiManager> wm(new ESPAsync_WiFiManager(&server, &dns, "bench"));
+
+    double knownUs = bestOfUs(5, [&]()
+    {
+      TEST_ASSERT_TRUE(wm->scanKnownNetworks());
+    });
+
+    if (n == sizes[0])
+      indexUs8 = indexUs;
+
+    snprintf(message, sizeof(message), "%3d stored, %d-AP scan: index %.2f us, nested compare %.2f us, scanKnownNetworks %.1f us",
+             n, scanSize, indexUs, legacyUs, knownUs);
+    TEST_MESSAGE(message);
+
+    if (n >= 256)
+    {
+      TEST_ASSERT_TRUE_MESSAGE(indexUs < legacyUs, "Hash index not faster than the nested compare");
+
+      // Near-constant per scan entry : growing the store 30x or more must not grow the match anywhere near that
+      TEST_ASSERT_TRUE_MESSAGE(indexUs < 4 * indexUs8 + 5, "Index lookup grows with the store size");
+    }
+  }
+}
+
+static void test_blind_plan_past_255()
+{
+  const int stored = std::min(300, WIFI_CREDENTIALS_CAPACITY);
+
+  WiFiCredentialStore store;
+
+  fill(store, stored);
+
+  // Empty scan : every stored network tried blindly, each fails for want of an AP
+  AsyncWebServer  server(80);
+  DNSServer       dns;
+
+  std::unique_ptr<ESPAsync_WiFiManager> wm(new ESPAsync_WiFiManager(&server, &dns, "bench"));
+
+  wm->setConnectTimeout(1);
+  wm->setConnectPlanTimeout(3600);
+  wm->setConfigPortalTimeout(1);
+
+  TEST_ASSERT_FALSE(wm->autoConnect("portal"));
+
+  // The plan ends, and none of the candidates past the 256th is lost to a wrapped count
+  TEST_ASSERT_GREATER_OR_EQUAL_UINT32(stored, HostWiFi::driver().begins);
+}
+
+//////////////////////////////////////////
+
+int main(int, char**)
+{
+  UNITY_BEGIN();
+
+  RUN_TEST(test_index_matches_linear_search);
+  RUN_TEST(test_scaling);
+  RUN_TEST(test_blind_plan_past_255);
+
+  return UNITY_END();
+}
@@ -0,0 +1,217 @@
+// Sort and duplicate removal of the scan table: same order and same listed networks as the quadratic
+// String code it replaced, and how both scale with the number of APs. Run with the native_bench env.
+#include <unity.h>
+
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+#include <Preferences.h>
+
+#include "AutoConnect.h"
+
+//////////////////////////////////////////
+
+// What processScanResults() did before : bubble sort on RSSI, String compare of every pair for duplicates
+typedef struct
+{
+  bool      duplicate;
+  String    SSID;
+  int32_t   RSSI;
+} LegacyResult;
+
+static std::vector<LegacyResult> legacyScan(int n)
+{
+  std::vector<LegacyResult> results(n);
+
+  for (int i = 0; i < n; i++)
+  {
+    wifi_ap_record_t* ap = (wifi_ap_record_t*) WiFi.getScanInfoByIndex(i);
+
+    results[i].duplicate  = false;
+    results[i].SSID       = String(reinterpret_cast<const char*>(ap->ssid));
+    results[i].RSSI       = ap->rssi;
+  }
+
+  for (int i = 0; i < n; i++)
+  {
+    for (int j = i + 1; j < n; j++)
+    {
+      if (results[j].RSSI > results[i].RSSI)
+        std::swap(results[i], results[j]);
+    }
+  }
+
+  String cssid;
+
+  for (int i = 0; i < n; i++)
+  {
+    if (results[i].duplicate)
+      continue;
+
+    cssid = results[i].SSID;
+
+    for (int j = i + 1; j < n; j++)
+    {
+      if (cssid == results[j].SSID)
+        results[j].duplicate = true;
+    }
+  }
+
+  return results;
+}
+
+//////////////////////////////////////////
+
+// n APs, every third an extra BSSID of the SSID before it. distinct gives every AP its own RSSI
+static void addAPs(int n, bool distinct)
+{
+  char ssid[33];
+
+  for (int i = 0; i < n; i++)
+  {
+    int8_t rssi = distinct ? (int8_t) (-20 - ((i * 7) % n)) : (int8_t) (-30 - ((i * 37) % 60));
+
+    snprintf(ssid, sizeof(ssid), "net-%04d", (i % 3 == 2) ? i - 1 : i);
+    HostWiFi::addAP(ssid, "password", 1 + (i % 13), rssi, 0);
+
+    HostWiFi::ap(i).bssid[4] = (uint8_t) (i >> 8);
+    HostWiFi::ap(i).bssid[5] = (uint8_t) i;
+  }
+}
+
+static std::vector<String> listed(const String& body)
+{
+  std::vector<String> out;
+
+  for (int at = body.indexOf("\"SSID\":\""); at >= 0; at = body.indexOf("\"SSID\":\"", at + 1))
+  {
+    int from = at + 8;
+
+    out.push_back(body.substring(from, body.indexOf('"', from)));
+  }
+
+  return out;
+}
+
+void setUp()
+{
+  HostSim::resetClock();
+  HostWiFi::reset();
+  HostNVS::reset();
+}
+
+void tearDown()
+{
+}
+
+//////////////////////////////////////////
+
+static void test_same_result_as_legacy()
+{
+  const int       apCount = 60;
+  AsyncWebServer  server(80);
+  DNSServer       dns;
+
+  addAPs(apCount, true);
+
+  std::unique_ptr<ESPAsync_WiFiManager> wm(new ESPAsync_WiFiManager(&server, &dns, "bench"));
+
+  wm->startConfigPortalModeless("portal", NULL, false);
+
+  TEST_ASSERT_TRUE(wm->startScan());
+
+  while (!wm->pollScan())
+    delay(10);
+
+  AsyncWebServerRequest request("/scan");
+
+  server.handle(request);
+
+  std::vector<String> fast = listed(request.body());
+
+  WiFi.scanNetworks(false);
+
+  std::vector<LegacyResult> legacy = legacyScan(WiFi.scanComplete());
+  std::vector<String>       expected;
+
+  for (const LegacyResult& result : legacy)
+  {
+    if (!result.duplicate)
+      expected.push_back(result.SSID);
+  }
+
+  // Strongest BSSID of each SSID, strongest first, 40 of 60 APs
+  TEST_ASSERT_EQUAL(40, expected.size());
+  TEST_ASSERT_EQUAL(expected.size(), fast.size());
+
+  for (size_t i = 0; i < expected.size(); i++)
+    TEST_ASSERT_EQUAL_STRING(expected[i].c_str(), fast[i].c_str());
+}
+
+static void test_scaling()
+{
+  const int sizes[] = { 16, 64, 256, 1024 };
+  char      message[160];
+
+  for (int n : sizes)
+  {
+    if (n > WIFI_SCAN_MAX_RESULTS)
+      continue;
+
+    HostSim::resetClock();
+    HostWiFi::reset();
+
+    addAPs(n, false);
+
+    AsyncWebServer  server(80);
+    DNSServer       dns;
+
+    std::unique_ptr<ESPAsync_WiFiManager> wm(new ESPAsync_WiFiManager(&server, &dns, "bench"));
+
+    double fastUs   = 1e30;
+    double legacyUs = 1e30;
+
+    // Best of 5, first round fills the table, the next ones merge into it
+    for (int round = 0; round < 5; round++)
+    {
+      TEST_ASSERT_TRUE(wm->startScan());
+      HostSim::advanceMs(13 * HostWiFi::driver().channelDwellMs + 10);
+
+      auto start = std::chrono::steady_clock::now();
+
+      TEST_ASSERT_TRUE(wm->pollScan());
+
+      fastUs = std::min(fastUs, std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count());
+    }
+
+    for (int round = 0; round < 5; round++)
+    {
+      WiFi.scanNetworks(false);
+
+      auto start = std::chrono::steady_clock::now();
+
+      std::vector<LegacyResult> legacy = legacyScan(WiFi.scanComplete());
+
+      legacyUs = std::min(legacyUs, std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count());
+    }
+
+    snprintf(message, sizeof(message), "%4d APs: table merge + sort + dedup %.1f us, legacy %.1f us", n, fastUs, legacyUs);
+    TEST_MESSAGE(message);
+
+    if (n >= 256)
+      TEST_ASSERT_TRUE_MESSAGE(fastUs < legacyUs, "O(n log n) path not faster than the quadratic one");
+  }
+}
+
+//////////////////////////////////////////
+
+int main(int, char**)
+{
+  UNITY_BEGIN();
+
+  RUN_TEST(test_same_result_as_legacy);
+  RUN_TEST(test_scaling);
+
+  return UNITY_END();
+}
@@ -0,0 +1,377 @@
+// Scan table footprint, heap use and time per scan: the POD record table against the WiFiResult / String array
+// it replaced, rebuilt from the same driver results. Run with the native_bench env.
+#include <unity.h>
+
+#include <atomic>
+#include <chrono>
+#include <new>
+
+#include <Preferences.h>
+
+#include "AutoConnect.h"
+
+//////////////////////////////////////////
+
+// Heap calls made by this process while counting is on
+static std::atomic<bool>      counting    { false };
+static std::atomic<uint32_t>  allocations { 0 };
+static std::atomic<uint64_t>  allocated   { 0 };
+
+void* operator new(size_t size)
+{
+  if (counting.load())
+  {
+    allocations++;
+    allocated += size;
+  }
+
+  void* p = malloc(size ? size : 1);
+
+  if (p == NULL)
+    throw std::bad_alloc();
+
+  return p;
+}
+
+void operator delete(void* p) noexcept
+{
+  free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+  free(p);
+}
+
+//////////////////////////////////////////
+
+// What processScanResults() did before the POD table
+class LegacyWiFiResult
+{
+  public:
+    bool      duplicate;
+    String    SSID;
+    uint8_t   encryptionType;
+    int32_t   RSSI;
+    uint8_t*  BSSID;
+    int32_t   channel;
+    bool      isHidden;
+};
+
+static LegacyWiFiResult* legacyScan(LegacyWiFiResult* previous, int n)
+{
+  delete [] previous;
+
+  LegacyWiFiResult* results = new LegacyWiFiResult[n];
+
+  for (int i = 0; i < n; i++)
+  {
+    wifi_ap_record_t* ap = (wifi_ap_record_t*) WiFi.getScanInfoByIndex(i);
+
+    results[i].duplicate      = false;
+    results[i].SSID           = String(reinterpret_cast<const char*>(ap->ssid));
+    results[i].encryptionType = ap->authmode;
+    results[i].RSSI           = ap->rssi;
+    results[i].BSSID          = ap->bssid;
+    results[i].channel        = ap->primary;
+  }
+
+  for (int i = 0; i < n; i++)
+  {
+    for (int j = i + 1; j < n; j++)
+    {
+      if (results[j].RSSI > results[i].RSSI)
+        std::swap(results[i], results[j]);
+    }
+  }
+
+  String cssid;
+
+  for (int i = 0; i < n; i++)
+  {
+    if (results[i].duplicate)
+      continue;
+
+    cssid = results[i].SSID;
+
+    for (int j = i + 1; j < n; j++)
+    {
+      if (cssid == results[j].SSID)
+        results[j].duplicate = true;
+    }
+  }
+
+  return results;
+}
+
+//////////////////////////////////////////
+
+// n APs, a quarter of them extra BSSIDs of an SSID already there
+static void addAPs(int n)
+{
+  char ssid[33];
+
+  for (int i = 0; i < n; i++)
+  {
+    snprintf(ssid, sizeof(ssid), "network-%04d-%s", (i % 4 == 3) ? i - 1 : i, (i % 2) ? "upstairs" : "lab");
+    HostWiFi::addAP(ssid, "password", 1 + (i % 13), -30 - (int8_t) ((i * 37) % 60), 0);
+
+    HostWiFi::ap(i).bssid[4] = (uint8_t) (i >> 8);
+    HostWiFi::ap(i).bssid[5] = (uint8_t) i;
+  }
+}
+
+// Scan done in the driver, results not yet collected
+static void scanInDriver(ESPAsync_WiFiManager& wm)
+{
+  TEST_ASSERT_TRUE(wm.startScan());
+  HostSim::advanceMs(13 * HostWiFi::driver().channelDwellMs + 10);
+}
+
+void setUp()
+{
+  HostSim::resetClock();
+  HostWiFi::reset();
+  HostNVS::reset();
+}
+
+void tearDown()
+{
+}
+
+//////////////////////////////////////////
+
+static void test_heap_per_scan()
+{
+  const int       apCount = 256;
+  AsyncWebServer  server(80);
+  DNSServer       dns;
+
+  addAPs(apCount);
+
+  std::unique_ptr<ESPAsync_WiFiManager> wm(new ESPAsync_WiFiManager(&server, &dns, "bench"));
+  char message[160];
+
+  for (int round = 0; round < 3; round++)
+  {
+    scanInDriver(*wm);
+
+    allocations = 0;
+    allocated   = 0;
+    counting    = true;
+
+    bool done = wm->pollScan();
+
+    counting    = false;
+
+    TEST_ASSERT_TRUE(done);
+
+    snprintf(message, sizeof(message), "POD table, %d APs, scan %d: %u allocations, %llu bytes",
+             apCount, round, allocations.load(), (unsigned long long) allocated.load());
+    TEST_MESSAGE(message);
+
+    TEST_ASSERT_EQUAL_UINT32(0, allocations.load());
+  }
+
+  // Same driver results through the old code
+  LegacyWiFiResult* legacy = NULL;
+
+  for (int round = 0; round < 3; round++)
+  {
+    WiFi.scanNetworks(false);
+
+    allocations = 0;
+    allocated   = 0;
+    counting    = true;
+
+    legacy = legacyScan(legacy, WiFi.scanComplete());
+
+    counting    = false;
+
+    snprintf(message, sizeof(message), "WiFiResult array, %d APs, scan %d: %u allocations, %llu bytes",
+             apCount, round, allocations.load(), (unsigned long long) allocated.load());
+    TEST_MESSAGE(message);
+
+    TEST_ASSERT_GREATER_THAN(apCount, allocations.load());
+  }
+
+  delete [] legacy;
+}
+
+// Best of a few rounds of one scan each, wall time
+static void timeScans(int apCount)
+{
+  AsyncWebServer  server(80);
+  DNSServer       dns;
+
+  HostSim::resetClock();
+  HostWiFi::reset();
+
+  addAPs(apCount);
+
+  std::unique_ptr<ESPAsync_WiFiManager> wm(new ESPAsync_WiFiManager(&server, &dns, "bench"));
+
+  double podUs    = 1e30;
+  double legacyUs = 1e30;
+
+  for (int round = 0; round < 10; round++)
+  {
+    scanInDriver(*wm);
+
+    auto start = std::chrono::steady_clock::now();
+
+    TEST_ASSERT_TRUE(wm->pollScan());
+
+    podUs = std::min(podUs, std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count());
+  }
+
+  LegacyWiFiResult* legacy = NULL;
+
+  for (int round = 0; round < 10; round++)
+  {
+    WiFi.scanNetworks(false);
+
+    auto start = std::chrono::steady_clock::now();
+
+    legacy = legacyScan(legacy, WiFi.scanComplete());
+
+    legacyUs = std::min(legacyUs, std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count());
+  }
+
+  delete [] legacy;
+
+  char message[160];
+
+  snprintf(message, sizeof(message), "%d APs per scan : POD table %.1f us, WiFiResult array %.1f us", apCount, podUs, legacyUs);
+  TEST_MESSAGE(message);
+
+  TEST_ASSERT_TRUE_MESSAGE(podUs < legacyUs, "POD table slower than the WiFiResult array");
+}
+
+static void test_time_per_scan()
+{
+  timeScans(100);
+  timeScans(256);
+}
+
+static void test_footprint()
+{
+  char message[160];
+
+  snprintf(message, sizeof(message), "sizeof(WiFiScanRecord) %u, sizeof(WiFiResult) %u + String heap",
+           (unsigned) sizeof(WiFiScanRecord), (unsigned) sizeof(LegacyWiFiResult));
+  TEST_MESSAGE(message);
+
+  // Fixed size, nothing behind pointers : the table can be copied into a snapshot with memcpy
+  TEST_ASSERT_TRUE(std::is_trivially_copyable<WiFiScanRecord>::value);
+  TEST_ASSERT_LESS_OR_EQUAL(64, sizeof(WiFiScanRecord));
+}
+
+static void test_table_holds_max_results()
+{
+  AsyncWebServer  server(80);
+  DNSServer       dns;
+
+  addAPs(WIFI_SCAN_MAX_RESULTS + 16);
+
+  std::unique_ptr<ESPAsync_WiFiManager> wm(new ESPAsync_WiFiManager(&server, &dns, "bench"));
+
+  scanInDriver(*wm);
+  TEST_ASSERT_TRUE(wm->pollScan());
+
+  wm->startConfigPortalModeless("portal", NULL, false);
+
+  AsyncWebServerRequest request("/scan");
+
+  server.handle(request);
+
+  String  body  = request.body();
+  int     items = 0;
+
+  for (int at = body.indexOf("\"SSID\""); at >= 0; at = body.indexOf("\"SSID\"", at + 1))
+    items++;
+
+  // Overflow is dropped, not written past the table. A quarter are duplicates, not listed
+  TEST_ASSERT_GREATER_THAN(0, items);
+  TEST_ASSERT_LESS_OR_EQUAL(WIFI_SCAN_MAX_RESULTS, items);
+}
+
+static void test_full_table_recycles_oldest()
+{
+  const int       quarter = WIFI_SCAN_MAX_RESULTS / 4;
+  AsyncWebServer  server(80);
+  DNSServer       dns;
+  char            ssid[33];
+
+  // Distinct SSIDs, so every table entry is listed
+  for (int i = 0; i < WIFI_SCAN_MAX_RESULTS + 2 * quarter; i++)
+  {
+    snprintf(ssid, sizeof(ssid), "ap-%04d", i);
+    HostWiFi::addAP(ssid, "password", 1 + (i % 13), -50, 0);
+
+    HostWiFi::ap(i).bssid[4] = (uint8_t) (i >> 8);
+    HostWiFi::ap(i).bssid[5] = (uint8_t) i;
+
+    HostWiFi::setUp(i, i < WIFI_SCAN_MAX_RESULTS);
+  }
+
+  std::unique_ptr<ESPAsync_WiFiManager> wm(new ESPAsync_WiFiManager(&server, &dns, "bench"));
+
+  wm->setRemoveDuplicateAPs(false);
+
+  // Full table, then the first quarter not heard in the second scan
+  scanInDriver(*wm);
+  TEST_ASSERT_TRUE(wm->pollScan());
+
+  for (int i = 0; i < quarter; i++)
+    HostWiFi::setUp(i, false);
+
+  scanInDriver(*wm);
+  TEST_ASSERT_TRUE(wm->pollScan());
+
+  // A quarter of new BSSIDs takes the place of the oldest ones, not of those just heard
+  for (int i = WIFI_SCAN_MAX_RESULTS; i < WIFI_SCAN_MAX_RESULTS + quarter; i++)
+    HostWiFi::setUp(i, true);
+
+  scanInDriver(*wm);
+  TEST_ASSERT_TRUE(wm->pollScan());
+
+  // Everything in the table heard again : nothing left to recycle, the last quarter is dropped
+  for (int i = WIFI_SCAN_MAX_RESULTS + quarter; i < WIFI_SCAN_MAX_RESULTS + 2 * quarter; i++)
+    HostWiFi::setUp(i, true);
+
+  scanInDriver(*wm);
+  TEST_ASSERT_TRUE(wm->pollScan());
+
+  wm->startConfigPortalModeless("portal", NULL, false);
+
+  AsyncWebServerRequest request("/scan");
+
+  server.handle(request);
+
+  String body = request.body();
+
+  for (int i = 0; i < WIFI_SCAN_MAX_RESULTS + 2 * quarter; i++)
+  {
+    snprintf(ssid, sizeof(ssid), "\"ap-%04d\"", i);
+
+    bool expected = (i >= quarter) && (i < WIFI_SCAN_MAX_RESULTS + quarter);
+
+    TEST_ASSERT_TRUE_MESSAGE(expected == (body.indexOf(ssid) >= 0), ssid);
+  }
+}
+
+//////////////////////////////////////////
+
+int main(int, char**)
+{
+  UNITY_BEGIN();
+
+  RUN_TEST(test_heap_per_scan);
+  RUN_TEST(test_time_per_scan);
+  RUN_TEST(test_footprint);
+  RUN_TEST(test_table_holds_max_results);
+  RUN_TEST(test_full_table_recycles_oldest);
+
+  return UNITY_END();
+}
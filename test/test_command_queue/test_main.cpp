@@ -0,0 +1,163 @@
+// Command ring: FIFO order, drops counted on a full ring and wiped slots, then one producer and one consumer
+// thread as the AsyncTCP task and the manager loop, every command arriving once, whole and in order
+// (run under native_tsan too).
+#include <unity.h>
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "WiFiCommandQueue.h"
+
+// Payload derived from the sequence number, so a torn copy shows up as a mismatch
+static WiFi_Command command(uint32_t seq)
+{
+  WiFi_Command c;
+
+  memset(&c, 0, sizeof(c));
+
+  c.type      = WM_CMD_SAVE;
+  c.IPFields  = (uint8_t) seq;
+  c.ip        = seq;
+  c.dns2      = ~seq;
+
+  snprintf(c.SSID, sizeof(c.SSID), "ssid-%u", seq);
+  snprintf(c.password, sizeof(c.password), "pass-%u", seq);
+
+  return c;
+}
+
+static bool matches(const WiFi_Command& c, uint32_t seq)
+{
+  WiFi_Command expected = command(seq);
+
+  return memcmp(&c, &expected, sizeof(c)) == 0;
+}
+
+void setUp()
+{
+}
+
+void tearDown()
+{
+}
+
+//////////////////////////////////////////
+
+static void test_fifo_and_drops()
+{
+  WiFiCommandQueue  queue;
+  WiFi_Command      c;
+
+  TEST_ASSERT_TRUE(queue.empty());
+  TEST_ASSERT_FALSE(queue.pop(c));
+
+  for (uint32_t i = 0; i < WIFI_COMMAND_QUEUE_SIZE; i++)
+    TEST_ASSERT_TRUE(queue.push(command(i)));
+
+  // Full : rejected and counted, what is queued stays
+  TEST_ASSERT_FALSE(queue.push(command(100)));
+  TEST_ASSERT_FALSE(queue.push(command(101)));
+  TEST_ASSERT_EQUAL_UINT32(2, queue.dropped());
+
+  for (uint32_t i = 0; i < WIFI_COMMAND_QUEUE_SIZE; i++)
+  {
+    TEST_ASSERT_TRUE(queue.pop(c));
+    TEST_ASSERT_TRUE(matches(c, i));
+  }
+
+  TEST_ASSERT_TRUE(queue.empty());
+  TEST_ASSERT_FALSE(queue.pop(c));
+}
+
+static void test_wraps_and_wipes()
+{
+  WiFiCommandQueue  queue;
+  WiFi_Command      c;
+
+  // Many times around the ring, one and a half slots at a time
+  for (uint32_t i = 0; i < 10 * WIFI_COMMAND_QUEUE_SIZE; i += 2)
+  {
+    TEST_ASSERT_TRUE(queue.push(command(i)));
+    TEST_ASSERT_TRUE(queue.push(command(i + 1)));
+
+    TEST_ASSERT_TRUE(queue.pop(c));
+    TEST_ASSERT_TRUE(matches(c, i));
+    TEST_ASSERT_TRUE(queue.pop(c));
+    TEST_ASSERT_TRUE(matches(c, i + 1));
+  }
+
+  TEST_ASSERT_EQUAL_UINT32(0, queue.dropped());
+
+  // No password left in the ring once popped
+  const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&queue);
+
+  for (size_t i = 0; i + 4 < sizeof(queue); i++)
+    TEST_ASSERT_FALSE(memcmp(bytes + i, "pass", 4) == 0);
+}
+
+static void test_producer_consumer_threads()
+{
+  const uint32_t    total = 200000;
+
+  WiFiCommandQueue  queue;
+  std::atomic<bool> done { false };
+  uint32_t          pushed = 0;
+
+  // AsyncTCP task : retries a rejected command, so nothing is lost but drops are counted
+  std::thread producer([&]()
+  {
+    for (uint32_t seq = 0; seq < total; )
+    {
+      if (queue.push(command(seq)))
+      {
+        seq++;
+        pushed++;
+      }
+      else
+      {
+        std::this_thread::yield();
+      }
+    }
+
+    done = true;
+  });
+
+  uint32_t      next = 0;
+  uint32_t      bad  = 0;
+  WiFi_Command  c;
+
+  // Manager loop
+  while (!done || !queue.empty())
+  {
+    if (!queue.pop(c))
+    {
+      std::this_thread::yield();
+      continue;
+    }
+
+    if (!matches(c, next))
+      bad++;
+
+    next++;
+  }
+
+  producer.join();
+
+  TEST_ASSERT_EQUAL_UINT32(0, bad);
+  TEST_ASSERT_EQUAL_UINT32(total, next);
+  TEST_ASSERT_EQUAL_UINT32(total, pushed);
+}
+
+//////////////////////////////////////////
+
+int main(int, char**)
+{
+  UNITY_BEGIN();
+
+  RUN_TEST(test_fifo_and_drops);
+  RUN_TEST(test_wraps_and_wipes);
+  RUN_TEST(test_producer_consumer_threads);
+
+  return UNITY_END();
+}
@@ -0,0 +1,172 @@
+// ETag / If-None-Match on the portal JSON endpoints: 304 while the content is unchanged, and the ETag sent
+// always names the version the body holds.
+#include <unity.h>
+
+#include <Preferences.h>
+
+#include "AutoConnect.h"
+
+static AsyncWebServer*        server;
+static DNSServer*             dns;
+static ESPAsync_WiFiManager*  wm;
+
+static void scanNow()
+{
+  TEST_ASSERT_TRUE(wm->startScan());
+
+  while (!wm->pollScan())
+    delay(10);
+}
+
+void setUp()
+{
+  HostSim::resetClock();
+  HostWiFi::reset();
+  HostNVS::reset();
+
+  HostWiFi::addAP("home", "password1", 6, -50);
+
+  server  = new AsyncWebServer(80);
+  dns     = new DNSServer();
+  wm      = new ESPAsync_WiFiManager(server, dns, "host");
+
+  wm->startConfigPortalModeless("portal", NULL, false);
+  scanNow();
+}
+
+void tearDown()
+{
+  delete wm;
+  delete dns;
+  delete server;
+}
+
+//////////////////////////////////////////
+
+static void test_scan_not_modified()
+{
+  AsyncWebServerRequest first("/scan");
+
+  server->handle(first);
+
+  String etag = first.response()->header("ETag");
+
+  TEST_ASSERT_EQUAL(200, first.response()->code);
+  TEST_ASSERT_TRUE(etag.length() > 0);
+
+  AsyncWebServerRequest again("/scan");
+
+  again.withHeader("If-None-Match", etag.c_str());
+  server->handle(again);
+
+  TEST_ASSERT_EQUAL(304, again.response()->code);
+  TEST_ASSERT_EQUAL_STRING(etag.c_str(), again.response()->header("ETag").c_str());
+
+  // A new scan is a new version
+  HostWiFi::addAP("office", "password2", 11, -60);
+  scanNow();
+
+  AsyncWebServerRequest changed("/scan");
+
+  changed.withHeader("If-None-Match", etag.c_str());
+  server->handle(changed);
+
+  TEST_ASSERT_EQUAL(200, changed.response()->code);
+  TEST_ASSERT_TRUE(changed.response()->header("ETag") != etag);
+  TEST_ASSERT_TRUE(changed.body().indexOf("office") >= 0);
+}
+
+static void test_scan_etag_matches_body()
+{
+  AsyncWebServerRequest request("/scan");
+
+  server->handle(request);
+
+  String etag = request.response()->header("ETag");
+
+  // A scan published after the headers went out, before the body is pulled
+  HostWiFi::addAP("office", "password2", 11, -40);
+  scanNow();
+
+  TEST_ASSERT_TRUE(request.body().indexOf("office") < 0);
+
+  // The same ETag again is the same body
+  AsyncWebServerRequest stale("/scan");
+
+  stale.withHeader("If-None-Match", etag.c_str());
+  server->handle(stale);
+
+  TEST_ASSERT_EQUAL(200, stale.response()->code);
+  TEST_ASSERT_TRUE(stale.body().indexOf("office") >= 0);
+}
+
+static void test_refresh_ignores_if_none_match()
+{
+  AsyncWebServerRequest first("/scan");
+
+  server->handle(first);
+
+  AsyncWebServerRequest refresh("/scan");
+
+  refresh.withArg("refresh", "1").withHeader("If-None-Match", first.response()->header("ETag").c_str());
+  server->handle(refresh);
+
+  String body = refresh.body(1460, []() { wm->loop(); delay(10); });
+
+  TEST_ASSERT_EQUAL(200, refresh.response()->code);
+  TEST_ASSERT_FALSE(refresh.response()->hasHeader("ETag"));
+  TEST_ASSERT_TRUE(body.indexOf("home") >= 0);
+}
+
+static void test_state_not_modified()
+{
+  AsyncWebServerRequest first("/state");
+
+  server->handle(first);
+
+  String etag = first.response()->header("ETag");
+
+  AsyncWebServerRequest again("/state");
+
+  again.withHeader("If-None-Match", etag.c_str());
+  server->handle(again);
+
+  TEST_ASSERT_EQUAL(304, again.response()->code);
+
+  // Any WiFi event invalidates it
+  wm->addCredential("home", "password1");
+  WiFi.begin("home", "password1");
+  HostSim::advanceMs(3000);
+
+  // Until the loop rebuilt the page the old one is served, and its ETag still names it
+  AsyncWebServerRequest pending("/state");
+
+  pending.withHeader("If-None-Match", etag.c_str());
+  server->handle(pending);
+
+  TEST_ASSERT_EQUAL(304, pending.response()->code);
+
+  wm->loop();
+
+  AsyncWebServerRequest changed("/state");
+
+  changed.withHeader("If-None-Match", etag.c_str());
+  server->handle(changed);
+
+  TEST_ASSERT_EQUAL(200, changed.response()->code);
+  TEST_ASSERT_TRUE(changed.response()->header("ETag") != etag);
+}
+
+//////////////////////////////////////////
+
+int main(int, char**)
+{
+  UNITY_BEGIN();
+
+  RUN_TEST(test_scan_not_modified);
+  RUN_TEST(test_scan_etag_matches_body);
+  RUN_TEST(test_refresh_ignores_if_none_match);
+  RUN_TEST(test_state_not_modified);
+
+  return UNITY_END();
+}
@@ -0,0 +1,274 @@
+// Connection planner: one scan matched against all stored credentials, candidates tried strongest / most
+// reliable first under a single deadline, and compared with the old sequential fallback through the list.
+#include <unity.h>
+
+#include <Preferences.h>
+
+#include "AutoConnect.h"
+
+static AsyncWebServer*        server;
+static DNSServer*             dns;
+static ESPAsync_WiFiManager*  wm;
+
+static uint64_t               failedAt;
+static uint64_t               portalAt;
+
+static std::vector<std::string> tried;
+
+static void onPortal(ESPAsync_WiFiManager*)
+{
+  portalAt = HostSim::nowUs();
+}
+
+static void start()
+{
+  server  = new AsyncWebServer(80);
+  dns     = new DNSServer();
+  wm      = new ESPAsync_WiFiManager(server, dns, "host");
+
+  wm->setAPCallback(onPortal);
+  wm->setConfigPortalTimeout(1);
+
+  WiFi.onEvent([](arduino_event_id_t event, arduino_event_info_t info)
+  {
+    if (event == ARDUINO_EVENT_WIFI_STA_DISCONNECTED)
+      failedAt = HostSim::nowUs();
+  });
+}
+
+// Stored credentials, most recent last, with optional connect history : successes out of attempts
+static void storeCredential(const char* ssid, const char* pass, int attempts = 0, int successes = 0)
+{
+  WiFiCredentialStore store;
+
+  int index = store.add(ssid, pass);
+
+  for (int i = 0; i < attempts; i++)
+    store.recordAttempt(index, i < successes, 2000);
+
+  store.save();
+}
+
+// What the driver has from a previous boot
+static void storeDriverConfig(const char* ssid, const char* pass)
+{
+  wifi_sta_config_t& flash = HostWiFi::driver().flash;
+
+  memset(&flash, 0, sizeof(flash));
+  strncpy((char*) flash.ssid, ssid, sizeof(flash.ssid));
+  strncpy((char*) flash.password, pass, sizeof(flash.password));
+
+  HostWiFi::boot();
+}
+
+// Every WiFi.begin() target, in order
+static void recordBegins()
+{
+  WiFi.onEvent([](arduino_event_id_t event, arduino_event_info_t info)
+  {
+    if (event == ARDUINO_EVENT_WIFI_STA_CONNECTED)
+      tried.push_back(std::string((const char*) info.wifi_sta_connected.ssid, info.wifi_sta_connected.ssid_len));
+  });
+}
+
+static bool timedAutoConnect(uint32_t& took)
+{
+  uint64_t  startedAt = HostSim::nowUs();
+  bool      connected = wm->autoConnect("portal");
+
+  took = (uint32_t) ((HostSim::nowUs() - startedAt) / 1000);
+
+  return connected;
+}
+
+void setUp()
+{
+  HostSim::resetClock();
+  HostSim::powerOff();
+  HostWiFi::reset();
+  HostNVS::reset();
+
+  failedAt  = 0;
+  portalAt  = 0;
+
+  tried.clear();
+}
+
+void tearDown()
+{
+  delete wm;
+  delete dns;
+  delete server;
+}
+
+//////////////////////////////////////////
+
+static void test_strongest_first()
+{
+  HostWiFi::addAP("home", "password1", 6, -70);
+  HostWiFi::addAP("office", "password2", 11, -50);
+  HostWiFi::addAP("cafe", "password3", 1, -60);
+
+  storeCredential("office", "password2");
+  storeCredential("cafe", "password3");
+  storeCredential("home", "password1");
+
+  start();
+  recordBegins();
+
+  TEST_ASSERT_TRUE(wm->autoConnect("portal"));
+
+  // Most recently saved is "home", the scan ranks "office" first and it is the only one tried
+  TEST_ASSERT_EQUAL(1, tried.size());
+  TEST_ASSERT_EQUAL_STRING("office", tried[0].c_str());
+  TEST_ASSERT_EQUAL_STRING("office", WiFi.SSID().c_str());
+  TEST_ASSERT_EQUAL(0, portalAt);
+}
+
+static void test_history_outranks_close_rssi()
+{
+  HostWiFi::addAP("home", "password1", 6, -55);
+  HostWiFi::addAP("office", "password2", 11, -60);
+
+  // "home" is 5 dB stronger, but failed most of its attempts
+  storeCredential("office", "password2", 8, 8);
+  storeCredential("home", "password1", 8, 1);
+
+  start();
+  recordBegins();
+
+  TEST_ASSERT_TRUE(wm->autoConnect("portal"));
+
+  TEST_ASSERT_EQUAL(1, tried.size());
+  TEST_ASSERT_EQUAL_STRING("office", tried[0].c_str());
+}
+
+static void test_falls_through_in_rank_order()
+{
+  // Seen by the scan, but "office" never answers the join, and "cafe" rejects the password
+  int office = HostWiFi::addAP("office", "password2", 11, -45);
+
+  HostWiFi::addAP("cafe", "password3", 1, -55);
+  HostWiFi::addAP("home", "password1", 6, -70);
+
+  HostWiFi::ap(office).assocMs = 60000;
+
+  storeCredential("home", "password1");
+  storeCredential("cafe", "wrong-password");
+  storeCredential("office", "password2");
+
+  start();
+  wm->setConnectTimeout(3);
+
+  uint32_t took;
+
+  TEST_ASSERT_TRUE(timedAutoConnect(took));
+
+  TEST_ASSERT_EQUAL_STRING("home", WiFi.SSID().c_str());
+
+  // Both stronger ones were tried and failed before "home", each once, all persisted in one write
+  WiFiCredentialStore store;
+
+  TEST_ASSERT_EQUAL(1, store.get(store.find("office"))->stats.attempts);
+  TEST_ASSERT_EQUAL(0, store.get(store.find("office"))->stats.successes);
+  TEST_ASSERT_EQUAL(1, store.get(store.find("cafe"))->stats.attempts);
+  TEST_ASSERT_EQUAL(0, store.get(store.find("cafe"))->stats.successes);
+  TEST_ASSERT_EQUAL(1, store.get(store.find("home"))->stats.successes);
+
+  // "office" cost the attempt limit, "cafe" only until the driver rejected the password
+  TEST_ASSERT_GREATER_OR_EQUAL_UINT32(3000, took);
+  TEST_ASSERT_LESS_THAN_UINT32(3000 + 13 * 150 + 5000, took);
+}
+
+static void test_driver_config_when_only_it_is_in_range()
+{
+  HostWiFi::addAP("home", "password1", 6, -50);
+
+  // Stored here, but not in range. The driver still has "home" from an older firmware
+  storeCredential("office", "password2");
+  storeDriverConfig("home", "password1");
+
+  start();
+
+  uint32_t took;
+
+  TEST_ASSERT_TRUE(timedAutoConnect(took));
+
+  TEST_ASSERT_EQUAL_STRING("home", WiFi.SSID().c_str());
+  TEST_ASSERT_EQUAL(0, portalAt);
+}
+
+static void test_plan_deadline_then_portal_at_once()
+{
+  int office  = HostWiFi::addAP("office", "password2", 11, -50);
+  int home    = HostWiFi::addAP("home", "password1", 6, -60);
+
+  HostWiFi::ap(office).assocMs  = 60000;
+  HostWiFi::ap(home).assocMs    = 60000;
+
+  storeCredential("home", "password1");
+  storeCredential("office", "password2");
+
+  start();
+  wm->setConnectTimeout(10);
+  wm->setConnectPlanTimeout(4);
+
+  uint64_t startedAt = HostSim::nowUs();
+
+  TEST_ASSERT_FALSE(wm->autoConnect("portal"));
+  TEST_ASSERT_NOT_EQUAL(0, portalAt);
+
+  // One scan plus the 4 s plan, not 2 x 10 s, and no extra wait before the portal
+  uint32_t toPortal = (uint32_t) ((portalAt - startedAt) / 1000);
+
+  TEST_ASSERT_LESS_THAN_UINT32(4000 + 13 * 150 + 500, toPortal);
+}
+
+static void test_worst_case_against_sequential()
+{
+  const int         stored        = 6;
+  const uint32_t    attemptLimit  = 5000;
+  const char*       names[stored] = { "net0", "net1", "net2", "net3", "net4", "net5" };
+
+  // Only the least recently saved one is in range : the worst case for a walk through the stored order
+  HostWiFi::addAP(names[0], "password", 6, -70);
+
+  for (int i = 0; i < stored; i++)
+    storeCredential(names[i], "password");
+
+  start();
+  wm->setConnectTimeout(attemptLimit / 1000);
+
+  uint32_t took;
+
+  TEST_ASSERT_TRUE(timedAutoConnect(took));
+  TEST_ASSERT_EQUAL_STRING(names[0], WiFi.SSID().c_str());
+
+  // Sequential : every missing network costs an attempt limit before the next one is tried
+  HostWiFi::AP&   ap          = HostWiFi::ap(0);
+  uint32_t        join        = HostWiFi::driver().connectDwellMs + ap.assocMs + ap.dhcpMs;
+  uint32_t        sequential  = (stored - 1) * attemptLimit + join;
+
+  TEST_ASSERT_LESS_THAN_UINT32(sequential / 4, took);
+
+  char message[128];
+
+  snprintf(message, sizeof(message), "%i stored, 1 in range : planner %u ms, sequential %u ms", stored, took, sequential);
+  TEST_MESSAGE(message);
+}
+
+//////////////////////////////////////////
+
+int main(int, char**)
+{
+  UNITY_BEGIN();
+
+  RUN_TEST(test_strongest_first);
+  RUN_TEST(test_history_outranks_close_rssi);
+  RUN_TEST(test_falls_through_in_rank_order);
+  RUN_TEST(test_driver_config_when_only_it_is_in_range);
+  RUN_TEST(test_plan_deadline_then_portal_at_once);
+  RUN_TEST(test_worst_case_against_sequential);
+
+  return UNITY_END();
+}
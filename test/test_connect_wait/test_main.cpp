@@ -0,0 +1,132 @@
+// Event-driven connect wait: autoConnect() returns as soon as the IP is bound, and gives up on a wrong
+// password or a missing SSID as soon as the driver reports it, not after the connect timeout.
+#include <unity.h>
+
+#include <Preferences.h>
+
+#include "AutoConnect.h"
+
+static AsyncWebServer*        server;
+static DNSServer*             dns;
+static ESPAsync_WiFiManager*  wm;
+
+static uint64_t               gotIPAt;
+static uint64_t               failedAt;
+static uint64_t               portalAt;
+
+static void onPortal(ESPAsync_WiFiManager*)
+{
+  portalAt = HostSim::nowUs();
+}
+
+// What the driver has from a previous boot
+static void storeDriverConfig(const char* ssid, const char* pass)
+{
+  wifi_sta_config_t& flash = HostWiFi::driver().flash;
+
+  memset(&flash, 0, sizeof(flash));
+  strncpy((char*) flash.ssid, ssid, sizeof(flash.ssid));
+  strncpy((char*) flash.password, pass, sizeof(flash.password));
+
+  HostWiFi::boot();
+}
+
+static void start()
+{
+  server  = new AsyncWebServer(80);
+  dns     = new DNSServer();
+  wm      = new ESPAsync_WiFiManager(server, dns, "host");
+
+  wm->setAPCallback(onPortal);
+  wm->setConfigPortalTimeout(5);
+
+  WiFi.onEvent([](arduino_event_id_t event, arduino_event_info_t info)
+  {
+    if (event == ARDUINO_EVENT_WIFI_STA_GOT_IP)
+      gotIPAt = HostSim::nowUs();
+
+    if ( (event == ARDUINO_EVENT_WIFI_STA_DISCONNECTED) && (failedAt == 0) &&
+         ( (info.wifi_sta_disconnected.reason == WIFI_REASON_AUTH_FAIL) || (info.wifi_sta_disconnected.reason == WIFI_REASON_NO_AP_FOUND) ) )
+    {
+      failedAt = HostSim::nowUs();
+    }
+  });
+}
+
+void setUp()
+{
+  HostSim::resetClock();
+  HostSim::powerOff();
+  HostWiFi::reset();
+  HostNVS::reset();
+
+  HostWiFi::addAP("home", "password1", 6, -50);
+
+  gotIPAt   = 0;
+  failedAt  = 0;
+  portalAt  = 0;
+}
+
+void tearDown()
+{
+  delete wm;
+  delete dns;
+  delete server;
+}
+
+//////////////////////////////////////////
+
+static void test_returns_on_got_ip()
+{
+  storeDriverConfig("home", "password1");
+  start();
+
+  TEST_ASSERT_TRUE(wm->autoConnect("portal"));
+
+  uint64_t returnedAt = HostSim::nowUs();
+
+  TEST_ASSERT_NOT_EQUAL(0, gotIPAt);
+  TEST_ASSERT_EQUAL(0, portalAt);
+
+  // No poll interval between the event and the return
+  TEST_ASSERT_LESS_OR_EQUAL_UINT64(1000, returnedAt - gotIPAt);
+}
+
+static void test_wrong_password_ends_wait()
+{
+  storeDriverConfig("home", "wrong-password");
+  start();
+
+  TEST_ASSERT_FALSE(wm->autoConnect("portal"));
+
+  TEST_ASSERT_NOT_EQUAL(0, failedAt);
+  TEST_ASSERT_NOT_EQUAL(0, portalAt);
+
+  // Straight to the portal, the AP settle delay aside
+  TEST_ASSERT_LESS_OR_EQUAL_UINT64((WIFI_PORTAL_AP_SETTLE_MS + 100) * 1000, portalAt - failedAt);
+}
+
+static void test_missing_ssid_ends_wait()
+{
+  storeDriverConfig("elsewhere", "password1");
+  start();
+
+  TEST_ASSERT_FALSE(wm->autoConnect("portal"));
+
+  TEST_ASSERT_NOT_EQUAL(0, failedAt);
+  TEST_ASSERT_NOT_EQUAL(0, portalAt);
+  TEST_ASSERT_LESS_OR_EQUAL_UINT64((WIFI_PORTAL_AP_SETTLE_MS + 100) * 1000, portalAt - failedAt);
+}
+
+//////////////////////////////////////////
+
+int main(int, char**)
+{
+  UNITY_BEGIN();
+
+  RUN_TEST(test_returns_on_got_ip);
+  RUN_TEST(test_wrong_password_ends_wait);
+  RUN_TEST(test_missing_ssid_ends_wait);
+
+  return UNITY_END();
+}
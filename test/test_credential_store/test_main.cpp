@@ -0,0 +1,292 @@
+// Credential store persistence, counted in NVS writes: unchanged or cancelled-out edits write nothing,
+// a change is written even if its blob hashes like the stored one, and a version 1 blob is migrated
+// with a single write. End to end, re-submitting the config we are connected with neither writes nor reconnects.
+#include <unity.h>
+
+#include <unordered_map>
+
+#include <Preferences.h>
+
+#include "AutoConnect.h"
+
+static uint32_t credentialWrites()
+{
+  return HostNVS::writes(WIFI_CREDENTIALS_KEY);
+}
+
+// What NVS holds now, as a fresh boot would load it
+static void expectStored(const char* ssid, const char* pass)
+{
+  WiFiCredentialStore stored;
+
+  int index = stored.find(ssid);
+
+  TEST_ASSERT_GREATER_OR_EQUAL(0, index);
+  TEST_ASSERT_EQUAL_STRING(pass, stored.get(index)->password);
+}
+
+void setUp()
+{
+  HostSim::resetClock();
+  HostSim::powerOff();
+  HostWiFi::reset();
+  HostNVS::reset();
+}
+
+void tearDown()
+{
+}
+
+//////////////////////////////////////////
+
+static void test_unchanged_saves_nothing()
+{
+  WiFiCredentialStore store;
+
+  // Nothing stored, nothing to write
+  TEST_ASSERT_TRUE(store.save());
+  TEST_ASSERT_EQUAL_UINT32(0, credentialWrites());
+
+  store.add("home", "password1");
+  store.setChannel(0, 6);
+
+  TEST_ASSERT_TRUE(store.save());
+  TEST_ASSERT_EQUAL_UINT32(1, credentialWrites());
+
+  // Same again, and no-op edits
+  store.add("home", "password1");
+  store.setChannel(0, 6);
+
+  TEST_ASSERT_FALSE(store.changed());
+  TEST_ASSERT_TRUE(store.save());
+  TEST_ASSERT_EQUAL_UINT32(1, credentialWrites());
+
+  store.setChannel(0, 11);
+
+  TEST_ASSERT_TRUE(store.changed());
+  TEST_ASSERT_TRUE(store.save());
+  TEST_ASSERT_EQUAL_UINT32(2, credentialWrites());
+  TEST_ASSERT_EQUAL_UINT32(2, store.writes());
+}
+
+static void test_cancelled_edits_save_nothing()
+{
+  WiFiCredentialStore store;
+
+  store.add("office", "password2");
+  store.add("home", "password1");
+  store.save();
+
+  TEST_ASSERT_EQUAL_UINT32(1, credentialWrites());
+
+  // /wifisave with SSID home, SSID1 office : office moves up, then home back in front
+  store.add("office", "password2");
+  store.add("home", "password1");
+
+  TEST_ASSERT_FALSE(store.changed());
+  TEST_ASSERT_TRUE(store.save());
+  TEST_ASSERT_EQUAL_UINT32(1, credentialWrites());
+}
+
+// Two passwords whose blobs hash alike : FNV-1a over identical bytes around them, so a collision of the
+// whole blob is a birthday search over the password alone
+static bool findCollision(const char* ssid, char* first, char* second)
+{
+  WiFi_CredentialBlob* blob = new WiFi_CredentialBlob();
+
+  memset(blob, 0, sizeof(*blob));
+
+  blob->header.version    = WIFI_CREDENTIALS_VERSION;
+  blob->header.recordSize = sizeof(WiFi_Credential);
+  blob->header.count      = 1;
+  strncpy(blob->records[0].SSID, ssid, WIFI_SSID_MAXLEN);
+
+  size_t len = sizeof(WiFi_CredentialHeader) + sizeof(WiFi_Credential);
+
+  std::unordered_map<uint32_t, uint32_t> seen;
+
+  bool found = false;
+
+  for (uint32_t i = 0; (i < 1000000) && !found; i++)
+  {
+    memset(blob->records[0].password, 0, sizeof(blob->records[0].password));
+    snprintf(blob->records[0].password, sizeof(blob->records[0].password), "pw-%08x", i);
+
+    uint32_t hash = WiFi_SSIDHash(reinterpret_cast<const char*>(blob), len);
+    auto     hit  = seen.find(hash);
+
+    if (hit != seen.end())
+    {
+      snprintf(first, WIFI_PASS_MAXLEN + 1, "pw-%08x", hit->second);
+      snprintf(second, WIFI_PASS_MAXLEN + 1, "pw-%08x", i);
+
+      found = true;
+    }
+
+    seen[hash] = i;
+  }
+
+  delete blob;
+
+  return found;
+}
+
+static void test_hash_collision_still_written()
+{
+  char first[WIFI_PASS_MAXLEN + 1];
+  char second[WIFI_PASS_MAXLEN + 1];
+
+  TEST_ASSERT_TRUE(findCollision("home", first, second));
+
+  WiFiCredentialStore store;
+
+  store.add("home", first);
+  store.save();
+
+  TEST_ASSERT_EQUAL_UINT32(1, credentialWrites());
+
+  // Same hash, different bytes : must not be taken for unchanged
+  store.add("home", second);
+
+  TEST_ASSERT_TRUE(store.changed());
+  TEST_ASSERT_TRUE(store.save());
+  TEST_ASSERT_EQUAL_UINT32(2, credentialWrites());
+
+  expectStored("home", second);
+}
+
+static void test_v1_blob_migrated_with_one_write()
+{
+  // Version 1 : 4-byte header, records up to and including the channel
+  const char* ssids[] = { "home", "office" };
+  const char* pws[]   = { "password1", "password2" };
+
+  std::vector<uint8_t> v1(WIFI_CREDENTIAL_V1_HEADER + 2 * WIFI_CREDENTIAL_V1_SIZE, 0);
+
+  v1[0] = 1;
+  v1[1] = WIFI_CREDENTIAL_V1_SIZE;
+  v1[2] = 2;
+
+  for (int i = 0; i < 2; i++)
+  {
+    uint8_t* record = &v1[WIFI_CREDENTIAL_V1_HEADER + i * WIFI_CREDENTIAL_V1_SIZE];
+
+    strcpy((char*) record + offsetof(WiFi_Credential, SSID), ssids[i]);
+    strcpy((char*) record + offsetof(WiFi_Credential, password), pws[i]);
+    record[offsetof(WiFi_Credential, channel)] = 6 + i;
+  }
+
+  {
+    Preferences prefs;
+
+    prefs.begin(WIFI_PREFS_NAMESPACE, false);
+    prefs.putBytes(WIFI_CREDENTIALS_KEY, v1.data(), v1.size());
+    prefs.end();
+  }
+
+  uint32_t before = credentialWrites();
+
+  WiFiCredentialStore store;
+
+  // Loading migrates in RAM only
+  TEST_ASSERT_EQUAL(2, store.count());
+  TEST_ASSERT_EQUAL_UINT32(before, credentialWrites());
+
+  for (int i = 0; i < 2; i++)
+  {
+    TEST_ASSERT_EQUAL_STRING(ssids[i], store.get(i)->SSID);
+    TEST_ASSERT_EQUAL_STRING(pws[i], store.get(i)->password);
+    TEST_ASSERT_EQUAL_UINT8(6 + i, store.get(i)->channel);
+    TEST_ASSERT_EQUAL(0, store.get(i)->stats.attempts);
+  }
+
+  TEST_ASSERT_TRUE(store.changed());
+  TEST_ASSERT_TRUE(store.save());
+  TEST_ASSERT_EQUAL_UINT32(before + 1, credentialWrites());
+
+  // Next boot loads version 2 as is, nothing to write back
+  WiFiCredentialStore next;
+
+  TEST_ASSERT_EQUAL(2, next.count());
+  TEST_ASSERT_EQUAL_STRING("office", next.get(1)->SSID);
+  TEST_ASSERT_FALSE(next.changed());
+  TEST_ASSERT_TRUE(next.save());
+  TEST_ASSERT_EQUAL_UINT32(before + 1, credentialWrites());
+}
+
+static void test_identical_wifisave_keeps_connection()
+{
+  HostWiFi::addAP("home", "password1", 6, -50);
+  HostWiFi::addAP("office", "password2", 11, -60);
+
+  AsyncWebServer        server(80);
+  DNSServer             dns;
+  ESPAsync_WiFiManager  wm(&server, &dns, "host");
+
+  wm.addCredential("office", "password2");
+  wm.addCredential("home", "password1");
+
+  TEST_ASSERT_TRUE(wm.autoConnect("portal"));
+
+  wm.startConfigPortalModeless("portal", NULL, false);
+
+  for (int i = 0; i < 5; i++)
+  {
+    wm.criticalLoop();
+    delay(100);
+  }
+
+  uint32_t writes       = HostNVS::writes();
+  uint32_t begins       = HostWiFi::driver().begins;
+  uint32_t disconnects  = HostWiFi::driver().disconnects;
+
+  AsyncWebServerRequest same("/wifisave");
+
+  same.withHeader("SSID", "home").withHeader("Pwd", "password1").withHeader("SSID1", "office").withHeader("Pwd1", "password2");
+  server.handle(same);
+
+  for (int i = 0; i < 5; i++)
+  {
+    wm.criticalLoop();
+    delay(100);
+  }
+
+  // Nothing written, not even the static IP, and the link never dropped
+  TEST_ASSERT_EQUAL_UINT32(writes, HostNVS::writes());
+  TEST_ASSERT_EQUAL_UINT32(begins, HostWiFi::driver().begins);
+  TEST_ASSERT_EQUAL_UINT32(disconnects, HostWiFi::driver().disconnects);
+  TEST_ASSERT_EQUAL(WL_CONNECTED, WiFi.status());
+
+  // A new password is one credential write
+  AsyncWebServerRequest changed("/wifisave");
+
+  changed.withHeader("SSID", "home").withHeader("Pwd", "password3").withHeader("SSID1", "office").withHeader("Pwd1", "password2");
+  server.handle(changed);
+
+  uint32_t credsBefore = credentialWrites();
+
+  for (int i = 0; i < 5; i++)
+  {
+    wm.criticalLoop();
+    delay(100);
+  }
+
+  TEST_ASSERT_EQUAL_UINT32(credsBefore + 1, credentialWrites());
+
+  expectStored("home", "password3");
+}
+
+//////////////////////////////////////////
+
+int main(int, char**)
+{
+  UNITY_BEGIN();
+
+  RUN_TEST(test_unchanged_saves_nothing);
+  RUN_TEST(test_cancelled_edits_save_nothing);
+  RUN_TEST(test_hash_collision_still_written);
+  RUN_TEST(test_v1_blob_migrated_with_one_write);
+  RUN_TEST(test_identical_wifisave_keeps_connection);
+
+  return UNITY_END();
+}
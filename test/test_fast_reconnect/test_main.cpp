@@ -0,0 +1,285 @@
+// Fast reconnect from the cached BSSID / channel / lease: no scan and no DHCP wait on the way up, but the
+// driver ends up unpinned, DHCP takes over the cached address, and the lease is only reused while fresh. A
+// failed fast reconnect drops the NVS copy too, so a cold boot doesn't retry the same AP.
+#include <unity.h>
+
+#include <Preferences.h>
+
+#include "AutoConnect.h"
+
+static AsyncWebServer*        server;
+static DNSServer*             dns;
+static ESPAsync_WiFiManager*  wm;
+
+static int                    home;
+static int                    homeFar;
+
+static void start()
+{
+  server  = new AsyncWebServer(80);
+  dns     = new DNSServer();
+  wm      = new ESPAsync_WiFiManager(server, dns, "host");
+
+  wm->setConfigPortalTimeout(5);
+}
+
+static void stop()
+{
+  delete wm;
+  delete dns;
+  delete server;
+
+  wm = NULL;
+}
+
+// Reset or wake from deep sleep, secondsAsleep later. RTC memory and the wall clock carry on
+static void reboot(uint32_t secondsAsleep)
+{
+  int64_t wall = HostSim::core().epochS.load() + (int64_t) (HostSim::nowUs() / 1000000);
+
+  stop();
+
+  HostSim::resetClock();
+  HostSim::setEpoch(HostSim::core().epochS.load() ? wall + secondsAsleep - 1 : 0);
+  HostWiFi::boot();
+
+  start();
+}
+
+static uint32_t timedAutoConnect()
+{
+  uint64_t startedAt = HostSim::nowUs();
+
+  TEST_ASSERT_TRUE(wm->autoConnect("portal"));
+
+  return (uint32_t) ((HostSim::nowUs() - startedAt) / 1000);
+}
+
+// Pinned join : one channel visited, then association. DHCP on top unless the cached lease is used
+static uint32_t joinMs(bool dhcp)
+{
+  return HostWiFi::driver().connectDwellMs + HostWiFi::ap(home).assocMs + (dhcp ? HostWiFi::ap(home).dhcpMs : 0);
+}
+
+static std::vector<uint8_t> storedCache()
+{
+  std::lock_guard<std::recursive_mutex> guard(HostNVS::store().lock);
+
+  return HostNVS::store().spaces[WIFI_PREFS_NAMESPACE][WIFI_RECONNECT_CACHE_KEY];
+}
+
+void setUp()
+{
+  HostSim::resetClock();
+  HostSim::powerOff();
+  HostSim::setEpoch(1790000000);
+  HostWiFi::reset();
+  HostNVS::reset();
+
+  home    = HostWiFi::addAP("home", "password1", 6, -50);
+  homeFar = HostWiFi::addAP("home", "password1", 11, -70);
+
+  // Stored by the driver on an earlier boot
+  wifi_sta_config_t& flash = HostWiFi::driver().flash;
+
+  strcpy((char*) flash.ssid, "home");
+  strcpy((char*) flash.password, "password1");
+
+  HostWiFi::boot();
+
+  // First boot, scan and DHCP, fills the cache
+  start();
+  timedAutoConnect();
+
+  TEST_ASSERT_EQUAL_UINT32(HostWiFi::leaseOf(home), (uint32_t) WiFi.localIP());
+  TEST_ASSERT_FALSE(storedCache().empty());
+}
+
+void tearDown()
+{
+  stop();
+}
+
+//////////////////////////////////////////
+
+static void test_skips_scan_and_dhcp()
+{
+  reboot(60);
+
+  uint32_t took = timedAutoConnect();
+
+  TEST_ASSERT_EQUAL_UINT32(0, HostWiFi::driver().scansStarted);
+  TEST_ASSERT_TRUE(HostWiFi::driver().lastBeginPinned);
+  TEST_ASSERT_EQUAL_UINT32(HostWiFi::leaseOf(home), (uint32_t) WiFi.localIP());
+
+  TEST_ASSERT_UINT32_WITHIN(20, joinMs(false), took);
+}
+
+static void test_driver_unpinned_after_join()
+{
+  reboot(60);
+  timedAutoConnect();
+
+  const wifi_sta_config_t& ram = HostWiFi::driver().ram;
+
+  TEST_ASSERT_FALSE(ram.bssid_set);
+  TEST_ASSERT_EQUAL_UINT8(0, ram.channel);
+  TEST_ASSERT_EQUAL_UINT32(0, HostWiFi::driver().flashWrites);
+
+  // The driver's own reconnect may take the other BSSID once this one goes away
+  HostWiFi::setUp(home, false);
+  HostSim::advanceMs(5000);
+
+  TEST_ASSERT_EQUAL(WL_CONNECTED, WiFi.status());
+  TEST_ASSERT_EQUAL_UINT8(11, WiFi.channel());
+}
+
+static void test_dhcp_takes_over_cached_lease()
+{
+  // The server would hand out another address by now
+  uint32_t cached = HostWiFi::leaseOf(home);
+
+  HostWiFi::ap(home).lease = 0x3201A8C0;
+
+  reboot(60);
+  timedAutoConnect();
+
+  TEST_ASSERT_EQUAL_UINT32(cached, (uint32_t) WiFi.localIP());
+  TEST_ASSERT_EQUAL_UINT32(1, HostWiFi::driver().dhcpStarts);
+
+  // The cached address stays usable until DHCP binds
+  HostSim::advanceMs(HostWiFi::ap(home).dhcpMs / 2);
+
+  TEST_ASSERT_EQUAL_UINT32(cached, (uint32_t) WiFi.localIP());
+
+  HostSim::advanceMs(HostWiFi::ap(home).dhcpMs);
+
+  TEST_ASSERT_TRUE(HostWiFi::driver().dhcp);
+  TEST_ASSERT_EQUAL_UINT32(0x3201A8C0, (uint32_t) WiFi.localIP());
+}
+
+static void test_cached_lease_not_written_back()
+{
+  std::vector<uint8_t> before = storedCache();
+
+  reboot(60);
+
+  uint32_t writesBefore = HostNVS::writes(WIFI_RECONNECT_CACHE_KEY);
+
+  timedAutoConnect();
+
+  // Same AP, lease restored from the cache : nothing new to store, its time must not move
+  TEST_ASSERT_EQUAL_UINT32(writesBefore, HostNVS::writes(WIFI_RECONNECT_CACHE_KEY));
+  TEST_ASSERT_TRUE(before == storedCache());
+
+  // Rebooting just before the TTL still uses it, just after doesn't
+  reboot(WIFI_FAST_RECONNECT_LEASE_TTL - 120);
+
+  uint32_t took = timedAutoConnect();
+
+  TEST_ASSERT_UINT32_WITHIN(20, joinMs(false), took);
+}
+
+static void test_stale_lease_goes_through_dhcp()
+{
+  reboot(WIFI_FAST_RECONNECT_LEASE_TTL + 1);
+
+  uint32_t took = timedAutoConnect();
+
+  // Still pinned, no scan, but DHCP for the address
+  TEST_ASSERT_EQUAL_UINT32(0, HostWiFi::driver().scansStarted);
+  TEST_ASSERT_UINT32_WITHIN(20, joinMs(true), took);
+  TEST_ASSERT_EQUAL_UINT32(0, HostWiFi::driver().dhcpStarts);
+
+  // And the new lease is cached with its own time
+  reboot(60);
+
+  took = timedAutoConnect();
+
+  TEST_ASSERT_UINT32_WITHIN(20, joinMs(false), took);
+}
+
+static void test_power_cycle_without_time_sync()
+{
+  // Cached before time was ever synced
+  HostSim::setEpoch(0);
+  reboot(0);
+  timedAutoConnect();
+
+  stop();
+
+  HostSim::resetClock();
+  HostSim::powerOff();
+  HostWiFi::boot();
+
+  start();
+
+  // BSSID and channel from NVS still help, the lease age is unknown
+  uint32_t took = timedAutoConnect();
+
+  TEST_ASSERT_EQUAL_UINT32(0, HostWiFi::driver().scansStarted);
+  TEST_ASSERT_UINT32_WITHIN(20, joinMs(true), took);
+}
+
+static void test_power_cycle_with_time_sync()
+{
+  stop();
+
+  HostSim::resetClock();
+  HostSim::powerOff();
+  HostSim::setEpoch(1790000600);
+  HostWiFi::boot();
+
+  start();
+
+  uint32_t took = timedAutoConnect();
+
+  TEST_ASSERT_UINT32_WITHIN(20, joinMs(false), took);
+}
+
+static void test_failure_clears_nvs_copy()
+{
+  // Both gone : the pinned join fails, and so does the fallback
+  HostWiFi::setUp(home, false);
+  HostWiFi::setUp(homeFar, false);
+
+  reboot(60);
+
+  TEST_ASSERT_FALSE(wm->autoConnect("portal"));
+  TEST_ASSERT_TRUE(storedCache().empty());
+
+  // Power cycle, the RTC copy is gone too : straight to the scan, no pinned join to the old AP first
+  stop();
+
+  HostSim::resetClock();
+  HostSim::powerOff();
+  HostWiFi::boot();
+  HostWiFi::setUp(homeFar, true);
+
+  start();
+  timedAutoConnect();
+
+  TEST_ASSERT_GREATER_THAN_UINT32(0, HostWiFi::driver().scansStarted);
+  TEST_ASSERT_EQUAL_UINT32(HostWiFi::leaseOf(homeFar), (uint32_t) WiFi.localIP());
+
+  // Cached again once connected
+  TEST_ASSERT_FALSE(storedCache().empty());
+}
+
+//////////////////////////////////////////
+
+int main(int, char**)
+{
+  UNITY_BEGIN();
+
+  RUN_TEST(test_skips_scan_and_dhcp);
+  RUN_TEST(test_driver_unpinned_after_join);
+  RUN_TEST(test_dhcp_takes_over_cached_lease);
+  RUN_TEST(test_cached_lease_not_written_back);
+  RUN_TEST(test_stale_lease_goes_through_dhcp);
+  RUN_TEST(test_power_cycle_without_time_sync);
+  RUN_TEST(test_power_cycle_with_time_sync);
+  RUN_TEST(test_failure_clears_nvs_copy);
+
+  return UNITY_END();
+}
@@ -0,0 +1,242 @@
+// HTTP handlers on their own thread, as on the AsyncTCP task, while the portal task or criticalLoop() runs the
+// manager: handlers only post commands and copy what the loop published, so under native_tsan nothing races.
+// /state never pairs an ETag with another version's body, and page opens post one portal hold, not one each.
+// WiFi events delivered on their own thread, as by the event task, match the attempt the loop is making.
+#include <unity.h>
+
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <thread>
+
+#include <Preferences.h>
+
+#include "AutoConnect.h"
+
+static AsyncWebServer*        server;
+static DNSServer*             dns;
+static ESPAsync_WiFiManager*  wm;
+
+static const char* urls[] = { "/", "/wifi", "/i", "/state", "/scan", "/stats", "/link" };
+
+static AsyncWebServerRequest* get(const char* url)
+{
+  AsyncWebServerRequest* request = new AsyncWebServerRequest(url);
+
+  server->handle(*request);
+
+  return request;
+}
+
+static int save(const char* ssid, const char* pass)
+{
+  AsyncWebServerRequest request("/wifisave");
+
+  request.withHeader("SSID", ssid).withHeader("Pwd", pass);
+  server->handle(request);
+
+  // No response once the portal ended
+  return request.response() ? request.response()->code : 0;
+}
+
+// The AsyncTCP task : one thread, the only producer of the command ring. Every url in turn, a refreshed /scan
+// now and then, and a /wifisave halfway. /state bodies are recorded per ETag
+static void serve(int rounds, std::map<String, String>& states, int& mismatches, int& saveCode)
+{
+  for (int round = 0; round < rounds; round++)
+  {
+    for (const char* url : urls)
+    {
+      std::unique_ptr<AsyncWebServerRequest> request(get(url));
+
+      String body = request->body(1460, []() { std::this_thread::sleep_for(std::chrono::milliseconds(1)); });
+
+      if (request->response() && (strcmp(url, "/state") == 0))
+      {
+        String etag = request->response()->header("ETag");
+        auto   seen = states.find(etag);
+
+        if (seen == states.end())
+          states[etag] = body;
+        else if (seen->second != body)
+          mismatches++;
+      }
+    }
+
+    if (round % 10 == 5)
+    {
+      AsyncWebServerRequest refresh("/scan");
+
+      refresh.withArg("refresh", "1");
+      server->handle(refresh);
+      refresh.body(1460, []() { std::this_thread::sleep_for(std::chrono::milliseconds(1)); });
+    }
+
+    if (round == rounds / 2)
+      saveCode = save("office", "password2");
+  }
+}
+
+void setUp()
+{
+  HostSim::resetClock();
+  HostSim::powerOff();
+  HostWiFi::reset();
+  HostNVS::reset();
+
+  HostWiFi::addAP("home", "password1", 6, -50);
+  HostWiFi::addAP("office", "password2", 11, -60);
+
+  server  = new AsyncWebServer(80);
+  dns     = new DNSServer();
+  wm      = new ESPAsync_WiFiManager(server, dns, "host");
+}
+
+void tearDown()
+{
+  delete wm;
+  delete dns;
+  delete server;
+
+  HostSim::realTime(false);
+}
+
+//////////////////////////////////////////
+
+static void test_page_opens_post_one_hold()
+{
+  wm->setConfigPortalTimeout(60);
+  wm->startConfigPortalModeless("portal", NULL, false);
+
+  for (int i = 0; i < 3; i++)
+  {
+    wm->criticalLoop();
+    delay(50);
+  }
+
+  // The loop stalls meanwhile : one hold in the ring, not one per page
+  for (int round = 0; round < 20; round++)
+  {
+    for (const char* url : urls)
+      delete get(url);
+  }
+
+  TEST_ASSERT_EQUAL(200, save("office", "password2"));
+}
+
+static void test_task_portal_with_handler_thread()
+{
+  HostSim::realTime(true);
+
+  wm->setConfigPortalTask(true);
+  wm->setConfigPortalTimeout(60);
+
+  TEST_ASSERT_FALSE(wm->startConfigPortal("portal"));
+
+  std::map<String, String> states;
+  int                      mismatches = 0;
+  int                      saveCode   = 0;
+
+  std::thread asyncTCP([&]()
+  {
+    serve(60, states, mismatches, saveCode);
+  });
+
+  asyncTCP.join();
+
+  TEST_ASSERT_EQUAL(200, saveCode);
+  TEST_ASSERT_EQUAL(0, mismatches);
+  TEST_ASSERT_TRUE(wm->waitConfigPortal(10000));
+  TEST_ASSERT_EQUAL_STRING("office", WiFi.SSID().c_str());
+}
+
+static void test_modeless_loop_with_handler_thread()
+{
+  HostSim::realTime(true);
+
+  wm->startConfigPortalModeless("portal", NULL, false);
+
+  std::map<String, String> states;
+  int                      mismatches = 0;
+  int                      saveCode   = 0;
+  std::atomic<bool>        done { false };
+
+  std::thread asyncTCP([&]()
+  {
+    serve(60, states, mismatches, saveCode);
+    done = true;
+  });
+
+  while (!done)
+  {
+    wm->criticalLoop();
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+
+  asyncTCP.join();
+
+  for (int i = 0; (i < 5000) && (WiFi.status() != WL_CONNECTED); i++)
+  {
+    wm->criticalLoop();
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+
+  TEST_ASSERT_EQUAL(200, saveCode);
+  TEST_ASSERT_EQUAL(0, mismatches);
+  TEST_ASSERT_TRUE(states.size() > 1);
+  TEST_ASSERT_EQUAL(WL_CONNECTED, WiFi.status());
+  TEST_ASSERT_EQUAL_STRING("office", WiFi.SSID().c_str());
+}
+
+static void test_connect_events_on_event_task()
+{
+  HostSim::realTime(true);
+
+  // Wrong password : every reconnect attempt ends on the driver's auth failure, well before the timeout
+  wm->addCredential("office", "password1");
+  wm->setReconnectBackoff(1, 1);
+  wm->setConnectTimeout(10);
+  wm->startConfigPortalModeless("portal", NULL, false);
+
+  std::atomic<bool> done { false };
+
+  // The event task : the only thread delivering driver events
+  std::thread events([&]()
+  {
+    while (!done)
+    {
+      HostSim::pump();
+      std::this_thread::sleep_for(std::chrono::microseconds(200));
+    }
+  });
+
+  // Three attempts after the first scan, in well under one connect timeout each
+  uint32_t  begins  = HostWiFi::driver().begins;
+  auto      until   = std::chrono::steady_clock::now() + std::chrono::seconds(12);
+
+  while ( (HostWiFi::driver().begins - begins < 3) && (std::chrono::steady_clock::now() < until) )
+  {
+    wm->criticalLoop();
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+
+  done = true;
+  events.join();
+
+  TEST_ASSERT_GREATER_OR_EQUAL_UINT32(3, HostWiFi::driver().begins - begins);
+  TEST_ASSERT_NOT_EQUAL(WL_CONNECTED, WiFi.status());
+}
+
+//////////////////////////////////////////
+
+int main(int, char**)
+{
+  UNITY_BEGIN();
+
+  RUN_TEST(test_page_opens_post_one_hold);
+  RUN_TEST(test_task_portal_with_handler_thread);
+  RUN_TEST(test_modeless_loop_with_handler_thread);
+  RUN_TEST(test_connect_events_on_event_task);
+
+  return UNITY_END();
+}
@@ -0,0 +1,140 @@
+// Channel-targeted scan for the stored credentials: a full sweep the first time, then only the channels
+// they were last found on, back to a full sweep when none of them answers there.
+#include <unity.h>
+
+#include <Preferences.h>
+
+#include "AutoConnect.h"
+
+static AsyncWebServer*        server;
+static DNSServer*             dns;
+static ESPAsync_WiFiManager*  wm;
+
+static const uint32_t fullSweepMs = 13 * 150;
+
+void setUp()
+{
+  HostSim::resetClock();
+  HostWiFi::reset();
+  HostNVS::reset();
+
+  HostWiFi::addAP("home", "password1", 6, -50);
+  HostWiFi::addAP("office", "password2", 11, -65);
+  HostWiFi::addAP("neighbour", "password3", 3, -75);
+
+  server  = new AsyncWebServer(80);
+  dns     = new DNSServer();
+  wm      = new ESPAsync_WiFiManager(server, dns, "host");
+}
+
+void tearDown()
+{
+  delete wm;
+  delete dns;
+  delete server;
+}
+
+static uint32_t timedScan(bool expectFound)
+{
+  uint64_t startedAt = HostSim::nowUs();
+
+  TEST_ASSERT_EQUAL(expectFound, wm->scanKnownNetworks());
+
+  return (uint32_t) ((HostSim::nowUs() - startedAt) / 1000);
+}
+
+//////////////////////////////////////////
+
+static void test_first_scan_sweeps_and_records_channels()
+{
+  wm->addCredential("office", "password2");
+  wm->addCredential("home", "password1");
+
+  TEST_ASSERT_EQUAL_UINT8(0, wm->getChannel(wm->findCredential("home")));
+
+  uint32_t took = timedScan(true);
+
+  TEST_ASSERT_UINT32_WITHIN(30, fullSweepMs, took);
+  TEST_ASSERT_EQUAL_UINT8(6, wm->getChannel(wm->findCredential("home")));
+  TEST_ASSERT_EQUAL_UINT8(11, wm->getChannel(wm->findCredential("office")));
+}
+
+static void test_known_channels_are_targeted()
+{
+  wm->addCredential("office", "password2");
+  wm->addCredential("home", "password1");
+
+  timedScan(true);
+
+  uint32_t scansBefore  = HostWiFi::driver().scansStarted;
+  uint32_t took         = timedScan(true);
+
+  // Two channels at the targeted dwell instead of thirteen
+  TEST_ASSERT_EQUAL_UINT32(2, HostWiFi::driver().scansStarted - scansBefore);
+  TEST_ASSERT_UINT32_WITHIN(30, 2 * WIFI_SCAN_TARGETED_DWELL_MS, took);
+  TEST_ASSERT_LESS_THAN(fullSweepMs / 4, took);
+
+  char message[96];
+
+  snprintf(message, sizeof(message), "Known networks found in %u ms, full sweep %u ms", took, fullSweepMs);
+  TEST_MESSAGE(message);
+}
+
+static void test_channels_survive_reboot()
+{
+  wm->addCredential("home", "password1");
+
+  timedScan(true);
+
+  delete wm;
+
+  HostWiFi::boot();
+  wm = new ESPAsync_WiFiManager(server, dns, "host");
+
+  TEST_ASSERT_EQUAL_UINT8(6, wm->getChannel(wm->findCredential("home")));
+
+  uint32_t took = timedScan(true);
+
+  TEST_ASSERT_LESS_THAN(fullSweepMs / 4, took);
+}
+
+static void test_moved_network_falls_back_to_sweep()
+{
+  wm->addCredential("home", "password1");
+
+  timedScan(true);
+
+  // The AP changed channel since
+  HostWiFi::ap(0).channel = 1;
+
+  uint32_t took = timedScan(true);
+
+  TEST_ASSERT_UINT32_WITHIN(30, WIFI_SCAN_TARGETED_DWELL_MS + fullSweepMs, took);
+  TEST_ASSERT_EQUAL_UINT8(1, wm->getChannel(wm->findCredential("home")));
+
+  // And the next one targets the new channel
+  TEST_ASSERT_LESS_THAN(fullSweepMs / 4, timedScan(true));
+}
+
+static void test_nothing_in_range()
+{
+  wm->addCredential("elsewhere", "password9");
+
+  TEST_ASSERT_UINT32_WITHIN(30, fullSweepMs, timedScan(false));
+  TEST_ASSERT_EQUAL_UINT8(0, wm->getChannel(0));
+}
+
+//////////////////////////////////////////
+
+int main(int, char**)
+{
+  UNITY_BEGIN();
+
+  RUN_TEST(test_first_scan_sweeps_and_records_channels);
+  RUN_TEST(test_known_channels_are_targeted);
+  RUN_TEST(test_channels_survive_reboot);
+  RUN_TEST(test_moved_network_falls_back_to_sweep);
+  RUN_TEST(test_nothing_in_range);
+
+  return UNITY_END();
+}
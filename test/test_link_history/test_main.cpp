@@ -0,0 +1,231 @@
+// Link history ring: statistics against a brute-force reference over the same samples, before and after
+// the ring wraps, raw bytes oldest first, and /link read while the loop keeps adding (run under native_tsan too).
+#include <unity.h>
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "WiFiLinkHistory.h"
+
+static WiFi_LinkSample sample(uint32_t time, int8_t rssi, bool connected = true)
+{
+  WiFi_LinkSample s;
+
+  s.time        = time;
+  s.RSSI        = connected ? rssi : 0;
+  s.channel     = 6;
+  s.connected   = connected;
+  s.disconnects = 0;
+
+  return s;
+}
+
+// Nearest rank over the connected RSSI values
+static int8_t referencePercentile(std::vector<int8_t> rssi, uint8_t pct)
+{
+  std::sort(rssi.begin(), rssi.end());
+
+  size_t rank = (pct * rssi.size() + 99) / 100;
+
+  return rssi[std::max<size_t>(rank, 1) - 1];
+}
+
+static void expectStatistics(WiFiLinkHistory& history, const std::vector<int8_t>& rssi)
+{
+  WiFi_LinkSummary summary = history.summary();
+
+  int sum = 0;
+
+  for (int8_t r : rssi)
+    sum += r;
+
+  TEST_ASSERT_EQUAL_UINT16(rssi.size(), summary.connected);
+  TEST_ASSERT_EQUAL_INT8(*std::min_element(rssi.begin(), rssi.end()), summary.minRSSI);
+  TEST_ASSERT_EQUAL_INT8(*std::max_element(rssi.begin(), rssi.end()), summary.maxRSSI);
+  TEST_ASSERT_EQUAL_INT8(sum / (int) rssi.size(), summary.meanRSSI);
+  TEST_ASSERT_EQUAL_INT8(referencePercentile(rssi, 5), summary.p5RSSI);
+  TEST_ASSERT_EQUAL_INT8(referencePercentile(rssi, 95), summary.p95RSSI);
+
+  for (uint8_t pct : { 1, 25, 50, 75, 99, 100 })
+    TEST_ASSERT_EQUAL_INT8(referencePercentile(rssi, pct), history.percentileRSSI(pct));
+}
+
+void setUp()
+{
+  srand(1);
+}
+
+void tearDown()
+{
+}
+
+//////////////////////////////////////////
+
+static void test_empty()
+{
+  WiFiLinkHistory history;
+
+  WiFi_LinkSummary summary = history.summary();
+
+  TEST_ASSERT_EQUAL_UINT16(0, summary.samples);
+  TEST_ASSERT_EQUAL_UINT16(0, summary.connected);
+  TEST_ASSERT_EQUAL_INT8(0, summary.minRSSI);
+  TEST_ASSERT_EQUAL_INT8(0, summary.p95RSSI);
+
+  uint8_t buffer[16];
+
+  TEST_ASSERT_EQUAL(0, history.copy(0, buffer, sizeof(buffer)));
+}
+
+static void test_percentiles()
+{
+  WiFiLinkHistory     history;
+  std::vector<int8_t> rssi;
+
+  // 100 samples -30 .. -89, a few disconnected ones which must not count
+  for (int i = 0; i < 100; i++)
+  {
+    bool connected = (i % 10) != 3;
+
+    int8_t r = -30 - (rand() % 60);
+
+    history.add(sample(i * 10000, r, connected));
+
+    if (connected)
+      rssi.push_back(r);
+  }
+
+  TEST_ASSERT_EQUAL_UINT16(100, history.count());
+  TEST_ASSERT_EQUAL_UINT16(100, history.summary().samples);
+
+  expectStatistics(history, rssi);
+
+  // The weakest 5 % : P5 at or below 95 % of the samples
+  WiFi_LinkSummary summary = history.summary();
+
+  TEST_ASSERT_TRUE(summary.minRSSI <= summary.p5RSSI);
+  TEST_ASSERT_TRUE(summary.p5RSSI <= summary.meanRSSI);
+  TEST_ASSERT_TRUE(summary.meanRSSI <= summary.p95RSSI);
+  TEST_ASSERT_TRUE(summary.p95RSSI <= summary.maxRSSI);
+}
+
+static void test_ring_wrap()
+{
+  WiFiLinkHistory     history;
+  std::vector<int8_t> all;
+
+  const int total = WIFI_LINK_HISTORY_SIZE * 2 + 17;
+
+  // Strong at first, so a stale sample left in the statistics would show in max
+  for (int i = 0; i < total; i++)
+  {
+    int8_t r = (i < WIFI_LINK_HISTORY_SIZE) ? -20 - (rand() % 10) : -50 - (rand() % 40);
+
+    history.add(sample(i, r));
+    all.push_back(r);
+  }
+
+  TEST_ASSERT_EQUAL_UINT16(WIFI_LINK_HISTORY_SIZE, history.count());
+
+  // Only the last WIFI_LINK_HISTORY_SIZE are kept, oldest first
+  std::vector<int8_t> kept(all.end() - WIFI_LINK_HISTORY_SIZE, all.end());
+
+  for (uint16_t i = 0; i < WIFI_LINK_HISTORY_SIZE; i++)
+  {
+    TEST_ASSERT_EQUAL_UINT32(total - WIFI_LINK_HISTORY_SIZE + i, history.at(i).time);
+    TEST_ASSERT_EQUAL_INT8(kept[i], history.at(i).RSSI);
+  }
+
+  expectStatistics(history, kept);
+  TEST_ASSERT_TRUE(history.maxRSSI() <= -50);
+
+  // Raw bytes, in odd-sized chunks straddling samples, are the same samples in the same order
+  std::vector<uint8_t> raw(WIFI_LINK_HISTORY_SIZE * sizeof(WiFi_LinkSample));
+  size_t               offset = 0;
+
+  while (offset < raw.size())
+  {
+    size_t n = history.copy(offset, &raw[offset], std::min<size_t>(13, raw.size() - offset));
+
+    TEST_ASSERT_TRUE(n > 0);
+    offset += n;
+  }
+
+  TEST_ASSERT_EQUAL(0, history.copy(offset, &raw[0], 8));
+
+  for (uint16_t i = 0; i < WIFI_LINK_HISTORY_SIZE; i++)
+  {
+    WiFi_LinkSample s;
+
+    memcpy(&s, &raw[i * sizeof(WiFi_LinkSample)], sizeof(s));
+
+    TEST_ASSERT_EQUAL_UINT32(total - WIFI_LINK_HISTORY_SIZE + i, s.time);
+    TEST_ASSERT_EQUAL_INT8(kept[i], s.RSSI);
+  }
+
+  history.clear();
+
+  TEST_ASSERT_EQUAL_UINT16(0, history.count());
+  TEST_ASSERT_EQUAL_INT8(0, history.meanRSSI());
+}
+
+// The loop adds while a handler summarises and copies : every summary is of one consistent ring
+static void test_read_while_adding()
+{
+  WiFiLinkHistory   history;
+  std::atomic<bool> done(false);
+
+  std::thread loop([&]()
+  {
+    for (uint32_t i = 0; i < 20000; i++)
+      history.add(sample(i, -40 - (i % 50), (i % 7) != 0));
+
+    done = true;
+  });
+
+  uint8_t   raw[WIFI_LINK_HISTORY_SIZE * sizeof(WiFi_LinkSample)];
+  uint32_t  reads = 0;
+
+  while (!done || (reads == 0))
+  {
+    WiFi_LinkSummary summary = history.summary();
+
+    TEST_ASSERT_TRUE(summary.samples <= WIFI_LINK_HISTORY_SIZE);
+    TEST_ASSERT_TRUE(summary.connected <= summary.samples);
+
+    if (summary.connected > 0)
+    {
+      TEST_ASSERT_TRUE(summary.minRSSI >= -89);
+      TEST_ASSERT_TRUE(summary.maxRSSI <= -40);
+      TEST_ASSERT_TRUE(summary.minRSSI <= summary.p5RSSI);
+      TEST_ASSERT_TRUE(summary.p5RSSI <= summary.p95RSSI);
+      TEST_ASSERT_TRUE(summary.p95RSSI <= summary.maxRSSI);
+      TEST_ASSERT_TRUE(summary.minRSSI <= summary.meanRSSI);
+      TEST_ASSERT_TRUE(summary.meanRSSI <= summary.maxRSSI);
+    }
+
+    history.copy(0, raw, sizeof(raw));
+    reads++;
+  }
+
+  loop.join();
+
+  TEST_ASSERT_EQUAL_UINT16(WIFI_LINK_HISTORY_SIZE, history.count());
+  TEST_ASSERT_EQUAL_UINT32(19999, history.at(WIFI_LINK_HISTORY_SIZE - 1).time);
+}
+
+//////////////////////////////////////////
+
+int main(int, char**)
+{
+  UNITY_BEGIN();
+
+  RUN_TEST(test_empty);
+  RUN_TEST(test_percentiles);
+  RUN_TEST(test_ring_wrap);
+  RUN_TEST(test_read_while_adding);
+
+  return UNITY_END();
+}
@@ -0,0 +1,248 @@
+// Connect after /wifisave from the config portal: the modal loop keeps polling DNS through the settle delay
+// and the attempt, also when the AP never answers, and the portal task is asked to end by the destructor,
+// never deleted from outside. An idle portal task wakes for the DNS poll only and uses little CPU.
+#include <unity.h>
+
+#include <time.h>
+
+#include <vector>
+
+#include <Preferences.h>
+
+#include "AutoConnect.h"
+
+static AsyncWebServer*        server;
+static DNSServer*             dns;
+static ESPAsync_WiFiManager*  wm;
+
+static uint64_t               startedAt;
+static std::vector<uint32_t>  polls;
+
+static void save(const char* ssid, const char* pass)
+{
+  AsyncWebServerRequest request("/wifisave");
+
+  request.withHeader("SSID", ssid).withHeader("Pwd", pass);
+  server->handle(request);
+}
+
+// /wifisave at ms into the portal, as the AsyncTCP task would
+static void saveAt(uint64_t ms, const char* ssid, const char* pass)
+{
+  HostSim::schedule(startedAt + ms * 1000, [ssid, pass]()
+  {
+    save(ssid, pass);
+  });
+}
+
+// DNS poll count every stepMs from fromMs to toMs into the portal
+static void probe(uint64_t fromMs, uint64_t toMs, uint64_t stepMs)
+{
+  for (uint64_t ms = fromMs; ms <= toMs; ms += stepMs)
+  {
+    HostSim::schedule(startedAt + ms * 1000, []()
+    {
+      polls.push_back(dns->polls);
+    });
+  }
+}
+
+static void expectPollingThroughout()
+{
+  TEST_ASSERT_TRUE(polls.size() > 2);
+
+  for (size_t i = 1; i < polls.size(); i++)
+    TEST_ASSERT_GREATER_THAN_UINT32(polls[i - 1], polls[i]);
+}
+
+void setUp()
+{
+  HostSim::resetClock();
+  HostSim::powerOff();
+  HostWiFi::reset();
+  HostNVS::reset();
+
+  HostWiFi::addAP("home", "password1", 6, -50);
+
+  server  = new AsyncWebServer(80);
+  dns     = new DNSServer();
+  wm      = new ESPAsync_WiFiManager(server, dns, "host");
+
+  startedAt = HostSim::nowUs();
+  polls.clear();
+}
+
+void tearDown()
+{
+  delete wm;
+  delete dns;
+  delete server;
+
+  HostSim::realTime(false);
+}
+
+//////////////////////////////////////////
+
+static void test_modal_portal_serves_while_connecting()
+{
+  wm->setConfigPortalTimeout(60);
+
+  saveAt(1000, "home", "password1");
+  probe(1000, 4500, 250);
+
+  TEST_ASSERT_TRUE(wm->startConfigPortal("portal"));
+  TEST_ASSERT_EQUAL_STRING("home", WiFi.SSID().c_str());
+
+  // Settle delay and association + DHCP passed, DNS polled all along
+  uint64_t elapsedMs = (HostSim::nowUs() - startedAt) / 1000;
+
+  TEST_ASSERT_GREATER_OR_EQUAL_UINT64(1000 + WIFI_PORTAL_CONNECT_SETTLE_MS, elapsedMs);
+  TEST_ASSERT_LESS_THAN_UINT64(7000, elapsedMs);
+
+  expectPollingThroughout();
+}
+
+static void test_unresponsive_ap_keeps_portal_up()
+{
+  // Never associates, the attempt runs into the connect timeout
+  HostWiFi::ap(0).assocMs = 60000;
+
+  wm->setConnectTimeout(4);
+  wm->setConfigPortalTimeout(60);
+
+  static wifi_mode_t modeAfterAttempt;
+
+  saveAt(1000, "home", "password1");
+  probe(1000, 14500, 500);
+
+  // Settle ends at 3 s, the attempt gives up at 7 s and the portal stays up
+  HostSim::schedule(startedAt + 8000 * 1000, []()
+  {
+    modeAfterAttempt = WiFi.getMode();
+  });
+
+  // The save held the portal timeout, /close ends it
+  HostSim::schedule(startedAt + 15000 * 1000, []()
+  {
+    AsyncWebServerRequest request("/close");
+
+    server->handle(request);
+  });
+
+  TEST_ASSERT_FALSE(wm->startConfigPortal("portal"));
+  TEST_ASSERT_NOT_EQUAL(WL_CONNECTED, WiFi.status());
+  TEST_ASSERT_EQUAL(WIFI_AP, modeAfterAttempt);
+
+  uint64_t elapsedMs = (HostSim::nowUs() - startedAt) / 1000;
+
+  TEST_ASSERT_GREATER_OR_EQUAL_UINT64(15000, elapsedMs);
+  TEST_ASSERT_LESS_THAN_UINT64(16000, elapsedMs);
+
+  expectPollingThroughout();
+}
+
+static void test_task_portal_connects()
+{
+  HostSim::realTime(true);
+
+  wm->setConfigPortalTask(true);
+  wm->setConfigPortalTimeout(60);
+
+  TEST_ASSERT_FALSE(wm->startConfigPortal("portal"));
+  TEST_ASSERT_TRUE(wm->isConfigPortalRunning());
+
+  save("home", "password1");
+
+  TEST_ASSERT_TRUE(wm->waitConfigPortal(10000));
+  TEST_ASSERT_EQUAL(0, hostTaskKills.load());
+}
+
+static void test_destructor_ends_task()
+{
+  HostSim::realTime(true);
+
+  wm->setConfigPortalTask(true);
+  wm->setConfigPortalTimeout(60);
+
+  TEST_ASSERT_FALSE(wm->startConfigPortal("portal"));
+
+  // Mid settle delay
+  save("home", "password1");
+  std::this_thread::sleep_for(std::chrono::milliseconds(300));
+
+  auto start = std::chrono::steady_clock::now();
+
+  delete wm;
+  wm = NULL;
+
+  auto tookMs = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+
+  // Signalled and waited for, no connect wait on the way out
+  TEST_ASSERT_LESS_THAN_UINT32(1000, (uint32_t) tookMs);
+  TEST_ASSERT_EQUAL(0, hostTaskKills.load());
+
+  for (int i = 0; (i < 100) && (hostTasksRunning.load() > 0); i++)
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+  TEST_ASSERT_EQUAL(0, hostTasksRunning.load());
+}
+
+static uint64_t cpuUs()
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+
+  return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void test_idle_task_portal_cpu()
+{
+  const uint32_t idleMs = 3000;
+
+  HostSim::realTime(true);
+
+  wm->setConfigPortalTask(true);
+  wm->setConfigPortalTimeout(60);
+
+  TEST_ASSERT_FALSE(wm->startConfigPortal("portal"));
+
+  // Past the first scan, then nothing to do but serve DNS. This thread only sleeps, the CPU is the task's
+  std::this_thread::sleep_for(std::chrono::milliseconds(1000));
+
+  uint32_t  dnsPolls  = dns->polls;
+  uint64_t  cpuAt     = cpuUs();
+
+  std::this_thread::sleep_for(std::chrono::milliseconds(idleMs));
+
+  uint64_t  cpu       = cpuUs() - cpuAt;
+  uint32_t  wakes     = dns->polls - dnsPolls;
+
+  char message[128];
+
+  snprintf(message, sizeof(message), "Idle task portal, %u ms : %llu us CPU, %u DNS polls (every %u ms)",
+           idleMs, (unsigned long long) cpu, wakes, (unsigned) WIFI_PORTAL_DNS_POLL_MS);
+  TEST_MESSAGE(message);
+
+  TEST_ASSERT_TRUE(wm->isConfigPortalRunning());
+
+  // Synchronous DNSServer : woken once per poll interval, no busy loop in between
+  TEST_ASSERT_GREATER_THAN_UINT32(idleMs / WIFI_PORTAL_DNS_POLL_MS / 2, wakes);
+  TEST_ASSERT_LESS_OR_EQUAL_UINT32(idleMs / WIFI_PORTAL_DNS_POLL_MS + 10, wakes);
+  TEST_ASSERT_LESS_THAN_UINT64(idleMs * 1000 / 20, cpu);
+}
+
+//////////////////////////////////////////
+
+int main(int, char**)
+{
+  UNITY_BEGIN();
+
+  RUN_TEST(test_modal_portal_serves_while_connecting);
+  RUN_TEST(test_unresponsive_ap_keeps_portal_up);
+  RUN_TEST(test_task_portal_connects);
+  RUN_TEST(test_destructor_ends_task);
+  RUN_TEST(test_idle_task_portal_cpu);
+
+  return UNITY_END();
+}
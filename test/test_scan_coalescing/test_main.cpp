@@ -0,0 +1,160 @@
+// /scan?refresh=1 single flight: however many clients ask for a fresh scan, they share one driver scan.
+#include <unity.h>
+
+#include <memory>
+#include <vector>
+
+#include <Preferences.h>
+
+#include "AutoConnect.h"
+
+static AsyncWebServer*        server;
+static DNSServer*             dns;
+static ESPAsync_WiFiManager*  wm;
+static int                    scanDoneCalls;
+
+static void onScanDone(ESPAsync_WiFiManager*)
+{
+  scanDoneCalls++;
+}
+
+static void loopFor(uint32_t ms)
+{
+  uint64_t until = HostSim::nowUs() + (uint64_t) ms * 1000;
+
+  while (HostSim::nowUs() < until)
+  {
+    wm->loop();
+    delay(10);
+  }
+}
+
+void setUp()
+{
+  HostSim::resetClock();
+  HostWiFi::reset();
+  HostNVS::reset();
+
+  HostWiFi::addAP("home", "password1", 6, -50);
+
+  server  = new AsyncWebServer(80);
+  dns     = new DNSServer();
+  wm      = new ESPAsync_WiFiManager(server, dns, "host");
+
+  wm->setScanDoneCallback(onScanDone);
+  wm->startConfigPortalModeless("portal", NULL, false);
+
+  // The modeless loop's own first scan
+  loopFor(2500);
+
+  scanDoneCalls = 0;
+}
+
+void tearDown()
+{
+  delete wm;
+  delete dns;
+  delete server;
+}
+
+//////////////////////////////////////////
+
+static void test_refreshes_share_one_scan()
+{
+  const int clients     = 10;
+  uint32_t  scansBefore = HostWiFi::driver().scansStarted;
+
+  std::vector<std::unique_ptr<AsyncWebServerRequest>> requests;
+
+  for (int i = 0; i < clients; i++)
+  {
+    requests.push_back(std::unique_ptr<AsyncWebServerRequest>(new AsyncWebServerRequest("/scan")));
+    requests.back()->withArg("refresh", "1");
+
+    server->handle(*requests.back());
+  }
+
+  // Found by this scan only
+  HostWiFi::addAP("office", "password2", 11, -60);
+
+  // Bodies held until the scan is in, the server retries them on its polls
+  for (auto& request : requests)
+  {
+    String body = request->body(1460, []() { wm->loop(); delay(10); });
+
+    TEST_ASSERT_TRUE(body.indexOf("office") >= 0);
+  }
+
+  TEST_ASSERT_EQUAL_UINT32(1, HostWiFi::driver().scansStarted - scansBefore);
+  TEST_ASSERT_EQUAL(1, scanDoneCalls);
+}
+
+static void test_refresh_joins_scan_in_flight()
+{
+  TEST_ASSERT_TRUE(wm->startScan());
+
+  uint32_t scansBefore = HostWiFi::driver().scansStarted;
+
+  AsyncWebServerRequest request("/scan");
+
+  request.withArg("refresh", "1");
+  server->handle(request);
+
+  String body = request.body(1460, []() { wm->loop(); delay(10); });
+
+  TEST_ASSERT_TRUE(body.indexOf("home") >= 0);
+  TEST_ASSERT_EQUAL_UINT32(scansBefore, HostWiFi::driver().scansStarted);
+  TEST_ASSERT_EQUAL(1, scanDoneCalls);
+
+  // And no second one queued behind it
+  loopFor(3000);
+
+  TEST_ASSERT_EQUAL_UINT32(scansBefore, HostWiFi::driver().scansStarted);
+}
+
+static void test_plain_get_never_scans()
+{
+  uint32_t scansBefore = HostWiFi::driver().scansStarted;
+
+  for (int i = 0; i < 20; i++)
+  {
+    AsyncWebServerRequest request("/scan");
+
+    server->handle(request);
+
+    TEST_ASSERT_TRUE(request.body().indexOf("home") >= 0);
+
+    wm->loop();
+  }
+
+  TEST_ASSERT_EQUAL_UINT32(scansBefore, HostWiFi::driver().scansStarted);
+}
+
+static void test_refresh_times_out()
+{
+  AsyncWebServerRequest request("/scan");
+
+  request.withArg("refresh", "1");
+  server->handle(request);
+
+  // Nobody runs the loop : the current table is served once the wait times out
+  uint64_t startedAt  = HostSim::nowUs();
+  String   body       = request.body(1460, []() { delay(10); });
+
+  TEST_ASSERT_TRUE(body.indexOf("home") >= 0);
+  TEST_ASSERT_UINT32_WITHIN(20, WIFI_SCAN_REFRESH_TIMEOUT_MS, (HostSim::nowUs() - startedAt) / 1000);
+}
+
+//////////////////////////////////////////
+
+int main(int, char**)
+{
+  UNITY_BEGIN();
+
+  RUN_TEST(test_refreshes_share_one_scan);
+  RUN_TEST(test_refresh_joins_scan_in_flight);
+  RUN_TEST(test_plain_get_never_scans);
+  RUN_TEST(test_refresh_times_out);
+
+  return UNITY_END();
+}
@@ -0,0 +1,156 @@
+// Asynchronous scan engine: starting a scan returns at once, results come in through pollScan() once the
+// driver is done, and the modeless loop keeps serving DNS meanwhile.
+#include <unity.h>
+
+#include <Preferences.h>
+
+#include "AutoConnect.h"
+
+static AsyncWebServer*        server;
+static DNSServer*             dns;
+static ESPAsync_WiFiManager*  wm;
+static int                    scanDoneCalls;
+
+static void onScanDone(ESPAsync_WiFiManager*)
+{
+  scanDoneCalls++;
+}
+
+void setUp()
+{
+  HostSim::resetClock();
+  HostWiFi::reset();
+  HostNVS::reset();
+
+  HostWiFi::addAP("home", "password1", 6, -50);
+  HostWiFi::addAP("office", "password2", 11, -70);
+  HostWiFi::addAP("cafe", "", 1, -80);
+
+  server  = new AsyncWebServer(80);
+  dns     = new DNSServer();
+  wm      = new ESPAsync_WiFiManager(server, dns, "host");
+
+  scanDoneCalls = 0;
+  wm->setScanDoneCallback(onScanDone);
+}
+
+void tearDown()
+{
+  delete wm;
+  delete dns;
+  delete server;
+}
+
+//////////////////////////////////////////
+
+static void test_start_returns_immediately()
+{
+  uint64_t before = HostSim::nowUs();
+
+  TEST_ASSERT_TRUE(wm->startScan());
+  TEST_ASSERT_EQUAL_UINT64(before, HostSim::nowUs());
+  TEST_ASSERT_TRUE(wm->isScanRunning());
+  TEST_ASSERT_FALSE(wm->isScanReady());
+
+  // A second start while one is in flight is refused, the driver sees one scan
+  TEST_ASSERT_FALSE(wm->startScan());
+  TEST_ASSERT_EQUAL_UINT32(1, HostWiFi::driver().scansStarted);
+}
+
+static void test_poll_completes_after_sweep()
+{
+  uint64_t  startedAt = HostSim::nowUs();
+  int       polls     = 0;
+
+  TEST_ASSERT_TRUE(wm->startScan());
+
+  while (!wm->pollScan())
+  {
+    polls++;
+    delay(10);
+
+    TEST_ASSERT_LESS_THAN(1000, polls);
+  }
+
+  // 13 channels at the driver dwell, polled every 10 ms
+  uint64_t took = (HostSim::nowUs() - startedAt) / 1000;
+
+  TEST_ASSERT_UINT32_WITHIN(20, 13 * HostWiFi::driver().channelDwellMs, took);
+  TEST_ASSERT_GREATER_THAN(100, polls);
+
+  TEST_ASSERT_TRUE(wm->isScanReady());
+  TEST_ASSERT_FALSE(wm->isScanRunning());
+  TEST_ASSERT_EQUAL(1, scanDoneCalls);
+
+  // Nothing more to report until the next scan
+  TEST_ASSERT_FALSE(wm->pollScan());
+  TEST_ASSERT_EQUAL(1, scanDoneCalls);
+}
+
+static void test_targeted_scan_visits_given_channels()
+{
+  const uint8_t channels[] = { 6, 11 };
+  uint64_t      startedAt  = HostSim::nowUs();
+
+  TEST_ASSERT_TRUE(wm->startScan(channels, sizeof(channels)));
+
+  while (!wm->pollScan())
+    delay(5);
+
+  // One driver scan per channel, each far shorter than a full sweep
+  TEST_ASSERT_EQUAL_UINT32(2, HostWiFi::driver().scansStarted);
+  TEST_ASSERT_EQUAL_UINT8(11, HostWiFi::driver().lastScanChannel);
+  TEST_ASSERT_LESS_THAN(13 * HostWiFi::driver().channelDwellMs / 2, (HostSim::nowUs() - startedAt) / 1000);
+  TEST_ASSERT_EQUAL(1, scanDoneCalls);
+}
+
+static void test_modeless_loop_never_blocks()
+{
+  wm->startConfigPortalModeless("portal", NULL, false);
+
+  uint32_t  dnsBefore = dns->polls;
+  uint64_t  longest   = 0;
+  uint64_t  until     = HostSim::nowUs() + 3000000;
+
+  while (HostSim::nowUs() < until)
+  {
+    uint64_t before = HostSim::nowUs();
+
+    wm->loop();
+
+    longest = std::max<uint64_t>(longest, HostSim::nowUs() - before);
+
+    delay(10);
+  }
+
+  // The scan ran in the background, the loop itself took no simulated time
+  TEST_ASSERT_GREATER_OR_EQUAL_UINT32(1, HostWiFi::driver().scansStarted);
+  TEST_ASSERT_EQUAL(1, scanDoneCalls);
+  TEST_ASSERT_LESS_OR_EQUAL_UINT64(1000, longest);
+  TEST_ASSERT_GREATER_THAN(250, dns->polls - dnsBefore);
+
+  // And the handlers serve what it found
+  AsyncWebServerRequest request("/scan");
+
+  TEST_ASSERT_TRUE(server->handle(request));
+
+  String body = request.body();
+
+  TEST_ASSERT_TRUE(body.indexOf("\"SSID\":\"home\"") >= 0);
+  TEST_ASSERT_TRUE(body.indexOf("\"SSID\":\"office\"") >= 0);
+  TEST_ASSERT_TRUE(body.indexOf("home") < body.indexOf("office"));
+}
+
+//////////////////////////////////////////
+
+int main(int, char**)
+{
+  UNITY_BEGIN();
+
+  RUN_TEST(test_start_returns_immediately);
+  RUN_TEST(test_poll_completes_after_sweep);
+  RUN_TEST(test_targeted_scan_visits_given_channels);
+  RUN_TEST(test_modeless_loop_never_blocks);
+
+  return UNITY_END();
+}
@@ -0,0 +1,334 @@
+// Scan snapshot pool: a held snapshot is never refilled, publication is deferred while every other slot is held
+// and goes through once one is released, and readers on other threads only ever see whole snapshots while the
+// writer keeps publishing (run under native_tsan too). End to end, a /scan body is the version its ETag names.
+#include <unity.h>
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <Preferences.h>
+
+#include "AutoConnect.h"
+
+static AsyncWebServer*        server;
+static DNSServer*             dns;
+static ESPAsync_WiFiManager*  wm;
+
+// Every field derived from the generation, so a torn or refilled snapshot shows up as a mismatch
+static void fill(WiFi_ScanSnapshot* snapshot, uint32_t generation)
+{
+  snapshot->generation  = generation;
+  snapshot->count       = 1 + generation % WIFI_SCAN_MAX_RESULTS;
+
+  for (uint16_t i = 0; i < snapshot->count; i++)
+  {
+    WiFiScanRecord& r = snapshot->records[i];
+
+    memset(&r, 0, sizeof(r));
+
+    r.SSIDLength  = (uint8_t) snprintf(r.SSID, sizeof(r.SSID), "g%u-%u", generation, i);
+    r.lastSeen    = generation;
+    r.SSIDHash    = generation * 31 + i;
+    r.channel     = 1 + (generation + i) % 13;
+  }
+}
+
+static bool whole(const WiFi_ScanSnapshot* snapshot)
+{
+  if (snapshot->count != 1 + snapshot->generation % WIFI_SCAN_MAX_RESULTS)
+    return false;
+
+  for (uint16_t i = 0; i < snapshot->count; i++)
+  {
+    const WiFiScanRecord& r = snapshot->records[i];
+
+    if ( (r.lastSeen != snapshot->generation) || (r.SSIDHash != snapshot->generation * 31 + i) ||
+         (r.channel != 1 + (snapshot->generation + i) % 13) )
+      return false;
+  }
+
+  return true;
+}
+
+static bool publish(WiFiScanSnapshots& pool, uint32_t generation)
+{
+  WiFi_ScanSnapshot* snapshot = pool.claim();
+
+  if (snapshot == NULL)
+    return false;
+
+  fill(snapshot, generation);
+  pool.publish(snapshot);
+
+  return true;
+}
+
+static void loopFor(uint32_t ms)
+{
+  uint64_t until = HostSim::nowUs() + (uint64_t) ms * 1000;
+
+  while (HostSim::nowUs() < until)
+  {
+    wm->loop();
+    delay(10);
+  }
+}
+
+// One more AP, then a scan merged and published
+static void scanWith(const char* ssid, uint8_t bssidTail)
+{
+  HostWiFi::addAP(ssid, "password", 6, -55, bssidTail);
+
+  TEST_ASSERT_TRUE(wm->startScan());
+
+  loopFor(3000);
+}
+
+// /scan handled but its body not pulled yet, as a slow client : the snapshot stays held
+static AsyncWebServerRequest* hold()
+{
+  AsyncWebServerRequest* request = new AsyncWebServerRequest("/scan");
+
+  server->handle(*request);
+
+  return request;
+}
+
+static String body(const char* url = "/scan")
+{
+  AsyncWebServerRequest request(url);
+
+  server->handle(request);
+
+  return request.body();
+}
+
+void setUp()
+{
+  HostSim::resetClock();
+  HostWiFi::reset();
+  HostNVS::reset();
+
+  HostWiFi::addAP("home", "password1", 6, -50, 1);
+
+  server  = new AsyncWebServer(80);
+  dns     = new DNSServer();
+  wm      = new ESPAsync_WiFiManager(server, dns, "host");
+}
+
+void tearDown()
+{
+  delete wm;
+  delete dns;
+  delete server;
+}
+
+//////////////////////////////////////////
+
+static void test_held_snapshot_never_refilled()
+{
+  WiFiScanSnapshots pool;
+
+  // Empty until the first publish
+  const WiFi_ScanSnapshot* empty = pool.acquire();
+
+  TEST_ASSERT_EQUAL(0, empty->count);
+  TEST_ASSERT_EQUAL_UINT32(0, pool.generation());
+  pool.release(empty);
+
+  TEST_ASSERT_TRUE(publish(pool, 1));
+
+  const WiFi_ScanSnapshot* held = pool.acquire();
+
+  TEST_ASSERT_EQUAL_UINT32(1, held->generation);
+
+  // Many times around the pool, the held slot is skipped every time
+  for (uint32_t generation = 2; generation < 50; generation++)
+  {
+    TEST_ASSERT_TRUE(publish(pool, generation));
+    TEST_ASSERT_EQUAL_UINT32(generation, pool.generation());
+  }
+
+  TEST_ASSERT_EQUAL_UINT32(1, held->generation);
+  TEST_ASSERT_TRUE(whole(held));
+
+  pool.release(held);
+}
+
+static void test_publish_deferred_while_all_held()
+{
+  WiFiScanSnapshots                     pool;
+  std::vector<const WiFi_ScanSnapshot*> held;
+
+  // Hold every slot but the current one
+  for (uint32_t generation = 1; generation < WIFI_SCAN_SNAPSHOTS; generation++)
+  {
+    TEST_ASSERT_TRUE(publish(pool, generation));
+    held.push_back(pool.acquire());
+  }
+
+  TEST_ASSERT_TRUE(publish(pool, WIFI_SCAN_SNAPSHOTS));
+
+  // Nothing free : the writer doesn't wait, and readers keep the last published one
+  TEST_ASSERT_NULL(pool.claim());
+  TEST_ASSERT_EQUAL_UINT32(WIFI_SCAN_SNAPSHOTS, pool.generation());
+
+  // More readers of the current one don't change that
+  const WiFi_ScanSnapshot* current = pool.acquire();
+
+  TEST_ASSERT_EQUAL_UINT32(WIFI_SCAN_SNAPSHOTS, current->generation);
+  TEST_ASSERT_NULL(pool.claim());
+
+  pool.release(held.front());
+
+  TEST_ASSERT_TRUE(publish(pool, WIFI_SCAN_SNAPSHOTS + 1));
+  TEST_ASSERT_EQUAL_UINT32(WIFI_SCAN_SNAPSHOTS + 1, pool.generation());
+
+  // The ones still held are untouched
+  for (size_t i = 1; i < held.size(); i++)
+  {
+    TEST_ASSERT_EQUAL_UINT32(i + 1, held[i]->generation);
+    TEST_ASSERT_TRUE(whole(held[i]));
+    pool.release(held[i]);
+  }
+
+  TEST_ASSERT_EQUAL_UINT32(WIFI_SCAN_SNAPSHOTS, current->generation);
+  TEST_ASSERT_TRUE(whole(current));
+  pool.release(current);
+}
+
+static void test_readers_see_whole_snapshots()
+{
+  const uint32_t    publishes = 20000;
+  const uint32_t    minReads  = 20000;
+  const int         readers   = 3;
+
+  WiFiScanSnapshots pool;
+
+  TEST_ASSERT_TRUE(publish(pool, 1));
+
+  std::atomic<bool>     done      { false };
+  std::atomic<uint32_t> torn      { 0 };
+  std::atomic<uint32_t> backwards { 0 };
+  std::atomic<uint32_t> reads     { 0 };
+
+  std::vector<std::thread> threads;
+
+  for (int t = 0; t < readers; t++)
+  {
+    threads.push_back(std::thread([&]()
+    {
+      uint32_t last = 0;
+
+      while (!done)
+      {
+        const WiFi_ScanSnapshot* snapshot = pool.acquire();
+
+        if (!whole(snapshot))
+          torn++;
+
+        // A reader never goes back to an older version than one it already had
+        if (snapshot->generation < last)
+          backwards++;
+
+        last = snapshot->generation;
+
+        // Held a little, as a response being streamed
+        std::this_thread::yield();
+
+        if (!whole(snapshot) || (snapshot->generation != last))
+          torn++;
+
+        pool.release(snapshot);
+        reads++;
+      }
+    }));
+  }
+
+  // The manager loop, deferring when every other slot is held. Until the readers got their share too
+  uint32_t generation = 2;
+  uint32_t deferred   = 0;
+
+  while ( (generation <= publishes) || (reads < minReads) )
+  {
+    if (publish(pool, generation))
+    {
+      generation++;
+    }
+    else
+    {
+      deferred++;
+      std::this_thread::yield();
+    }
+  }
+
+  done = true;
+
+  for (std::thread& t : threads)
+    t.join();
+
+  char message[96];
+
+  snprintf(message, sizeof(message), "%u publishes, %u reads, %u deferred", generation - 1, reads.load(), deferred);
+  TEST_MESSAGE(message);
+
+  TEST_ASSERT_EQUAL_UINT32(0, torn.load());
+  TEST_ASSERT_EQUAL_UINT32(0, backwards.load());
+  TEST_ASSERT_EQUAL_UINT32(generation - 1, pool.generation());
+}
+
+static void test_slow_clients_keep_their_version()
+{
+  wm->startConfigPortalModeless("portal", NULL, false);
+  loopFor(2500);
+
+  // One client per version, bodies not pulled yet
+  std::unique_ptr<AsyncWebServerRequest> first(hold());
+
+  scanWith("office", 2);
+
+  std::unique_ptr<AsyncWebServerRequest> second(hold());
+
+  scanWith("garage", 3);
+
+  // Current and both held : nothing free, this one waits for a slot
+  scanWith("attic", 4);
+
+  TEST_ASSERT_TRUE(body().indexOf("garage") >= 0);
+  TEST_ASSERT_TRUE(body().indexOf("attic") < 0);
+
+  // Each held body is the version it started with, and its ETag says so
+  TEST_ASSERT_TRUE(first->response()->header("ETag") != second->response()->header("ETag"));
+
+  String firstBody = first->body();
+
+  TEST_ASSERT_TRUE(firstBody.indexOf("home") >= 0);
+  TEST_ASSERT_TRUE(firstBody.indexOf("office") < 0);
+
+  // Released with the response, the deferred publish goes out on the next poll
+  first.reset();
+  loopFor(100);
+
+  TEST_ASSERT_TRUE(body().indexOf("attic") >= 0);
+
+  String secondBody = second->body();
+
+  TEST_ASSERT_TRUE(secondBody.indexOf("office") >= 0);
+  TEST_ASSERT_TRUE(secondBody.indexOf("garage") < 0);
+}
+
+//////////////////////////////////////////
+
+int main(int, char**)
+{
+  UNITY_BEGIN();
+
+  RUN_TEST(test_held_snapshot_never_refilled);
+  RUN_TEST(test_publish_deferred_while_all_held);
+  RUN_TEST(test_readers_see_whole_snapshots);
+  RUN_TEST(test_slow_clients_keep_their_version);
+
+  return UNITY_END();
+}
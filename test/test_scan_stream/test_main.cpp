@@ -0,0 +1,196 @@
+// Streamed /scan body: same JSON whatever the chunk size, escaped SSIDs, and heap use per request that
+// doesn't grow with the number of APs.
+#include <unity.h>
+
+#include <atomic>
+#include <new>
+
+#include <Preferences.h>
+
+#include "AutoConnect.h"
+
+static std::atomic<bool>      counting    { false };
+static std::atomic<uint32_t>  allocations { 0 };
+static std::atomic<uint64_t>  allocated   { 0 };
+
+void* operator new(size_t size)
+{
+  if (counting.load())
+  {
+    allocations++;
+    allocated += size;
+  }
+
+  void* p = malloc(size ? size : 1);
+
+  if (p == NULL)
+    throw std::bad_alloc();
+
+  return p;
+}
+
+void operator delete(void* p) noexcept
+{
+  free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+  free(p);
+}
+
+//////////////////////////////////////////
+
+static AsyncWebServer*        server;
+static DNSServer*             dns;
+static ESPAsync_WiFiManager*  wm;
+
+static void startWith(int apCount)
+{
+  char ssid[33];
+
+  for (int i = 0; i < apCount; i++)
+  {
+    snprintf(ssid, sizeof(ssid), "network-%02d", i);
+    HostWiFi::addAP(ssid, (i % 2) ? "password" : "", 1 + (i % 13), -40 - (i % 50));
+  }
+
+  wm->startConfigPortalModeless("portal", NULL, false);
+
+  TEST_ASSERT_TRUE(wm->startScan());
+
+  while (!wm->pollScan())
+    delay(10);
+}
+
+// Heap calls of one request, handler and every filler call, body copied to a fixed buffer
+static uint32_t requestAllocations(uint64_t* bytes)
+{
+  static uint8_t body[16384];
+
+  AsyncWebServerRequest request("/scan");
+
+  allocations = 0;
+  allocated   = 0;
+  counting    = true;
+
+  server->handle(request);
+
+  AwsResponseFiller filler  = request.response()->filler;
+  size_t            index   = 0;
+
+  while (true)
+  {
+    size_t n = filler(body + index, std::min<size_t>(512, sizeof(body) - index), index);
+
+    if ( (n == 0) || (n == RESPONSE_TRY_AGAIN) )
+      break;
+
+    index += n;
+  }
+
+  counting = false;
+
+  *bytes = allocated.load();
+
+  return allocations.load();
+}
+
+void setUp()
+{
+  HostSim::resetClock();
+  HostWiFi::reset();
+  HostNVS::reset();
+
+  server  = new AsyncWebServer(80);
+  dns     = new DNSServer();
+  wm      = new ESPAsync_WiFiManager(server, dns, "host");
+}
+
+void tearDown()
+{
+  delete wm;
+  delete dns;
+  delete server;
+}
+
+//////////////////////////////////////////
+
+static void test_chunk_size_doesnt_matter()
+{
+  startWith(40);
+
+  AsyncWebServerRequest whole("/scan");
+  AsyncWebServerRequest pieces("/scan");
+
+  server->handle(whole);
+  server->handle(pieces);
+
+  String expected = whole.body(4096);
+
+  TEST_ASSERT_TRUE(expected.startsWith("{\"Access_Points\":[{\"SSID\":\""));
+  TEST_ASSERT_TRUE(expected.endsWith("}]}"));
+
+  // Records cut anywhere, down to a byte at a time
+  TEST_ASSERT_EQUAL_STRING(expected.c_str(), pieces.body(7).c_str());
+
+  AsyncWebServerRequest single("/scan");
+
+  server->handle(single);
+
+  TEST_ASSERT_EQUAL_STRING(expected.c_str(), single.body(1).c_str());
+}
+
+static void test_ssid_is_escaped()
+{
+  HostWiFi::addAP("say \"hi\"\\", "password", 6, -40);
+  HostWiFi::addAP("tab\there", "", 6, -45);
+
+  startWith(0);
+
+  AsyncWebServerRequest request("/scan");
+
+  server->handle(request);
+
+  String body = request.body();
+
+  TEST_ASSERT_TRUE(body.indexOf("\"SSID\":\"say \\\"hi\\\"\\\\\", \"Encryption\":true") >= 0);
+  TEST_ASSERT_TRUE(body.indexOf("\"SSID\":\"tab\\u0009here\", \"Encryption\":false") >= 0);
+}
+
+static void test_heap_independent_of_ap_count()
+{
+  uint64_t fewBytes, manyBytes;
+
+  startWith(4);
+
+  uint32_t few = requestAllocations(&fewBytes);
+
+  HostWiFi::reset();
+
+  startWith(WIFI_SCAN_MAX_RESULTS);
+
+  uint32_t many = requestAllocations(&manyBytes);
+
+  char message[128];
+
+  snprintf(message, sizeof(message), "/scan heap per request: 4 APs %u calls %llu bytes, %d APs %u calls %llu bytes",
+           few, (unsigned long long) fewBytes, WIFI_SCAN_MAX_RESULTS, many, (unsigned long long) manyBytes);
+  TEST_MESSAGE(message);
+
+  TEST_ASSERT_EQUAL_UINT32(few, many);
+  TEST_ASSERT_EQUAL_UINT64(fewBytes, manyBytes);
+}
+
+//////////////////////////////////////////
+
+int main(int, char**)
+{
+  UNITY_BEGIN();
+
+  RUN_TEST(test_chunk_size_doesnt_matter);
+  RUN_TEST(test_ssid_is_escaped);
+  RUN_TEST(test_heap_independent_of_ap_count);
+
+  return UNITY_END();
+}
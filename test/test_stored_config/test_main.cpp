@@ -0,0 +1,131 @@
+// Driver config copy: the HTTP handlers read what the loop published and never call esp_wifi_get_config(),
+// and the loop reads the driver once per config change, not once per request.
+#include <unity.h>
+
+#include <Preferences.h>
+
+#include "AutoConnect.h"
+
+static AsyncWebServer*        server;
+static DNSServer*             dns;
+static ESPAsync_WiFiManager*  wm;
+
+static const char* urls[] = { "/", "/i", "/state", "/close" };
+
+// What the driver has from a previous boot
+static void storeDriverConfig(const char* ssid, const char* pass)
+{
+  wifi_sta_config_t& flash = HostWiFi::driver().flash;
+
+  memset(&flash, 0, sizeof(flash));
+  strncpy((char*) flash.ssid, ssid, sizeof(flash.ssid));
+  strncpy((char*) flash.password, pass, sizeof(flash.password));
+
+  HostWiFi::boot();
+}
+
+static void loops(int n)
+{
+  for (int i = 0; i < n; i++)
+  {
+    wm->criticalLoop();
+    delay(50);
+  }
+}
+
+static String get(const char* url)
+{
+  AsyncWebServerRequest request(url);
+
+  server->handle(request);
+
+  return request.body();
+}
+
+void setUp()
+{
+  HostSim::resetClock();
+  HostSim::powerOff();
+  HostWiFi::reset();
+  HostNVS::reset();
+
+  HostWiFi::addAP("home", "password1", 6, -50);
+  HostWiFi::addAP("office", "password2", 11, -60);
+
+  storeDriverConfig("home", "password1");
+
+  server  = new AsyncWebServer(80);
+  dns     = new DNSServer();
+  wm      = new ESPAsync_WiFiManager(server, dns, "host");
+
+  wm->startConfigPortalModeless("portal", NULL, false);
+  loops(3);
+}
+
+void tearDown()
+{
+  delete wm;
+  delete dns;
+  delete server;
+}
+
+//////////////////////////////////////////
+
+static void test_requests_never_read_the_driver()
+{
+  uint32_t reads = HostWiFi::driver().getConfigCalls;
+
+  for (int round = 0; round < 10; round++)
+  {
+    for (const char* url : urls)
+      get(url);
+  }
+
+  TEST_ASSERT_EQUAL_UINT32(reads, HostWiFi::driver().getConfigCalls);
+
+  String state = get("/state");
+
+  TEST_ASSERT_TRUE(state.indexOf("\"SSID\":\"home\"") >= 0);
+  TEST_ASSERT_TRUE(state.indexOf("\"Password\":true") >= 0);
+  TEST_ASSERT_EQUAL_UINT32(reads, HostWiFi::driver().getConfigCalls);
+}
+
+static void test_one_read_per_config_change()
+{
+  AsyncWebServerRequest save("/wifisave");
+
+  save.withHeader("SSID", "office").withHeader("Pwd", "password2");
+  server->handle(save);
+
+  // The handler only posted the command
+  uint32_t reads = HostWiFi::driver().getConfigCalls;
+
+  // The loop starts the attempt without waiting for it, association + DHCP take a couple of seconds
+  loops(50);
+
+  TEST_ASSERT_EQUAL_STRING("office", WiFi.SSID().c_str());
+
+  for (int round = 0; round < 10; round++)
+  {
+    for (const char* url : urls)
+      get(url);
+  }
+
+  // The new config was read once, by the loop, and the handlers see it
+  TEST_ASSERT_EQUAL_UINT32(reads + 1, HostWiFi::driver().getConfigCalls);
+  TEST_ASSERT_TRUE(get("/state").indexOf("\"SSID\":\"office\"") >= 0);
+  TEST_ASSERT_TRUE(get("/i").indexOf("SSID office") >= 0);
+  TEST_ASSERT_EQUAL_UINT32(reads + 1, HostWiFi::driver().getConfigCalls);
+}
+
+//////////////////////////////////////////
+
+int main(int, char**)
+{
+  UNITY_BEGIN();
+
+  RUN_TEST(test_requests_never_read_the_driver);
+  RUN_TEST(test_one_read_per_config_change);
+
+  return UNITY_END();
+}
@@ -0,0 +1,229 @@
+// Cooperative lifecycle under a slow driver and flash: every tick() makes at most one blocking call (mode switch,
+// softAP, driver config write, NVS write), so no tick takes longer than the slowest single call, through portal
+// bring-up, a save, a failed plan and a link drop. Deferred NVS writes still land, and NVS is only read by a tick
+// that counts it as its one call : the reconnect cache of a cold boot is loaded by begin().
+#include <unity.h>
+
+#include <Preferences.h>
+
+#include "AutoConnect.h"
+
+static const uint32_t modeMs    = 100;
+static const uint32_t softAPMs  = 150;
+static const uint32_t flashMs   = 80;
+static const uint32_t nvsMs     = 60;
+
+// Longest single blocking call, plus what a tick costs otherwise
+static const uint32_t maxTickUs = softAPMs * 1000 + 2000;
+
+static AsyncWebServer*        server;
+static DNSServer*             dns;
+static ESPAsync_WiFiManager*  wm;
+
+static uint32_t               ticks;
+static uint32_t               blockingTicks;
+
+// One loop() pass of the sketch
+static void tickOnce()
+{
+  uint32_t ops      = HostSim::core().blockingOps;
+  uint32_t reads    = HostNVS::reads();
+  uint64_t started  = HostSim::nowUs();
+
+  wm->tick();
+
+  uint32_t made = HostSim::core().blockingOps - ops;
+
+  TEST_ASSERT_LESS_OR_EQUAL_UINT32(1, made);
+
+  // NVS is only read by a tick that makes its one call there, anything else was loaded by begin()
+  if (made == 0)
+    TEST_ASSERT_EQUAL_UINT32(reads, HostNVS::reads());
+  TEST_ASSERT_LESS_OR_EQUAL_UINT64(maxTickUs, HostSim::nowUs() - started);
+
+  ticks++;
+  blockingTicks += made;
+
+  delay(10);
+}
+
+static bool tickUntil(WiFi_State state, uint32_t ms)
+{
+  uint64_t deadline = HostSim::nowUs() + (uint64_t) ms * 1000;
+
+  while ( (wm->getState() != state) && (HostSim::nowUs() < deadline) )
+    tickOnce();
+
+  return wm->getState() == state;
+}
+
+static void tickFor(uint32_t ms)
+{
+  uint64_t deadline = HostSim::nowUs() + (uint64_t) ms * 1000;
+
+  while (HostSim::nowUs() < deadline)
+    tickOnce();
+}
+
+static void save(const char* ssid, const char* pass)
+{
+  AsyncWebServerRequest request("/wifisave");
+
+  request.withHeader("SSID", ssid).withHeader("Pwd", pass);
+  server->handle(request);
+}
+
+void setUp()
+{
+  HostSim::resetClock();
+  HostSim::powerOff();
+  HostWiFi::reset();
+  HostNVS::reset();
+
+  HostWiFi::addAP("home", "password1", 6, -50);
+
+  HostWiFi::driver().modeMs       = modeMs;
+  HostWiFi::driver().softAPMs     = softAPMs;
+  HostWiFi::driver().flashWriteMs = flashMs;
+  HostNVS::store().writeMs        = nvsMs;
+
+  server  = new AsyncWebServer(80);
+  dns     = new DNSServer();
+  wm      = new ESPAsync_WiFiManager(server, dns, "host");
+
+  ticks         = 0;
+  blockingTicks = 0;
+}
+
+void tearDown()
+{
+  delete wm;
+  delete dns;
+  delete server;
+}
+
+//////////////////////////////////////////
+
+static void test_portal_and_save()
+{
+  wm->begin("portal");
+
+  TEST_ASSERT_EQUAL(WM_STATE_PORTAL, wm->getState());
+
+  // Mode switch, soft AP and settle, then the server answers
+  tickFor(WIFI_PORTAL_AP_SETTLE_MS + 200);
+
+  TEST_ASSERT_EQUAL_UINT32(1, HostWiFi::driver().softAPCalls);
+  TEST_ASSERT_TRUE(dns->polls > 0);
+
+  save("home", "password1");
+
+  TEST_ASSERT_TRUE(tickUntil(WM_STATE_CONNECTED, 10000));
+
+  // Portal closed and everything written on the ticks after
+  tickFor(1000);
+
+  TEST_ASSERT_EQUAL(WL_CONNECTED, WiFi.status());
+  TEST_ASSERT_EQUAL(WIFI_STA, WiFi.getMode());
+
+  // The save, then its connect history
+  WiFiCredentialStore stored;
+
+  TEST_ASSERT_EQUAL(0, stored.find("home"));
+  TEST_ASSERT_EQUAL(1, stored.get(0)->stats.successes);
+
+  // The slow calls did happen, one per tick
+  TEST_ASSERT_TRUE(blockingTicks >= 4);
+  TEST_ASSERT_LESS_OR_EQUAL_UINT32(maxTickUs, wm->getMaxTickTime());
+}
+
+static void test_failed_plan_opens_portal()
+{
+  wm->addCredential("home", "wrong");
+
+  wm->begin("portal");
+
+  TEST_ASSERT_TRUE(tickUntil(WM_STATE_PORTAL, 30000));
+
+  tickFor(WIFI_PORTAL_AP_SETTLE_MS + 1000);
+
+  // The failed attempt is in the connect history on flash
+  WiFiCredentialStore stored;
+
+  TEST_ASSERT_EQUAL(0, stored.find("home"));
+  TEST_ASSERT_EQUAL(1, stored.get(0)->stats.attempts);
+  TEST_ASSERT_EQUAL(0, stored.get(0)->stats.successes);
+
+  TEST_ASSERT_EQUAL_UINT32(1, HostWiFi::driver().softAPCalls);
+  TEST_ASSERT_LESS_OR_EQUAL_UINT32(maxTickUs, wm->getMaxTickTime());
+}
+
+static void test_link_drop_and_back()
+{
+  wm->addCredential("home", "password1");
+  wm->setReconnectBackoff(1, 4);
+
+  wm->begin("portal");
+
+  TEST_ASSERT_TRUE(tickUntil(WM_STATE_CONNECTED, 15000));
+
+  tickFor(500);
+
+  HostWiFi::setUp(0, false);
+
+  TEST_ASSERT_TRUE(tickUntil(WM_STATE_BACKOFF, 5000));
+
+  HostWiFi::setUp(0, true);
+
+  TEST_ASSERT_TRUE(tickUntil(WM_STATE_CONNECTED, 30000));
+
+  tickFor(500);
+
+  // The driver may have rejoined by itself, at least the first connect is on flash
+  WiFiCredentialStore stored;
+
+  TEST_ASSERT_EQUAL(0, stored.find("home"));
+  TEST_ASSERT_TRUE(stored.get(0)->stats.successes >= 1);
+  TEST_ASSERT_LESS_OR_EQUAL_UINT32(maxTickUs, wm->getMaxTickTime());
+}
+
+static void test_cold_boot_cache_loaded_by_begin()
+{
+  wm->addCredential("home", "password1");
+  wm->begin("portal");
+
+  TEST_ASSERT_TRUE(tickUntil(WM_STATE_CONNECTED, 15000));
+
+  tickFor(1000);
+
+  TEST_ASSERT_GREATER_THAN_UINT32(0, HostNVS::writes(WIFI_RECONNECT_CACHE_KEY));
+
+  // Power cycle : only the NVS copy of the cache is left, the plan still ranks with it
+  delete wm;
+
+  HostSim::powerOff();
+  HostWiFi::boot();
+
+  wm = new ESPAsync_WiFiManager(server, dns, "host");
+
+  uint32_t reads = HostNVS::reads();
+
+  wm->begin("portal");
+
+  TEST_ASSERT_GREATER_THAN_UINT32(reads, HostNVS::reads());
+  TEST_ASSERT_TRUE(tickUntil(WM_STATE_CONNECTED, 15000));
+}
+
+//////////////////////////////////////////
+
+int main(int, char**)
+{
+  UNITY_BEGIN();
+
+  RUN_TEST(test_portal_and_save);
+  RUN_TEST(test_failed_plan_opens_portal);
+  RUN_TEST(test_link_drop_and_back);
+  RUN_TEST(test_cold_boot_cache_loaded_by_begin);
+
+  return UNITY_END();
+}
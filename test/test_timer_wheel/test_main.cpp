@@ -0,0 +1,378 @@
+// Timer wheel on a fake clock: a deadline already past or within the tick last polled expires on the next poll,
+// deadlines turns of the wheel away expire on time as the cursor wraps, and a random schedule / cancel / poll
+// sequence matches a plain list of deadlines. Through the manager, the portal timeout, the modeless scan and the
+// reconnect backoff stay on time across the 32-bit millis() wrap.
+#include <unity.h>
+
+#include <algorithm>
+#include <vector>
+
+#include <Preferences.h>
+
+#include "AutoConnect.h"
+#include "WiFiTimerWheel.h"
+
+static const uint64_t turnMs  = WIFI_TIMER_SLOTS * WIFI_TIMER_SLOT_MS;
+static const uint64_t wrapMs  = 1ULL << 32;
+
+// TIME_BETWEEN_MODELESS_SCANS
+static const uint32_t modelessScanMs = 120000;
+
+static AsyncWebServer*        server;
+static DNSServer*             dns;
+static ESPAsync_WiFiManager*  wm;
+
+static uint64_t nowMs()
+{
+  return HostSim::nowUs() / 1000;
+}
+
+// Clock ms before millis() wraps, and a manager on it
+static void startBeforeWrap(uint64_t ms)
+{
+  HostSim::resetClock((wrapMs - ms) * 1000);
+
+  server  = new AsyncWebServer(80);
+  dns     = new DNSServer();
+  wm      = new ESPAsync_WiFiManager(server, dns, "host");
+}
+
+// Modeless loop of the sketch for ms, calling probe() after each pass
+template<typename F>
+static void loopFor(uint64_t ms, F probe)
+{
+  uint64_t until = nowMs() + ms;
+
+  while (nowMs() < until)
+  {
+    wm->criticalLoop();
+    probe();
+    delay(10);
+  }
+}
+
+void setUp()
+{
+  srand(7);
+
+  HostSim::resetClock();
+  HostSim::powerOff();
+  HostWiFi::reset();
+  HostNVS::reset();
+
+  HostWiFi::addAP("home", "password1", 6, -50);
+
+  wm = NULL;
+}
+
+void tearDown()
+{
+  delete wm;
+  delete dns;
+  delete server;
+
+  wm      = NULL;
+  dns     = NULL;
+  server  = NULL;
+}
+
+//////////////////////////////////////////
+
+static void test_past_deadline_fires_on_next_poll()
+{
+  WiFiTimerWheel wheel;
+
+  wheel.poll(10000);
+
+  // Slot of 5000 ms was passed long ago, it mustn't wait a turn for the cursor to come round
+  wheel.schedule(1, 5000);
+
+  TEST_ASSERT_TRUE(wheel.pending(1));
+  TEST_ASSERT_EQUAL_UINT64(5000, wheel.nextDeadline());
+  TEST_ASSERT_EQUAL_UINT32(1UL << 1, wheel.poll(10001));
+  TEST_ASSERT_TRUE(wheel.expired(1));
+
+  // Even polled at the same instant again
+  wheel.schedule(2, 9999);
+
+  TEST_ASSERT_EQUAL_UINT32(1UL << 2, wheel.poll(10001));
+}
+
+static void test_same_tick_deadline()
+{
+  WiFiTimerWheel wheel;
+
+  wheel.poll(10000);
+
+  // Later in the tick just polled, and exactly now
+  wheel.schedule(0, 10000 + WIFI_TIMER_SLOT_MS / 2);
+  wheel.schedule(1, 10000);
+
+  TEST_ASSERT_EQUAL_UINT32(1UL << 1, wheel.poll(10000));
+  TEST_ASSERT_EQUAL_UINT32(0, wheel.poll(10000 + WIFI_TIMER_SLOT_MS / 2 - 1));
+  TEST_ASSERT_EQUAL_UINT32(1UL << 0, wheel.poll(10000 + WIFI_TIMER_SLOT_MS / 2));
+}
+
+static void test_cancel_past_deadline_keeps_others()
+{
+  WiFiTimerWheel wheel;
+
+  wheel.poll(10000);
+
+  // 1 sits in the slot of 5000 for a later turn, 0 in the cursor slot though its deadline is 5000 too
+  wheel.schedule(1, 5000 + 2 * turnMs);
+  wheel.schedule(0, 5000);
+
+  wheel.cancel(0);
+
+  TEST_ASSERT_FALSE(wheel.pending(0));
+  TEST_ASSERT_TRUE(wheel.pending(1));
+  TEST_ASSERT_EQUAL_UINT32(0, wheel.poll(5000 + 2 * turnMs - 1));
+  TEST_ASSERT_EQUAL_UINT32(1UL << 1, wheel.poll(5000 + 2 * turnMs));
+
+  // Reschedule from the cursor slot to a future one
+  wheel.schedule(2, 1000);
+  wheel.schedule(2, 5000 + 3 * turnMs);
+
+  TEST_ASSERT_EQUAL_UINT32(0, wheel.poll(5000 + 3 * turnMs - 1));
+  TEST_ASSERT_EQUAL_UINT32(1UL << 2, wheel.poll(5000 + 3 * turnMs));
+}
+
+static void test_wrap()
+{
+  WiFiTimerWheel wheel;
+
+  uint64_t now = 1000000;
+
+  wheel.poll(now);
+
+  // Several turns away, the cursor wraps past their slot a few times first
+  wheel.schedule(0, now + 3 * turnMs + 7);
+  wheel.schedule(1, now + turnMs);
+  wheel.schedule(2, now + WIFI_TIMER_SLOT_MS * (WIFI_TIMER_SLOTS - 1));
+
+  uint64_t fired[3] = { 0, 0, 0 };
+
+  for (uint64_t t = now; t <= now + 4 * turnMs; t += 50)
+  {
+    uint32_t mask = wheel.poll(t);
+
+    for (int id = 0; id < 3; id++)
+    {
+      if (mask & (1UL << id))
+        fired[id] = t;
+    }
+  }
+
+  // First poll at or after each deadline, polls are 50 ms apart
+  TEST_ASSERT_EQUAL_UINT64(now + 3 * turnMs + 50, fired[0]);
+  TEST_ASSERT_EQUAL_UINT64(now + turnMs, fired[1]);
+  TEST_ASSERT_EQUAL_UINT64(now + WIFI_TIMER_SLOT_MS * (WIFI_TIMER_SLOTS - 1), fired[2]);
+
+  // A long gap : one walk of the wheel finds it
+  wheel.schedule(0, now + 10 * turnMs);
+
+  TEST_ASSERT_EQUAL_UINT32(1UL << 0, wheel.poll(now + 50 * turnMs));
+}
+
+// Random operations against a list of deadlines : expired on the first poll at or after the deadline
+static void test_matches_reference()
+{
+  WiFiTimerWheel  wheel;
+  uint64_t        reference[WIFI_TIMERS_MAX];
+  uint64_t        now = 5000;
+
+  for (int id = 0; id < WIFI_TIMERS_MAX; id++)
+    reference[id] = WIFI_TIMER_NEVER;
+
+  wheel.poll(now);
+
+  for (int op = 0; op < 200000; op++)
+  {
+    int id = rand() % WIFI_TIMERS_MAX;
+
+    switch (rand() % 4)
+    {
+      case 0:
+      {
+        // Past, this tick, near or several turns out
+        int64_t offset = (int64_t) (rand() % (4 * turnMs)) - (int64_t) turnMs;
+
+        if (rand() % 4 == 0)
+          offset = (int64_t) (rand() % WIFI_TIMER_SLOT_MS) - WIFI_TIMER_SLOT_MS / 2;
+
+        uint64_t deadline = (offset < 0 && (uint64_t) -offset > now) ? 0 : now + offset;
+
+        wheel.schedule(id, deadline);
+        reference[id] = deadline;
+        break;
+      }
+
+      case 1:
+        wheel.cancel(id);
+        reference[id] = WIFI_TIMER_NEVER;
+        break;
+
+      default:
+      {
+        now += (rand() % 8 == 0) ? rand() % (2 * turnMs) : rand() % 120;
+
+        uint32_t mask     = wheel.poll(now);
+        uint32_t expected = 0;
+
+        for (int t = 0; t < WIFI_TIMERS_MAX; t++)
+        {
+          if (reference[t] <= now)
+          {
+            expected |= (1UL << t);
+            reference[t] = WIFI_TIMER_NEVER;
+          }
+        }
+
+        TEST_ASSERT_EQUAL_HEX32(expected, mask);
+        break;
+      }
+    }
+
+    uint64_t next = WIFI_TIMER_NEVER;
+
+    for (int t = 0; t < WIFI_TIMERS_MAX; t++)
+    {
+      next = std::min(next, reference[t]);
+      TEST_ASSERT_EQUAL(reference[t] != WIFI_TIMER_NEVER, wheel.pending(t));
+    }
+
+    TEST_ASSERT_EQUAL_UINT64(next, wheel.nextDeadline());
+  }
+}
+
+static void test_portal_timeout_across_millis_wrap()
+{
+  startBeforeWrap(5000);
+
+  wm->setConfigPortalTimeout(10);
+  wm->setConnectTimeout(1);
+
+  static uint64_t closedAt;
+  uint64_t        startedAt = nowMs();
+
+  closedAt = 0;
+
+  // Back to station mode once the portal timed out
+  for (uint64_t ms = 100; ms <= 15000; ms += 100)
+  {
+    HostSim::schedule((startedAt + ms) * 1000, []()
+    {
+      if ( (closedAt == 0) && (WiFi.getMode() == WIFI_STA) )
+        closedAt = nowMs();
+    });
+  }
+
+  TEST_ASSERT_FALSE(wm->startConfigPortal("portal"));
+
+  // Wrapped meanwhile, and the timeout neither cut short nor pushed out by it
+  TEST_ASSERT_TRUE(closedAt > wrapMs);
+  TEST_ASSERT_UINT32_WITHIN(150, 10000, (uint32_t) (closedAt - startedAt));
+}
+
+static void test_modeless_scans_across_millis_wrap()
+{
+  startBeforeWrap(modelessScanMs / 2);
+
+  wm->startConfigPortalModeless("portal", NULL, false);
+
+  std::vector<uint64_t> scans;
+  uint32_t              started = HostWiFi::driver().scansStarted;
+
+  loopFor(2 * modelessScanMs + 5000, [&]()
+  {
+    if (HostWiFi::driver().scansStarted != started)
+    {
+      started = HostWiFi::driver().scansStarted;
+      scans.push_back(nowMs());
+    }
+  });
+
+  // The second one falls after the wrap, none of them early, late or doubled
+  TEST_ASSERT_EQUAL(3, scans.size());
+  TEST_ASSERT_TRUE(scans[1] > wrapMs);
+
+  for (size_t i = 1; i < scans.size(); i++)
+    TEST_ASSERT_UINT32_WITHIN(50, modelessScanMs, (uint32_t) (scans[i] - scans[i - 1]));
+}
+
+static void test_reconnect_backoff_across_millis_wrap()
+{
+  const uint64_t backoffMs = 4000;
+
+  startBeforeWrap(30000);
+
+  wm->addCredential("home", "password1");
+  wm->setReconnectBackoff(backoffMs / 1000, backoffMs / 1000);
+  wm->setConnectTimeout(3);
+  wm->startConfigPortalModeless("portal", NULL, false);
+
+  // Down at start : the reconnect path brings it up
+  loopFor(15000, []() {});
+
+  TEST_ASSERT_EQUAL(WL_CONNECTED, WiFi.status());
+
+  // Drop the link so the first backoff runs across the wrap, and keep the AP away for the next one too
+  loopFor(wrapMs - 1500 - nowMs(), []() {});
+
+  HostWiFi::setUp(0, false);
+
+  std::vector<uint64_t> begins;
+  uint64_t              downAt  = 0;
+  uint32_t              seen    = HostWiFi::driver().begins;
+
+  loopFor(3 * backoffMs + 3000, [&]()
+  {
+    if ( (downAt == 0) && (WiFi.status() != WL_CONNECTED) )
+      downAt = nowMs();
+
+    if (HostWiFi::driver().begins != seen)
+    {
+      seen = HostWiFi::driver().begins;
+      begins.push_back(nowMs());
+    }
+  });
+
+  // Equal jitter : half to all of the backoff after the drop, then after each failed attempt
+  TEST_ASSERT_TRUE(downAt != 0);
+  TEST_ASSERT_TRUE(begins.size() >= 2);
+  TEST_ASSERT_TRUE(begins[0] > wrapMs);
+  TEST_ASSERT_GREATER_OR_EQUAL_UINT64(backoffMs / 2, begins[0] - downAt);
+  TEST_ASSERT_LESS_OR_EQUAL_UINT64(backoffMs + 50, begins[0] - downAt);
+
+  for (size_t i = 1; i < begins.size(); i++)
+  {
+    TEST_ASSERT_GREATER_OR_EQUAL_UINT64(backoffMs / 2, begins[i] - begins[i - 1]);
+    TEST_ASSERT_LESS_OR_EQUAL_UINT64(backoffMs + 3000 + 50, begins[i] - begins[i - 1]);
+  }
+
+  // Back up : the next attempt gets it
+  HostWiFi::setUp(0, true);
+
+  loopFor(backoffMs + 10000, []() {});
+
+  TEST_ASSERT_EQUAL(WL_CONNECTED, WiFi.status());
+}
+
+//////////////////////////////////////////
+
+int main(int, char**)
+{
+  UNITY_BEGIN();
+
+  RUN_TEST(test_past_deadline_fires_on_next_poll);
+  RUN_TEST(test_same_tick_deadline);
+  RUN_TEST(test_cancel_past_deadline_keeps_others);
+  RUN_TEST(test_wrap);
+  RUN_TEST(test_matches_reference);
+  RUN_TEST(test_portal_timeout_across_millis_wrap);
+  RUN_TEST(test_modeless_scans_across_millis_wrap);
+  RUN_TEST(test_reconnect_backoff_across_millis_wrap);
+
+  return UNITY_END();
+}